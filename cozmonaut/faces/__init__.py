@@ -6,3 +6,8 @@
 #
 
 from faces import *
+
+from cozmonaut.faces_events import events, wait_events
+
+# Let recognizers do this themselves
+Recognizer.events = events
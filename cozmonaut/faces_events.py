@@ -0,0 +1,72 @@
+#
+# Cozmonaut
+# Copyright (c) 2019 The Cozmonaut Contributors
+#
+# InsertLicenseText
+#
+
+"""
+Waiting on recognizer events from asyncio.
+
+These work with faces.Recognizer and with faces_remote.RemoteRecognizer alike. They live apart from cozmonaut.faces
+so the remote client can use them without loading the faces extension.
+"""
+
+import asyncio
+
+
+async def wait_events(rec, loop=None):
+    """
+    Wait until a recognizer has events pending.
+
+    This sleeps on the recognizer's event file descriptor, so it wakes up as soon as events come in and not at all
+    otherwise. If the platform has no such descriptor, it falls back to checking every ten milliseconds.
+
+    :param rec: The recognizer
+    :param loop: The event loop (defaults to the current one)
+    """
+
+    # Remote recognizers may have events already read off their socket, which the descriptor knows nothing about
+    if getattr(rec, 'pending', False):
+        return
+
+    fd = rec.event_fd
+
+    # Fall back to a timer
+    if fd < 0:
+        await asyncio.sleep(0.01)
+        return
+
+    if loop is None:
+        loop = asyncio.get_event_loop()
+
+    # Wait for the descriptor to become readable
+    # The reader is level-triggered, so this returns right away if events are already pending
+    ready = loop.create_future()
+    loop.add_reader(fd, lambda: ready.done() or ready.set_result(None))
+    try:
+        await ready
+    finally:
+        loop.remove_reader(fd)
+
+
+async def events(rec, loop=None):
+    """
+    Iterate over a recognizer's events as they come in.
+
+    Each item is a batch from ``poll_batch()``. A batch is never empty. Use it like::
+
+        async for batch in rec.events():
+            for evt in batch.appear:
+                ...
+
+    :param rec: The recognizer
+    :param loop: The event loop (defaults to the current one)
+    """
+
+    while True:
+        await wait_events(rec, loop)
+
+        batch = rec.poll_batch()
+        if len(batch.appear) or len(batch.disappear) or len(batch.move):
+            yield batch
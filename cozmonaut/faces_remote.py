@@ -0,0 +1,570 @@
+#
+# Cozmonaut
+# Copyright (c) 2019 The Cozmonaut Contributors
+#
+# InsertLicenseText
+#
+
+"""
+A client for faces_server.
+
+This mirrors the Recognizer and Cache API of the faces module, but the recognizers and the cache live in the server
+process. Several robot processes can then share one server (and one copy of the models) on the same host::
+
+    client = faces_remote.Client('/tmp/faces.sock')
+
+    rec = client.create_recognizer(faces_remote.Backend.DLIB)
+    rec.register_face_appear(on_appear)
+    rec.start()
+
+    rec.source.update(pil_image)
+
+    while True:
+        await faces_events.wait_events(rec)
+        rec.poll()
+
+This is plain Python, and it does not need the faces extension to be built. The wire protocol is described in
+ext/faces/server/protocol.h. A client is not thread-safe.
+"""
+
+import collections
+import enum
+import socket
+import struct
+
+from cozmonaut.faces_events import events
+
+# The message header: body size, type, status, sequence number
+_HEADER = struct.Struct('<IHHI')
+
+# An event: id, track, left, top, right, bottom, stream, timestamp, sequence number
+_EVENT = struct.Struct('<7iqq')
+
+# An encoding
+_ENCODING = struct.Struct('<128d')
+
+# The bit marking a reply
+_REPLY = 0x8000
+
+
+class _Msg(enum.IntEnum):
+    CREATE_RECOGNIZER = 1
+    DESTROY_RECOGNIZER = 2
+    CONFIGURE_SYNTHETIC = 3
+    START = 4
+    STOP = 5
+    ATTACH_RING = 6
+    SUBMIT_FRAMES = 7
+    GET_STATS = 8
+    SET_SCENE_THRESHOLD = 9
+    SET_SAMPLING = 10
+    CACHE_INSERT = 16
+    CACHE_INSERT_PROTOTYPE = 17
+    CACHE_INSERT_UNKNOWN = 18
+    CACHE_REMOVE = 19
+    CACHE_RENAME = 20
+    CACHE_RETRIEVE = 21
+    CACHE_QUERY = 22
+    CACHE_EPOCH = 23
+    CACHE_CONSOLIDATE_UNKNOWNS = 24
+    EVENTS = 32
+
+
+class Backend(enum.IntEnum):
+    """The recognition backends (as in faces.Recognizer.Backend)."""
+
+    DLIB = 0
+    SYNTHETIC = 1
+
+
+class PixelFormat(enum.IntEnum):
+    """The pixel formats (as in faces.PixelFormat)."""
+
+    RGB = 0
+    BGR = 1
+    RGBA = 2
+    BGRA = 3
+    GRAY = 4
+
+
+class RemoteError(RuntimeError):
+    """An error reported by the server."""
+
+
+# A recognizer event (the same fields as the records of faces.Recognizer.poll_batch())
+Event = collections.namedtuple('Event', 'id track left top right bottom stream timestamp seq')
+
+# Recognizer counters (as in faces.Recognizer.Stats)
+Stats = collections.namedtuple('Stats', 'moves_enqueued moves_coalesced unknowns_inserted frames frames_gated '
+                                        'idle_entries idle_exits allocations_counted frame_allocations '
+                                        'allocating_frames')
+
+
+class Encoding:
+    """A face encoding that came over the wire. It works like faces.Encoding."""
+
+    def __init__(self, vector=None):
+        self.vector = list(vector) if vector is not None else [0.0] * 128
+
+    def compare(self, rhs):
+        """
+        :param rhs: The other face encoding
+        :return: The square of the Euclidean distance between the two
+        """
+
+        return sum((a - b) ** 2 for a, b in zip(self.vector, _vector(rhs)))
+
+
+class EventBatch:
+    """A batch of recognizer events (as in faces.Recognizer.EventBatch)."""
+
+    def __init__(self, appear, disappear, move, encodings):
+        self.appear = appear
+        self.disappear = disappear
+        self.move = move
+        self.encodings = encodings
+
+    def encoding(self, index):
+        """
+        :param index: The index of an appearance
+        :return: The face encoding of that appearance
+        """
+
+        return self.encodings[index]
+
+
+def _vector(face):
+    """Get the face vector of an encoding, be it ours, one from the faces module, or a plain sequence."""
+
+    vector = getattr(face, 'vector', face)
+    if len(vector) != 128:
+        raise ValueError('face vector must have 128 elements')
+    return vector
+
+
+def _frame(img, format=None):
+    """
+    Describe an image for submission.
+
+    :param img: A PIL image, or anything exposing its memory through the buffer protocol
+    :param format: The pixel format of a buffer (guessed from its shape if not given)
+    :return: The width, height, pixel format, and pixel memory
+    """
+
+    # PIL images get mapped by mode, like PILSource does
+    if hasattr(img, 'mode'):
+        if img.mode == 'RGB':
+            format = PixelFormat.RGB
+        elif img.mode in ('RGBA', 'RGBX'):
+            format = PixelFormat.RGBA
+        elif img.mode == 'L':
+            format = PixelFormat.GRAY
+        else:
+            img = img.convert('RGB')
+            format = PixelFormat.RGB
+
+        return img.width, img.height, format, img.tobytes('raw')
+
+    # Buffers go out as they are, without copying, if they're contiguous
+    view = memoryview(img)
+    if not view.c_contiguous:
+        raise ValueError('image buffer must be contiguous')
+    if view.ndim == 2:
+        format = PixelFormat.GRAY if format is None else format
+    elif view.ndim == 3:
+        if format is None:
+            format = PixelFormat.RGBA if view.shape[2] == 4 else PixelFormat.RGB
+    else:
+        raise ValueError('image buffer must have two or three dimensions')
+
+    return view.shape[1], view.shape[0], format, view.cast('B')
+
+
+class Client:
+    """A connection to faces_server."""
+
+    def __init__(self, path='/tmp/faces.sock'):
+        """
+        :param path: The server socket path
+        """
+
+        self._sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self._sock.connect(path)
+
+        # The last sequence number used
+        self._seq = 0
+
+        # Bytes read off the socket that do not make up a whole message yet
+        self._input = bytearray()
+
+        # Replies read off the socket but not yet picked up, by sequence number
+        self._replies = {}
+
+        # Event batches read off the socket but not yet polled, by recognizer handle
+        self._events = collections.defaultdict(collections.deque)
+
+        # Errors from submissions, raised on the next call
+        self._errors = []
+
+        self.cache = RemoteCache(self)
+
+    def close(self):
+        """Close the connection. The server destroys all recognizers created over it."""
+
+        self._sock.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def fileno(self):
+        """
+        :return: The socket file descriptor
+        """
+
+        return self._sock.fileno()
+
+    def create_recognizer(self, backend=Backend.DLIB, stream=0):
+        """
+        Create a recognizer on the server. It recognizes faces in the server's cache.
+
+        :param backend: The recognition backend
+        :param stream: The stream number stamped on its events
+        :return: The recognizer
+        """
+
+        body = self._request(_Msg.CREATE_RECOGNIZER, struct.pack('<Ii', int(backend), stream))
+        handle, = struct.unpack('<I', body)
+        return RemoteRecognizer(self, handle, stream)
+
+    def submit(self, frames):
+        """
+        Submit frames to several recognizers in one go (like one frame from each robot).
+
+        :param frames: An iterable of (recognizer, image) pairs, or (recognizer, image, format) triples
+        """
+
+        parts = [b'']
+        count = 0
+        for item in frames:
+            rec, img = item[0], item[1]
+            width, height, format, pixels = _frame(img, item[2] if len(item) > 2 else None)
+            parts.append(struct.pack('<IiiII', rec.handle, width, height, int(format), len(pixels)))
+            parts.append(pixels)
+            count += 1
+
+        parts[0] = struct.pack('<I', count)
+        self._send(_Msg.SUBMIT_FRAMES, parts)
+
+    def pump(self):
+        """Read whatever the server has sent without waiting for more."""
+
+        # Part of a message may be all there is so far, so this never waits on the rest
+        while self._read(block=False):
+            pass
+
+        self._raise_errors()
+
+    def _next_seq(self):
+        self._seq = (self._seq + 1) & 0xffffffff or 1
+        return self._seq
+
+    def _send(self, msg, parts):
+        """Send a message made of several buffers, and return its sequence number."""
+
+        seq = self._next_seq()
+        size = sum(len(memoryview(p).cast('B')) for p in parts)
+        self._sock.sendall(_HEADER.pack(size, int(msg), 0, seq))
+        for part in parts:
+            self._sock.sendall(part)
+        return seq
+
+    def _request(self, msg, body=b''):
+        """Send a request and wait for its reply. Events that come first are kept for polling."""
+
+        self._raise_errors()
+
+        seq = self._send(msg, [body])
+        while seq not in self._replies:
+            self._read(block=True)
+
+        status, body = self._replies.pop(seq)
+        if status:
+            raise RemoteError(body.decode('utf-8', 'replace'))
+        return body
+
+    def _raise_errors(self):
+        if self._errors:
+            error = self._errors.pop(0)
+            raise RemoteError(error)
+
+    def _read(self, block):
+        """
+        Read what the server has sent, and handle every whole message in it.
+
+        :param block: Whether to wait for something to read
+        :return: True if anything was read, otherwise false
+        """
+
+        try:
+            data = self._sock.recv(65536, 0 if block else socket.MSG_DONTWAIT)
+        except BlockingIOError:
+            return False
+
+        if not data:
+            raise ConnectionError('faces_server closed the connection')
+
+        self._input += data
+
+        # Handle the whole messages, and keep the tail for next time
+        view = memoryview(self._input)
+        offset = 0
+        while len(view) - offset >= _HEADER.size:
+            size, msg, status, seq = _HEADER.unpack_from(view, offset)
+            if len(view) - offset - _HEADER.size < size:
+                break
+
+            body = bytes(view[offset + _HEADER.size:offset + _HEADER.size + size])
+            offset += _HEADER.size + size
+            self._handle(msg, status, seq, body)
+
+        view.release()
+        del self._input[:offset]
+        return True
+
+    def _handle(self, msg, status, seq, body):
+        """Handle one message. Events are queued up, and replies are kept for whoever waits on them."""
+
+        if msg == _Msg.EVENTS:
+            handle, n_appear, n_disappear, n_move = struct.unpack_from('<4I', body)
+            offset = 16
+
+            lists = []
+            for n in (n_appear, n_disappear, n_move):
+                lists.append([Event._make(_EVENT.unpack_from(body, offset + i * _EVENT.size)) for i in range(n)])
+                offset += n * _EVENT.size
+
+            encodings = []
+            for i in range(n_appear):
+                encodings.append(Encoding(_ENCODING.unpack_from(body, offset)))
+                offset += _ENCODING.size
+
+            self._events[handle].append(EventBatch(lists[0], lists[1], lists[2], encodings))
+            return
+
+        # A failed submission has nobody waiting on it
+        if msg == _Msg.SUBMIT_FRAMES | _REPLY:
+            if status:
+                self._errors.append(body.decode('utf-8', 'replace'))
+            return
+
+        self._replies[seq] = (status, body)
+
+
+class RemoteSource:
+    """The frame source of a remote recognizer."""
+
+    def __init__(self, rec):
+        self._rec = rec
+
+    def update(self, img, format=None):
+        """
+        Submit a frame.
+
+        :param img: A PIL image, or anything exposing its memory through the buffer protocol
+        :param format: The pixel format of a buffer (guessed from its shape if not given)
+        """
+
+        self._rec._client.submit([(self._rec, img, format)])
+
+
+class RemoteRecognizer:
+    """A recognizer hosted by faces_server. It works like faces.Recognizer."""
+
+    def __init__(self, client, handle, stream):
+        self._client = client
+        self.handle = handle
+        self.stream = stream
+        self.source = RemoteSource(self)
+
+        self._cbs_face_appear = []
+        self._cbs_face_disappear = []
+        self._cbs_face_move = []
+
+    @property
+    def cache(self):
+        """The cache. This is always the server's."""
+
+        return self._client.cache
+
+    @property
+    def event_fd(self):
+        """A file descriptor that becomes readable when events come in (shared by all recognizers of a client)."""
+
+        return self._client.fileno()
+
+    @property
+    def pending(self):
+        """True if events were already read off the socket, so waiting on event_fd would miss them."""
+
+        return bool(self._client._events.get(self.handle))
+
+    @property
+    def stats(self):
+        """The recognizer counters."""
+
+        body = self._client._request(_Msg.GET_STATS, struct.pack('<I', self.handle))
+        stats = Stats._make(struct.unpack('<10Q', body))
+        return stats._replace(allocations_counted=bool(stats.allocations_counted))
+
+    def register_face_appear(self, cb):
+        """:param cb: Called as cb(rec, fid, rect, enc) for each face that appears"""
+
+        self._cbs_face_appear.append(cb)
+
+    def register_face_disappear(self, cb):
+        """:param cb: Called as cb(rec, fid) for each face that disappears"""
+
+        self._cbs_face_disappear.append(cb)
+
+    def register_face_move(self, cb):
+        """:param cb: Called as cb(rec, fid, rect) for each face that moves"""
+
+        self._cbs_face_move.append(cb)
+
+    def set_scene_threshold(self, threshold):
+        """Set the scene change threshold (see faces.Recognizer.scene_threshold). Zero turns it off."""
+
+        self._client._request(_Msg.SET_SCENE_THRESHOLD, struct.pack('<Id', self.handle, threshold))
+
+    def set_sampling(self, adaptive, active_rate=0.0, idle_rate=2.0, idle_after=5.0, wake_frames=1):
+        """Set the adaptive sampling settings (see faces.Recognizer.Sampling)."""
+
+        self._client._request(_Msg.SET_SAMPLING, struct.pack('<IBdddi', self.handle, adaptive, active_rate, idle_rate,
+                                                             idle_after, wake_frames))
+
+    def configure_synthetic(self, faces, detect_cost, embed_cost):
+        """Configure the synthetic backend (see faces.Recognizer.configure_synthetic)."""
+
+        self._client._request(_Msg.CONFIGURE_SYNTHETIC, struct.pack('<Iiii', self.handle, faces, detect_cost,
+                                                                    embed_cost))
+
+    def attach_ring(self, name):
+        """
+        Take frames from a shared memory frame ring instead of the socket. The ring must already exist (as created by
+        faces.sources.ShmProducer). The recognizer must not be running.
+
+        :param name: The ring name
+        """
+
+        name = name.encode('utf-8')
+        self._client._request(_Msg.ATTACH_RING, struct.pack('<II', self.handle, len(name)) + name)
+
+    def start(self):
+        """Start recognizing."""
+
+        self._client._request(_Msg.START, struct.pack('<I', self.handle))
+
+    def stop(self):
+        """Stop recognizing."""
+
+        self._client._request(_Msg.STOP, struct.pack('<I', self.handle))
+
+    def destroy(self):
+        """Destroy the recognizer on the server."""
+
+        self._client._request(_Msg.DESTROY_RECOGNIZER, struct.pack('<I', self.handle))
+
+    def poll_batch(self):
+        """
+        Take all events that came in so far, without calling any callbacks.
+
+        :return: The events
+        """
+
+        self._client.pump()
+
+        batches = self._client._events.pop(self.handle, ())
+        appear, disappear, move, encodings = [], [], [], []
+        for batch in batches:
+            appear += batch.appear
+            disappear += batch.disappear
+            move += batch.move
+            encodings += batch.encodings
+
+        return EventBatch(appear, disappear, move, encodings)
+
+    def poll(self):
+        """Call the registered callbacks for all events that came in so far."""
+
+        batch = self.poll_batch()
+
+        # Put the events back in the order they happened in
+        evts = [(evt.seq, 0, i) for i, evt in enumerate(batch.appear)]
+        evts += [(evt.seq, 1, i) for i, evt in enumerate(batch.disappear)]
+        evts += [(evt.seq, 2, i) for i, evt in enumerate(batch.move)]
+        evts.sort()
+
+        for _, kind, i in evts:
+            if kind == 0:
+                evt = batch.appear[i]
+                rect = (evt.left, evt.top, evt.right, evt.bottom)
+                for cb in self._cbs_face_appear:
+                    cb(self, evt.id, rect, batch.encodings[i])
+            elif kind == 1:
+                evt = batch.disappear[i]
+                for cb in self._cbs_face_disappear:
+                    cb(self, evt.id)
+            else:
+                evt = batch.move[i]
+                rect = (evt.left, evt.top, evt.right, evt.bottom)
+                for cb in self._cbs_face_move:
+                    cb(self, evt.id, rect)
+
+
+class RemoteCache:
+    """The cache of faces_server. It works like faces.Cache."""
+
+    def __init__(self, client):
+        self._client = client
+
+    def insert(self, fid, face):
+        self._client._request(_Msg.CACHE_INSERT, struct.pack('<i', fid) + _ENCODING.pack(*_vector(face)))
+
+    def insert_prototype(self, fid, face):
+        self._client._request(_Msg.CACHE_INSERT_PROTOTYPE, struct.pack('<i', fid) + _ENCODING.pack(*_vector(face)))
+
+    def insert_unknown(self, face):
+        body = self._client._request(_Msg.CACHE_INSERT_UNKNOWN, _ENCODING.pack(*_vector(face)))
+        return struct.unpack('<i', body)[0]
+
+    def remove(self, fid):
+        self._client._request(_Msg.CACHE_REMOVE, struct.pack('<i', fid))
+
+    def rename(self, fid_old, fid_new):
+        self._client._request(_Msg.CACHE_RENAME, struct.pack('<ii', fid_old, fid_new))
+
+    def retrieve(self, fid):
+        body = self._client._request(_Msg.CACHE_RETRIEVE, struct.pack('<i', fid))
+        return Encoding(_ENCODING.unpack(body))
+
+    def query(self, face, tol):
+        body = self._client._request(_Msg.CACHE_QUERY, struct.pack('<d', tol) + _ENCODING.pack(*_vector(face)))
+        return struct.unpack('<i', body)[0]
+
+    def consolidate_unknowns(self, tol):
+        body = self._client._request(_Msg.CACHE_CONSOLIDATE_UNKNOWNS, struct.pack('<d', tol))
+        count = struct.unpack_from('<I', body)[0]
+        pairs = struct.unpack_from('<%di' % (2 * count), body, 4)
+        return dict(zip(pairs[0::2], pairs[1::2]))
+
+    @property
+    def epoch(self):
+        body = self._client._request(_Msg.CACHE_EPOCH)
+        return struct.unpack('<Q', body)[0]
+
+
+# Let remote recognizers do this themselves too
+RemoteRecognizer.events = events
@@ -106,14 +106,14 @@ class TaskRun:
 
         # Main robot loop
         while True:
+            # Sleep until the face recognizer has events for us
+            # This lets the other coroutines have a go
+            await faces.wait_events(face_recognizer)
+
             # Poll the face recognizer
             # This calls our callbacks for any enqueued face-related events
             face_recognizer.poll()
 
-            # Sleep for a bit
-            # This lets the other coroutines have a go
-            await asyncio.sleep(0.01)
-
     def _robot_on_new_raw_camera_image_cb(self, robot: cozmo.robot.Robot, evt: cozmo.camera.EvtNewRawCameraImage, **kw):
         asyncio.ensure_future(self._robot_on_new_raw_camera_image(robot, evt, **kw))
 
@@ -21,6 +21,9 @@ def on_face_appear(rec: faces.Recognizer, fid: int, bounds: tuple, enc: faces.En
     if fid < 0:
         print(f"I've never seen you before! I'll call you {counter}...")
         rec.cache.rename(fid, counter)
+
+        # The face keeps being tracked under its new ID
+        rectangles[counter] = rectangles.pop(fid)
         counter = counter + 1
     elif fid > 0:
         print(f"Hello again {fid}!")
@@ -0,0 +1,187 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace faces {
+namespace bench {
+
+/** A benchmark parameter list, like {{"gallery", 1000}}. */
+using Params = std::vector<std::pair<std::string, long long>>;
+
+/** The result of one benchmark. */
+struct Result {
+  /** The benchmark name. */
+  std::string name;
+
+  /** The benchmark parameters. */
+  Params params;
+
+  /** The number of iterations in each sample. */
+  std::uint64_t iterations;
+
+  /** The per-iteration time of each sample in nanoseconds. */
+  std::vector<double> samples;
+};
+
+/** A pausable stopwatch handed to each benchmark body. */
+class Timer {
+  /** The accumulated time. */
+  std::chrono::steady_clock::duration m_elapsed;
+
+  /** The time of the last start. */
+  std::chrono::steady_clock::time_point m_start;
+
+public:
+  Timer() : m_elapsed(), m_start() {
+  }
+
+  /** Start (or resume) timing. */
+  void start() {
+    m_start = std::chrono::steady_clock::now();
+  }
+
+  /** Stop (or pause) timing. */
+  void stop() {
+    m_elapsed += std::chrono::steady_clock::now() - m_start;
+  }
+
+  /**
+   * @return The accumulated time in nanoseconds
+   */
+  double nanos() const {
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(m_elapsed).count());
+  }
+};
+
+/** Keep the optimizer from discarding a value. */
+template<class T>
+inline void keep(T&& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/** A benchmark runner. It collects results and writes them out as JSON. */
+class Runner {
+  /** The minimum time to spend on each sample in seconds. */
+  double m_min_time;
+
+  /** The number of samples to take of each benchmark. */
+  int m_samples;
+
+  /** Only run benchmarks whose names contain this. */
+  std::string m_filter;
+
+  /** All results so far. */
+  std::vector<Result> m_results;
+
+public:
+  /**
+   * This throws if there are no samples to take, as results are summarized
+   * from the samples.
+   *
+   * @param p_min_time The minimum time to spend on each sample in seconds
+   * @param p_samples The number of samples to take of each benchmark
+   * @param p_filter Only run benchmarks whose names contain this
+   */
+  Runner(double p_min_time, int p_samples, std::string p_filter)
+      : m_min_time(p_min_time)
+      , m_samples(p_samples)
+      , m_filter(std::move(p_filter))
+      , m_results() {
+    if (m_samples < 1) {
+      throw std::runtime_error("need at least one sample");
+    }
+  }
+
+  /**
+   * Run a benchmark. The body is called as body(n, timer) and must perform n
+   * iterations, starting and stopping the timer around the measured part.
+   *
+   * @param name The benchmark name
+   * @param params The benchmark parameters
+   * @param body The benchmark body
+   */
+  template<class Body>
+  void run(const std::string& name, Params params, Body&& body) {
+    // Skip benchmarks not selected by the filter
+    if (name.find(m_filter) == std::string::npos) {
+      return;
+    }
+
+    // Grow the iteration count until one sample takes long enough
+    std::uint64_t n = 1;
+    for (;;) {
+      Timer timer;
+      body(n, timer);
+
+      if (timer.nanos() >= m_min_time * 1e9 || n >= (1ull << 32u)) {
+        break;
+      }
+
+      // Aim for the minimum time with some headroom, but grow at most tenfold
+      auto scale = timer.nanos() > 0 ? 1.2 * m_min_time * 1e9 / timer.nanos() : 10.0;
+      n = std::max<std::uint64_t>(n + 1, static_cast<std::uint64_t>(n * std::min(scale, 10.0)));
+    }
+
+    Result result {name, std::move(params), n, {}};
+
+    // Take the samples
+    for (int i = 0; i < m_samples; ++i) {
+      Timer timer;
+      body(n, timer);
+      result.samples.push_back(timer.nanos() / n);
+    }
+
+    m_results.push_back(std::move(result));
+  }
+
+  /**
+   * Write all results as JSON.
+   *
+   * @param out The output stream
+   */
+  void write_json(std::ostream& out) const {
+    out << "{\"benchmarks\":[";
+
+    for (std::size_t i = 0; i < m_results.size(); ++i) {
+      auto& result = m_results[i];
+
+      // Summarize the samples
+      auto sorted = result.samples;
+      std::sort(sorted.begin(), sorted.end());
+      auto median = sorted[sorted.size() / 2];
+
+      out << (i ? "," : "") << "\n{\"name\":\"" << result.name << "\",\"params\":{";
+      for (std::size_t j = 0; j < result.params.size(); ++j) {
+        out << (j ? "," : "") << '"' << result.params[j].first << "\":" << result.params[j].second;
+      }
+      out << "},\"iterations\":" << result.iterations
+          << ",\"ns_per_op\":" << median
+          << ",\"ns_per_op_min\":" << sorted.front()
+          << ",\"ns_per_op_max\":" << sorted.back()
+          << ",\"ops_per_sec\":" << (median > 0 ? 1e9 / median : 0)
+          << "}";
+    }
+
+    out << "\n]}\n";
+  }
+};
+
+} // namespace bench
+} // namespace faces
+
+#endif // #ifndef BENCH_H
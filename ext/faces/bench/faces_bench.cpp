@@ -0,0 +1,473 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include <unistd.h>
+
+#include <pybind11/embed.h>
+
+#include <faces/encoding.h>
+#include <faces/recognizer.h>
+#include <faces/caches/basic_cache.h>
+#include <faces/caches/shared_cache.h>
+#include <faces/sources/pil_source.h>
+
+#include "bench.h"
+#include "preprocess.h"
+#include "recognizer_impl.h"
+
+namespace py = pybind11;
+
+using namespace pybind11::literals;
+
+using namespace faces;
+using namespace faces::bench;
+
+namespace {
+
+/** Make a random face encoding. */
+Encoding random_encoding(std::mt19937_64& rng) {
+  std::normal_distribution<double> dist(0, 0.1);
+
+  Encoding::vector_type vec {};
+  for (auto& x : vec) {
+    x = dist(rng);
+  }
+
+  Encoding enc;
+  enc.set_vector(vec);
+  return enc;
+}
+
+/** Fill a cache with random faces with IDs 1 through n. */
+void fill_cache(Cache& cache, long long n, std::mt19937_64& rng) {
+  for (long long id = 1; id <= n; ++id) {
+    cache.insert(static_cast<int>(id), random_encoding(rng));
+  }
+}
+
+void bench_encoding(Runner& runner) {
+  std::mt19937_64 rng(1);
+  auto a = random_encoding(rng);
+  auto b = random_encoding(rng);
+
+  runner.run("encoding_compare", {}, [&](std::uint64_t n, Timer& timer) {
+    timer.start();
+    for (std::uint64_t i = 0; i < n; ++i) {
+      keep(a.compare(b));
+    }
+    timer.stop();
+  });
+}
+
+void bench_basic_cache(Runner& runner, long long max_gallery) {
+  for (long long size = 100; size <= max_gallery; size *= 10) {
+    std::mt19937_64 rng(2);
+
+    caches::BasicCache cache(1024);
+    fill_cache(cache, size, rng);
+
+    // A face that matches nothing, so every query scans the whole gallery
+    auto probe = random_encoding(rng);
+
+    runner.run("basic_cache_query", {{"gallery", size}}, [&](std::uint64_t n, Timer& timer) {
+      timer.start();
+      for (std::uint64_t i = 0; i < n; ++i) {
+        keep(cache.query(probe, 1e-9));
+      }
+      timer.stop();
+    });
+
+    runner.run("basic_cache_insert", {{"gallery", size}}, [&](std::uint64_t n, Timer& timer) {
+      timer.start();
+      for (std::uint64_t i = 0; i < n; ++i) {
+        cache.insert(static_cast<int>(size + 1 + i), probe);
+      }
+      timer.stop();
+
+      // Restore the gallery size
+      for (std::uint64_t i = 0; i < n; ++i) {
+        cache.remove(static_cast<int>(size + 1 + i));
+      }
+    });
+
+    runner.run("basic_cache_remove", {{"gallery", size}}, [&](std::uint64_t n, Timer& timer) {
+      for (std::uint64_t i = 0; i < n; ++i) {
+        cache.insert(static_cast<int>(size + 1 + i), probe);
+      }
+
+      timer.start();
+      for (std::uint64_t i = 0; i < n; ++i) {
+        cache.remove(static_cast<int>(size + 1 + i));
+      }
+      timer.stop();
+    });
+
+    runner.run("basic_cache_rename", {{"gallery", size}}, [&](std::uint64_t n, Timer& timer) {
+      // Bounce one face between two IDs past the end of the gallery
+      int from = static_cast<int>(size + 1);
+      int to = static_cast<int>(size + 2);
+      cache.insert(from, probe);
+
+      timer.start();
+      for (std::uint64_t i = 0; i < n; ++i) {
+        cache.rename(from, to);
+        std::swap(from, to);
+      }
+      timer.stop();
+
+      cache.remove(from);
+    });
+  }
+}
+
+void bench_basic_cache_prototypes(Runner& runner, long long max_gallery) {
+  // Five photos per face, spread around each face the way photos of one person are
+  for (long long size = 100; size <= max_gallery && size <= 100000; size *= 10) {
+    std::mt19937_64 rng(4);
+    std::normal_distribution<double> spread(0, 0.03);
+
+    caches::BasicCache cache(1024);
+    for (long long id = 1; id <= size; ++id) {
+      auto face = random_encoding(rng);
+      cache.insert(static_cast<int>(id), face);
+
+      for (int i = 0; i < 4; ++i) {
+        auto vec = face.get_vector();
+        for (auto& x : vec) {
+          x += spread(rng);
+        }
+
+        Encoding prototype;
+        prototype.set_vector(vec);
+        cache.insert_prototype(static_cast<int>(id), prototype);
+      }
+    }
+
+    // A face that matches nothing at the usual tolerance
+    auto probe = random_encoding(rng);
+
+    runner.run("basic_cache_query_prototypes", {{"gallery", size}, {"prototypes", 5}},
+        [&](std::uint64_t n, Timer& timer) {
+      timer.start();
+      for (std::uint64_t i = 0; i < n; ++i) {
+        keep(cache.query(probe, 0.6));
+      }
+      timer.stop();
+    });
+  }
+}
+
+void bench_shared_cache(Runner& runner, long long max_gallery) {
+  // Each face takes about 10 KiB of the segment, so stop short of the big galleries
+  for (long long size = 100; size <= max_gallery && size <= 10000; size *= 10) {
+    std::mt19937_64 rng(2);
+
+    std::string name = "/faces_bench." + std::to_string(getpid());
+    caches::SharedCache::unlink(name);
+
+    caches::SharedCache cache(name, static_cast<std::size_t>(size) + 1, 1024, 8, 1.0);
+    fill_cache(cache, size, rng);
+
+    // A face that matches nothing, so every query scans the whole gallery
+    auto probe = random_encoding(rng);
+
+    runner.run("shared_cache_query", {{"gallery", size}}, [&](std::uint64_t n, Timer& timer) {
+      timer.start();
+      for (std::uint64_t i = 0; i < n; ++i) {
+        keep(cache.query(probe, 1e-9));
+      }
+      timer.stop();
+    });
+
+    runner.run("shared_cache_insert_remove", {{"gallery", size}}, [&](std::uint64_t n, Timer& timer) {
+      timer.start();
+      for (std::uint64_t i = 0; i < n; ++i) {
+        cache.remove(cache.insert_unknown(probe));
+      }
+      timer.stop();
+    });
+
+    caches::SharedCache::unlink(name);
+  }
+}
+
+void bench_basic_cache_unknowns(Runner& runner) {
+  // Insert unknown faces into a full cache, so every insertion evicts one
+  for (long long capacity = 100; capacity <= 10000; capacity *= 10) {
+    std::mt19937_64 rng(3);
+
+    caches::BasicCache cache(1024);
+    cache.set_unknown_capacity(static_cast<std::size_t>(capacity));
+    for (long long i = 0; i < capacity; ++i) {
+      cache.insert_unknown(random_encoding(rng));
+    }
+
+    auto face = random_encoding(rng);
+
+    runner.run("basic_cache_insert_unknown_full", {{"capacity", capacity}}, [&](std::uint64_t n, Timer& timer) {
+      timer.start();
+      for (std::uint64_t i = 0; i < n; ++i) {
+        keep(cache.insert_unknown(face));
+      }
+      timer.stop();
+
+      // Nobody listens, so drop the eviction events
+      cache.poll();
+    });
+  }
+}
+
+void bench_pil_source(Runner& runner) {
+  // A stand-in for PIL images, so PIL need not be installed
+  // PILSource only touches the width, height, mode, and tobytes members
+  py::exec(R"(
+class BenchImage:
+    def __init__(self, width, height):
+        self.width = width
+        self.height = height
+        self.mode = 'RGB'
+        self._bytes = bytes(width * height * 3)
+
+    def tobytes(self, mode='raw'):
+        return self._bytes
+)");
+
+  std::pair<int, int> resolutions[] = {{320, 240}, {640, 480}, {1280, 720}, {1920, 1080}};
+
+  for (auto[width, height] : resolutions) {
+    auto img = py::globals()["BenchImage"](width, height);
+    auto buf = py::eval("memoryview(bytearray({0} * {1} * 3)).cast('B', ({1}, {0}, 3))"_s.format(width, height));
+    Params params {{"width", width}, {"height", height}};
+
+    sources::PILSource source;
+
+    runner.run("pil_source_update", params, [&](std::uint64_t n, Timer& timer) {
+      timer.start();
+      for (std::uint64_t i = 0; i < n; ++i) {
+        source.update(img);
+      }
+      timer.stop();
+    });
+
+    runner.run("pil_source_update_buffer", params, [&](std::uint64_t n, Timer& timer) {
+      timer.start();
+      for (std::uint64_t i = 0; i < n; ++i) {
+        source.update(buf);
+      }
+      timer.stop();
+    });
+
+    runner.run("pil_source_wait", params, [&](std::uint64_t n, Timer& timer) {
+      for (std::uint64_t i = 0; i < n; ++i) {
+        source.update(img);
+
+        timer.start();
+        keep(source.wait(0).has_value());
+        timer.stop();
+      }
+    });
+  }
+}
+
+void bench_preprocess(Runner& runner) {
+  std::pair<int, int> resolutions[] = {{320, 240}, {640, 480}, {1280, 720}};
+
+  for (auto[width, height] : resolutions) {
+    Params params {{"width", width}, {"height", height}};
+
+    Image frame;
+    frame.width = width;
+    frame.height = height;
+    frame.data.resize(static_cast<std::size_t>(width) * height * 4);
+
+    // Each stage on its own, then the legacy upscale-and-blur combination
+    struct Case {
+      const char* name;
+      PixelFormat format;
+      Preprocess config;
+    };
+    Case cases[] = {
+        {"preprocess_bgr_to_rgb", PixelFormat::BGR, {Preprocess::Resize::NONE, false}},
+        {"preprocess_rgba_to_rgb", PixelFormat::RGBA, {Preprocess::Resize::NONE, false}},
+        {"preprocess_half", PixelFormat::RGB, {Preprocess::Resize::HALF, false}},
+        {"preprocess_double", PixelFormat::RGB, {Preprocess::Resize::DOUBLE, false}},
+        {"preprocess_blur", PixelFormat::RGB, {Preprocess::Resize::NONE, true}},
+        {"preprocess_double_blur", PixelFormat::RGB, {Preprocess::Resize::DOUBLE, true}},
+    };
+
+    for (auto& c : cases) {
+      Preprocessor pre;
+      pre.set_config(c.config);
+      frame.format = c.format;
+
+      runner.run(c.name, params, [&](std::uint64_t n, Timer& timer) {
+        timer.start();
+        for (std::uint64_t i = 0; i < n; ++i) {
+          pre.process(frame);
+        }
+        timer.stop();
+      });
+    }
+
+    std::vector<std::uint8_t> gray(static_cast<std::size_t>(width));
+    runner.run("preprocess_rgb_to_gray", params, [&](std::uint64_t n, Timer& timer) {
+      timer.start();
+      for (std::uint64_t i = 0; i < n; ++i) {
+        for (int y = 0; y < height; ++y) {
+          convert_row_gray(PixelFormat::RGB, reinterpret_cast<const std::uint8_t*>(frame.data.data()) + y * width * 3ul,
+              gray.data(), width);
+        }
+      }
+      timer.stop();
+      keep(gray[0]);
+    });
+  }
+}
+
+void bench_recognizer_poll(Runner& runner) {
+  // The synthetic backend keeps model loading out of the picture
+  Recognizer rec(Recognizer::Backend::SYNTHETIC);
+  auto& impl = get_impl(rec);
+
+  // A trivial C++ callback, so we measure the dispatch machinery alone
+  long long moves = 0;
+  rec.register_face_move([&](Recognizer&, int, std::tuple<int, int, int, int>) {
+    ++moves;
+  });
+
+  for (long long count = 1; count <= 10000; count *= 10) {
+    runner.run("recognizer_poll", {{"events", count}}, [&](std::uint64_t n, Timer& timer) {
+      for (std::uint64_t i = 0; i < n; ++i) {
+        // Enqueue the events as the recognition thread would
+        {
+          std::lock_guard lock(impl.m_crt_mutex);
+          for (long long j = 0; j < count; ++j) {
+            impl.enqueue_face_move(static_cast<int>(j + 1), static_cast<int>(j + 1), std::tuple {0, 0, 10, 10});
+          }
+        }
+
+        timer.start();
+        rec.poll();
+        timer.stop();
+      }
+    });
+  }
+
+  // The same events taken as a batch, with no callbacks
+  for (long long count = 1; count <= 10000; count *= 10) {
+    runner.run("recognizer_poll_batch", {{"events", count}}, [&](std::uint64_t n, Timer& timer) {
+      for (std::uint64_t i = 0; i < n; ++i) {
+        {
+          std::lock_guard lock(impl.m_crt_mutex);
+          for (long long j = 0; j < count; ++j) {
+            impl.enqueue_face_move(static_cast<int>(j + 1), static_cast<int>(j + 1), std::tuple {0, 0, 10, 10});
+          }
+        }
+
+        timer.start();
+        keep(rec.poll_batch().move.size());
+        timer.stop();
+      }
+    });
+  }
+
+  // The same number of movements spread over ten faces, as when Python polls late
+  // Coalescing leaves ten events to dispatch no matter how many came in
+  for (long long count = 10; count <= 10000; count *= 10) {
+    runner.run("recognizer_poll_coalesced", {{"events", count}, {"faces", 10}}, [&](std::uint64_t n, Timer& timer) {
+      for (std::uint64_t i = 0; i < n; ++i) {
+        {
+          std::lock_guard lock(impl.m_crt_mutex);
+          for (long long j = 0; j < count; ++j) {
+            auto id = static_cast<int>(j % 10 + 1);
+            impl.enqueue_face_move(id, id, std::tuple {0, 0, 10, 10});
+          }
+        }
+
+        timer.start();
+        rec.poll();
+        timer.stop();
+      }
+    });
+  }
+
+  keep(moves);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  // Defaults
+  long long max_gallery = 1000000;
+  double min_time = 0.2;
+  int samples = 5;
+  std::string filter;
+  std::string out_path;
+
+  // Parse arguments
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        std::cerr << "missing value for " << arg << "\n";
+        std::exit(2);
+      }
+      return argv[++i];
+    };
+
+    if (arg == "--max-gallery") {
+      max_gallery = std::stoll(value());
+    } else if (arg == "--min-time") {
+      min_time = std::stod(value());
+    } else if (arg == "--samples") {
+      samples = std::stoi(value());
+    } else if (arg == "--filter") {
+      filter = value();
+    } else if (arg == "--out") {
+      out_path = value();
+    } else {
+      std::cerr << "usage: faces_bench [--max-gallery N] [--min-time SECS] [--samples N] [--filter STR] [--out FILE]\n";
+      return 2;
+    }
+  }
+
+  // Results are the median of the samples, so there has to be one
+  if (samples < 1) {
+    std::cerr << "need at least one sample\n";
+    return 2;
+  }
+
+  // Some benchmarks need Python objects
+  py::scoped_interpreter interpreter;
+
+  Runner runner(min_time, samples, filter);
+  bench_encoding(runner);
+  bench_basic_cache(runner, max_gallery);
+  bench_basic_cache_prototypes(runner, max_gallery);
+  bench_basic_cache_unknowns(runner);
+  bench_shared_cache(runner, max_gallery);
+  bench_pil_source(runner);
+  bench_preprocess(runner);
+  bench_recognizer_poll(runner);
+
+  // Write the results
+  if (out_path.empty()) {
+    runner.write_json(std::cout);
+  } else {
+    std::ofstream out(out_path);
+    runner.write_json(out);
+  }
+
+  return 0;
+}
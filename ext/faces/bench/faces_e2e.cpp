@@ -0,0 +1,305 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <faces/recognizer.h>
+#include <faces/source.h>
+#include <faces/caches/basic_cache.h>
+#include <faces/sources/shm_source.h>
+
+using namespace faces;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/** A latest-frame-wins source fed from C++, like PILSource without Python. */
+class BenchSource : public Source {
+  /** The pending frame. */
+  Image m_image;
+
+  /** The pending condition variable. */
+  std::condition_variable m_cond;
+
+  /** The pending mutex. */
+  std::mutex m_mutex;
+
+  /** The presence indicator. */
+  bool m_present;
+
+public:
+  BenchSource() : m_image(), m_cond(), m_mutex(), m_present(false) {
+  }
+
+  void update(const pybind11::object&) final {
+    throw std::runtime_error("bench source takes frames from push()");
+  }
+
+  /**
+   * Submit a frame.
+   *
+   * @param image The frame
+   */
+  void push(Image image) {
+    std::lock_guard lock(m_mutex);
+
+    m_image = std::move(image);
+    m_present = true;
+    m_cond.notify_all();
+  }
+
+  std::optional<Image> wait(unsigned long millis) final {
+    std::unique_lock lock(m_mutex);
+
+    if (!m_cond.wait_for(lock, std::chrono::milliseconds(millis), [&]() { return m_present; })) {
+      return std::nullopt;
+    }
+
+    m_present = false;
+    return m_image;
+  }
+};
+
+/** The options of a run. */
+struct Options {
+  double seconds = 10;
+  double fps = 30;
+  double poll_hz = 100;
+  int width = 320;
+  int height = 240;
+  int faces = 2;
+  int detect_cost = 0;
+  int embed_cost = 0;
+  bool notify = false;
+  bool shm = false;
+};
+
+Options parse(int argc, char* argv[]) {
+  Options opts;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> double {
+      if (i + 1 >= argc) {
+        std::cerr << "missing value for " << arg << "\n";
+        std::exit(2);
+      }
+      return std::stod(argv[++i]);
+    };
+
+    if (arg == "--notify") {
+      opts.notify = true;
+    } else if (arg == "--shm") {
+      opts.shm = true;
+    } else if (arg == "--seconds") {
+      opts.seconds = value();
+    } else if (arg == "--fps") {
+      opts.fps = value();
+    } else if (arg == "--poll-hz") {
+      opts.poll_hz = value();
+    } else if (arg == "--width") {
+      opts.width = static_cast<int>(value());
+    } else if (arg == "--height") {
+      opts.height = static_cast<int>(value());
+    } else if (arg == "--faces") {
+      opts.faces = static_cast<int>(value());
+    } else if (arg == "--detect-cost-us") {
+      opts.detect_cost = static_cast<int>(value());
+    } else if (arg == "--embed-cost-us") {
+      opts.embed_cost = static_cast<int>(value());
+    } else {
+      std::cerr << "usage: faces_e2e [--seconds S] [--fps F] [--poll-hz H] [--width W] [--height H] [--faces N]"
+                   " [--detect-cost-us US] [--embed-cost-us US] [--notify] [--shm]\n"
+                   "  an fps or poll rate of zero means as fast as possible\n"
+                   "  --notify polls when the event fd says so instead of on a timer\n"
+                   "  --shm sends frames through a shared memory frame ring\n";
+      std::exit(2);
+    }
+  }
+
+  return opts;
+}
+
+/** Get a percentile of some sorted samples. */
+double percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+
+  auto index = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  auto opts = parse(argc, argv);
+
+  // The push time of each frame, indexed by frame tag
+  // This is sized for the whole run so tags never wrap
+  auto max_frames = static_cast<std::size_t>(opts.fps > 0 ? opts.seconds * opts.fps * 2 + 16 : 1u << 24u);
+  std::vector<std::atomic<std::int64_t>> push_times(max_frames);
+
+  caches::BasicCache cache(1024);
+  BenchSource source;
+
+  // The frame ring is private to this run
+  std::string ring_name = "/faces_e2e." + std::to_string(getpid());
+  std::unique_ptr<sources::ShmProducer> ring_producer;
+  std::unique_ptr<sources::ShmSource> ring_source;
+  if (opts.shm) {
+    auto slot_size = static_cast<std::size_t>(opts.width) * opts.height * 3;
+    ring_producer = std::make_unique<sources::ShmProducer>(ring_name, 4, slot_size, 1.0);
+    ring_source = std::make_unique<sources::ShmSource>(ring_name, 4, slot_size, 1.0);
+    shm_unlink(ring_name.c_str());
+  }
+
+  Recognizer rec(Recognizer::Backend::SYNTHETIC);
+  rec.configure_synthetic(opts.faces, opts.detect_cost, opts.embed_cost);
+  rec.set_cache(&cache);
+  if (ring_source) {
+    rec.set_source(ring_source.get());
+  } else {
+    rec.set_source(&source);
+  }
+
+  // Event accounting (only touched on this thread, from inside poll)
+  std::uint64_t events = 0;
+  std::int64_t last_tag = -1;
+  std::vector<double> latencies;
+
+  // Work out frame latency from the frame tag the synthetic detector puts in x
+  auto on_frame_event = [&](int tag) {
+    ++events;
+
+    // The first event from a newer frame marks that frame delivered
+    if (tag > last_tag && static_cast<std::size_t>(tag) < push_times.size()) {
+      last_tag = tag;
+
+      auto pushed = push_times[tag].load(std::memory_order_acquire);
+      auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+      latencies.push_back((now - pushed) / 1e3);
+    }
+  };
+
+  rec.register_face_appear([&](Recognizer&, int, std::tuple<int, int, int, int> rect, Encoding&) {
+    on_frame_event(std::get<0>(rect));
+  });
+  rec.register_face_disappear([&](Recognizer&, int) {
+    ++events;
+  });
+  rec.register_face_move([&](Recognizer&, int, std::tuple<int, int, int, int> rect) {
+    on_frame_event(std::get<0>(rect));
+  });
+
+  rec.start();
+
+  auto begin = Clock::now();
+  auto end = begin + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opts.seconds));
+
+  // Push frames from another thread, like the Cozmo SDK would
+  std::atomic<std::uint64_t> frames_pushed(0);
+  std::thread producer([&]() {
+    auto period = opts.fps > 0 ? std::chrono::duration<double>(1.0 / opts.fps) : std::chrono::duration<double>(0);
+    auto next = Clock::now();
+
+    for (std::uint32_t tag = 0; tag < push_times.size() && Clock::now() < end; ++tag) {
+      Image image;
+      image.width = opts.width;
+      image.height = opts.height;
+      image.data.resize(static_cast<std::size_t>(opts.width) * opts.height * 3);
+      std::memcpy(image.data.data(), &tag, sizeof(tag));
+
+      push_times[tag].store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+          Clock::now().time_since_epoch()).count(), std::memory_order_release);
+      if (ring_producer) {
+        ring_producer->push(image);
+      } else {
+        source.push(std::move(image));
+      }
+      frames_pushed.fetch_add(1, std::memory_order_relaxed);
+
+      if (opts.fps > 0) {
+        next += std::chrono::duration_cast<Clock::duration>(period);
+        std::this_thread::sleep_until(next);
+      }
+    }
+  });
+
+  // Poll for events on this thread, like the Python event loop would
+  auto poll_period = opts.poll_hz > 0 ? std::chrono::duration<double>(1.0 / opts.poll_hz)
+                                      : std::chrono::duration<double>(0);
+  auto next_poll = Clock::now();
+  while (Clock::now() < end) {
+    // Sleep until events are pending, like an asyncio reader would
+    if (opts.notify) {
+      pollfd pfd {rec.get_event_fd(), POLLIN, 0};
+      ::poll(&pfd, 1, 100);
+      rec.poll();
+      continue;
+    }
+
+    rec.poll();
+
+    if (opts.poll_hz > 0) {
+      next_poll += std::chrono::duration_cast<Clock::duration>(poll_period);
+      std::this_thread::sleep_until(next_poll);
+    }
+  }
+
+  producer.join();
+  rec.stop();
+  rec.poll();
+
+  auto elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+  auto stats = rec.get_stats();
+
+  // Throughput comes from the recognizer's own count, as the latency samples only cover frames seen by a poll
+  auto frames_processed = static_cast<double>(stats.frames);
+  std::sort(latencies.begin(), latencies.end());
+
+  std::cout << "{\"seconds\":" << elapsed
+            << ",\"faces\":" << opts.faces
+            << ",\"detect_cost_us\":" << opts.detect_cost
+            << ",\"embed_cost_us\":" << opts.embed_cost
+            << ",\"width\":" << opts.width
+            << ",\"height\":" << opts.height
+            << ",\"notify\":" << (opts.notify ? "true" : "false")
+            << ",\"shm\":" << (opts.shm ? "true" : "false")
+            << ",\"frames_pushed\":" << frames_pushed.load()
+            << ",\"frames_processed\":" << stats.frames
+            << ",\"frames_gated\":" << stats.frames_gated
+            << ",\"frames_per_sec\":" << frames_processed / elapsed
+            << ",\"events\":" << events
+            << ",\"events_per_sec\":" << static_cast<double>(events) / elapsed
+            << ",\"moves_coalesced\":" << stats.moves_coalesced
+            << ",\"latency_samples\":" << latencies.size()
+            << ",\"latency_p50_us\":" << percentile(latencies, 0.50)
+            << ",\"latency_p99_us\":" << percentile(latencies, 0.99)
+            << ",\"latency_max_us\":" << (latencies.empty() ? 0 : latencies.back())
+            << "}\n";
+
+  return 0;
+}
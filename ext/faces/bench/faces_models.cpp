@@ -0,0 +1,162 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <faces/recognizer.h>
+#include <faces/source.h>
+#include <faces/caches/basic_cache.h>
+
+using namespace faces;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/** A source that always has the same frame ready, so the recognizer never waits on frames. */
+class LoopSource : public Source {
+  /** The frame. */
+  Image m_image;
+
+public:
+  explicit LoopSource(Image p_image) : m_image(std::move(p_image)) {
+  }
+
+  void update(const pybind11::object&) final {
+    throw std::runtime_error("loop source has a fixed frame");
+  }
+
+  std::optional<Image> wait(unsigned long) final {
+    return m_image;
+  }
+};
+
+/** The options of a run. */
+struct Options {
+  double seconds = 10;
+  int recognizers = 2;
+  int max_drivers = 0;
+  int width = 320;
+  int height = 240;
+};
+
+Options parse(int argc, char* argv[]) {
+  Options opts;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> double {
+      if (i + 1 >= argc) {
+        std::cerr << "missing value for " << arg << "\n";
+        std::exit(2);
+      }
+      return std::stod(argv[++i]);
+    };
+
+    if (arg == "--seconds") {
+      opts.seconds = value();
+    } else if (arg == "--recognizers") {
+      opts.recognizers = static_cast<int>(value());
+    } else if (arg == "--max-drivers") {
+      opts.max_drivers = static_cast<int>(value());
+    } else if (arg == "--width") {
+      opts.width = static_cast<int>(value());
+    } else if (arg == "--height") {
+      opts.height = static_cast<int>(value());
+    } else {
+      std::cerr << "usage: faces_models [--seconds S] [--recognizers N] [--max-drivers M] [--width W] [--height H]\n"
+                   "  runs N dlib recognizers at once on the shared models, each as fast as it can\n"
+                   "  compare the total frame rate across N to see how well the models scale\n"
+                   "  --max-drivers caps the sets of models they share (default: the library's)\n";
+      std::exit(2);
+    }
+  }
+
+  if (opts.recognizers < 1) {
+    std::cerr << "need at least one recognizer\n";
+    std::exit(2);
+  }
+  if (opts.max_drivers < 0) {
+    std::cerr << "need at least one set of models\n";
+    std::exit(2);
+  }
+
+  return opts;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  auto opts = parse(argc, argv);
+
+  if (opts.max_drivers) {
+    Recognizer::set_max_drivers(opts.max_drivers);
+  }
+
+  // Noise costs the detector as much as a photo does, as it scans the whole frame either way
+  Image image;
+  image.width = opts.width;
+  image.height = opts.height;
+  image.data.resize(static_cast<std::size_t>(opts.width) * opts.height * 3);
+  std::mt19937 rng(1);
+  for (auto& byte : image.data) {
+    byte = static_cast<char>(rng());
+  }
+
+  caches::BasicCache cache(1024);
+
+  std::vector<std::unique_ptr<LoopSource>> sources;
+  std::vector<std::unique_ptr<Recognizer>> recs;
+  for (int i = 0; i < opts.recognizers; ++i) {
+    sources.push_back(std::make_unique<LoopSource>(image));
+    recs.push_back(std::make_unique<Recognizer>(Recognizer::Backend::DLIB));
+    recs.back()->set_cache(&cache);
+    recs.back()->set_source(sources.back().get());
+  }
+
+  // Loading is not what is being measured
+  recs.front()->get_ready().get();
+
+  for (auto& rec : recs) {
+    rec->start();
+  }
+
+  auto begin = Clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(opts.seconds));
+
+  std::vector<unsigned long long> frames;
+  for (auto& rec : recs) {
+    rec->stop();
+    frames.push_back(rec->get_stats().frames);
+  }
+
+  auto elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+
+  unsigned long long total = 0;
+  std::cout << "{\"seconds\":" << elapsed
+            << ",\"recognizers\":" << opts.recognizers
+            << ",\"max_drivers\":" << Recognizer::get_max_drivers()
+            << ",\"width\":" << opts.width
+            << ",\"height\":" << opts.height
+            << ",\"cpus\":" << std::thread::hardware_concurrency()
+            << ",\"frames_per_sec_each\":[";
+  for (std::size_t i = 0; i < frames.size(); ++i) {
+    total += frames[i];
+    std::cout << (i ? "," : "") << static_cast<double>(frames[i]) / elapsed;
+  }
+  std::cout << "],\"frames_per_sec\":" << static_cast<double>(total) / elapsed << "}\n";
+
+  return 0;
+}
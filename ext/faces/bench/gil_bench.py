@@ -0,0 +1,139 @@
+#!/usr/bin/env python
+
+#
+# Cozmonaut
+# Copyright (c) 2019 The Cozmonaut Contributors
+#
+# InsertLicenseText
+#
+
+"""
+Multi-threaded benchmark of the faces bindings.
+
+Each thread plays one robot. The "query" scenario scans a shared face cache as fast as it can, and the "robots"
+scenario runs a synthetic recognizer per thread, feeding it frames and polling it like TaskRun does. If the bindings
+hold the GIL while they work or wait, total throughput stays flat as threads are added. If they let go of it, it grows
+with the thread count (up to the number of cores).
+
+Usage: python gil_bench.py [--threads 1,2,4] [--seconds S] [--gallery N] [--detect-cost-us US]
+
+Run it with the built faces module on the path. Results are printed as JSON. To see what releasing the GIL buys, run
+it against a build with and without the release and compare. Either way, it takes at least as many cores as the largest
+thread count, as on fewer cores, the threads serialize on the CPU whether or not they hold the GIL.
+"""
+
+import argparse
+import json
+import random
+import select
+import threading
+import time
+
+import faces
+
+
+def random_encoding(rng):
+    enc = faces.Encoding()
+    enc.vector = [rng.gauss(0, 0.1) for _ in range(128)]
+    return enc
+
+
+def run_threads(count, seconds, body):
+    """Run body(index, deadline) on some threads and return the sum of what they return."""
+
+    results = [0] * count
+    deadline = time.monotonic() + seconds
+
+    def target(index):
+        results[index] = body(index, deadline)
+
+    threads = [threading.Thread(target=target, args=(i,)) for i in range(count)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    return sum(results)
+
+
+def bench_query(count, seconds, gallery):
+    rng = random.Random(1)
+
+    cache = faces.caches.BasicCache()
+    for fid in range(1, gallery + 1):
+        cache.insert(fid, random_encoding(rng))
+
+    # A face that matches nothing, so every query scans the whole gallery
+    probe = random_encoding(rng)
+
+    def body(index, deadline):
+        queries = 0
+        while time.monotonic() < deadline:
+            cache.query(probe, 1e-9)
+            queries += 1
+        return queries
+
+    return run_threads(count, seconds, body) / seconds
+
+
+def bench_robots(count, seconds, detect_cost):
+    def body(index, deadline):
+        # Hold on to the cache and source, as the recognizer only points at them
+        cache = faces.caches.BasicCache()
+        source = faces.sources.PILSource()
+
+        rec = faces.Recognizer(faces.Recognizer.Backend.SYNTHETIC)
+        rec.configure_synthetic(2, detect_cost, 0)
+        rec.cache = cache
+        rec.source = source
+        rec.stream = index
+
+        frames = []
+        rec.register_face_move(lambda r, fid, rect: frames.append(rect[0]))
+        rec.start()
+
+        # Feed frames at 30 fps and handle events as they come in
+        frame = bytearray(320 * 240 * 3)
+        tag = 0
+        next_frame = time.monotonic()
+        while time.monotonic() < deadline:
+            now = time.monotonic()
+            if now >= next_frame:
+                frame[0:4] = tag.to_bytes(4, 'little')
+                source.update(memoryview(bytes(frame)).cast('B', (240, 320, 3)))
+                tag += 1
+                next_frame += 1 / 30
+
+            select.select([rec.event_fd], [], [], max(0.0, next_frame - time.monotonic()))
+            rec.poll()
+
+        rec.stop()
+        rec.poll()
+
+        # Count frames that made it through
+        return len(set(frames))
+
+    return run_threads(count, seconds, body) / seconds
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Multi-threaded benchmark of the faces bindings')
+    parser.add_argument('--threads', default='1,2,4', help='comma-separated thread counts')
+    parser.add_argument('--seconds', type=float, default=3, help='time per run')
+    parser.add_argument('--gallery', type=int, default=10000, help='faces in the query cache')
+    parser.add_argument('--detect-cost-us', type=int, default=20000, help='synthetic detection cost per frame')
+    args = parser.parse_args()
+
+    results = []
+    for count in [int(x) for x in args.threads.split(',')]:
+        results.append({
+            'threads': count,
+            'queries_per_sec': bench_query(count, args.seconds, args.gallery),
+            'robot_frames_per_sec': bench_robots(count, args.seconds, args.detect_cost_us),
+        })
+
+    print(json.dumps({'gallery': args.gallery, 'detect_cost_us': args.detect_cost_us, 'results': results}, indent=1))
+
+
+if __name__ == '__main__':
+    main()
@@ -8,14 +8,49 @@
 #ifndef FACES_CACHE_H
 #define FACES_CACHE_H
 
+#include <cstdint>
+#include <map>
+#include <vector>
+
 #include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
 
-namespace faces {
+#include <faces/encoding.h>
 
-class Encoding;
+namespace faces {
 
-/** An abstract face cache. */
+/**
+ * An abstract face cache. Every change to a cache bumps its epoch and is
+ * recorded in a journal, so users (like the recognizer) can catch up on what
+ * changed instead of starting over.
+ */
 struct Cache {
+  /** A change to a cache. */
+  struct Change {
+    /** The kinds of changes. */
+    enum class Kind {
+      /** A face was inserted (known or unknown). */
+      INSERT,
+
+      /** A face was removed. */
+      REMOVE,
+
+      /** A face was renamed. */
+      RENAME,
+    };
+
+    /** The kind of change. */
+    Kind kind;
+
+    /** The face ID (the old one, for renames). */
+    int id;
+
+    /** The new face ID, for renames. */
+    int id_new;
+  };
+
+  virtual ~Cache() = default;
+
   /**
    * Map a new known face into the cache.
    *
@@ -24,6 +59,16 @@ struct Cache {
    */
   virtual void insert(int id, const Encoding& face) = 0;
 
+  /**
+   * Add another prototype encoding to a face in the cache. A face matches a
+   * query if any of its prototypes does, so this is how to give one face
+   * several photos (like from different angles).
+   *
+   * @param id The face ID
+   * @param face The face encoding
+   */
+  virtual void insert_prototype(int id, const Encoding& face) = 0;
+
   /**
    * Map a new unknown face into the cache. An ID will be assigned to the face
    * at the cache's sole discretion.
@@ -49,7 +94,10 @@ struct Cache {
   virtual void rename(int id_old, int id_new) = 0;
 
   /**
-   * Retrieve a face from the cache.
+   * Retrieve a face from the cache. For faces with several prototype
+   * encodings, this is the first one. Caches may be used from several threads
+   * at once, so the returned reference may be to a per-thread copy. It stays
+   * valid until the next retrieval on the same thread.
    *
    * @param id The face ID
    * @return The face encoding
@@ -65,6 +113,44 @@ struct Cache {
    */
   virtual int query(const Encoding& face, double tol) const = 0;
 
+  /**
+   * Mark faces as still in use, as if they had just been matched. Faces that
+   * stay in view are followed without being queried again, so this is how
+   * their users keep them from looking forgotten. Caches that never forget
+   * faces need not do anything. IDs not in the cache are skipped.
+   *
+   * @param ids The face IDs
+   */
+  virtual void touch(const std::vector<int>& ids) const;
+
+  /**
+   * Merge unknown faces that are likely the same person. The same person
+   * walking by a few times tends to pile up as several unknown faces, so this
+   * clusters them (two faces are neighbors if they would match each other at
+   * the tolerance) and folds each cluster into one face. The merged faces
+   * become prototypes of the one that is kept, and are recorded as renamed to
+   * it.
+   *
+   * @param tol The tolerance
+   * @return The old face ID to new face ID of every merged face
+   */
+  virtual std::map<int, int> consolidate_unknowns(double tol) = 0;
+
+  /**
+   * @return The current epoch. This goes up by one with every change.
+   */
+  virtual std::uint64_t get_epoch() const = 0;
+
+  /**
+   * Get all changes made after an epoch. Caches only remember so many
+   * changes, so this can fail for old epochs.
+   *
+   * @param since The epoch
+   * @param changes The changes, oldest first (appended to)
+   * @return True on success, otherwise false if the changes are forgotten
+   */
+  virtual bool get_changes(std::uint64_t since, std::vector<Change>& changes) const = 0;
+
 protected:
   /**
    * Validate a user-given face ID.
@@ -80,22 +166,36 @@ template<class Module>
 void bind(Module&& m) {
   namespace py = pybind11;
 
+  // None of these need Python, and the recognition thread may be holding the cache
+  // So other Python threads get to run while we wait on it or scan it
+  using release = py::call_guard<py::gil_scoped_release>;
+
   py::class_<Cache>(m, "Cache")
       .def("insert", [](Cache& self, int id, const Encoding& face) {
         return self.insert(id, face);
-      })
+      }, release())
+      .def("insert_prototype", [](Cache& self, int id, const Encoding& face) {
+        return self.insert_prototype(id, face);
+      }, release())
       .def("remove", [](Cache& self, int id) {
         return self.remove(id);
-      })
+      }, release())
       .def("rename", [](Cache& self, int id_old, int id_new) {
         return self.rename(id_old, id_new);
-      })
+      }, release())
       .def("retrieve", [](Cache& self, int id) {
         return self.retrieve(id);
-      })
+      }, release())
       .def("query", [](Cache& self, const Encoding& face, double tol) {
         return self.query(face, tol);
-      });
+      }, release())
+      .def("touch", [](Cache& self, const std::vector<int>& ids) {
+        return self.touch(ids);
+      }, release(), py::arg("ids"))
+      .def("consolidate_unknowns", [](Cache& self, double tol) {
+        return self.consolidate_unknowns(tol);
+      }, release(), py::arg("tol"))
+      .def_property_readonly("epoch", &Cache::get_epoch);
 }
 
 } // namespace cache
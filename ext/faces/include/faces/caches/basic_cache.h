@@ -8,7 +8,10 @@
 #ifndef FACES_CACHES_BASIC_CACHE_H
 #define FACES_CACHES_BASIC_CACHE_H
 
+#include <cstddef>
+#include <functional>
 #include <memory>
+#include <pybind11/functional.h>
 #include <pybind11/pybind11.h>
 #include <faces/cache.h>
 
@@ -18,14 +21,57 @@ namespace caches {
 struct BasicCacheImpl;
 
 /**
- * A basic face cache.
+ * A basic face cache. Each face keeps the centroid of its prototype encodings
+ * and their distance from it, so queries can rule out whole faces at once.
+ * Unknown faces (the ones with negative IDs) can be kept
+ * in check with a capacity and a time to live, past which the least recently
+ * matched of them get evicted. Known faces are never evicted.
  */
 class BasicCache : public Cache {
+public:
+  /** The reasons for evicting an unknown face. */
+  enum class Eviction {
+    /** The unknown faces were at capacity, and this one was matched least recently. */
+    CAPACITY,
+
+    /** The face was not matched within its time to live. */
+    EXPIRED,
+  };
+
+  /**
+   * A callback for evictions.
+   *
+   * @param id The evicted face ID
+   * @param reason The reason for eviction
+   */
+  using CbEvict = std::function<void(int id, Eviction reason)>;
+
+  /** Cache counters. The eviction counts only ever count up. */
+  struct Stats {
+    /** The number of known faces. */
+    std::size_t known = 0;
+
+    /** The number of unknown faces. */
+    std::size_t unknown = 0;
+
+    /** The number of unknown faces evicted for capacity. */
+    unsigned long long evicted_capacity = 0;
+
+    /** The number of unknown faces evicted for age. */
+    unsigned long long evicted_expired = 0;
+  };
+
+private:
   /** PImpl. */
   std::unique_ptr<BasicCacheImpl> impl;
 
 public:
-  BasicCache();
+  /**
+   * Create an empty cache.
+   *
+   * @param journal_size The most recent changes to remember for get_changes()
+   */
+  explicit BasicCache(std::size_t journal_size);
 
   BasicCache(const BasicCache& rhs) = delete;
 
@@ -39,6 +85,8 @@ public:
 
   void insert(int id, const Encoding& face) final;
 
+  void insert_prototype(int id, const Encoding& face) final;
+
   int insert_unknown(const Encoding& face) final;
 
   void remove(int id) final;
@@ -48,6 +96,65 @@ public:
   const Encoding& retrieve(int id) const final;
 
   int query(const Encoding& face, double tol) const final;
+
+  void touch(const std::vector<int>& ids) const final;
+
+  std::map<int, int> consolidate_unknowns(double tol) final;
+
+  std::uint64_t get_epoch() const final;
+
+  bool get_changes(std::uint64_t since, std::vector<Change>& changes) const final;
+
+  /**
+   * @return The maximum number of unknown faces, or zero for no limit
+   */
+  std::size_t get_unknown_capacity() const;
+
+  /**
+   * Set the maximum number of unknown faces. If there are too many already,
+   * the least recently matched ones are evicted right away.
+   *
+   * @param p_unknown_capacity The maximum number of unknown faces, or zero for no limit
+   */
+  void set_unknown_capacity(std::size_t p_unknown_capacity);
+
+  /**
+   * @return The time to live of unknown faces in seconds, or zero for forever
+   */
+  double get_unknown_ttl() const;
+
+  /**
+   * Set the time to live of unknown faces. An unknown face that has not been
+   * matched within this long is evicted on the next expire() or insertion of
+   * an unknown face.
+   *
+   * @param p_unknown_ttl The time to live in seconds, or zero for forever
+   */
+  void set_unknown_ttl(double p_unknown_ttl);
+
+  /**
+   * Evict all unknown faces past their time to live.
+   *
+   * @return The number of faces evicted
+   */
+  std::size_t expire();
+
+  /**
+   * @return A snapshot of the cache counters
+   */
+  Stats get_stats() const;
+
+  /**
+   * Register a callback for evictions. Evictions can happen on any thread
+   * (like the recognition thread), so callbacks are not called right away.
+   * They are called from poll() instead.
+   *
+   * @param cb The callback
+   */
+  void register_evict(CbEvict cb);
+
+  /** Poll for eviction callbacks. */
+  void poll();
 };
 
 namespace basic_cache {
@@ -56,8 +163,31 @@ template<class Module>
 void bind(Module&& m) {
   namespace py = pybind11;
 
-  py::class_<BasicCache, Cache>(m, "BasicCache")
-      .def(py::init<>());
+  using release = py::call_guard<py::gil_scoped_release>;
+  auto released = [](auto f) {
+    return py::cpp_function(f, release());
+  };
+
+  py::class_<BasicCache, Cache> cls(m, "BasicCache");
+
+  py::enum_<BasicCache::Eviction>(cls, "Eviction")
+      .value("CAPACITY", BasicCache::Eviction::CAPACITY)
+      .value("EXPIRED", BasicCache::Eviction::EXPIRED);
+
+  py::class_<BasicCache::Stats>(cls, "Stats")
+      .def_readonly("known", &BasicCache::Stats::known)
+      .def_readonly("unknown", &BasicCache::Stats::unknown)
+      .def_readonly("evicted_capacity", &BasicCache::Stats::evicted_capacity)
+      .def_readonly("evicted_expired", &BasicCache::Stats::evicted_expired);
+
+  cls.def(py::init<std::size_t>(), py::arg("journal_size") = 1024)
+      .def_property("unknown_capacity", released(&BasicCache::get_unknown_capacity),
+          released(&BasicCache::set_unknown_capacity))
+      .def_property("unknown_ttl", released(&BasicCache::get_unknown_ttl), released(&BasicCache::set_unknown_ttl))
+      .def_property_readonly("stats", released(&BasicCache::get_stats))
+      .def("expire", &BasicCache::expire, release())
+      .def("register_evict", &BasicCache::register_evict)
+      .def("poll", &BasicCache::poll);
 }
 
 } // namespace basic_cache
@@ -0,0 +1,152 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef FACES_CACHES_SHARED_CACHE_H
+#define FACES_CACHES_SHARED_CACHE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <pybind11/pybind11.h>
+#include <faces/cache.h>
+
+namespace faces {
+namespace caches {
+
+struct SharedCacheImpl;
+
+/**
+ * A face cache in POSIX shared memory. Every process that opens a shared cache
+ * by the same name sees the same faces, so faces learned by one recognizer
+ * process are matched by all the others right away.
+ *
+ * Changes are serialized by a process-shared mutex. Queries take no lock at
+ * all. They read under a sequence counter and start over if a change raced
+ * with them, so changes should be rare next to queries (as they are). The
+ * mutex survives the death of its holder. If a process dies in the middle of
+ * a change, the next change or stuck query repairs the cache: faces left
+ * twice or with a bogus ID are dropped, and counts are brought back in range.
+ * The change itself may be lost, and followers of the journal are made to
+ * look up all their faces again.
+ *
+ * The segment holds a fixed number of faces, each with a fixed number of
+ * prototype encodings, and remembers a fixed number of changes. Whoever
+ * creates the segment picks these, and everybody opening it goes by them.
+ * Unknown faces are not evicted, so a full cache turns away new faces until
+ * some are removed.
+ */
+class SharedCache : public Cache {
+  /** PImpl. */
+  std::unique_ptr<SharedCacheImpl> impl;
+
+public:
+  /**
+   * Open a shared cache, creating it if it does not exist yet.
+   *
+   * @param name The segment name (like "/cozmonaut-faces")
+   * @param capacity The maximum number of faces (only used if creating)
+   * @param journal_size The number of changes remembered for recognizers catching up (only used if creating)
+   * @param max_prototypes The maximum number of prototype encodings per face (only used if creating)
+   * @param timeout How long to wait in seconds for another process to finish creating the cache
+   */
+  SharedCache(const std::string& name, std::size_t capacity, std::size_t journal_size, std::size_t max_prototypes,
+      double timeout);
+
+  SharedCache(const SharedCache& rhs) = delete;
+
+  SharedCache(SharedCache&& rhs) = delete;
+
+  ~SharedCache();
+
+  SharedCache& operator=(const SharedCache& rhs) = delete;
+
+  SharedCache& operator=(SharedCache&& rhs) = delete;
+
+  void insert(int id, const Encoding& face) final;
+
+  void insert_prototype(int id, const Encoding& face) final;
+
+  int insert_unknown(const Encoding& face) final;
+
+  void remove(int id) final;
+
+  void rename(int id_old, int id_new) final;
+
+  const Encoding& retrieve(int id) const final;
+
+  int query(const Encoding& face, double tol) const final;
+
+  std::map<int, int> consolidate_unknowns(double tol) final;
+
+  std::uint64_t get_epoch() const final;
+
+  bool get_changes(std::uint64_t since, std::vector<Change>& changes) const final;
+
+  /**
+   * @return The segment name
+   */
+  std::string get_name() const;
+
+  /**
+   * @return The maximum number of faces
+   */
+  std::size_t get_capacity() const;
+
+  /**
+   * @return The number of changes remembered
+   */
+  std::size_t get_journal_size() const;
+
+  /**
+   * @return The maximum number of prototype encodings per face
+   */
+  std::size_t get_max_prototypes() const;
+
+  /**
+   * @return The number of faces
+   */
+  std::size_t get_size() const;
+
+  /**
+   * Remove a shared cache name from the system. Processes that have it open
+   * keep using it, but the next one to open the name gets a new, empty cache.
+   *
+   * @param name The segment name
+   * @return True on success, otherwise false if there was no such cache
+   */
+  static bool unlink(const std::string& name);
+};
+
+namespace shared_cache {
+
+template<class Module>
+void bind(Module&& m) {
+  namespace py = pybind11;
+
+  using release = py::call_guard<py::gil_scoped_release>;
+  auto released = [](auto f) {
+    return py::cpp_function(f, release());
+  };
+
+  // Opening may wait briefly on another process to finish setting up the segment
+  py::class_<SharedCache, Cache>(m, "SharedCache")
+      .def(py::init<const std::string&, std::size_t, std::size_t, std::size_t, double>(), py::arg("name"),
+          py::arg("capacity") = 1024, py::arg("journal_size") = 1024, py::arg("max_prototypes") = 8,
+          py::arg("timeout") = 1.0, release())
+      .def_property_readonly("name", &SharedCache::get_name)
+      .def_property_readonly("capacity", &SharedCache::get_capacity)
+      .def_property_readonly("journal_size", &SharedCache::get_journal_size)
+      .def_property_readonly("max_prototypes", &SharedCache::get_max_prototypes)
+      .def_property_readonly("size", released(&SharedCache::get_size))
+      .def_static("unlink", &SharedCache::unlink);
+}
+
+} // namespace shared_cache
+} // namespace caches
+} // namespace faces
+
+#endif // #ifndef FACES_CACHES_SHARED_CACHE_H
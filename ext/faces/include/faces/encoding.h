@@ -9,34 +9,118 @@
 #define FACES_ENCODING_H
 
 #include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
 
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
 namespace faces {
 
-/** A face encoding. */
-class Encoding {
+namespace detail {
+
+/**
+ * Get the number of partial sums to keep for a distance kernel. Independent
+ * partial sums let the compiler vectorize the kernel and keep the additions
+ * from waiting on each other.
+ *
+ * @tparam N The dimension
+ * @return The number of partial sums
+ */
+template<std::size_t N>
+constexpr std::size_t distance_lanes() {
+  if constexpr (N % 8 == 0) {
+    return 8;
+  } else if constexpr (N % 4 == 0) {
+    return 4;
+  } else if constexpr (N % 2 == 0) {
+    return 2;
+  } else {
+    return 1;
+  }
+}
+
+/**
+ * Get the square of the distance between two face vectors. The loop is fully
+ * unrolled at compile time.
+ *
+ * @param a The first face vector
+ * @param b The second face vector
+ * @return The square of the distance
+ */
+template<class T, std::size_t N, std::size_t... I>
+inline double distance_sq(const std::array<T, N>& a, const std::array<T, N>& b, std::index_sequence<I...>) {
+  // Single precision vectors sum in single precision, which is plenty for distances this short
+  using sum_type = std::conditional_t<std::is_same_v<T, float>, float, double>;
+  constexpr auto lanes = distance_lanes<N>();
+
+  sum_type sums[lanes] {};
+  auto add = [&sums](std::size_t lane, sum_type diff) {
+    sums[lane] += diff * diff;
+  };
+  (add(I % lanes, static_cast<sum_type>(b[I]) - static_cast<sum_type>(a[I])), ...);
+
+  // Folding the lanes adds in a different order than one running sum would
+  // So results can differ from a plain loop in the last place
+  sum_type sum = 0;
+  for (auto partial : sums) {
+    sum += partial;
+  }
+  return static_cast<double>(sum);
+}
+
+} // namespace detail
+
+/**
+ * Get the square of the distance between two face vectors.
+ *
+ * @param a The first face vector
+ * @param b The second face vector
+ * @return The square of the distance
+ */
+template<class T, std::size_t N>
+inline double distance_sq(const std::array<T, N>& a, const std::array<T, N>& b) {
+  return detail::distance_sq(a, b, std::make_index_sequence<N>());
+}
+
+/**
+ * A face encoding.
+ *
+ * @tparam T The scalar type (float or double)
+ * @tparam N The dimension
+ */
+template<class T, std::size_t N>
+class BasicEncoding {
+  static_assert(std::is_floating_point_v<T>, "face vectors must be floating point");
+  static_assert(N > 0, "face vectors must not be empty");
+
 public:
+  /** The type of a face vector element. */
+  using scalar_type = T;
+
   /** The type of a face vector. */
-  using vector_type = std::array<double, 128>;
+  using vector_type = std::array<T, N>;
+
+  /** The dimension. */
+  static constexpr std::size_t dimension = N;
 
 private:
   /** The face vector. */
   vector_type m_vector;
 
 public:
-  Encoding();
+  BasicEncoding() = default;
 
-  Encoding(const Encoding& rhs);
+  BasicEncoding(const BasicEncoding& rhs) = default;
 
-  Encoding(Encoding&& rhs) noexcept;
+  BasicEncoding(BasicEncoding&& rhs) noexcept = default;
 
-  ~Encoding();
+  ~BasicEncoding() = default;
 
-  Encoding& operator=(const Encoding& rhs);
+  BasicEncoding& operator=(const BasicEncoding& rhs) = default;
 
-  Encoding& operator=(Encoding&& rhs) noexcept;
+  BasicEncoding& operator=(BasicEncoding&& rhs) noexcept = default;
 
   /**
    * @return The face vector
@@ -61,19 +145,45 @@ public:
    * @param rhs The other face encoding
    * @return The dissimilarity measure as specified
    */
-  double compare(const Encoding& rhs) const;
+  double compare(const BasicEncoding& rhs) const {
+    return distance_sq(m_vector, rhs.m_vector);
+  }
 };
 
+/**
+ * The face encoding the detection and embedding backends produce (dlib's 128-d
+ * doubles). The caches, the recognizer and the server all work in this one
+ * type, so it is the only one offered.
+ */
+using Encoding = BasicEncoding<double, 128>;
+
+// This is instantiated once, in encoding.cpp
+extern template class BasicEncoding<double, 128>;
+
 namespace encoding {
 
-template<class Module>
-void bind(Module&& m) {
+/**
+ * Bind one face encoding type.
+ *
+ * @param m The module
+ * @param name The Python class name
+ */
+template<class E, class Module>
+void bind_one(Module&& m, const char* name) {
   namespace py = pybind11;
 
-  py::class_<Encoding>(m, "Encoding")
+  py::class_<E>(m, name)
       .def(py::init<>())
-      .def_property("vector", &Encoding::get_vector, &Encoding::set_vector)
-      .def("compare", &Encoding::compare);
+      .def_property("vector", &E::get_vector, &E::set_vector)
+      .def("compare", &E::compare)
+      .def_property_readonly_static("dimension", [](py::object) {
+        return E::dimension;
+      });
+}
+
+template<class Module>
+void bind(Module&& m) {
+  bind_one<Encoding>(m, "Encoding");
 }
 
 } // namespace encoding
@@ -0,0 +1,105 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef FACES_ENROLL_H
+#define FACES_ENROLL_H
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <faces/cache.h>
+#include <faces/encoding.h>
+#include <faces/placement.h>
+#include <faces/preprocess.h>
+#include <faces/recognizer.h>
+#include <faces/source.h>
+
+namespace faces {
+
+/** Batch enrollment settings. */
+struct EnrollOptions {
+  /** The detection and embedding backend. */
+  Recognizer::Backend backend = Recognizer::Backend::DLIB;
+
+  /** The preprocessing settings. Photos are upscaled by default, which finds smaller faces. */
+  Preprocess preprocess {Preprocess::Resize::DOUBLE, false};
+
+  /**
+   * The memo file, or empty for none. It remembers the encoding of every photo
+   * by a hash of its pixels (and the settings above), so photos that haven't
+   * changed since last time are not encoded again.
+   */
+  std::string memo;
+
+  /** The number of worker threads, or zero for one per core. */
+  unsigned threads = 0;
+
+  /** The placement of the worker threads. */
+  Placement placement;
+};
+
+/**
+ * Encode the largest face in each of a batch of photos. The photos are spread
+ * across a pool of worker threads.
+ *
+ * @param images The photos
+ * @param options The settings
+ * @return The face encodings, in the same order (empty where no face was found)
+ */
+std::vector<std::optional<Encoding>> enroll_many(const std::vector<Image>& images, const EnrollOptions& options);
+
+/**
+ * Encode the largest face in each of a batch of Python photos and insert them
+ * into a cache. If an ID comes up more than once, the first photo with a face
+ * inserts it, and the rest add prototypes. The IDs must not be in the cache
+ * yet. The GIL must be held, but is released while encoding.
+ *
+ * @param images The photos (PIL images or image buffers)
+ * @param ids The face ID of each photo
+ * @param cache The cache, or null to only encode
+ * @param options The settings
+ * @return The face encodings, in the same order (None where no face was found)
+ */
+pybind11::list enroll_many(const pybind11::sequence& images, const std::vector<int>& ids, Cache* cache,
+    const EnrollOptions& options);
+
+namespace enroll {
+
+template<class Module>
+void bind(Module&& m) {
+  namespace py = pybind11;
+
+  m.def("enroll_many", [](const py::sequence& images, const std::vector<int>& ids, Cache* cache,
+      const std::optional<std::string>& memo, unsigned threads, Recognizer::Backend backend,
+      const std::optional<Preprocess>& preprocess, const std::optional<Placement>& placement) {
+    EnrollOptions options;
+    options.backend = backend;
+    options.threads = threads;
+    if (memo) {
+      options.memo = *memo;
+    }
+    if (preprocess) {
+      options.preprocess = *preprocess;
+    }
+    if (placement) {
+      options.placement = *placement;
+    }
+
+    return enroll_many(images, ids, cache, options);
+  }, py::arg("images"), py::arg("ids"), py::arg("cache") = static_cast<Cache*>(nullptr), py::arg("memo") = py::none(),
+      py::arg("threads") = 0, py::arg("backend") = Recognizer::Backend::DLIB, py::arg("preprocess") = py::none(),
+      py::arg("placement") = py::none());
+}
+
+} // namespace enroll
+} // namespace faces
+
+#endif // #ifndef FACES_ENROLL_H
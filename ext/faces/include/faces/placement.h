@@ -0,0 +1,94 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef FACES_PLACEMENT_H
+#define FACES_PLACEMENT_H
+
+#include <vector>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+namespace faces {
+
+/**
+ * Thread placement settings. These say which CPUs a thread runs on and how
+ * the kernel schedules it. By default, threads are left as they are started,
+ * and they compete with everything else in the process (like the Cozmo SDK's
+ * event loop) on equal terms. This is only supported on Linux.
+ */
+struct Placement {
+  /** The scheduling policies (see sched(7)). */
+  enum class Policy {
+    /** Keep the policy of the starting thread. The nice value and priority below are ignored. */
+    INHERIT,
+
+    /** Normal time sharing (SCHED_OTHER). */
+    OTHER,
+
+    /** Time sharing for CPU-bound work, which gets longer but fewer time slices (SCHED_BATCH). */
+    BATCH,
+
+    /** Only run when nothing else wants to (SCHED_IDLE). */
+    IDLE,
+
+    /** Real-time, first in first out (SCHED_FIFO). This takes CAP_SYS_NICE. */
+    FIFO,
+
+    /** Real-time, round robin (SCHED_RR). This takes CAP_SYS_NICE. */
+    RR,
+  };
+
+  /** The CPUs to run on, or empty to keep the affinity of the starting thread. */
+  std::vector<int> cpus;
+
+  /**
+   * Whether to reserve the CPUs above. Every other thread in the process is
+   * moved off of them, and threads started after that inherit their starter's
+   * affinity, so they stay off, too. Threads that would be left with nowhere to
+   * run are left alone. Reserved CPUs are not given back.
+   */
+  bool reserve = false;
+
+  /** The scheduling policy. */
+  Policy policy = Policy::INHERIT;
+
+  /** The nice value for the OTHER and BATCH policies, from -20 (most favored) to 19. Going below zero takes CAP_SYS_NICE. */
+  int nice = 0;
+
+  /** The priority for the FIFO and RR policies, from 1 to 99. */
+  int priority = 1;
+};
+
+namespace placement {
+
+template<class Module>
+void bind(Module&& m) {
+  namespace py = pybind11;
+
+  py::class_<Placement> cls(m, "Placement");
+
+  py::enum_<Placement::Policy>(cls, "Policy")
+      .value("INHERIT", Placement::Policy::INHERIT)
+      .value("OTHER", Placement::Policy::OTHER)
+      .value("BATCH", Placement::Policy::BATCH)
+      .value("IDLE", Placement::Policy::IDLE)
+      .value("FIFO", Placement::Policy::FIFO)
+      .value("RR", Placement::Policy::RR);
+
+  cls.def(py::init<>())
+      .def_readwrite("cpus", &Placement::cpus)
+      .def_readwrite("reserve", &Placement::reserve)
+      .def_readwrite("policy", &Placement::policy)
+      .def_readwrite("nice", &Placement::nice)
+      .def_readwrite("priority", &Placement::priority);
+}
+
+} // namespace placement
+} // namespace faces
+
+#endif // #ifndef FACES_PLACEMENT_H
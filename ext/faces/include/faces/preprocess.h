@@ -0,0 +1,63 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef FACES_PREPROCESS_H
+#define FACES_PREPROCESS_H
+
+#include <pybind11/pybind11.h>
+#include <faces/source.h>
+
+namespace faces {
+
+/**
+ * Image preprocessing settings. Frames go through these steps, in order,
+ * before detection: conversion to RGB (for frames in other formats), resizing,
+ * and denoising. Reported face rectangles are always in the coordinates of the
+ * original frame.
+ */
+struct Preprocess {
+  /** The resize steps. */
+  enum class Resize {
+    /** Leave the frame size alone. */
+    NONE,
+
+    /** Halve the frame size. This speeds up detection of large faces. */
+    HALF,
+
+    /** Double the frame size. This finds smaller faces (like dlib::pyramid_up). */
+    DOUBLE,
+  };
+
+  /** The resize step. */
+  Resize resize = Resize::NONE;
+
+  /** Whether to blur the frame to fight camera speckle (like dlib::gaussian_blur). */
+  bool blur = false;
+};
+
+namespace preprocess {
+
+template<class Module>
+void bind(Module&& m) {
+  namespace py = pybind11;
+
+  py::class_<Preprocess> cls(m, "Preprocess");
+
+  py::enum_<Preprocess::Resize>(cls, "Resize")
+      .value("NONE", Preprocess::Resize::NONE)
+      .value("HALF", Preprocess::Resize::HALF)
+      .value("DOUBLE", Preprocess::Resize::DOUBLE);
+
+  cls.def(py::init<>())
+      .def_readwrite("resize", &Preprocess::resize)
+      .def_readwrite("blur", &Preprocess::blur);
+}
+
+} // namespace preprocess
+} // namespace faces
+
+#endif // #ifndef FACES_PREPROCESS_H
@@ -8,18 +8,28 @@
 #ifndef FACES_RECOGNIZER_H
 #define FACES_RECOGNIZER_H
 
+#include <cstdint>
+#include <chrono>
 #include <functional>
+#include <future>
 #include <memory>
+#include <optional>
+#include <stdexcept>
 #include <tuple>
+#include <vector>
 
 #include <pybind11/functional.h>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
+#include <faces/encoding.h>
+#include <faces/placement.h>
+#include <faces/preprocess.h>
+
 namespace faces {
 
 struct Cache;
-struct Encoding;
 struct Source;
 
 struct RecognizerImpl;
@@ -33,6 +43,175 @@ struct RecognizerImpl;
  */
 class Recognizer {
 public:
+  /** The face detection and embedding backends. */
+  enum class Backend {
+    /** The dlib detector and embedder. These load model data files. */
+    DLIB,
+
+    /** Stand-in drivers with configurable cost. These need no model data. */
+    SYNTHETIC,
+  };
+
+  /**
+   * Adaptive sampling settings. With these, the recognizer drops to a slow
+   * probe rate when nobody has been in view for a while, and goes back to full
+   * rate as soon as a face turns up. While idle, it sleeps between frames
+   * instead of taking every frame the source offers.
+   */
+  struct Sampling {
+    /** Whether to adapt the frame rate to activity. Otherwise, every frame is recognized. */
+    bool adaptive = false;
+
+    /** The frame rate while faces are in view in frames per second, or zero for every frame. */
+    double active_rate = 0;
+
+    /** The frame rate while idle in frames per second. */
+    double idle_rate = 2;
+
+    /** How long no faces must be in view before going idle in seconds. */
+    double idle_after = 5;
+
+    /** How many probe frames in a row must have faces in view before waking up. */
+    int wake_frames = 1;
+  };
+
+  /**
+   * Scene gate settings. Each frame is boiled down to a small grayscale
+   * thumbnail, and frames whose thumbnail has not changed since the last frame
+   * that went through detection skip it.
+   */
+  struct SceneGating {
+    /** The scene change threshold (see set_scene_threshold()), or zero to detect faces in every frame. */
+    double threshold = 0;
+
+    /** The thumbnail width. Larger thumbnails notice smaller changes. */
+    int thumb_width = 32;
+
+    /** The thumbnail height. */
+    int thumb_height = 24;
+
+    /** The number of pixel rows sampled per row of thumbnail cells. More rows average out more sensor noise. */
+    int rows_per_cell = 4;
+
+    /** The number of frames that may skip detection in a row before one goes through regardless. */
+    int max_skipped = 30;
+  };
+
+  /** Recognizer counters. These only ever count up. */
+  struct Stats {
+    /** The number of face movement events enqueued. */
+    unsigned long long moves_enqueued = 0;
+
+    /**
+     * The number of face movement events dropped before delivery because a
+     * newer movement (or a disappearance) of the same face replaced them.
+     */
+    unsigned long long moves_coalesced = 0;
+
+    /** The number of unknown faces inserted into the cache. */
+    unsigned long long unknowns_inserted = 0;
+
+    /** The number of frames recognized. */
+    unsigned long long frames = 0;
+
+    /** The number of frames that skipped detection because the scene had not changed. */
+    unsigned long long frames_gated = 0;
+
+    /** The number of times adaptive sampling went idle. */
+    unsigned long long idle_entries = 0;
+
+    /**
+     * The number of times adaptive sampling woke up. If this is one less than
+     * the number of times it went idle, it is idle now.
+     */
+    unsigned long long idle_exits = 0;
+
+    /**
+     * Whether heap allocations are counted. This takes a debug build with the
+     * CMake option FACES_COUNT_ALLOCATIONS, and the counts below stay at zero
+     * without it.
+     */
+    bool allocations_counted = false;
+
+    /** The number of heap allocations made by the recognition thread while recognizing frames. */
+    unsigned long long frame_allocations = 0;
+
+    /**
+     * The number of frames during which the recognition thread allocated
+     * anything. Buffers grow over the first few frames and are reused from
+     * then on, so after that this should stay put.
+     */
+    unsigned long long allocating_frames = 0;
+  };
+
+  /** A face event record. The layout doubles as a NumPy structured dtype. */
+  struct Event {
+    /** The face ID. */
+    std::int32_t id;
+
+    /**
+     * The track ID. A track follows one face on camera and keeps its ID when
+     * the face ID changes (like when the face is renamed in the cache).
+     */
+    std::int32_t track;
+
+    /** The left edge of the face bounding rectangle. */
+    std::int32_t left;
+
+    /** The top edge of the face bounding rectangle. */
+    std::int32_t top;
+
+    /** The right edge of the face bounding rectangle. */
+    std::int32_t right;
+
+    /** The bottom edge of the face bounding rectangle. */
+    std::int32_t bottom;
+
+    /** The stream number of the recognizer. */
+    std::int32_t stream;
+
+    /** When the frame was received in nanoseconds on the steady clock. */
+    std::int64_t timestamp;
+
+    /**
+     * The sequence number. The events of a recognizer are numbered in the order
+     * they happen, over all three kinds, so the kinds can be taken apart and
+     * still be put back in order. A coalesced movement takes the number of the
+     * latest movement it stands for.
+     */
+    std::int64_t seq;
+  };
+
+  /**
+   * A batch of events taken all at once. Disappearances carry the rectangle
+   * of the last sighting.
+   */
+  struct EventBatch {
+    /** The face appearances. Each kind is kept apart, so merge by sequence number for the order across kinds. */
+    std::vector<Event> appear;
+
+    /** The face disappearances. */
+    std::vector<Event> disappear;
+
+    /** The face movements. */
+    std::vector<Event> move;
+
+    /** The face encodings of the appearances, in the same order. */
+    std::vector<Encoding> encodings;
+
+    /**
+     * @param index The appearance index
+     * @return The face encoding of the appearance
+     */
+    const Encoding& encoding(std::size_t index) const {
+      if (index >= encodings.size()) {
+        throw std::out_of_range("appearance index out of range");
+      }
+
+      return encodings[index];
+    }
+  };
+
   /**
    * A callback for face appearances.
    *
@@ -62,9 +241,13 @@ private:
   /** PImpl. */
   std::unique_ptr<RecognizerImpl> impl;
 
+  friend RecognizerImpl& get_impl(Recognizer& rec);
+
 public:
   Recognizer();
 
+  explicit Recognizer(Backend backend);
+
   Recognizer(const Recognizer& rhs) = delete;
 
   Recognizer(Recognizer&& rhs) = delete;
@@ -95,6 +278,123 @@ public:
    */
   void set_source(Source* p_source);
 
+  /**
+   * @return The preprocessing settings
+   */
+  Preprocess get_preprocess() const;
+
+  /**
+   * @param p_preprocess The preprocessing settings
+   */
+  void set_preprocess(const Preprocess& p_preprocess);
+
+  /**
+   * @return The placement of the continuous recognition thread
+   */
+  Placement get_placement() const;
+
+  /**
+   * Set the placement of the continuous recognition thread. This takes effect
+   * the next time recognition starts.
+   *
+   * @param p_placement The placement
+   */
+  void set_placement(const Placement& p_placement);
+
+  /**
+   * @return The adaptive sampling settings
+   */
+  Sampling get_sampling() const;
+
+  /**
+   * Set the adaptive sampling settings. If the recognizer is idle, this takes
+   * effect with the next probe frame.
+   *
+   * @param p_sampling The adaptive sampling settings
+   */
+  void set_sampling(const Sampling& p_sampling);
+
+  /**
+   * @return The scene gate settings
+   */
+  SceneGating get_scene_gating() const;
+
+  /**
+   * Set the scene gate settings. This throws if they make no sense.
+   *
+   * @param p_scene_gating The scene gate settings
+   */
+  void set_scene_gating(const SceneGating& p_scene_gating);
+
+  /**
+   * @return The scene change threshold
+   */
+  double get_scene_threshold() const;
+
+  /**
+   * Set the scene change threshold. Frames whose scene has not changed since
+   * the last frame that went through detection skip it, and the faces seen
+   * then carry over. The scene counts as changed once any patch of the frame
+   * changes in brightness by more than the threshold (out of 255). Something
+   * like 8 suits a robot sitting on its charger. Zero turns this off, which is
+   * the default.
+   *
+   * @param p_scene_threshold The scene change threshold
+   */
+  void set_scene_threshold(double p_scene_threshold);
+
+  /**
+   * Get a file descriptor that becomes readable whenever events are pending.
+   * It goes back to unreadable on the next poll. Hand it to an event loop (like
+   * asyncio's add_reader) instead of polling on a timer. The recognizer owns
+   * the descriptor, so do not close it.
+   *
+   * @return The file descriptor, or -1 if not supported
+   */
+  int get_event_fd() const;
+
+  /**
+   * Get a future that becomes ready when the models are loaded. The dlib
+   * models load in the background and are shared by all recognizers in the
+   * process, so only the first recognizer waits on them. Until then, frames
+   * are skipped. If loading failed, the future holds the error.
+   *
+   * @return The future
+   */
+  std::shared_future<void> get_ready() const;
+
+  /**
+   * @return The most sets of dlib models loaded at once in the process
+   */
+  static int get_max_drivers();
+
+  /**
+   * Set the most sets of dlib models loaded at once in the process. One set
+   * serves one recognizer at a time, so with more busy recognizers than sets,
+   * they take turns. Each set holds its own copy of the models, though, and
+   * extra sets only pay off with cores to spare. Extra sets are unloaded after
+   * sitting idle for a while. The default is two, or one on a single CPU.
+   * This throws if the cap is less than one.
+   *
+   * @param p_max_drivers The most sets of models
+   */
+  static void set_max_drivers(int p_max_drivers);
+
+  /**
+   * @return The stream number stamped on events
+   */
+  int get_stream() const;
+
+  /**
+   * @param p_stream The stream number stamped on events
+   */
+  void set_stream(int p_stream);
+
+  /**
+   * @return A snapshot of the recognizer counters
+   */
+  Stats get_stats() const;
+
   /**
    * Register a callback for face appearances.
    *
@@ -116,14 +416,55 @@ public:
    */
   void register_face_move(CbFaceMove cb);
 
-  /** Start continuous recognition. */
+  /**
+   * Configure the synthetic backend. Face i is reported at x = frame tag and
+   * y = i * 64, where the frame tag is the first four bytes of the frame.
+   *
+   * @param faces The number of faces to report per frame
+   * @param detect_cost The CPU time to spend detecting per frame in microseconds
+   * @param embed_cost The CPU time to spend embedding per face in microseconds
+   */
+  void configure_synthetic(int faces, int detect_cost, int embed_cost);
+
+  /** Start continuous recognition. This fails if the thread cannot be placed. */
   void start();
 
   /** Stop continuous recognition. */
   void stop();
 
-  /** Poll for event callbacks. */
+  /**
+   * Poll for event callbacks. Events are delivered in the order they happened.
+   * Movements are coalesced while they wait, so each face gets at most one
+   * movement per poll, carrying its latest position, and a face that
+   * disappeared gets no movement at all.
+   */
   void poll();
+
+  /**
+   * Take all pending events as a batch instead of calling callbacks. The same
+   * coalescing and ordering rules apply as for poll().
+   *
+   * @return The events
+   */
+  EventBatch poll_batch();
+
+  /**
+   * Take all pending events into a batch, replacing what was in it. The
+   * batch and the pending event queues trade memory, so a caller that polls
+   * into the same batch every time keeps both sides from allocating.
+   *
+   * @param batch The batch
+   */
+  void poll_batch(EventBatch& batch);
+
+  /**
+   * Send a batch of events to the registered callbacks in sequence order.
+   * Together with poll_batch(), this splits up poll() so the two halves can
+   * run under different locks.
+   *
+   * @param batch The events
+   */
+  void dispatch(EventBatch& batch);
 };
 
 namespace recognizer {
@@ -132,16 +473,116 @@ template<class Module>
 void bind(Module&& m) {
   namespace py = pybind11;
 
-  py::class_<Recognizer>(m, "Recognizer")
+  py::class_<Recognizer> cls(m, "Recognizer");
+
+  py::enum_<Recognizer::Backend>(cls, "Backend")
+      .value("DLIB", Recognizer::Backend::DLIB)
+      .value("SYNTHETIC", Recognizer::Backend::SYNTHETIC);
+
+  PYBIND11_NUMPY_DTYPE(Recognizer::Event, id, track, left, top, right, bottom, stream, timestamp, seq);
+
+  // The arrays point into the batch, which they keep alive, so nothing gets copied
+  auto events = [](std::vector<Recognizer::Event> Recognizer::EventBatch::* field) {
+    return [field](py::object self) {
+      auto& vec = self.cast<Recognizer::EventBatch&>().*field;
+      return py::array_t<Recognizer::Event>(static_cast<py::ssize_t>(vec.size()), vec.data(), self);
+    };
+  };
+
+  py::class_<Recognizer::EventBatch>(cls, "EventBatch")
+      .def_property_readonly("appear", events(&Recognizer::EventBatch::appear))
+      .def_property_readonly("disappear", events(&Recognizer::EventBatch::disappear))
+      .def_property_readonly("move", events(&Recognizer::EventBatch::move))
+      .def("encoding", &Recognizer::EventBatch::encoding, py::return_value_policy::reference_internal,
+          py::arg("index"));
+
+  py::class_<Recognizer::Sampling>(cls, "Sampling")
+      .def(py::init<>())
+      .def_readwrite("adaptive", &Recognizer::Sampling::adaptive)
+      .def_readwrite("active_rate", &Recognizer::Sampling::active_rate)
+      .def_readwrite("idle_rate", &Recognizer::Sampling::idle_rate)
+      .def_readwrite("idle_after", &Recognizer::Sampling::idle_after)
+      .def_readwrite("wake_frames", &Recognizer::Sampling::wake_frames);
+
+  py::class_<Recognizer::SceneGating>(cls, "SceneGating")
       .def(py::init<>())
-      .def_property("cache", &Recognizer::get_cache, &Recognizer::set_cache)
-      .def_property("source", &Recognizer::get_source, &Recognizer::set_source)
+      .def_readwrite("threshold", &Recognizer::SceneGating::threshold)
+      .def_readwrite("thumb_width", &Recognizer::SceneGating::thumb_width)
+      .def_readwrite("thumb_height", &Recognizer::SceneGating::thumb_height)
+      .def_readwrite("rows_per_cell", &Recognizer::SceneGating::rows_per_cell)
+      .def_readwrite("max_skipped", &Recognizer::SceneGating::max_skipped);
+
+  py::class_<Recognizer::Stats>(cls, "Stats")
+      .def_readonly("moves_enqueued", &Recognizer::Stats::moves_enqueued)
+      .def_readonly("moves_coalesced", &Recognizer::Stats::moves_coalesced)
+      .def_readonly("unknowns_inserted", &Recognizer::Stats::unknowns_inserted)
+      .def_readonly("frames", &Recognizer::Stats::frames)
+      .def_readonly("frames_gated", &Recognizer::Stats::frames_gated)
+      .def_readonly("idle_entries", &Recognizer::Stats::idle_entries)
+      .def_readonly("idle_exits", &Recognizer::Stats::idle_exits)
+      .def_readonly("allocations_counted", &Recognizer::Stats::allocations_counted)
+      .def_readonly("frame_allocations", &Recognizer::Stats::frame_allocations)
+      .def_readonly("allocating_frames", &Recognizer::Stats::allocating_frames);
+
+  // Everything that takes the interface mutex can wait out a whole frame of recognition
+  // Those drop the GIL, so other Python threads (like other robots) keep going
+  // Callbacks take the GIL back when called (pybind11 does this for std::function)
+  using release = py::call_guard<py::gil_scoped_release>;
+  auto released = [](auto f) {
+    return py::cpp_function(f, release());
+  };
+
+  cls.def(py::init<>())
+      .def(py::init<Recognizer::Backend>())
+      // The recognizer only points at its cache and source, so Python must not take them over, and must keep them around
+      .def_property("cache", py::cpp_function(&Recognizer::get_cache, release(), py::return_value_policy::reference),
+          py::cpp_function(&Recognizer::set_cache, release(), py::keep_alive<1, 2>()))
+      .def_property("source", py::cpp_function(&Recognizer::get_source, release(), py::return_value_policy::reference),
+          py::cpp_function(&Recognizer::set_source, release(), py::keep_alive<1, 2>()))
+      .def_property("preprocess", released(&Recognizer::get_preprocess), released(&Recognizer::set_preprocess))
+      .def_property("placement", released(&Recognizer::get_placement), released(&Recognizer::set_placement))
+      .def_property("sampling", released(&Recognizer::get_sampling), released(&Recognizer::set_sampling))
+      .def_property("scene_gating", released(&Recognizer::get_scene_gating), released(&Recognizer::set_scene_gating))
+      .def_property("scene_threshold", released(&Recognizer::get_scene_threshold),
+          released(&Recognizer::set_scene_threshold))
+      .def_property("stream", released(&Recognizer::get_stream), released(&Recognizer::set_stream))
+      .def_property_readonly("event_fd", &Recognizer::get_event_fd)
+      .def_property_readonly("ready", [](Recognizer& self) {
+        // This means loading finished, not that it succeeded (wait_ready() raises if it failed)
+        return self.get_ready().wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+      })
+      .def("wait_ready", [](Recognizer& self, std::optional<double> timeout) {
+        auto ready = self.get_ready();
+        if (timeout) {
+          if (ready.wait_for(std::chrono::duration<double>(*timeout)) != std::future_status::ready) {
+            return false;
+          }
+        }
+        ready.get();
+        return true;
+      }, py::arg("timeout") = py::none(), release())
+      .def_property_readonly("stats", released(&Recognizer::get_stats))
+      .def_static("get_max_drivers", &Recognizer::get_max_drivers)
+      .def_static("set_max_drivers", &Recognizer::set_max_drivers, py::arg("max_drivers"))
       .def("register_face_appear", &Recognizer::register_face_appear)
       .def("register_face_disappear", &Recognizer::register_face_disappear)
       .def("register_face_move", &Recognizer::register_face_move)
-      .def("start", &Recognizer::start)
-      .def("stop", &Recognizer::stop)
-      .def("poll", &Recognizer::poll);
+      .def("configure_synthetic", &Recognizer::configure_synthetic,
+          py::arg("faces"), py::arg("detect_cost") = 0, py::arg("embed_cost") = 0, release())
+      .def("start", &Recognizer::start, release())
+      .def("stop", &Recognizer::stop, release())
+      .def("poll", [](Recognizer& self) {
+        // Wait for the events without the GIL, then dispatch them with it
+        Recognizer::EventBatch batch;
+        {
+          py::gil_scoped_release gil;
+          batch = self.poll_batch();
+        }
+        self.dispatch(batch);
+      })
+      .def("poll_batch", [](Recognizer& self) {
+        return self.poll_batch();
+      }, release());
 }
 
 } // namespace recognizer
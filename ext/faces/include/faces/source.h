@@ -8,12 +8,57 @@
 #ifndef FACES_SOURCE_H
 #define FACES_SOURCE_H
 
+#include <cstddef>
+#include <memory>
 #include <optional>
+#include <utility>
+#include <vector>
 #include <pybind11/pybind11.h>
 
 namespace faces {
 
-/** The common image type. */
+/** A pixel layout. All formats are eight bits per channel. */
+enum class PixelFormat {
+  /** Packed red, green, blue. */
+  RGB,
+
+  /** Packed blue, green, red. */
+  BGR,
+
+  /** Packed red, green, blue, alpha. */
+  RGBA,
+
+  /** Packed blue, green, red, alpha. */
+  BGRA,
+
+  /** Luminance only. */
+  GRAY,
+};
+
+/**
+ * @param format A pixel format
+ * @return The number of bytes per pixel in that format
+ */
+inline int bytes_per_pixel(PixelFormat format) {
+  switch (format) {
+    case PixelFormat::RGB:
+    case PixelFormat::BGR:
+      return 3;
+    case PixelFormat::RGBA:
+    case PixelFormat::BGRA:
+      return 4;
+    case PixelFormat::GRAY:
+      return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * The common image type. Pixels either live in the data vector, or they are
+ * borrowed from memory someone else owns (like a NumPy array or a shared
+ * memory segment), in which case the owner handle keeps that memory alive.
+ */
 struct Image {
   /** The image width. */
   int width;
@@ -21,8 +66,58 @@ struct Image {
   /** The image height. */
   int height;
 
+  /** The distance between rows in bytes, or zero for tightly packed rows. */
+  int stride = 0;
+
+  /** The pixel format. */
+  PixelFormat format = PixelFormat::RGB;
+
   /** The image data. */
   std::vector<char> data;
+
+  /** The borrowed pixel memory, or null to use the image data. */
+  const char* borrowed = nullptr;
+
+  /** The size of the borrowed pixel memory in bytes. */
+  std::size_t borrowed_size = 0;
+
+  /** The owner of the borrowed pixel memory. */
+  std::shared_ptr<const void> owner;
+
+  /**
+   * @return The first pixel
+   */
+  const char* pixels() const {
+    return borrowed ? borrowed : data.data();
+  }
+
+  /**
+   * @return The number of bytes of pixel memory
+   */
+  std::size_t size() const {
+    return borrowed ? borrowed_size : data.size();
+  }
+
+  /**
+   * @return The distance between rows in bytes
+   */
+  int step() const {
+    return stride ? stride : width * bytes_per_pixel(format);
+  }
+
+  /**
+   * Check that the pixel memory is large enough for the dimensions.
+   *
+   * @return True if the dimensions fit, otherwise false
+   */
+  bool fits() const {
+    if (width <= 0 || height <= 0) {
+      return false;
+    }
+
+    auto row = static_cast<std::size_t>(width) * bytes_per_pixel(format);
+    return step() >= static_cast<int>(row) && size() >= static_cast<std::size_t>(step()) * (height - 1) + row;
+  }
 };
 
 /** An abstract video source. */
@@ -41,6 +136,25 @@ struct Source {
    * @return The next frame
    */
   virtual std::optional<Image> wait(unsigned long millis) = 0;
+
+  /**
+   * Wait for the next video frame, reusing the memory of an old one. The
+   * recognizer calls this every frame, so sources that copy pixels should
+   * override it to copy into the old frame's data rather than a new one.
+   *
+   * @param millis The maximum number of milliseconds to wait
+   * @param frame The old frame, replaced with the next frame on success
+   * @return True on success, otherwise false if no frame came
+   */
+  virtual bool wait_into(unsigned long millis, Image& frame) {
+    auto next = wait(millis);
+    if (!next) {
+      return false;
+    }
+
+    frame = std::move(*next);
+    return true;
+  }
 };
 
 namespace source {
@@ -49,6 +163,13 @@ template<class Module>
 void bind(Module&& m) {
   namespace py = pybind11;
 
+  py::enum_<PixelFormat>(m, "PixelFormat")
+      .value("RGB", PixelFormat::RGB)
+      .value("BGR", PixelFormat::BGR)
+      .value("RGBA", PixelFormat::RGBA)
+      .value("BGRA", PixelFormat::BGRA)
+      .value("GRAY", PixelFormat::GRAY);
+
   py::class_<Source>(m, "Source")
       .def("update", [](Source& self, const py::object& img) {
         return self.update(img);
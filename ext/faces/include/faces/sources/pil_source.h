@@ -18,7 +18,11 @@ namespace sources {
 struct PILSourceImpl;
 
 /**
- * An OpenCV source.
+ * A source for frames from Python. It takes PIL images as well as anything
+ * that exposes its memory through the buffer protocol (like NumPy arrays and
+ * memoryviews). Frames are never repacked on the way in: the source keeps a
+ * reference to the Python object and lets the recognizer read its memory in
+ * place, so callers must not modify a buffer after handing it over.
  */
 class PILSource : public Source {
   /** PImpl. */
@@ -39,7 +43,19 @@ public:
 
   void update(const pybind11::object& img) final;
 
+  /**
+   * Update the source with raw image memory. The buffer must be laid out as
+   * (height, width) for gray or (height, width, channels) otherwise, with
+   * packed pixels. Rows may be padded.
+   *
+   * @param buf The image buffer
+   * @param format The pixel format
+   */
+  void update_buffer(const pybind11::buffer& buf, PixelFormat format);
+
   std::optional<Image> wait(unsigned long millis) final;
+
+  bool wait_into(unsigned long millis, Image& frame) final;
 };
 
 namespace pil_source {
@@ -49,7 +65,8 @@ void bind(Module&& m) {
   namespace py = pybind11;
 
   py::class_<PILSource, Source>(m, "PILSource")
-      .def(py::init<>());
+      .def(py::init<>())
+      .def("update_buffer", &PILSource::update_buffer, py::arg("buffer"), py::arg("format") = PixelFormat::RGB);
 }
 
 } // namespace pil_source
@@ -0,0 +1,243 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef FACES_SOURCES_SHM_SOURCE_H
+#define FACES_SOURCES_SHM_SOURCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <pybind11/pybind11.h>
+#include <faces/source.h>
+
+namespace faces {
+namespace sources {
+
+class ShmRing;
+struct ShmSourceImpl;
+struct ShmProducerImpl;
+
+/**
+ * A source for frames from another process. Frames arrive through a ring of
+ * slots in POSIX shared memory, written by a ShmProducer in the other process.
+ * The recognizer reads each frame right where the producer wrote it, and the
+ * slot is held until the recognizer is done with it. Neither waiting nor
+ * reading involves Python, so the GIL of this process is never touched.
+ *
+ * Whichever side opens the ring first creates it with its slot count and slot
+ * size. The other side then takes those as they are.
+ */
+class ShmSource : public Source {
+  /** PImpl. */
+  std::unique_ptr<ShmSourceImpl> impl;
+
+public:
+  /**
+   * Open a frame ring for reading.
+   *
+   * @param name The segment name (like "/cozmonaut-frames")
+   * @param slots The number of slots (only used if creating)
+   * @param slot_size The size of each slot in bytes (only used if creating)
+   * @param timeout How long to wait in seconds for another process to finish creating the ring
+   */
+  ShmSource(const std::string& name, std::size_t slots, std::size_t slot_size, double timeout);
+
+  ShmSource(const ShmSource& rhs) = delete;
+
+  ShmSource(ShmSource&& rhs) = delete;
+
+  ~ShmSource();
+
+  ShmSource& operator=(const ShmSource& rhs) = delete;
+
+  ShmSource& operator=(ShmSource&& rhs) = delete;
+
+  void update(const pybind11::object& img) final;
+
+  std::optional<Image> wait(unsigned long millis) final;
+
+  /**
+   * @return The segment name
+   */
+  std::string get_name() const;
+
+  /**
+   * @return The number of frames the producer dropped because every slot was in use
+   */
+  std::uint64_t get_dropped() const;
+};
+
+/**
+ * The memory of a claimed ring slot, as handed out to Python. Views of it keep
+ * the ring mapped, and no new views are handed out once the slot is published
+ * or abandoned.
+ */
+struct ShmSlot {
+  /** The ring. */
+  std::shared_ptr<ShmRing> ring;
+
+  /** The slot memory. */
+  char* data;
+
+  /** The size of the slot memory in bytes. */
+  std::size_t size;
+
+  /** Whether the slot is still claimed. */
+  bool claimed;
+};
+
+/**
+ * The writing end of a frame ring. There must be only one producer per ring.
+ *
+ * Frames can be written straight into the ring: claim a slot, fill it in, and
+ * publish it. For frames that already live somewhere else, push() copies them
+ * into a slot in one go.
+ */
+class ShmProducer {
+  /** PImpl. */
+  std::unique_ptr<ShmProducerImpl> impl;
+
+public:
+  /**
+   * Open a frame ring for writing.
+   *
+   * @param name The segment name (like "/cozmonaut-frames")
+   * @param slots The number of slots (only used if creating)
+   * @param slot_size The size of each slot in bytes (only used if creating)
+   * @param timeout How long to wait in seconds for another process to finish creating the ring
+   */
+  ShmProducer(const std::string& name, std::size_t slots, std::size_t slot_size, double timeout);
+
+  ShmProducer(const ShmProducer& rhs) = delete;
+
+  ShmProducer(ShmProducer&& rhs) = delete;
+
+  ~ShmProducer();
+
+  ShmProducer& operator=(const ShmProducer& rhs) = delete;
+
+  ShmProducer& operator=(ShmProducer&& rhs) = delete;
+
+  /**
+   * @return The size of each slot in bytes
+   */
+  std::size_t get_slot_size() const;
+
+  /**
+   * @return The number of frames dropped because every slot was in use
+   */
+  std::uint64_t get_dropped() const;
+
+  /**
+   * Claim a slot to write the next frame into.
+   *
+   * @return The slot memory (slot size bytes), or null if every slot is in use
+   */
+  char* claim();
+
+  /**
+   * Publish the frame written into the claimed slot.
+   *
+   * @param width The frame width
+   * @param height The frame height
+   * @param format The pixel format
+   * @param stride The distance between rows in bytes, or zero for packed rows
+   */
+  void publish(int width, int height, PixelFormat format, int stride);
+
+  /** Give up the claimed slot without publishing anything. */
+  void abandon();
+
+  /**
+   * Copy a frame into the ring and publish it.
+   *
+   * @param image The frame
+   * @return True on success, otherwise false if every slot is in use
+   */
+  bool push(const Image& image);
+
+  /**
+   * Copy a frame from raw image memory into the ring and publish it. The
+   * buffer is laid out as for PILSource::update_buffer.
+   *
+   * @param buf The image buffer
+   * @param format The pixel format
+   * @return True on success, otherwise false if every slot is in use
+   */
+  bool push_buffer(const pybind11::buffer& buf, PixelFormat format);
+
+  /**
+   * Claim a slot and expose it to Python as a writable memoryview. The view
+   * is released when the slot is published or abandoned through
+   * release_view().
+   *
+   * @return The slot memory, or None if every slot is in use
+   */
+  pybind11::object claim_view();
+
+  /**
+   * Release the memoryview from claim_view(), if any. After this, the slot
+   * memory cannot be reached from Python anymore. This throws (and leaves the
+   * slot claimed) if anything taken from the view, like a slice or a NumPy
+   * array, is still around, as it could write into the slot after readers
+   * get it.
+   */
+  void release_view();
+};
+
+namespace shm_source {
+
+template<class Module>
+void bind(Module&& m) {
+  namespace py = pybind11;
+
+  using release = py::call_guard<py::gil_scoped_release>;
+
+  // Cozmo's camera tops out at 320x240 RGB, so this is plenty (TODO: Extract this)
+  constexpr std::size_t slot_size = 640 * 480 * 4;
+
+  py::class_<ShmSource, Source>(m, "ShmSource")
+      .def(py::init<const std::string&, std::size_t, std::size_t, double>(), py::arg("name"), py::arg("slots") = 4,
+          py::arg("slot_size") = slot_size, py::arg("timeout") = 1.0, release())
+      .def_property_readonly("name", &ShmSource::get_name)
+      .def_property_readonly("dropped", &ShmSource::get_dropped);
+
+  py::class_<ShmSlot>(m, "ShmSlot", py::buffer_protocol())
+      .def_buffer([](ShmSlot& self) {
+        if (!self.claimed) {
+          throw py::buffer_error("ring slot was already published or abandoned");
+        }
+        return py::buffer_info(self.data, 1, py::format_descriptor<std::uint8_t>::format(),
+            static_cast<py::ssize_t>(self.size));
+      });
+
+  py::class_<ShmProducer>(m, "ShmProducer")
+      .def(py::init<const std::string&, std::size_t, std::size_t, double>(), py::arg("name"), py::arg("slots") = 4,
+          py::arg("slot_size") = slot_size, py::arg("timeout") = 1.0, release())
+      .def_property_readonly("slot_size", &ShmProducer::get_slot_size)
+      .def_property_readonly("dropped", &ShmProducer::get_dropped)
+      .def("claim", &ShmProducer::claim_view)
+      .def("publish", [](ShmProducer& self, int width, int height, PixelFormat format, int stride) {
+        // Take the slot memory away from Python before readers get it
+        self.release_view();
+
+        py::gil_scoped_release gil;
+        self.publish(width, height, format, stride);
+      }, py::arg("width"), py::arg("height"), py::arg("format") = PixelFormat::RGB, py::arg("stride") = 0)
+      .def("abandon", [](ShmProducer& self) {
+        self.release_view();
+        self.abandon();
+      })
+      .def("push", &ShmProducer::push_buffer, py::arg("buffer"), py::arg("format") = PixelFormat::RGB);
+}
+
+} // namespace shm_source
+} // namespace sources
+} // namespace faces
+
+#endif // #ifndef FACES_SOURCES_SHM_SOURCE_H
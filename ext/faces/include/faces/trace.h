@@ -0,0 +1,137 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef FACES_TRACE_H
+#define FACES_TRACE_H
+
+#include <cstdint>
+#include <string>
+
+#include <pybind11/pybind11.h>
+
+namespace faces {
+namespace trace {
+
+/**
+ * Enable or disable span recording. Tracing is off by default, and recording
+ * sites cost a single relaxed atomic load while it is off.
+ *
+ * @param enabled True to record spans, otherwise false
+ */
+void set_enabled(bool enabled);
+
+/**
+ * @return True if spans are being recorded, otherwise false
+ */
+bool is_enabled();
+
+/** Discard all recorded spans on all threads. */
+void clear();
+
+/**
+ * Name the calling thread in the trace output.
+ *
+ * @param name The thread name
+ */
+void set_thread_name(const std::string& name);
+
+/**
+ * @return The current trace clock reading in nanoseconds
+ */
+std::uint64_t now();
+
+/**
+ * Record a complete span on the calling thread. This is lock-free: every thread
+ * owns a private ring buffer, and the oldest spans are overwritten when it
+ * fills up.
+ *
+ * @param name The span name (must have static storage duration)
+ * @param begin The span begin time in nanoseconds
+ * @param end The span end time in nanoseconds
+ * @param arg An integer argument to attach to the span
+ */
+void record(const char* name, std::uint64_t begin, std::uint64_t end, std::int64_t arg = 0);
+
+/**
+ * Render all recorded spans in the Chrome trace event format. The result can be
+ * loaded into chrome://tracing or the Perfetto UI.
+ *
+ * @return The trace JSON
+ */
+std::string dump();
+
+/**
+ * Write all recorded spans to a file in the Chrome trace event format.
+ *
+ * @param path The output file path
+ */
+void dump_file(const std::string& path);
+
+/** A scoped span. It records itself on destruction if tracing was enabled. */
+class Span {
+  /** The span name. */
+  const char* m_name;
+
+  /** The span begin time (zero if not recording). */
+  std::uint64_t m_begin;
+
+  /** The span argument. */
+  std::int64_t m_arg;
+
+public:
+  explicit Span(const char* p_name, std::int64_t p_arg = 0)
+      : m_name(p_name)
+      , m_begin(is_enabled() ? now() : 0)
+      , m_arg(p_arg) {
+  }
+
+  Span(const Span& rhs) = delete;
+
+  Span(Span&& rhs) = delete;
+
+  ~Span() {
+    if (m_begin) {
+      record(m_name, m_begin, now(), m_arg);
+    }
+  }
+
+  Span& operator=(const Span& rhs) = delete;
+
+  Span& operator=(Span&& rhs) = delete;
+
+  /**
+   * @param p_arg The span argument
+   */
+  void set_arg(std::int64_t p_arg) {
+    m_arg = p_arg;
+  }
+};
+
+template<class Module>
+void bind(Module&& m) {
+  namespace py = pybind11;
+
+  m.def("enable", []() {
+    set_enabled(true);
+  });
+  m.def("disable", []() {
+    set_enabled(false);
+  });
+  m.def("is_enabled", &is_enabled);
+  m.def("clear", &clear);
+  m.def("dump", []() {
+    return dump();
+  });
+  m.def("dump", [](const std::string& path) {
+    dump_file(path);
+  }, py::arg("path"));
+}
+
+} // namespace trace
+} // namespace faces
+
+#endif // #ifndef FACES_TRACE_H
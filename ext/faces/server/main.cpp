@@ -0,0 +1,105 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <csignal>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <faces/caches/basic_cache.h>
+#include <faces/caches/shared_cache.h>
+
+#include "server.h"
+
+using namespace faces;
+
+namespace {
+
+/** The server being run, for the signal handler. */
+server::Server* g_server = nullptr;
+
+void on_signal(int) {
+  if (g_server) {
+    g_server->stop();
+  }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::string path = "/tmp/faces.sock";
+  std::string shared_cache;
+  std::size_t capacity = 4096;
+  std::size_t journal_size = 1024;
+  std::size_t max_prototypes = 8;
+  double attach_timeout = 1;
+  std::size_t max_backlog = 16u << 20u;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--socket" && i + 1 < argc) {
+      path = argv[++i];
+    } else if (arg == "--shared-cache" && i + 1 < argc) {
+      shared_cache = argv[++i];
+    } else if (arg == "--capacity" && i + 1 < argc) {
+      capacity = std::stoul(argv[++i]);
+    } else if (arg == "--journal-size" && i + 1 < argc) {
+      journal_size = std::stoul(argv[++i]);
+    } else if (arg == "--max-prototypes" && i + 1 < argc) {
+      max_prototypes = std::stoul(argv[++i]);
+    } else if (arg == "--attach-timeout" && i + 1 < argc) {
+      attach_timeout = std::stod(argv[++i]);
+    } else if (arg == "--max-backlog" && i + 1 < argc) {
+      max_backlog = std::stoul(argv[++i]);
+    } else {
+      std::cerr << "usage: faces_server [--socket PATH] [--shared-cache NAME] [--capacity N] [--attach-timeout S]\n"
+                   "                    [--journal-size N] [--max-prototypes N] [--max-backlog BYTES]\n"
+                   "  --socket is where to listen (default /tmp/faces.sock)\n"
+                   "  --shared-cache puts the cache in shared memory under NAME, with room for\n"
+                   "    --capacity faces, so processes outside the server can use it too\n"
+                   "  --journal-size is how many recent changes the cache remembers for clients\n"
+                   "    catching up (default 1024)\n"
+                   "  --max-prototypes is how many encodings the shared cache keeps per face\n"
+                   "    (default 8)\n"
+                   "  --attach-timeout is how long to wait for another process to finish creating\n"
+                   "    the shared cache or a frame ring (default 1 second)\n"
+                   "  --max-backlog is how much output a client may leave unread before its events\n"
+                   "    get dropped (default 16 MiB)\n";
+      return 2;
+    }
+  }
+
+  try {
+    // One cache for all recognizers
+    std::unique_ptr<Cache> cache;
+    if (shared_cache.empty()) {
+      cache = std::make_unique<caches::BasicCache>(journal_size);
+    } else {
+      cache = std::make_unique<caches::SharedCache>(shared_cache, capacity, journal_size, max_prototypes,
+          attach_timeout);
+    }
+
+    server::Server server(path, cache.get(), attach_timeout, max_backlog);
+
+    // Shut down cleanly on the usual signals
+    g_server = &server;
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    std::cerr << "faces_server: listening on " << path << "\n";
+    server.run();
+
+    g_server = nullptr;
+  } catch (const std::exception& e) {
+    std::cerr << "faces_server: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
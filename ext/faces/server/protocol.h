@@ -0,0 +1,242 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef SERVER_PROTOCOL_H
+#define SERVER_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/*
+ * The faces_server wire protocol. The Python client in cozmonaut/faces_remote.py
+ * speaks this too, so keep the two in step.
+ *
+ * Everything is little-endian. Every message starts with a header:
+ *
+ *   u32 size     The size of the body in bytes
+ *   u16 type     The message type (replies have the reply bit set)
+ *   u16 status   Zero, or one on replies carrying an error message (UTF-8)
+ *   u32 seq      Chosen by the client, echoed in the reply (zero on events)
+ *
+ * Requests get exactly one reply each, in order, except SUBMIT_FRAMES, which
+ * only gets a reply if it fails. Events may come between replies at any time.
+ *
+ * An encoding on the wire is 128 f64s. A rectangle is four i32s (left, top,
+ * right, bottom).
+ */
+
+namespace faces {
+namespace server {
+
+/** The size of a message header. */
+constexpr std::size_t kHeaderSize = 12;
+
+/** The largest message body accepted (TODO: Extract this). */
+constexpr std::uint32_t kMaxBody = 64u << 20u;
+
+/** The bit marking a reply. */
+constexpr std::uint16_t kReply = 0x8000;
+
+/** The message types. The bodies are given request first, then reply. */
+enum class MsgType : std::uint16_t {
+  /** Create a recognizer: u32 backend, i32 stream. Reply: u32 handle. */
+  CREATE_RECOGNIZER = 1,
+
+  /** Destroy a recognizer: u32 handle. */
+  DESTROY_RECOGNIZER = 2,
+
+  /** Configure the synthetic backend: u32 handle, i32 faces, i32 detect cost, i32 embed cost. */
+  CONFIGURE_SYNTHETIC = 3,
+
+  /** Start a recognizer: u32 handle. */
+  START = 4,
+
+  /** Stop a recognizer: u32 handle. */
+  STOP = 5,
+
+  /** Take frames from a shared memory frame ring: u32 handle, u32 length, name. */
+  ATTACH_RING = 6,
+
+  /**
+   * Submit frames to any number of recognizers: u32 count, then for each frame
+   * u32 handle, i32 width, i32 height, u32 format, u32 size, and the packed
+   * pixels. No reply unless it fails.
+   */
+  SUBMIT_FRAMES = 7,
+
+  /**
+   * Get recognizer counters: u32 handle. Reply: u64 moves enqueued, u64 moves
+   * coalesced, u64 unknowns inserted, u64 frames, u64 frames gated, u64 idle
+   * entries, u64 idle exits, u64 allocations counted (0 or 1), u64 frame
+   * allocations, u64 allocating frames.
+   */
+  GET_STATS = 8,
+
+  /** Set the scene change threshold of a recognizer: u32 handle, f64 threshold. */
+  SET_SCENE_THRESHOLD = 9,
+
+  /**
+   * Set the adaptive sampling settings of a recognizer: u32 handle, u8
+   * adaptive, f64 active rate, f64 idle rate, f64 idle after, i32 wake frames.
+   */
+  SET_SAMPLING = 10,
+
+  /** Insert a known face: i32 id, encoding. */
+  CACHE_INSERT = 16,
+
+  /** Add a prototype to a face: i32 id, encoding. */
+  CACHE_INSERT_PROTOTYPE = 17,
+
+  /** Insert an unknown face: encoding. Reply: i32 id. */
+  CACHE_INSERT_UNKNOWN = 18,
+
+  /** Remove a face: i32 id. */
+  CACHE_REMOVE = 19,
+
+  /** Rename a face: i32 old id, i32 new id. */
+  CACHE_RENAME = 20,
+
+  /** Retrieve a face: i32 id. Reply: encoding. */
+  CACHE_RETRIEVE = 21,
+
+  /** Query a face: f64 tolerance, encoding. Reply: i32 id. */
+  CACHE_QUERY = 22,
+
+  /** Get the cache epoch. Reply: u64 epoch. */
+  CACHE_EPOCH = 23,
+
+  /** Merge unknown faces: f64 tolerance. Reply: u32 count, then each as i32 old id, i32 new id. */
+  CACHE_CONSOLIDATE_UNKNOWNS = 24,
+
+  /**
+   * Events from a recognizer (server to client only): u32 handle, u32 appear
+   * count, u32 disappear count, u32 move count, then each event as i32 id,
+   * i32 track, rectangle, i32 stream, i64 timestamp, i64 sequence number
+   * (appear, disappear, move in that order), then an encoding for each
+   * appearance. Clients merge the kinds by sequence number to get the order
+   * the events happened in.
+   */
+  EVENTS = 32,
+};
+
+/** Appends values to a message body. */
+class Writer {
+  /** The buffer. */
+  std::vector<char>& m_buf;
+
+public:
+  explicit Writer(std::vector<char>& p_buf) : m_buf(p_buf) {
+  }
+
+  /**
+   * Append a value.
+   *
+   * @param value The value
+   */
+  template<class T>
+  void put(T value) {
+    static_assert(std::is_arithmetic_v<T>);
+    auto at = m_buf.size();
+    m_buf.resize(at + sizeof(T));
+    std::memcpy(m_buf.data() + at, &value, sizeof(T));
+  }
+
+  /**
+   * Append raw bytes.
+   *
+   * @param data The bytes
+   * @param size The number of bytes
+   */
+  void put_bytes(const void* data, std::size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    m_buf.insert(m_buf.end(), bytes, bytes + size);
+  }
+};
+
+/** Reads values from a message body. */
+class Reader {
+  /** The next byte. */
+  const char* m_pos;
+
+  /** The end of the body. */
+  const char* m_end;
+
+public:
+  Reader(const char* p_pos, std::size_t size) : m_pos(p_pos), m_end(p_pos + size) {
+  }
+
+  /**
+   * Read a value.
+   *
+   * @return The value
+   */
+  template<class T>
+  T get() {
+    static_assert(std::is_arithmetic_v<T>);
+    T value;
+    std::memcpy(&value, get_bytes(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  /**
+   * Read raw bytes in place.
+   *
+   * @param size The number of bytes
+   * @return The bytes
+   */
+  const char* get_bytes(std::size_t size) {
+    if (static_cast<std::size_t>(m_end - m_pos) < size) {
+      throw std::runtime_error("truncated message");
+    }
+
+    auto bytes = m_pos;
+    m_pos += size;
+    return bytes;
+  }
+};
+
+/**
+ * Start a message in a buffer. Finish it with end_message().
+ *
+ * @param buf The buffer
+ * @param type The message type
+ * @param status The status
+ * @param seq The sequence number
+ * @return The offset of the message in the buffer
+ */
+inline std::size_t begin_message(std::vector<char>& buf, std::uint16_t type, std::uint16_t status, std::uint32_t seq) {
+  auto at = buf.size();
+
+  Writer writer(buf);
+  writer.put<std::uint32_t>(0);
+  writer.put(type);
+  writer.put(status);
+  writer.put(seq);
+
+  return at;
+}
+
+/**
+ * Finish a message by filling in its size.
+ *
+ * @param buf The buffer
+ * @param at The offset of the message in the buffer
+ */
+inline void end_message(std::vector<char>& buf, std::size_t at) {
+  auto size = static_cast<std::uint32_t>(buf.size() - at - kHeaderSize);
+  std::memcpy(buf.data() + at, &size, sizeof(size));
+}
+
+} // namespace server
+} // namespace faces
+
+#endif // #ifndef SERVER_PROTOCOL_H
@@ -0,0 +1,863 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <faces/encoding.h>
+
+#include "protocol.h"
+#include "server.h"
+
+namespace faces {
+namespace server {
+
+namespace {
+
+/**
+ * Throw an error for a failed system call.
+ *
+ * @param what What failed
+ */
+[[noreturn]] void throw_errno(const std::string& what) {
+  throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+/**
+ * Put a file descriptor in non-blocking mode.
+ *
+ * @param fd The file descriptor
+ */
+void set_nonblocking(int fd) {
+  auto flags = fcntl(fd, F_GETFL);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    throw_errno("cannot make descriptor non-blocking");
+  }
+}
+
+/**
+ * Read an encoding off the wire.
+ *
+ * @param reader The reader
+ * @return The encoding
+ */
+Encoding get_encoding(Reader& reader) {
+  Encoding::vector_type vec;
+  std::memcpy(vec.data(), reader.get_bytes(sizeof(vec)), sizeof(vec));
+
+  Encoding enc;
+  enc.set_vector(vec);
+  return enc;
+}
+
+/**
+ * Write an encoding to the wire.
+ *
+ * @param writer The writer
+ * @param enc The encoding
+ */
+void put_encoding(Writer& writer, const Encoding& enc) {
+  auto vec = enc.get_vector();
+  writer.put_bytes(vec.data(), sizeof(vec));
+}
+
+/**
+ * Write an event to the wire.
+ *
+ * @param writer The writer
+ * @param evt The event
+ */
+void put_event(Writer& writer, const Recognizer::Event& evt) {
+  writer.put(evt.id);
+  writer.put(evt.track);
+  writer.put(evt.left);
+  writer.put(evt.top);
+  writer.put(evt.right);
+  writer.put(evt.bottom);
+  writer.put(evt.stream);
+  writer.put(evt.timestamp);
+  writer.put(evt.seq);
+}
+
+} // namespace
+
+QueueSource::QueueSource() : m_image(), m_cond(), m_mutex(), m_present(false) {
+}
+
+void QueueSource::update(const pybind11::object&) {
+  throw std::runtime_error("server source takes frames from the socket");
+}
+
+void QueueSource::push(const Image& image) {
+  std::lock_guard lock(m_mutex);
+
+  // Copy the frame over the pending one
+  // The pending frame may be an old one handed back by the recognizer, so drop anything it borrowed
+  m_image.width = image.width;
+  m_image.height = image.height;
+  m_image.stride = image.stride;
+  m_image.format = image.format;
+  m_image.data.assign(image.pixels(), image.pixels() + image.size());
+  m_image.borrowed = nullptr;
+  m_image.borrowed_size = 0;
+  m_image.owner.reset();
+
+  m_present = true;
+  m_cond.notify_all();
+}
+
+std::optional<Image> QueueSource::wait(unsigned long millis) {
+  Image frame;
+  if (!wait_into(millis, frame)) {
+    return std::nullopt;
+  }
+  return frame;
+}
+
+bool QueueSource::wait_into(unsigned long millis, Image& frame) {
+  std::unique_lock lock(m_mutex);
+
+  if (!m_cond.wait_for(lock, std::chrono::milliseconds(millis), [&]() { return m_present; })) {
+    return false;
+  }
+
+  // Trade the pending frame for the old one, whose memory the next push reuses
+  m_present = false;
+  std::swap(m_image, frame);
+  return true;
+}
+
+Server::Server(const std::string& p_path, Cache* p_cache, double p_attach_timeout, std::size_t p_max_backlog)
+    : m_path(p_path)
+    , m_cache(p_cache)
+    , m_attach_timeout(p_attach_timeout)
+    , m_max_backlog(p_max_backlog)
+    , m_listen(-1)
+    , m_wake_read(-1)
+    , m_wake_write(-1)
+    , m_clients()
+    , m_hosted()
+    , m_next_handle(1)
+    , m_next_serial(1)
+    , m_done_read(-1)
+    , m_done_write(-1)
+    , m_jobs()
+    , m_done()
+    , m_job_mutex()
+    , m_job_cond()
+    , m_quit(false)
+    , m_worker() {
+  sockaddr_un addr {};
+  addr.sun_family = AF_UNIX;
+  if (m_path.size() >= sizeof(addr.sun_path)) {
+    throw std::runtime_error("socket path too long");
+  }
+  std::strcpy(addr.sun_path, m_path.c_str());
+
+  m_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (m_listen == -1) {
+    throw_errno("cannot create socket");
+  }
+
+  // Replace a socket left behind by a previous run
+  // Anything else at the path, including the socket of a server still running, stays put
+  struct stat st {};
+  if (lstat(m_path.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      close(m_listen);
+      throw std::runtime_error(m_path + " is in the way and is not a socket");
+    }
+
+    auto probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe == -1) {
+      close(m_listen);
+      throw_errno("cannot create socket");
+    }
+    // Only a socket nobody listens on refuses the connection
+    auto answered = connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    auto refused = !answered && errno == ECONNREFUSED;
+    close(probe);
+
+    if (answered) {
+      close(m_listen);
+      throw std::runtime_error("a server is already listening on " + m_path);
+    }
+    if (!refused) {
+      close(m_listen);
+      throw std::runtime_error("cannot tell whether " + m_path + " is still in use");
+    }
+
+    unlink(m_path.c_str());
+  }
+
+  if (bind(m_listen, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+    close(m_listen);
+    throw_errno("cannot bind " + m_path);
+  }
+  if (listen(m_listen, 16) == -1) {
+    close(m_listen);
+    throw_errno("cannot listen on " + m_path);
+  }
+  set_nonblocking(m_listen);
+
+  // The wakeup pipe lets stop() interrupt poll(2) from a signal handler
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) == -1) {
+    close(m_listen);
+    throw_errno("cannot create wakeup pipe");
+  }
+  m_wake_read = fds[0];
+  m_wake_write = fds[1];
+
+  // The completion pipe lets the worker interrupt poll(2) when a job is done
+  if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) == -1) {
+    close(m_wake_read);
+    close(m_wake_write);
+    close(m_listen);
+    throw_errno("cannot create completion pipe");
+  }
+  m_done_read = fds[0];
+  m_done_write = fds[1];
+
+  m_worker = std::thread(&Server::work, this);
+}
+
+Server::~Server() {
+  while (!m_clients.empty()) {
+    disconnect(m_clients.begin()->first);
+  }
+
+  // Let the worker finish off the recognizers first
+  {
+    std::lock_guard lock(m_job_mutex);
+    m_quit = true;
+  }
+  m_job_cond.notify_all();
+  m_worker.join();
+
+  close(m_done_read);
+  close(m_done_write);
+  close(m_wake_read);
+  close(m_wake_write);
+  close(m_listen);
+  unlink(m_path.c_str());
+}
+
+void Server::stop() {
+  char byte = 0;
+  auto r = write(m_wake_write, &byte, 1);
+  (void) r;
+}
+
+void Server::run() {
+  std::vector<pollfd> fds;
+  std::vector<std::uint32_t> handles;
+
+  for (;;) {
+    // Watch the wakeup pipe, the listening socket, the completion pipe, every client, and every recognizer
+    // Clients waiting on the worker are not read from, so they can't pile up requests meanwhile
+    fds.clear();
+    fds.push_back({m_wake_read, POLLIN, 0});
+    fds.push_back({m_listen, POLLIN, 0});
+    fds.push_back({m_done_read, POLLIN, 0});
+    for (auto&&[fd, client] : m_clients) {
+      short events = client.waiting ? 0 : POLLIN;
+      if (client.out_sent < client.out.size()) {
+        events |= POLLOUT;
+      }
+      fds.push_back({fd, events, 0});
+    }
+    auto first_rec = fds.size();
+    handles.clear();
+    for (auto&&[handle, hosted] : m_hosted) {
+      fds.push_back({hosted.rec->get_event_fd(), POLLIN, 0});
+      handles.push_back(handle);
+    }
+
+    if (::poll(fds.data(), fds.size(), -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw_errno("cannot poll");
+    }
+
+    // Stop if asked to
+    if (fds[0].revents) {
+      return;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      accept_clients();
+    }
+
+    // Send the replies of finished jobs
+    if (fds[2].revents & POLLIN) {
+      finish_jobs();
+    }
+
+    // Forward recognizer events first, so they go out with this round of writes
+    for (std::size_t i = first_rec; i < fds.size(); ++i) {
+      if (fds[i].revents) {
+        auto it = m_hosted.find(handles[i - first_rec]);
+        if (it != m_hosted.end()) {
+          forward_events(it->first, it->second);
+        }
+      }
+    }
+
+    // Serve the clients
+    for (std::size_t i = 3; i < first_rec; ++i) {
+      auto it = m_clients.find(fds[i].fd);
+      if (it == m_clients.end()) {
+        continue;
+      }
+
+      bool keep = true;
+      if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+        keep = receive(it->second);
+      }
+      if (keep) {
+        keep = flush(it->second);
+      }
+      if (!keep) {
+        disconnect(fds[i].fd);
+      }
+    }
+
+    // Events forwarded to clients with nothing to say still need to go out
+    for (auto it = m_clients.begin(); it != m_clients.end();) {
+      auto fd = it->first;
+      auto keep = flush(it->second);
+      ++it;
+      if (!keep) {
+        disconnect(fd);
+      }
+    }
+  }
+}
+
+void Server::accept_clients() {
+  for (;;) {
+    auto fd = accept4(m_listen, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        std::cerr << "faces_server: cannot accept: " << std::strerror(errno) << "\n";
+      }
+      return;
+    }
+
+    auto& client = m_clients[fd];
+    client.fd = fd;
+    client.serial = m_next_serial++;
+  }
+}
+
+bool Server::receive(Client& client) {
+  // Read everything available
+  char buf[65536];
+  for (;;) {
+    auto n = read(client.fd, buf, sizeof(buf));
+    if (n > 0) {
+      client.in.insert(client.in.end(), buf, buf + n);
+      continue;
+    }
+    if (n == 0) {
+      return false;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    }
+    return false;
+  }
+
+  return dispatch(client);
+}
+
+bool Server::dispatch(Client& client) {
+  // Handle every complete message, until one has to wait on the worker
+  std::size_t pos = 0;
+  while (!client.waiting && client.in.size() - pos >= kHeaderSize) {
+    Reader header(client.in.data() + pos, kHeaderSize);
+    auto size = header.get<std::uint32_t>();
+    auto type = header.get<std::uint16_t>();
+    header.get<std::uint16_t>();
+    auto seq = header.get<std::uint32_t>();
+
+    // Don't let a client make us buffer without bound
+    if (size > kMaxBody) {
+      std::cerr << "faces_server: message too large, disconnecting client\n";
+      return false;
+    }
+
+    if (client.in.size() - pos - kHeaderSize < size) {
+      break;
+    }
+
+    handle(client, type, seq, client.in.data() + pos + kHeaderSize, size);
+    pos += kHeaderSize + size;
+  }
+
+  client.in.erase(client.in.begin(), client.in.begin() + static_cast<std::ptrdiff_t>(pos));
+  return true;
+}
+
+bool Server::flush(Client& client) {
+  while (client.out_sent < client.out.size()) {
+    auto n = send(client.fd, client.out.data() + client.out_sent, client.out.size() - client.out_sent, MSG_NOSIGNAL);
+    if (n > 0) {
+      client.out_sent += static_cast<std::size_t>(n);
+      continue;
+    }
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    }
+    return false;
+  }
+
+  client.out.clear();
+  client.out_sent = 0;
+  return true;
+}
+
+void Server::disconnect(int fd) {
+  auto it = m_clients.find(fd);
+  if (it == m_clients.end()) {
+    return;
+  }
+
+  // The recognizers go with their owner
+  for (auto handle : it->second.recognizers) {
+    post(nullptr, 0, 0, retire(handle));
+  }
+
+  if (it->second.dropped) {
+    std::cerr << "faces_server: client dropped " << it->second.dropped << " event batches\n";
+  }
+
+  close(fd);
+  m_clients.erase(it);
+}
+
+Hosted& Server::lookup(const Client& client, std::uint32_t handle) {
+  auto it = m_hosted.find(handle);
+  if (it == m_hosted.end() || it->second.owner != client.fd) {
+    throw std::runtime_error("unknown recognizer handle");
+  }
+
+  return it->second;
+}
+
+Job Server::retire(std::uint32_t handle) {
+  Job job;
+
+  auto node = m_hosted.extract(handle);
+  if (node.empty()) {
+    job.work = [](std::vector<char>&) {};
+    return job;
+  }
+
+  // Stopping waits on the frame in progress, so the recognizer goes away on the worker
+  // It stops on its way out, before its sources go
+  auto hosted = std::make_shared<Hosted>(std::move(node.mapped()));
+  job.work = [hosted](std::vector<char>&) {
+    hosted->rec.reset();
+    hosted->ring.reset();
+    hosted->queue.reset();
+  };
+  return job;
+}
+
+void Server::post(Client* client, std::uint16_t type, std::uint32_t seq, Job job) {
+  if (client) {
+    job.fd = client->fd;
+    job.serial = client->serial;
+    client->waiting = true;
+  }
+  job.type = type;
+  job.seq = seq;
+
+  {
+    std::lock_guard lock(m_job_mutex);
+    m_jobs.push_back(std::move(job));
+  }
+  m_job_cond.notify_one();
+}
+
+void Server::work() {
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock lock(m_job_mutex);
+      m_job_cond.wait(lock, [&]() { return m_quit || !m_jobs.empty(); });
+      if (m_jobs.empty()) {
+        return;
+      }
+
+      job = std::move(m_jobs.front());
+      m_jobs.pop_front();
+    }
+
+    // Jobs run in the order they were posted
+    // So a recognizer still being stopped is not destroyed out from under the stop
+    auto at = begin_message(job.reply, job.type | kReply, 0, job.seq);
+    try {
+      job.work(job.reply);
+      job.succeeded = true;
+    } catch (const std::exception& e) {
+      // Swap the reply for an error
+      job.reply.resize(at);
+      at = begin_message(job.reply, job.type | kReply, 1, job.seq);
+      Writer writer(job.reply);
+      writer.put_bytes(e.what(), std::strlen(e.what()));
+    }
+    end_message(job.reply, at);
+
+    // Whatever the work held on to goes away here, off the poll loop
+    job.work = nullptr;
+
+    if (job.fd == -1) {
+      continue;
+    }
+
+    {
+      std::lock_guard lock(m_job_mutex);
+      m_done.push_back(std::move(job));
+    }
+
+    char byte = 0;
+    auto r = write(m_done_write, &byte, 1);
+    (void) r;
+  }
+}
+
+void Server::finish_jobs() {
+  // Empty the completion pipe
+  // The queue, not the pipe, says what is done
+  char buf[64];
+  while (read(m_done_read, buf, sizeof(buf)) > 0) {
+  }
+
+  std::deque<Job> done;
+  {
+    std::lock_guard lock(m_job_mutex);
+    std::swap(done, m_done);
+  }
+
+  for (auto& job : done) {
+    // The client may have gone, and another may have its socket now
+    auto it = m_clients.find(job.fd);
+    if (it == m_clients.end() || it->second.serial != job.serial) {
+      continue;
+    }
+    auto& client = it->second;
+
+    if (job.succeeded && job.done) {
+      job.done();
+    }
+
+    client.out.insert(client.out.end(), job.reply.begin(), job.reply.end());
+    client.waiting = false;
+
+    // Handle whatever the client sent in the meantime
+    if (!dispatch(client)) {
+      disconnect(job.fd);
+    }
+  }
+}
+
+void Server::handle(Client& client, std::uint16_t type, std::uint32_t seq, const char* body, std::size_t size) {
+  Reader reader(body, size);
+
+  // Start the reply right away
+  // If handling fails, it is thrown away for an error reply
+  auto at = begin_message(client.out, type | kReply, 0, seq);
+  Writer writer(client.out);
+
+  try {
+    switch (static_cast<MsgType>(type)) {
+      case MsgType::CREATE_RECOGNIZER: {
+        auto backend = reader.get<std::uint32_t>();
+        auto stream = reader.get<std::int32_t>();
+        if (backend > static_cast<std::uint32_t>(Recognizer::Backend::SYNTHETIC)) {
+          throw std::runtime_error("unknown backend");
+        }
+
+        auto handle = m_next_handle++;
+
+        Hosted hosted;
+        hosted.rec = std::make_unique<Recognizer>(static_cast<Recognizer::Backend>(backend));
+        hosted.queue = std::make_unique<QueueSource>();
+        hosted.owner = client.fd;
+        hosted.rec->set_cache(m_cache);
+        hosted.rec->set_source(hosted.queue.get());
+        hosted.rec->set_stream(stream);
+
+        m_hosted.emplace(handle, std::move(hosted));
+        client.recognizers.push_back(handle);
+
+        writer.put(handle);
+        break;
+      }
+      case MsgType::DESTROY_RECOGNIZER: {
+        auto handle = reader.get<std::uint32_t>();
+        lookup(client, handle);
+
+        client.recognizers.erase(std::remove(client.recognizers.begin(), client.recognizers.end(), handle),
+            client.recognizers.end());
+
+        // The reply comes once the recognizer is gone
+        client.out.resize(at);
+        post(&client, type, seq, retire(handle));
+        return;
+      }
+      case MsgType::CONFIGURE_SYNTHETIC: {
+        auto& hosted = lookup(client, reader.get<std::uint32_t>());
+        auto faces = reader.get<std::int32_t>();
+        auto detect_cost = reader.get<std::int32_t>();
+        auto embed_cost = reader.get<std::int32_t>();
+        hosted.rec->configure_synthetic(faces, detect_cost, embed_cost);
+        break;
+      }
+      case MsgType::START: {
+        auto& hosted = lookup(client, reader.get<std::uint32_t>());
+        hosted.rec->start();
+        hosted.running = true;
+        break;
+      }
+      case MsgType::STOP: {
+        auto& hosted = lookup(client, reader.get<std::uint32_t>());
+        hosted.running = false;
+
+        // Stopping waits on the frame in progress, so it goes to the worker
+        // If the client goes meanwhile, the recognizer is destroyed after this, not before
+        Job job;
+        job.work = [rec = hosted.rec.get()](std::vector<char>&) {
+          rec->stop();
+        };
+
+        client.out.resize(at);
+        post(&client, type, seq, std::move(job));
+        return;
+      }
+      case MsgType::ATTACH_RING: {
+        auto handle = reader.get<std::uint32_t>();
+        auto& hosted = lookup(client, handle);
+        auto length = reader.get<std::uint32_t>();
+        std::string name(reader.get_bytes(length), length);
+
+        // The recognition thread reads its source without a lock, so it must not be running
+        if (hosted.running) {
+          throw std::runtime_error("cannot attach a frame ring to a running recognizer");
+        }
+
+        // The producer creates the ring, and it may still be at it, so opening goes to the worker
+        // Asking for zero slots makes opening fail rather than create a ring nobody writes to
+        auto ring = std::make_shared<std::unique_ptr<sources::ShmSource>>();
+        Job job;
+        job.work = [ring, name, timeout = m_attach_timeout](std::vector<char>&) {
+          try {
+            *ring = std::make_unique<sources::ShmSource>(name, 0, 0, timeout);
+          } catch (const std::runtime_error&) {
+            throw std::runtime_error("no usable frame ring named " + name);
+          }
+        };
+
+        // The recognizer takes the ring back on the poll loop
+        job.done = [this, handle, ring]() {
+          auto it = m_hosted.find(handle);
+          if (it != m_hosted.end()) {
+            it->second.ring = std::move(*ring);
+            it->second.rec->set_source(it->second.ring.get());
+          }
+        };
+
+        client.out.resize(at);
+        post(&client, type, seq, std::move(job));
+        return;
+      }
+      case MsgType::SUBMIT_FRAMES: {
+        auto count = reader.get<std::uint32_t>();
+        for (std::uint32_t i = 0; i < count; ++i) {
+          auto& hosted = lookup(client, reader.get<std::uint32_t>());
+
+          // Describe the frame right in the message
+          // The source copies it from there
+          Image image;
+          image.width = reader.get<std::int32_t>();
+          image.height = reader.get<std::int32_t>();
+          auto format = reader.get<std::uint32_t>();
+          auto frame_size = reader.get<std::uint32_t>();
+          image.borrowed = reader.get_bytes(frame_size);
+          image.borrowed_size = frame_size;
+
+          if (format > static_cast<std::uint32_t>(PixelFormat::GRAY)) {
+            throw std::runtime_error("unknown pixel format");
+          }
+          image.format = static_cast<PixelFormat>(format);
+          if (!image.fits()) {
+            throw std::runtime_error("frame size does not match its dimensions");
+          }
+
+          hosted.queue->push(image);
+        }
+
+        // Submissions only get a reply if they fail
+        client.out.resize(at);
+        return;
+      }
+      case MsgType::GET_STATS: {
+        auto stats = lookup(client, reader.get<std::uint32_t>()).rec->get_stats();
+        writer.put<std::uint64_t>(stats.moves_enqueued);
+        writer.put<std::uint64_t>(stats.moves_coalesced);
+        writer.put<std::uint64_t>(stats.unknowns_inserted);
+        writer.put<std::uint64_t>(stats.frames);
+        writer.put<std::uint64_t>(stats.frames_gated);
+        writer.put<std::uint64_t>(stats.idle_entries);
+        writer.put<std::uint64_t>(stats.idle_exits);
+        writer.put<std::uint64_t>(stats.allocations_counted);
+        writer.put<std::uint64_t>(stats.frame_allocations);
+        writer.put<std::uint64_t>(stats.allocating_frames);
+        break;
+      }
+      case MsgType::SET_SCENE_THRESHOLD: {
+        auto& hosted = lookup(client, reader.get<std::uint32_t>());
+        hosted.rec->set_scene_threshold(reader.get<double>());
+        break;
+      }
+      case MsgType::SET_SAMPLING: {
+        auto& hosted = lookup(client, reader.get<std::uint32_t>());
+        Recognizer::Sampling sampling;
+        sampling.adaptive = reader.get<std::uint8_t>() != 0;
+        sampling.active_rate = reader.get<double>();
+        sampling.idle_rate = reader.get<double>();
+        sampling.idle_after = reader.get<double>();
+        sampling.wake_frames = reader.get<std::int32_t>();
+        hosted.rec->set_sampling(sampling);
+        break;
+      }
+      case MsgType::CACHE_INSERT: {
+        auto id = reader.get<std::int32_t>();
+        m_cache->insert(id, get_encoding(reader));
+        break;
+      }
+      case MsgType::CACHE_INSERT_PROTOTYPE: {
+        auto id = reader.get<std::int32_t>();
+        m_cache->insert_prototype(id, get_encoding(reader));
+        break;
+      }
+      case MsgType::CACHE_INSERT_UNKNOWN:
+        writer.put<std::int32_t>(m_cache->insert_unknown(get_encoding(reader)));
+        break;
+      case MsgType::CACHE_REMOVE:
+        m_cache->remove(reader.get<std::int32_t>());
+        break;
+      case MsgType::CACHE_RENAME: {
+        auto id_old = reader.get<std::int32_t>();
+        auto id_new = reader.get<std::int32_t>();
+        m_cache->rename(id_old, id_new);
+        break;
+      }
+      case MsgType::CACHE_RETRIEVE:
+        put_encoding(writer, m_cache->retrieve(reader.get<std::int32_t>()));
+        break;
+      case MsgType::CACHE_QUERY: {
+        auto tol = reader.get<double>();
+        writer.put<std::int32_t>(m_cache->query(get_encoding(reader), tol));
+        break;
+      }
+      case MsgType::CACHE_EPOCH:
+        writer.put<std::uint64_t>(m_cache->get_epoch());
+        break;
+      case MsgType::CACHE_CONSOLIDATE_UNKNOWNS: {
+        // Consolidating compares every unknown against every other, so it goes to the worker
+        Job job;
+        job.work = [cache = m_cache, tol = reader.get<double>()](std::vector<char>& out) {
+          auto merged = cache->consolidate_unknowns(tol);
+
+          Writer writer(out);
+          writer.put<std::uint32_t>(static_cast<std::uint32_t>(merged.size()));
+          for (auto&&[id_old, id_new] : merged) {
+            writer.put<std::int32_t>(id_old);
+            writer.put<std::int32_t>(id_new);
+          }
+        };
+
+        client.out.resize(at);
+        post(&client, type, seq, std::move(job));
+        return;
+      }
+      default:
+        throw std::runtime_error("unknown message type");
+    }
+  } catch (const std::exception& e) {
+    // Swap the reply for an error
+    client.out.resize(at);
+    at = begin_message(client.out, type | kReply, 1, seq);
+    writer.put_bytes(e.what(), std::strlen(e.what()));
+  }
+
+  end_message(client.out, at);
+}
+
+void Server::forward_events(std::uint32_t handle, Hosted& hosted) {
+  auto& batch = hosted.batch;
+  hosted.rec->poll_batch(batch);
+  if (batch.appear.empty() && batch.disappear.empty() && batch.move.empty()) {
+    return;
+  }
+
+  auto it = m_clients.find(hosted.owner);
+  if (it == m_clients.end()) {
+    return;
+  }
+  auto& client = it->second;
+
+  // If the client isn't keeping up, it loses events rather than us running out of memory
+  if (client.out.size() - client.out_sent > m_max_backlog) {
+    ++client.dropped;
+    return;
+  }
+
+  auto at = begin_message(client.out, static_cast<std::uint16_t>(MsgType::EVENTS), 0, 0);
+  Writer writer(client.out);
+  writer.put(handle);
+  writer.put(static_cast<std::uint32_t>(batch.appear.size()));
+  writer.put(static_cast<std::uint32_t>(batch.disappear.size()));
+  writer.put(static_cast<std::uint32_t>(batch.move.size()));
+  for (auto& evt : batch.appear) {
+    put_event(writer, evt);
+  }
+  for (auto& evt : batch.disappear) {
+    put_event(writer, evt);
+  }
+  for (auto& evt : batch.move) {
+    put_event(writer, evt);
+  }
+  for (auto& enc : batch.encodings) {
+    put_encoding(writer, enc);
+  }
+  end_message(client.out, at);
+}
+
+} // namespace server
+} // namespace faces
@@ -0,0 +1,322 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef SERVER_SERVER_H
+#define SERVER_SERVER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <faces/cache.h>
+#include <faces/recognizer.h>
+#include <faces/source.h>
+#include <faces/sources/shm_source.h>
+
+namespace faces {
+namespace server {
+
+/** A latest-frame-wins source fed from the socket. */
+class QueueSource : public Source {
+  /** The pending frame. */
+  Image m_image;
+
+  /** The pending condition variable. */
+  std::condition_variable m_cond;
+
+  /** The pending mutex. */
+  std::mutex m_mutex;
+
+  /** The presence indicator. */
+  bool m_present;
+
+public:
+  QueueSource();
+
+  void update(const pybind11::object& img) final;
+
+  /**
+   * Submit a frame, replacing any unread one. The pixels are copied into the
+   * pending frame, which reuses the memory of frames the recognizer is done
+   * with.
+   *
+   * @param image The frame
+   */
+  void push(const Image& image);
+
+  std::optional<Image> wait(unsigned long millis) final;
+
+  bool wait_into(unsigned long millis, Image& frame) final;
+};
+
+/** A recognizer hosted for a client. */
+struct Hosted {
+  /** The source for frames submitted over the socket. */
+  std::unique_ptr<QueueSource> queue;
+
+  /** The source for frames from a shared memory frame ring, if attached. */
+  std::unique_ptr<sources::ShmSource> ring;
+
+  /** The recognizer. This comes after the sources, so it goes (and stops) before them. */
+  std::unique_ptr<Recognizer> rec;
+
+  /** The file descriptor of the owning client. Events go there. */
+  int owner = -1;
+
+  /** The running indicator. */
+  bool running = false;
+
+  /** The events on their way to the owner. This is kept around so polling reuses its memory. */
+  Recognizer::EventBatch batch;
+};
+
+/** A connected client. */
+struct Client {
+  /** The socket. */
+  int fd;
+
+  /** The serial number. This tells the client apart from later ones on the same socket. */
+  std::uint64_t serial = 0;
+
+  /** Received bytes not yet handled. */
+  std::vector<char> in;
+
+  /** Bytes waiting to be sent. */
+  std::vector<char> out;
+
+  /** The number of bytes at the front of the output already sent. */
+  std::size_t out_sent = 0;
+
+  /** The handles of the recognizers this client owns. */
+  std::vector<std::uint32_t> recognizers;
+
+  /** The number of event batches dropped because the client fell behind. */
+  unsigned long long dropped = 0;
+
+  /** The waiting indicator. While a job runs for the client, its later messages wait their turn. */
+  bool waiting = false;
+};
+
+/** Work taken off the poll loop, as it can block for a long time. */
+struct Job {
+  /** The socket of the client waiting on the job, or -1 if nobody is. */
+  int fd = -1;
+
+  /** The serial number of the client waiting on the job. */
+  std::uint64_t serial = 0;
+
+  /** The message type being replied to. */
+  std::uint16_t type = 0;
+
+  /** The sequence number being replied to. */
+  std::uint32_t seq = 0;
+
+  /** The work. This runs on the worker thread, and appends the body of the reply to the buffer it is given. */
+  std::function<void(std::vector<char>&)> work;
+
+  /** What to do on the poll loop once the work is done, if it succeeded. */
+  std::function<void()> done;
+
+  /** The reply, as a whole message. */
+  std::vector<char> reply;
+
+  /** The success indicator. */
+  bool succeeded = false;
+};
+
+/**
+ * The recognition daemon. It hosts recognizers for clients over a Unix domain
+ * socket, all sharing one cache. Everything but the recognition itself runs
+ * on one thread, around poll(2), except for what can block for a long time
+ * (stopping recognizers, opening frame rings, and consolidating the cache).
+ * That goes to a worker thread, which posts the replies back.
+ */
+class Server {
+  /** The socket path. */
+  std::string m_path;
+
+  /** The shared cache. */
+  Cache* m_cache;
+
+  /** How long to wait in seconds for a producer to finish creating a frame ring. */
+  double m_attach_timeout;
+
+  /** The most output in bytes a client may have pending before its events get dropped. */
+  std::size_t m_max_backlog;
+
+  /** The listening socket. */
+  int m_listen;
+
+  /** The read end of the wakeup pipe. */
+  int m_wake_read;
+
+  /** The write end of the wakeup pipe. */
+  int m_wake_write;
+
+  /** The connected clients, by socket. */
+  std::map<int, Client> m_clients;
+
+  /** The hosted recognizers, by handle. */
+  std::map<std::uint32_t, Hosted> m_hosted;
+
+  /** The next recognizer handle. */
+  std::uint32_t m_next_handle;
+
+  /** The next client serial number. */
+  std::uint64_t m_next_serial;
+
+  /** The read end of the job completion pipe. */
+  int m_done_read;
+
+  /** The write end of the job completion pipe. */
+  int m_done_write;
+
+  /** The jobs waiting for the worker. */
+  std::deque<Job> m_jobs;
+
+  /** The jobs the worker finished, waiting for the poll loop. */
+  std::deque<Job> m_done;
+
+  /** The job mutex. This guards the job queues and the quit indicator. */
+  std::mutex m_job_mutex;
+
+  /** The job condition variable. */
+  std::condition_variable m_job_cond;
+
+  /** The quit indicator. The worker quits once it runs out of jobs. */
+  bool m_quit;
+
+  /** The worker thread. */
+  std::thread m_worker;
+
+public:
+  /**
+   * Bind the server to a socket path. A stale socket at the path is replaced,
+   * but this throws if a server is still listening there or if something else
+   * is in the way.
+   *
+   * @param p_path The socket path
+   * @param p_cache The shared cache
+   * @param p_attach_timeout How long to wait in seconds for a producer to finish creating a frame ring
+   * @param p_max_backlog The most output in bytes a client may have pending before its events get dropped
+   */
+  Server(const std::string& p_path, Cache* p_cache, double p_attach_timeout, std::size_t p_max_backlog);
+
+  Server(const Server& rhs) = delete;
+
+  ~Server();
+
+  Server& operator=(const Server& rhs) = delete;
+
+  /** Serve until stopped. */
+  void run();
+
+  /** Stop serving. This is safe to call from a signal handler. */
+  void stop();
+
+private:
+  /** Accept pending connections. */
+  void accept_clients();
+
+  /**
+   * Read from a client and handle any complete messages.
+   *
+   * @param client The client
+   * @return True to keep the client, otherwise false
+   */
+  bool receive(Client& client);
+
+  /**
+   * Handle the complete messages a client has sent, up to the first one that
+   * has to wait on the worker.
+   *
+   * @param client The client
+   * @return True to keep the client, otherwise false
+   */
+  bool dispatch(Client& client);
+
+  /**
+   * Send as much pending output to a client as it will take.
+   *
+   * @param client The client
+   * @return True to keep the client, otherwise false
+   */
+  bool flush(Client& client);
+
+  /**
+   * Disconnect a client, destroying its recognizers.
+   *
+   * @param fd The client socket
+   */
+  void disconnect(int fd);
+
+  /**
+   * Handle a message.
+   *
+   * @param client The sending client
+   * @param type The message type
+   * @param seq The sequence number
+   * @param body The message body
+   * @param size The size of the body
+   */
+  void handle(Client& client, std::uint16_t type, std::uint32_t seq, const char* body, std::size_t size);
+
+  /**
+   * Send the pending events of a recognizer to its owner.
+   *
+   * @param handle The recognizer handle
+   * @param hosted The recognizer
+   */
+  void forward_events(std::uint32_t handle, Hosted& hosted);
+
+  /**
+   * Look up a recognizer owned by a client.
+   *
+   * @param client The client
+   * @param handle The recognizer handle
+   * @return The recognizer
+   */
+  Hosted& lookup(const Client& client, std::uint32_t handle);
+
+  /**
+   * Take a recognizer out of service. It stops and goes away on the worker.
+   *
+   * @param handle The recognizer handle
+   * @return The job that destroys it
+   */
+  Job retire(std::uint32_t handle);
+
+  /**
+   * Hand a job to the worker. Its client gets no more messages handled until
+   * the reply is posted back.
+   *
+   * @param client The client to reply to, or nullptr for none
+   * @param type The message type being replied to
+   * @param seq The sequence number being replied to
+   * @param job The job
+   */
+  void post(Client* client, std::uint16_t type, std::uint32_t seq, Job job);
+
+  /** Run jobs until told to quit. This is the body of the worker thread. */
+  void work();
+
+  /** Send the replies of finished jobs, and pick up where their clients left off. */
+  void finish_jobs();
+};
+
+} // namespace server
+} // namespace faces
+
+#endif // #ifndef SERVER_SERVER_H
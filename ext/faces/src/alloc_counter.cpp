@@ -0,0 +1,154 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "alloc_counter.h"
+
+namespace faces {
+namespace alloc_counter {
+
+#ifdef FACES_COUNT_ALLOCATIONS
+
+namespace {
+
+/** The number of heap allocations the thread has made. This is plain data, so it needs no setup. */
+thread_local std::uint64_t g_count = 0;
+
+/**
+ * Allocate memory and count it.
+ *
+ * @param size The size in bytes
+ * @param align The alignment, or zero for the default
+ * @return The memory, or null on failure
+ */
+void* allocate(std::size_t size, std::size_t align) {
+  ++g_count;
+
+  // Zero-byte allocations must still return distinct pointers
+  if (size == 0) {
+    size = 1;
+  }
+
+  if (align <= alignof(std::max_align_t)) {
+    return std::malloc(size);
+  }
+
+  void* ptr = nullptr;
+  if (posix_memalign(&ptr, align, size) != 0) {
+    return nullptr;
+  }
+  return ptr;
+}
+
+/**
+ * Allocate memory and count it, throwing on failure.
+ *
+ * @param size The size in bytes
+ * @param align The alignment, or zero for the default
+ * @return The memory
+ */
+void* allocate_or_throw(std::size_t size, std::size_t align) {
+  auto ptr = allocate(size, align);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+} // namespace
+
+std::uint64_t get_thread_count() {
+  return g_count;
+}
+
+#else
+
+std::uint64_t get_thread_count() {
+  return 0;
+}
+
+#endif
+
+} // namespace alloc_counter
+} // namespace faces
+
+#ifdef FACES_COUNT_ALLOCATIONS
+
+// Replace every form of the global operator new, so nothing gets by uncounted
+// Every form allocates with malloc(3), so every form of delete frees with free(3)
+
+using faces::alloc_counter::allocate;
+using faces::alloc_counter::allocate_or_throw;
+
+void* operator new(std::size_t size) {
+  return allocate_or_throw(size, 0);
+}
+
+void* operator new[](std::size_t size) {
+  return allocate_or_throw(size, 0);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return allocate(size, 0);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return allocate(size, 0);
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+  return allocate_or_throw(size, static_cast<std::size_t>(align));
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+  return allocate_or_throw(size, static_cast<std::size_t>(align));
+}
+
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+  return allocate(size, static_cast<std::size_t>(align));
+}
+
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+  return allocate(size, static_cast<std::size_t>(align));
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+#endif
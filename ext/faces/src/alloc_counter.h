@@ -0,0 +1,35 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <cstdint>
+
+namespace faces {
+namespace alloc_counter {
+
+/**
+ * Whether heap allocations are being counted. Counting replaces the global
+ * operator new, so it is a debug feature, only built in with the CMake option
+ * FACES_COUNT_ALLOCATIONS.
+ */
+#ifdef FACES_COUNT_ALLOCATIONS
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+/**
+ * @return The number of heap allocations the calling thread has made so far (always zero unless enabled)
+ */
+std::uint64_t get_thread_count();
+
+} // namespace alloc_counter
+} // namespace faces
+
+#endif // #ifndef ALLOC_COUNTER_H
@@ -10,6 +10,10 @@
 
 namespace faces {
 
+void Cache::touch(const std::vector<int>&) const {
+  // Faces are never forgotten, so there is nothing to do
+}
+
 void Cache::validate_user_id(int id) {
   // User-given IDs cannot be negative
   // This range is reserved for temporary face IDs
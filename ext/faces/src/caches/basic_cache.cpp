@@ -5,31 +5,300 @@
  * InsertLicenseText
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <limits>
 #include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
 #include <faces/encoding.h>
 #include <faces/caches/basic_cache.h>
 
+#include "cluster.h"
+
 namespace faces {
 namespace caches {
 
+/**
+ * An identity in the cache. This is one face with one or more prototype
+ * encodings (like from several photos).
+ */
+struct Identity {
+  /** The prototype encodings. The first one is the one given at insertion. */
+  std::vector<Encoding> prototypes;
+
+  /** The mean of the prototypes. */
+  Encoding centroid;
+
+  /** The distance from the centroid to the farthest prototype. */
+  double radius;
+
+  explicit Identity(const Encoding& face);
+
+  /**
+   * Add a prototype encoding.
+   *
+   * @param face The face encoding
+   */
+  void add(const Encoding& face);
+
+  /**
+   * Check whether a face matches any of the prototypes.
+   *
+   * @param face The face encoding
+   * @param tol The query tolerance
+   * @param tol_sq The square of the query tolerance
+   * @return True if a prototype matches, otherwise false
+   */
+  bool match(const Encoding& face, double tol, double tol_sq) const;
+};
+
+Identity::Identity(const Encoding& face)
+    : prototypes {face}
+    , centroid(face)
+    , radius(0) {
+}
+
+void Identity::add(const Encoding& face) {
+  prototypes.push_back(face);
+
+  // Recompute the centroid
+  Encoding::vector_type mean {};
+  for (auto& prototype : prototypes) {
+    auto vec = prototype.get_vector();
+    for (std::size_t i = 0; i < mean.size(); ++i) {
+      mean[i] += vec[i];
+    }
+  }
+  for (auto& x : mean) {
+    x /= static_cast<double>(prototypes.size());
+  }
+  centroid.set_vector(mean);
+
+  // Recompute the radius
+  radius = 0;
+  for (auto& prototype : prototypes) {
+    radius = std::max(radius, std::sqrt(centroid.compare(prototype)));
+  }
+}
+
+bool Identity::match(const Encoding& face, double tol, double tol_sq) const {
+  auto dist_sq = centroid.compare(face);
+
+  // With only one prototype, the centroid is the prototype
+  if (radius == 0) {
+    return dist_sq < tol_sq;
+  }
+
+  // Every prototype lies within the radius of the centroid
+  // By the triangle inequality, none can be closer to the face than this
+  // If even that is too far, we can skip the whole identity
+  if (std::sqrt(dist_sq) - radius >= tol) {
+    return false;
+  }
+
+  for (auto& prototype : prototypes) {
+    if (prototype.compare(face) < tol_sq) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 struct BasicCacheImpl {
   /** The face backing store. */
-  std::map<int, Encoding> m_faces;
+  std::map<int, Identity> m_faces;
 
   /** The next face ID for unknown faces. */
   int m_unknown_id;
 
-  BasicCacheImpl();
+  /**
+   * Guards the backing store. The recognition thread queries while Python
+   * threads may be changing things, so queries share and changes exclude.
+   */
+  mutable std::shared_mutex m_mutex;
+
+  /** The current epoch. This is atomic so it can be checked without locking. */
+  std::atomic<std::uint64_t> m_epoch;
+
+  /** The most recent changes and the epochs they led to, oldest first. */
+  std::deque<std::pair<std::uint64_t, Cache::Change>> m_journal;
+
+  /** The most changes the journal holds. */
+  std::size_t m_journal_size;
+
+  /**
+   * When each unknown face was last matched (or inserted) in nanoseconds on
+   * the steady clock. Queries only hold a shared lock, so these are atomic.
+   */
+  std::map<int, std::atomic<std::int64_t>> m_last_used;
+
+  /** The maximum number of unknown faces, or zero for no limit. */
+  std::size_t m_unknown_capacity;
+
+  /** The time to live of unknown faces in nanoseconds, or zero for forever. */
+  std::int64_t m_unknown_ttl;
+
+  /** The number of unknown faces evicted for capacity. */
+  unsigned long long m_evicted_capacity;
+
+  /** The number of unknown faces evicted for age. */
+  unsigned long long m_evicted_expired;
+
+  /** Guards the eviction callbacks and pending evictions. */
+  std::mutex m_evict_mutex;
+
+  /** All registered eviction callbacks. */
+  std::vector<BasicCache::CbEvict> m_cbs_evict;
+
+  /** Pending eviction events. */
+  std::vector<std::pair<int, BasicCache::Eviction>> m_evts_evict;
+
+  explicit BasicCacheImpl(std::size_t p_journal_size);
+
+  /**
+   * @return The current time in nanoseconds on the steady clock
+   */
+  static std::int64_t now();
+
+  /**
+   * Evict an unknown face. The backing store must be locked for writing.
+   *
+   * @param id The face ID
+   * @param reason The reason for eviction
+   */
+  void evict(int id, BasicCache::Eviction reason);
+
+  /**
+   * Evict all unknown faces past their time to live. The backing store must be
+   * locked for writing.
+   *
+   * @param time The current time
+   * @return The number of faces evicted
+   */
+  std::size_t evict_expired(std::int64_t time);
+
+  /**
+   * Evict the least recently matched unknown faces until only so many are
+   * left. The backing store must be locked for writing.
+   *
+   * @param count The number of unknown faces to leave
+   */
+  void evict_down_to(std::size_t count);
+
+  /**
+   * Record a change. The backing store must be locked for writing.
+   *
+   * @param change The change
+   */
+  void record(const Cache::Change& change);
 };
 
-BasicCacheImpl::BasicCacheImpl()
+BasicCacheImpl::BasicCacheImpl(std::size_t p_journal_size)
     : m_faces()
-    , m_unknown_id(-1) {
+    , m_unknown_id(-1)
+    , m_mutex()
+    , m_epoch(0)
+    , m_journal()
+    , m_journal_size(p_journal_size)
+    , m_last_used()
+    , m_unknown_capacity(0)
+    , m_unknown_ttl(0)
+    , m_evicted_capacity(0)
+    , m_evicted_expired(0)
+    , m_evict_mutex()
+    , m_cbs_evict()
+    , m_evts_evict() {
+}
+
+void BasicCacheImpl::record(const Cache::Change& change) {
+  auto epoch = m_epoch.load(std::memory_order_relaxed) + 1;
+
+  // Forget the oldest change once the journal is full
+  if (m_journal.size() >= m_journal_size) {
+    m_journal.pop_front();
+  }
+  m_journal.emplace_back(epoch, change);
+
+  m_epoch.store(epoch, std::memory_order_release);
+}
+
+std::int64_t BasicCacheImpl::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void BasicCacheImpl::evict(int id, BasicCache::Eviction reason) {
+  m_faces.erase(id);
+  m_last_used.erase(id);
+  record({Cache::Change::Kind::REMOVE, id, 0});
+
+  if (reason == BasicCache::Eviction::CAPACITY) {
+    ++m_evicted_capacity;
+  } else {
+    ++m_evicted_expired;
+  }
+
+  // Enqueue an eviction event
+  std::lock_guard lock(m_evict_mutex);
+  m_evts_evict.emplace_back(id, reason);
+}
+
+std::size_t BasicCacheImpl::evict_expired(std::int64_t time) {
+  if (m_unknown_ttl == 0) {
+    return 0;
+  }
+
+  // Find the faces nobody has matched in a while
+  std::vector<int> expired;
+  for (auto&&[id, last_used] : m_last_used) {
+    if (time - last_used.load(std::memory_order_relaxed) > m_unknown_ttl) {
+      expired.push_back(id);
+    }
+  }
+
+  for (auto id : expired) {
+    evict(id, BasicCache::Eviction::EXPIRED);
+  }
+
+  return expired.size();
 }
 
-BasicCache::BasicCache() : impl() {
-  impl = std::make_unique<BasicCacheImpl>();
+void BasicCacheImpl::evict_down_to(std::size_t count) {
+  if (m_last_used.size() <= count) {
+    return;
+  }
+
+  // Order just enough of the unknown faces by when they were last matched
+  // That gets us the least recently matched ones without sorting them all
+  std::vector<std::pair<std::int64_t, int>> by_age;
+  by_age.reserve(m_last_used.size());
+  for (auto&&[id, last_used] : m_last_used) {
+    by_age.emplace_back(last_used.load(std::memory_order_relaxed), id);
+  }
+
+  auto excess = by_age.size() - count;
+  std::nth_element(by_age.begin(), by_age.begin() + static_cast<std::ptrdiff_t>(excess - 1), by_age.end());
+
+  for (std::size_t i = 0; i < excess; ++i) {
+    evict(by_age[i].second, BasicCache::Eviction::CAPACITY);
+  }
+}
+
+BasicCache::BasicCache(std::size_t journal_size) : impl() {
+  if (journal_size < 1) {
+    throw std::runtime_error("journal size must be at least one");
+  }
+
+  impl = std::make_unique<BasicCacheImpl>(journal_size);
 }
 
 BasicCache::~BasicCache() = default;
@@ -38,6 +307,9 @@ void BasicCache::insert(int id, const Encoding& face) {
   // Validate new face ID
   validate_user_id(id);
 
+  // Lock the backing store for writing
+  std::unique_lock lock(impl->m_mutex);
+
   // If this ID is not not already in use
   // In other words, if this ID is already in use
   if (impl->m_faces.find(id) != impl->m_faces.end()) {
@@ -45,21 +317,59 @@ void BasicCache::insert(int id, const Encoding& face) {
   }
 
   // Copy in the new face encoding
-  impl->m_faces[id] = face;
+  impl->m_faces.emplace(id, face);
+  impl->record({Change::Kind::INSERT, id, 0});
+}
+
+void BasicCache::insert_prototype(int id, const Encoding& face) {
+  // Lock the backing store for writing
+  std::unique_lock lock(impl->m_mutex);
+
+  // Look up the face by its ID
+  auto where = impl->m_faces.find(id);
+
+  // If face was not found
+  if (where == impl->m_faces.end()) {
+    throw std::runtime_error("unknown face id");
+  }
+
+  // Add the encoding as another prototype
+  // This may make the face match where it didn't before, so it counts as an insertion
+  where->second.add(face);
+  impl->record({Change::Kind::INSERT, id, 0});
 }
 
 int BasicCache::insert_unknown(const faces::Encoding& face) {
+  // Lock the backing store for writing
+  std::unique_lock lock(impl->m_mutex);
+
+  // Make room for the new face
+  auto time = BasicCacheImpl::now();
+  impl->evict_expired(time);
+  if (impl->m_unknown_capacity) {
+    impl->evict_down_to(impl->m_unknown_capacity - 1);
+  }
+
   // Generate a new ID for unknown faces
-  // We shouldn't need to worry about collisions (the user will probably rename, anyway)
-  int id = impl->m_unknown_id--;
+  // IDs wrap around before running out, skipping the ones still in use
+  int id;
+  do {
+    id = impl->m_unknown_id;
+    impl->m_unknown_id = id == std::numeric_limits<int>::min() ? -1 : id - 1;
+  } while (impl->m_faces.find(id) != impl->m_faces.end());
 
   // Copy in the new face encoding
-  impl->m_faces[id] = face;
+  impl->m_faces.emplace(id, face);
+  impl->m_last_used[id] = time;
+  impl->record({Change::Kind::INSERT, id, 0});
 
   return id;
 }
 
 void BasicCache::remove(int id) {
+  // Lock the backing store for writing
+  std::unique_lock lock(impl->m_mutex);
+
   // Look up the doomed face by its ID
   auto where = impl->m_faces.find(id);
 
@@ -70,12 +380,17 @@ void BasicCache::remove(int id) {
 
   // Delete the encoding
   impl->m_faces.erase(where);
+  impl->m_last_used.erase(id);
+  impl->record({Change::Kind::REMOVE, id, 0});
 }
 
 void BasicCache::rename(int id_old, int id_new) {
   // Validate new face ID
   validate_user_id(id_new);
 
+  // Lock the backing store for writing
+  std::unique_lock lock(impl->m_mutex);
+
   // Look up the old face by its ID
   auto where = impl->m_faces.find(id_old);
 
@@ -84,17 +399,23 @@ void BasicCache::rename(int id_old, int id_new) {
     throw std::runtime_error("unknown old face id");
   }
 
-  // Copy the face encoding out of the map
-  auto face = where->second;
-
-  // Erase the old mapping
-  impl->m_faces.erase(where);
-
-  // Copy the face mapping into the new location
-  impl->m_faces[id_new] = face;
+  // Take the face out of the map
+  // A renamed unknown face is known from now on, so it is no longer up for eviction
+  auto node = impl->m_faces.extract(where);
+  impl->m_last_used.erase(id_old);
+
+  // Put the face back in under the new ID
+  // If the new ID is in use, the face there is replaced
+  impl->m_faces.erase(id_new);
+  node.key() = id_new;
+  impl->m_faces.insert(std::move(node));
+  impl->record({Change::Kind::RENAME, id_old, id_new});
 }
 
 const Encoding& BasicCache::retrieve(int id) const {
+  // Lock the backing store for reading
+  std::shared_lock lock(impl->m_mutex);
+
   // Look up the face by its ID
   auto where = impl->m_faces.find(id);
 
@@ -103,8 +424,11 @@ const Encoding& BasicCache::retrieve(int id) const {
     throw std::runtime_error("unknown face id");
   }
 
-  // Copy out the encoding
-  return where->second;
+  // Copy out the first prototype encoding
+  // The copy is per thread, so it outlives the lock and any removal after it
+  thread_local Encoding copy;
+  copy = where->second.prototypes.front();
+  return copy;
 }
 
 int BasicCache::query(const Encoding& face, double tol) const {
@@ -112,20 +436,242 @@ int BasicCache::query(const Encoding& face, double tol) const {
   // By comparing squares, we can avoid costly sqrt(3) calls
   auto tol_sq = tol * tol;
 
+  // Lock the backing store for reading
+  std::shared_lock lock(impl->m_mutex);
+
   // The matched face ID
   int matched_id = 0;
 
   // Find the first matching face
   // If no faces match, then we leave matched_id at zero
   for (auto&&[id, known] : impl->m_faces) {
-    if (known.compare(face) < tol_sq) {
+    if (known.match(face, tol, tol_sq)) {
       matched_id = id;
       break;
     }
   }
 
+  // Keep matched unknown faces fresh
+  if (matched_id < 0) {
+    auto last_used_it = impl->m_last_used.find(matched_id);
+    if (last_used_it != impl->m_last_used.end()) {
+      last_used_it->second.store(BasicCacheImpl::now(), std::memory_order_relaxed);
+    }
+  }
+
   return matched_id;
 }
 
+void BasicCache::touch(const std::vector<int>& ids) const {
+  // Lock the backing store for reading
+  // Like query(), this only refreshes times, which are atomic
+  std::shared_lock lock(impl->m_mutex);
+
+  // Keep the touched unknown faces fresh
+  // Known faces are never evicted, so they have no time to refresh
+  auto time = BasicCacheImpl::now();
+  for (auto id : ids) {
+    auto last_used_it = impl->m_last_used.find(id);
+    if (last_used_it != impl->m_last_used.end()) {
+      last_used_it->second.store(time, std::memory_order_relaxed);
+    }
+  }
+}
+
+std::map<int, int> BasicCache::consolidate_unknowns(double tol) {
+  // Copy out the unknown faces
+  // Clustering takes a while, so it runs on the copy without holding anything up
+  std::vector<ClusterFace> faces;
+  {
+    std::shared_lock lock(impl->m_mutex);
+
+    for (auto&&[id, identity] : impl->m_faces) {
+      // The map is ordered, so the unknown faces come first
+      if (id >= 0) {
+        break;
+      }
+
+      ClusterFace face {id, {}, identity.centroid.get_vector(), identity.radius};
+      for (auto& prototype : identity.prototypes) {
+        face.prototypes.push_back(prototype.get_vector());
+      }
+      faces.push_back(std::move(face));
+    }
+  }
+
+  auto clusters = cluster_faces(faces, tol, ClusterLimits());
+
+  // Lock the backing store for writing
+  std::unique_lock lock(impl->m_mutex);
+
+  std::map<int, int> merged;
+  for (auto& cluster : clusters) {
+    // Faces may have been removed (or evicted) in the meantime, so skip those
+    std::vector<std::map<int, Identity>::iterator> members;
+    for (auto index : cluster) {
+      auto where = impl->m_faces.find(faces[index].id);
+      if (where != impl->m_faces.end()) {
+        members.push_back(where);
+      }
+    }
+    if (members.size() < 2) {
+      continue;
+    }
+
+    // Keep the oldest face, which has the ID closest to zero
+    auto survivor = *std::max_element(members.begin(), members.end(), [](auto& a, auto& b) {
+      return a->first < b->first;
+    });
+    auto survivor_id = survivor->first;
+    auto& survivor_used = impl->m_last_used.try_emplace(survivor_id, 0).first->second;
+
+    for (auto& member : members) {
+      if (member == survivor) {
+        continue;
+      }
+
+      auto id = member->first;
+
+      // Fold the face into the survivor
+      for (auto& prototype : member->second.prototypes) {
+        survivor->second.add(prototype);
+      }
+
+      // The survivor was last matched whenever any of its parts was
+      auto last_used_it = impl->m_last_used.find(id);
+      if (last_used_it != impl->m_last_used.end()) {
+        auto last_used = last_used_it->second.load(std::memory_order_relaxed);
+        if (last_used > survivor_used.load(std::memory_order_relaxed)) {
+          survivor_used.store(last_used, std::memory_order_relaxed);
+        }
+        impl->m_last_used.erase(last_used_it);
+      }
+
+      // To anybody following along, the face was renamed to the survivor
+      impl->m_faces.erase(member);
+      impl->record({Change::Kind::RENAME, id, survivor_id});
+      merged[id] = survivor_id;
+    }
+
+    // The survivor has new prototypes, which counts as an insertion
+    impl->record({Change::Kind::INSERT, survivor_id, 0});
+  }
+
+  return merged;
+}
+
+std::uint64_t BasicCache::get_epoch() const {
+  return impl->m_epoch.load(std::memory_order_acquire);
+}
+
+bool BasicCache::get_changes(std::uint64_t since, std::vector<Change>& changes) const {
+  // Lock the backing store for reading
+  std::shared_lock lock(impl->m_mutex);
+
+  // If nothing happened since, there is nothing to do
+  auto epoch = impl->m_epoch.load(std::memory_order_relaxed);
+  if (since >= epoch) {
+    return true;
+  }
+
+  // If the change right after the given epoch was forgotten, we can't help
+  if (impl->m_journal.empty() || impl->m_journal.front().first > since + 1) {
+    return false;
+  }
+
+  // Copy out all changes after the given epoch
+  // Epochs go up by one per entry, so we can skip right to the first
+  auto first = impl->m_journal.begin() + static_cast<std::ptrdiff_t>(since + 1 - impl->m_journal.front().first);
+  for (auto it = first; it != impl->m_journal.end(); ++it) {
+    changes.push_back(it->second);
+  }
+
+  return true;
+}
+
+std::size_t BasicCache::get_unknown_capacity() const {
+  // Lock the backing store for reading
+  std::shared_lock lock(impl->m_mutex);
+
+  return impl->m_unknown_capacity;
+}
+
+void BasicCache::set_unknown_capacity(std::size_t p_unknown_capacity) {
+  // Lock the backing store for writing
+  std::unique_lock lock(impl->m_mutex);
+
+  impl->m_unknown_capacity = p_unknown_capacity;
+
+  // Shed any faces over the new limit
+  if (impl->m_unknown_capacity) {
+    impl->evict_down_to(impl->m_unknown_capacity);
+  }
+}
+
+double BasicCache::get_unknown_ttl() const {
+  // Lock the backing store for reading
+  std::shared_lock lock(impl->m_mutex);
+
+  return static_cast<double>(impl->m_unknown_ttl) / 1e9;
+}
+
+void BasicCache::set_unknown_ttl(double p_unknown_ttl) {
+  if (p_unknown_ttl < 0) {
+    throw std::runtime_error("time to live cannot be negative");
+  }
+
+  // Lock the backing store for writing
+  std::unique_lock lock(impl->m_mutex);
+
+  impl->m_unknown_ttl = static_cast<std::int64_t>(p_unknown_ttl * 1e9);
+}
+
+std::size_t BasicCache::expire() {
+  // Lock the backing store for writing
+  std::unique_lock lock(impl->m_mutex);
+
+  return impl->evict_expired(BasicCacheImpl::now());
+}
+
+BasicCache::Stats BasicCache::get_stats() const {
+  // Lock the backing store for reading
+  std::shared_lock lock(impl->m_mutex);
+
+  Stats stats;
+  stats.unknown = impl->m_last_used.size();
+  stats.known = impl->m_faces.size() - stats.unknown;
+  stats.evicted_capacity = impl->m_evicted_capacity;
+  stats.evicted_expired = impl->m_evicted_expired;
+  return stats;
+}
+
+void BasicCache::register_evict(CbEvict cb) {
+  // Lock the eviction mutex
+  std::lock_guard lock(impl->m_evict_mutex);
+
+  // Save the callback
+  impl->m_cbs_evict.push_back(cb);
+}
+
+void BasicCache::poll() {
+  // Take all pending events and the callbacks to send them to
+  // Callbacks are free to call back into us, so the mutex is not held while they run
+  decltype(impl->m_evts_evict) evts_evict;
+  decltype(impl->m_cbs_evict) cbs_evict;
+  {
+    std::lock_guard lock(impl->m_evict_mutex);
+    evts_evict.swap(impl->m_evts_evict);
+    cbs_evict = impl->m_cbs_evict;
+  }
+
+  // For each pending event
+  for (auto&&[id, reason] : evts_evict) {
+    // For each receiving callback
+    for (auto& cb : cbs_evict) {
+      cb(id, reason);
+    }
+  }
+}
+
 } // namespace caches
 } // namespace faces
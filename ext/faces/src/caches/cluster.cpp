@@ -0,0 +1,230 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include <faces/trace.h>
+
+#include "cluster.h"
+
+namespace faces {
+namespace caches {
+
+namespace {
+
+/**
+ * Check whether two faces are neighbors.
+ *
+ * @param a The first face
+ * @param b The second face
+ * @param tol The tolerance
+ * @param tol_sq The square of the tolerance
+ * @return True if any two of their prototypes are closer than the tolerance, otherwise false
+ */
+bool neighbors(const ClusterFace& a, const ClusterFace& b, double tol, double tol_sq) {
+  auto dist = std::sqrt(distance_sq(a.centroid, b.centroid));
+
+  // Every prototype lies within its radius of its centroid
+  // By the triangle inequality, no two prototypes can be closer than this
+  if (dist - a.radius - b.radius >= tol) {
+    return false;
+  }
+
+  // With only one prototype each, the centroids are the prototypes
+  if (a.radius == 0 && b.radius == 0) {
+    return dist < tol;
+  }
+
+  for (auto& pa : a.prototypes) {
+    for (auto& pb : b.prototypes) {
+      if (distance_sq(pa, pb) < tol_sq) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Build the neighbor graph. The neighbors of face i are the edges from
+ * offsets[i] up to offsets[i + 1].
+ *
+ * @param faces The faces
+ * @param tol The tolerance
+ * @param faces_per_thread The fewest faces per thread
+ * @param offsets The edge offsets (filled in)
+ * @param edges The edges (filled in)
+ */
+void build_graph(const std::vector<ClusterFace>& faces, double tol, std::size_t faces_per_thread,
+    std::vector<std::size_t>& offsets, std::vector<std::size_t>& edges) {
+  trace::Span span_graph("neighbor graph");
+
+  auto n = faces.size();
+  auto tol_sq = tol * tol;
+
+  // Every pair gets compared once, so this is quadratic
+  // Spread the rows over the cores, interleaved, as the rows get shorter toward the end
+  // Small caches aren't worth the threads
+  std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, n / std::max<std::size_t>(faces_per_thread, 1) + 1);
+
+  std::vector<std::vector<std::pair<std::size_t, std::size_t>>> found(threads);
+  auto work = [&](std::size_t t) {
+    for (auto i = t; i < n; i += threads) {
+      for (auto j = i + 1; j < n; ++j) {
+        if (neighbors(faces[i], faces[j], tol, tol_sq)) {
+          found[t].emplace_back(i, j);
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (std::size_t t = 1; t < threads; ++t) {
+    workers.emplace_back(work, t);
+  }
+  work(0);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  // Lay the edges out by face, both ways
+  offsets.assign(n + 1, 0);
+  for (auto& pairs : found) {
+    for (auto&&[i, j] : pairs) {
+      ++offsets[i + 1];
+      ++offsets[j + 1];
+    }
+  }
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+  edges.resize(offsets[n]);
+  auto fill = std::vector<std::size_t>(offsets.begin(), offsets.end() - 1);
+  for (auto& pairs : found) {
+    for (auto&&[i, j] : pairs) {
+      edges[fill[i]++] = j;
+      edges[fill[j]++] = i;
+    }
+  }
+}
+
+/**
+ * Label the faces with Chinese Whispers. Every face starts out in its own
+ * cluster, and then, over and over, each face joins the cluster most of its
+ * neighbors are in, until nothing changes.
+ *
+ * @param offsets The edge offsets
+ * @param edges The edges
+ * @param max_rounds The most rounds to run
+ * @return The cluster label of each face
+ */
+std::vector<std::size_t> chinese_whispers(const std::vector<std::size_t>& offsets,
+    const std::vector<std::size_t>& edges, int max_rounds) {
+  trace::Span span_whispers("chinese whispers");
+
+  auto n = offsets.size() - 1;
+
+  std::vector<std::size_t> labels(n);
+  std::iota(labels.begin(), labels.end(), 0);
+
+  // Visit the faces in a different order every round, so no face always gets the last word
+  // The seed is fixed, so the same faces always cluster the same way
+  std::vector<std::size_t> order(labels);
+  std::mt19937 rng(0);
+
+  std::vector<std::size_t> votes;
+
+  // Give up eventually, as it may flip-flop forever
+  for (int round = 0; round < max_rounds; ++round) {
+    std::shuffle(order.begin(), order.end(), rng);
+
+    bool changed = false;
+    for (auto i : order) {
+      if (offsets[i] == offsets[i + 1]) {
+        continue;
+      }
+
+      // Tally the labels of the neighbors
+      // Ties go to the smallest label
+      votes.clear();
+      for (auto e = offsets[i]; e < offsets[i + 1]; ++e) {
+        votes.push_back(labels[edges[e]]);
+      }
+      std::sort(votes.begin(), votes.end());
+
+      auto best = votes.front();
+      std::size_t best_count = 0;
+      for (std::size_t v = 0; v < votes.size();) {
+        auto w = v;
+        while (w < votes.size() && votes[w] == votes[v]) {
+          ++w;
+        }
+        if (w - v > best_count) {
+          best = votes[v];
+          best_count = w - v;
+        }
+        v = w;
+      }
+
+      if (labels[i] != best) {
+        labels[i] = best;
+        changed = true;
+      }
+    }
+
+    if (!changed) {
+      break;
+    }
+  }
+
+  return labels;
+}
+
+} // namespace
+
+std::vector<std::vector<std::size_t>> cluster_faces(const std::vector<ClusterFace>& faces, double tol,
+    const ClusterLimits& limits) {
+  trace::Span span_cluster("cluster faces");
+
+  if (faces.size() < 2) {
+    return {};
+  }
+
+  std::vector<std::size_t> offsets;
+  std::vector<std::size_t> edges;
+  build_graph(faces, tol, limits.faces_per_thread, offsets, edges);
+
+  auto labels = chinese_whispers(offsets, edges, limits.max_rounds);
+
+  // Gather the clusters, in order of their first face
+  std::unordered_map<std::size_t, std::size_t> cluster_of;
+  std::vector<std::vector<std::size_t>> clusters;
+  for (std::size_t i = 0; i < faces.size(); ++i) {
+    auto it = cluster_of.emplace(labels[i], clusters.size()).first;
+    if (it->second == clusters.size()) {
+      clusters.emplace_back();
+    }
+    clusters[it->second].push_back(i);
+  }
+
+  // Lone faces have nothing to merge with
+  clusters.erase(std::remove_if(clusters.begin(), clusters.end(), [](auto& cluster) {
+    return cluster.size() < 2;
+  }), clusters.end());
+
+  return clusters;
+}
+
+} // namespace caches
+} // namespace faces
@@ -0,0 +1,63 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef CACHES_CLUSTER_H
+#define CACHES_CLUSTER_H
+
+#include <cstddef>
+#include <vector>
+
+#include <faces/encoding.h>
+
+namespace faces {
+namespace caches {
+
+/** A face up for clustering. Caches fill these in from their own storage. */
+struct ClusterFace {
+  /** The face ID. */
+  int id;
+
+  /** The prototype face vectors. */
+  std::vector<Encoding::vector_type> prototypes;
+
+  /** The mean of the prototypes. */
+  Encoding::vector_type centroid;
+
+  /** The distance from the centroid to the farthest prototype. */
+  double radius;
+};
+
+/** Limits on how much work clustering may do. */
+struct ClusterLimits {
+  /** The fewest faces each thread gets when building the neighbor graph. Smaller caches use fewer threads. */
+  std::size_t faces_per_thread = 256;
+
+  /** The most rounds of Chinese Whispers to run before giving up on settling. */
+  int max_rounds = 100;
+};
+
+/**
+ * Group faces that are likely the same person.
+ *
+ * Two faces are neighbors if any of their prototypes are closer than the
+ * tolerance (the same rule a query uses). The neighbor graph is built across
+ * threads, and then clustered with Chinese Whispers, so chains of neighbors
+ * don't snowball into one big cluster the way they would with plain
+ * connected components.
+ *
+ * @param faces The faces
+ * @param tol The tolerance
+ * @param limits The work limits
+ * @return The clusters (as indices into the faces) with more than one face each
+ */
+std::vector<std::vector<std::size_t>> cluster_faces(const std::vector<ClusterFace>& faces, double tol,
+    const ClusterLimits& limits);
+
+} // namespace caches
+} // namespace faces
+
+#endif // #ifndef CACHES_CLUSTER_H
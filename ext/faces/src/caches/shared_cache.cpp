@@ -0,0 +1,979 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <faces/encoding.h>
+#include <faces/caches/shared_cache.h>
+
+#include "cluster.h"
+
+namespace faces {
+namespace caches {
+
+namespace {
+
+/** The segment magic number ("COZFACES"). */
+constexpr std::uint64_t kMagic = 0x434f5a4641434553;
+
+/** The segment layout version. Bump this when the layout changes. */
+constexpr std::uint32_t kVersion = 2;
+
+/** The most prototype encodings per face that a segment may be set up for. */
+constexpr std::uint32_t kMaxMaxPrototypes = 65536;
+
+/**
+ * The number of times a reader yields to a change in progress before it goes
+ * and checks that the writer is still alive. Changes take microseconds, so
+ * this is only ever reached when a process died in the middle of one.
+ */
+constexpr unsigned kMaxSpins = 1000;
+
+// Atomics in shared memory only work across processes if they don't hide a lock
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+static_assert(std::is_trivially_copyable_v<Encoding::vector_type>);
+static_assert(std::is_trivially_copyable_v<Cache::Change>);
+
+/** The header at the start of the segment. */
+struct SharedHeader {
+  /** The magic number. This is set last, once the segment is ready. */
+  std::atomic<std::uint64_t> magic;
+
+  /** The layout version. */
+  std::uint32_t version;
+
+  /** The maximum number of faces. */
+  std::uint32_t capacity;
+
+  /** The number of changes remembered. */
+  std::uint32_t journal_size;
+
+  /** The maximum number of prototype encodings per face. */
+  std::uint32_t max_prototypes;
+
+  /** Serializes changes across processes. */
+  pthread_mutex_t mutex;
+
+  /** The sequence counter. This is odd while a change is in progress. */
+  std::atomic<std::uint64_t> seq;
+
+  /** The current epoch. */
+  std::atomic<std::uint64_t> epoch;
+
+  /** The number of faces. These are packed at the front of the slots. */
+  std::uint32_t count;
+
+  /** The next face ID for unknown faces. */
+  std::int32_t unknown_id;
+};
+
+/**
+ * One face in the segment. This is the shared memory version of an identity.
+ * The prototypes are kept apart, so queries that get by on the centroids scan
+ * only these. Every slot has room for the same number of prototypes, and
+ * the first one is the one given at insertion.
+ */
+struct SharedSlot {
+  /** The face ID. */
+  std::int32_t id;
+
+  /** The number of prototype encodings. */
+  std::uint32_t prototypes;
+
+  /** The distance from the centroid to the farthest prototype. */
+  double radius;
+
+  /** The mean of the prototypes. */
+  Encoding::vector_type centroid;
+};
+
+/**
+ * Where everything is in a segment. After the header come the journal, the
+ * slots, and the prototypes, in that order. The change leading to epoch e is
+ * at e % journal_size in the journal.
+ */
+struct SharedLayout {
+  /** The offset of the journal in bytes. */
+  std::size_t journal;
+
+  /** The offset of the slots in bytes. */
+  std::size_t slots;
+
+  /** The offset of the prototypes in bytes. */
+  std::size_t protos;
+
+  /** The segment size in bytes. */
+  std::size_t size;
+};
+
+/**
+ * Round an offset up to an alignment.
+ *
+ * @param offset The offset
+ * @param alignment The alignment
+ * @return The aligned offset
+ */
+constexpr std::size_t align_up(std::size_t offset, std::size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * Lay out a segment.
+ *
+ * @param capacity The maximum number of faces
+ * @param journal_size The number of changes remembered
+ * @param max_prototypes The maximum number of prototype encodings per face
+ * @return The layout
+ */
+SharedLayout segment_layout(std::size_t capacity, std::size_t journal_size, std::size_t max_prototypes) {
+  SharedLayout layout {};
+  layout.journal = align_up(sizeof(SharedHeader), alignof(Cache::Change));
+  layout.slots = align_up(layout.journal + journal_size * sizeof(Cache::Change), alignof(SharedSlot));
+  layout.protos = align_up(layout.slots + capacity * sizeof(SharedSlot), alignof(Encoding::vector_type));
+  layout.size = layout.protos + capacity * max_prototypes * sizeof(Encoding::vector_type);
+  return layout;
+}
+
+/**
+ * Check whether a face matches any prototype in a slot. This skips the slot
+ * outright if the face is too far from the centroid, just like BasicCache.
+ *
+ * @param slot The slot
+ * @param protos The prototypes of the slot
+ * @param max_prototypes The maximum number of prototypes per slot
+ * @param face The face vector
+ * @param tol The query tolerance
+ * @param tol_sq The square of the query tolerance
+ * @return True if a prototype matches, otherwise false
+ */
+bool slot_match(const SharedSlot& slot, const Encoding::vector_type* protos, std::uint32_t max_prototypes,
+    const Encoding::vector_type& face, double tol, double tol_sq) {
+  auto dist_sq = distance_sq(slot.centroid, face);
+
+  // With only one prototype, the centroid is the prototype
+  if (slot.radius == 0) {
+    return dist_sq < tol_sq;
+  }
+
+  // By the triangle inequality, no prototype can be closer than this
+  if (std::sqrt(dist_sq) - slot.radius >= tol) {
+    return false;
+  }
+
+  // The count may be torn by a racing change, in which case the result is thrown away anyway
+  auto prototypes = std::min(slot.prototypes, max_prototypes);
+  for (std::uint32_t i = 0; i < prototypes; ++i) {
+    if (distance_sq(protos[i], face) < tol_sq) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Recompute the centroid and radius of a slot.
+ *
+ * @param slot The slot
+ * @param protos The prototypes of the slot
+ */
+void slot_update(SharedSlot& slot, const Encoding::vector_type* protos) {
+  Encoding::vector_type mean {};
+  for (std::uint32_t p = 0; p < slot.prototypes; ++p) {
+    for (std::size_t i = 0; i < mean.size(); ++i) {
+      mean[i] += protos[p][i];
+    }
+  }
+  for (auto& x : mean) {
+    x /= static_cast<double>(slot.prototypes);
+  }
+  slot.centroid = mean;
+
+  slot.radius = 0;
+  for (std::uint32_t p = 0; p < slot.prototypes; ++p) {
+    slot.radius = std::max(slot.radius, std::sqrt(distance_sq(slot.centroid, protos[p])));
+  }
+}
+
+/**
+ * Throw an error for a failed system call.
+ *
+ * @param what What failed
+ */
+[[noreturn]] void throw_errno(const std::string& what) {
+  throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+} // namespace
+
+struct SharedCacheImpl {
+  /** The segment name. */
+  std::string m_name;
+
+  /** The mapped segment. */
+  void* m_map;
+
+  /** The size of the mapped segment. */
+  std::size_t m_map_size;
+
+  /** The segment header. */
+  SharedHeader* m_header;
+
+  /** The journal. */
+  Cache::Change* m_journal;
+
+  /** The face slots. */
+  SharedSlot* m_slots;
+
+  /** The prototypes of the face slots, each slot's after the last's. */
+  Encoding::vector_type* m_protos;
+
+  /** The maximum number of faces. */
+  std::uint32_t m_capacity;
+
+  /** The number of changes remembered. */
+  std::uint32_t m_journal_size;
+
+  /** The maximum number of prototype encodings per face. */
+  std::uint32_t m_max_prototypes;
+
+  explicit SharedCacheImpl(const std::string& p_name);
+
+  ~SharedCacheImpl();
+
+  /**
+   * Create and set up the segment. It must be open and empty.
+   *
+   * @param fd The segment file descriptor
+   * @param capacity The maximum number of faces
+   * @param journal_size The number of changes remembered
+   * @param max_prototypes The maximum number of prototype encodings per face
+   */
+  void create(int fd, std::size_t capacity, std::size_t journal_size, std::size_t max_prototypes);
+
+  /**
+   * Map an existing segment, waiting for its creator to finish setting it up.
+   *
+   * @param fd The segment file descriptor
+   * @param timeout How long to wait in seconds
+   */
+  void attach(int fd, double timeout);
+
+  /** Find the journal, slots, and prototypes in the mapped segment. */
+  void locate();
+
+  /**
+   * Get the prototypes of a slot.
+   *
+   * @param index The slot index
+   * @return The prototypes
+   */
+  Encoding::vector_type* prototypes(std::uint32_t index) const {
+    return m_protos + static_cast<std::size_t>(index) * m_max_prototypes;
+  }
+
+  /**
+   * Lock the process-shared mutex. If its last holder died, this repairs
+   * whatever change it left half done first.
+   */
+  void lock() const;
+
+  /**
+   * Repair the cache after a process died in the middle of a change. A
+   * change must be in progress.
+   */
+  void repair() const;
+
+  /**
+   * Run a read. The read runs again until no change raced with it, so it must
+   * not have side effects and must cope with garbage (like out-of-range counts).
+   * If a change seems stuck, this takes the lock to recover it, in case its
+   * process died.
+   *
+   * @param f The read
+   * @return The result of the last (consistent) run
+   */
+  template<class F>
+  auto read(F&& f) const;
+
+  /**
+   * Find the slot for a face. A change must be in progress.
+   *
+   * @param id The face ID
+   * @return The slot index, or the count if not found
+   */
+  std::uint32_t find(int id) const;
+
+  /**
+   * Fill the next free slot. A change must be in progress.
+   *
+   * @param id The face ID
+   * @param face The face vector
+   */
+  void append(int id, const Encoding::vector_type& face);
+
+  /**
+   * Empty a slot, moving the last one into it. A change must be in progress.
+   *
+   * @param index The slot index
+   */
+  void erase(std::uint32_t index) const;
+
+  /**
+   * Record a change. A change must be in progress.
+   *
+   * @param change The change
+   */
+  void record(const Cache::Change& change);
+};
+
+/**
+ * A change in progress. This holds the process-shared mutex and keeps the
+ * sequence counter odd, so readers know to try again.
+ */
+class SharedWriter {
+  /** The segment header. */
+  SharedHeader* m_header;
+
+public:
+  explicit SharedWriter(const SharedCacheImpl& p_impl);
+
+  SharedWriter(const SharedWriter& rhs) = delete;
+
+  ~SharedWriter();
+
+  SharedWriter& operator=(const SharedWriter& rhs) = delete;
+};
+
+SharedWriter::SharedWriter(const SharedCacheImpl& p_impl) : m_header(p_impl.m_header) {
+  p_impl.lock();
+
+  // Mark a change in progress
+  // The fence keeps the changes themselves from being seen before the mark
+  m_header->seq.store(m_header->seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+SharedWriter::~SharedWriter() {
+  // Mark the change done
+  m_header->seq.store(m_header->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+  pthread_mutex_unlock(&m_header->mutex);
+}
+
+SharedCacheImpl::SharedCacheImpl(const std::string& p_name)
+    : m_name(p_name)
+    , m_map(nullptr)
+    , m_map_size(0)
+    , m_header(nullptr)
+    , m_journal(nullptr)
+    , m_slots(nullptr)
+    , m_protos(nullptr)
+    , m_capacity(0)
+    , m_journal_size(0)
+    , m_max_prototypes(0) {
+}
+
+SharedCacheImpl::~SharedCacheImpl() {
+  if (m_map) {
+    munmap(m_map, m_map_size);
+  }
+}
+
+void SharedCacheImpl::create(int fd, std::size_t capacity, std::size_t journal_size, std::size_t max_prototypes) {
+  if (capacity == 0 || capacity > std::numeric_limits<std::int32_t>::max()) {
+    throw std::runtime_error("invalid shared cache capacity");
+  }
+  if (journal_size == 0 || journal_size > std::numeric_limits<std::uint32_t>::max()) {
+    throw std::runtime_error("invalid shared cache journal size");
+  }
+  if (max_prototypes == 0 || max_prototypes > kMaxMaxPrototypes) {
+    throw std::runtime_error("invalid shared cache prototype limit");
+  }
+
+  // Size the segment
+  // The pages are only backed once used, so a roomy capacity costs little
+  m_map_size = segment_layout(capacity, journal_size, max_prototypes).size;
+  if (ftruncate(fd, static_cast<off_t>(m_map_size)) == -1) {
+    throw_errno("cannot size shared cache");
+  }
+
+  m_map = mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (m_map == MAP_FAILED) {
+    m_map = nullptr;
+    throw_errno("cannot map shared cache");
+  }
+
+  m_header = new(m_map) SharedHeader;
+  m_capacity = static_cast<std::uint32_t>(capacity);
+  m_journal_size = static_cast<std::uint32_t>(journal_size);
+  m_max_prototypes = static_cast<std::uint32_t>(max_prototypes);
+  locate();
+
+  m_header->version = kVersion;
+  m_header->capacity = m_capacity;
+  m_header->journal_size = m_journal_size;
+  m_header->max_prototypes = m_max_prototypes;
+  m_header->seq.store(0, std::memory_order_relaxed);
+  m_header->epoch.store(0, std::memory_order_relaxed);
+  m_header->count = 0;
+  m_header->unknown_id = -1;
+
+  // Set up a mutex that works across processes and survives their deaths
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  auto err = pthread_mutex_init(&m_header->mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+  if (err != 0) {
+    errno = err;
+    throw_errno("cannot set up shared cache");
+  }
+
+  // Let other processes in
+  m_header->magic.store(kMagic, std::memory_order_release);
+}
+
+void SharedCacheImpl::attach(int fd, double timeout) {
+  // The creator may still be setting up, so give it a moment
+  auto deadline = std::chrono::steady_clock::now()
+      + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+
+  // Wait for the header to be there
+  struct stat st {};
+  for (;;) {
+    if (fstat(fd, &st) == -1) {
+      throw_errno("cannot stat shared cache");
+    }
+
+    if (static_cast<std::size_t>(st.st_size) >= sizeof(SharedHeader)) {
+      break;
+    }
+
+    if (std::chrono::steady_clock::now() > deadline) {
+      throw std::runtime_error("shared cache was never set up");
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  m_map_size = static_cast<std::size_t>(st.st_size);
+  m_map = mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (m_map == MAP_FAILED) {
+    m_map = nullptr;
+    throw_errno("cannot map shared cache");
+  }
+
+  m_header = static_cast<SharedHeader*>(m_map);
+
+  // Wait for the rest of the setup
+  while (m_header->magic.load(std::memory_order_acquire) != kMagic) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      throw std::runtime_error("shared cache was never set up");
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // Make sure we agree on the layout
+  if (m_header->version != kVersion) {
+    throw std::runtime_error("shared cache has a different layout version");
+  }
+  if (m_header->journal_size == 0 || m_header->max_prototypes == 0 || m_header->max_prototypes > kMaxMaxPrototypes
+      || segment_layout(m_header->capacity, m_header->journal_size, m_header->max_prototypes).size != m_map_size) {
+    throw std::runtime_error("shared cache has the wrong size");
+  }
+
+  // The creator picked the sizes, so go by those
+  m_capacity = m_header->capacity;
+  m_journal_size = m_header->journal_size;
+  m_max_prototypes = m_header->max_prototypes;
+  locate();
+}
+
+void SharedCacheImpl::locate() {
+  auto layout = segment_layout(m_capacity, m_journal_size, m_max_prototypes);
+  auto base = static_cast<char*>(m_map);
+  m_journal = reinterpret_cast<Cache::Change*>(base + layout.journal);
+  m_slots = reinterpret_cast<SharedSlot*>(base + layout.slots);
+  m_protos = reinterpret_cast<Encoding::vector_type*>(base + layout.protos);
+}
+
+void SharedCacheImpl::lock() const {
+  auto err = pthread_mutex_lock(&m_header->mutex);
+  if (err == 0) {
+    return;
+  }
+  if (err != EOWNERDEAD) {
+    errno = err;
+    throw_errno("cannot lock shared cache");
+  }
+
+  // A process died while holding the lock, so we inherit it
+  pthread_mutex_consistent(&m_header->mutex);
+
+  // Readers keep off while the sequence counter is odd, which it may already be
+  auto seq = m_header->seq.load(std::memory_order_relaxed);
+  if (!(seq & 1u)) {
+    m_header->seq.store(++seq, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  repair();
+
+  m_header->seq.store(seq + 1, std::memory_order_release);
+}
+
+void SharedCacheImpl::repair() const {
+  // Changes keep the counts in range as they go, but only up to where they stopped
+  m_header->count = std::min(m_header->count, m_capacity);
+
+  // Erasing copies the last face over the one going before dropping the last
+  // Cut short, that leaves a face twice, with the later copy the whole one
+  // No face ever has ID zero, so a slot with that is junk too
+  std::unordered_set<std::int32_t> seen;
+  for (auto i = m_header->count; i-- > 0;) {
+    auto id = m_slots[i].id;
+    if (id == 0 || !seen.insert(id).second) {
+      erase(i);
+    }
+  }
+
+  // Adding a prototype may have stopped between the encoding and the count, or the count and the centroid
+  for (std::uint32_t i = 0; i < m_header->count; ++i) {
+    auto& slot = m_slots[i];
+    slot.prototypes = std::clamp(slot.prototypes, 1u, m_max_prototypes);
+    slot_update(slot, prototypes(i));
+  }
+
+  // Whatever followers made of the journal may be wrong now, so make it look forgotten
+  // That has them look up all their faces again
+  auto epoch = m_header->epoch.load(std::memory_order_relaxed);
+  m_header->epoch.store(epoch + m_journal_size + 1, std::memory_order_release);
+}
+
+template<class F>
+auto SharedCacheImpl::read(F&& f) const {
+  for (unsigned spins = 0;;) {
+    // Wait out any change in progress
+    auto begin = m_header->seq.load(std::memory_order_acquire);
+    if (begin & 1u) {
+      if (++spins < kMaxSpins) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      // The change is taking too long, so its process may have died in the middle of it
+      // Taking the lock waits for a live writer to finish, or repairs the damage of a dead one
+      lock();
+      pthread_mutex_unlock(&m_header->mutex);
+      spins = 0;
+      continue;
+    }
+
+    auto result = f();
+
+    // If the counter moved, a change raced with us, and the result may be garbage
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_header->seq.load(std::memory_order_relaxed) == begin) {
+      return result;
+    }
+  }
+}
+
+std::uint32_t SharedCacheImpl::find(int id) const {
+  auto count = m_header->count;
+  for (std::uint32_t i = 0; i < count; ++i) {
+    if (m_slots[i].id == id) {
+      return i;
+    }
+  }
+  return count;
+}
+
+void SharedCacheImpl::append(int id, const Encoding::vector_type& face) {
+  if (m_header->count >= m_capacity) {
+    throw std::runtime_error("shared cache is full");
+  }
+
+  auto& slot = m_slots[m_header->count];
+  slot.id = id;
+  slot.prototypes = 1;
+  slot.radius = 0;
+  slot.centroid = face;
+  prototypes(m_header->count)[0] = face;
+
+  ++m_header->count;
+}
+
+void SharedCacheImpl::erase(std::uint32_t index) const {
+  auto last = m_header->count - 1;
+
+  // Keep the faces packed by moving the last one into the hole
+  // Only the prototypes in use are copied
+  if (index != last) {
+    auto from = prototypes(last);
+    m_slots[index] = m_slots[last];
+    std::copy(from, from + std::min(m_slots[last].prototypes, m_max_prototypes), prototypes(index));
+  }
+
+  m_header->count = last;
+}
+
+void SharedCacheImpl::record(const Cache::Change& change) {
+  auto epoch = m_header->epoch.load(std::memory_order_relaxed) + 1;
+  m_journal[epoch % m_journal_size] = change;
+  m_header->epoch.store(epoch, std::memory_order_release);
+}
+
+SharedCache::SharedCache(const std::string& name, std::size_t capacity, std::size_t journal_size,
+    std::size_t max_prototypes, double timeout) : impl() {
+  impl = std::make_unique<SharedCacheImpl>(name);
+
+  // Try to create the segment
+  // If somebody beat us to it, open theirs instead
+  bool created = true;
+  auto fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd == -1 && errno == EEXIST) {
+    created = false;
+    fd = shm_open(name.c_str(), O_RDWR, 0600);
+  }
+  if (fd == -1) {
+    throw_errno("cannot open shared cache " + name);
+  }
+
+  // The mapping outlives the descriptor
+  try {
+    if (created) {
+      impl->create(fd, capacity, journal_size, max_prototypes);
+    } else {
+      impl->attach(fd, timeout);
+    }
+  } catch (...) {
+    close(fd);
+    if (created) {
+      shm_unlink(name.c_str());
+    }
+    throw;
+  }
+
+  close(fd);
+}
+
+SharedCache::~SharedCache() = default;
+
+void SharedCache::insert(int id, const Encoding& face) {
+  // Validate new face ID
+  validate_user_id(id);
+
+  auto vec = face.get_vector();
+
+  // Start a change
+  SharedWriter writer(*impl);
+
+  // If this ID is already in use
+  if (impl->find(id) != impl->m_header->count) {
+    throw std::runtime_error("duplicate face id");
+  }
+
+  // Copy in the new face encoding
+  impl->append(id, vec);
+  impl->record({Change::Kind::INSERT, id, 0});
+}
+
+void SharedCache::insert_prototype(int id, const Encoding& face) {
+  auto vec = face.get_vector();
+
+  // Start a change
+  SharedWriter writer(*impl);
+
+  // Look up the face by its ID
+  auto index = impl->find(id);
+
+  // If face was not found
+  if (index == impl->m_header->count) {
+    throw std::runtime_error("unknown face id");
+  }
+
+  auto& slot = impl->m_slots[index];
+  auto protos = impl->prototypes(index);
+  if (slot.prototypes >= impl->m_max_prototypes) {
+    throw std::runtime_error("too many prototypes for face");
+  }
+
+  // Add the encoding as another prototype
+  protos[slot.prototypes++] = vec;
+  slot_update(slot, protos);
+  impl->record({Change::Kind::INSERT, id, 0});
+}
+
+int SharedCache::insert_unknown(const Encoding& face) {
+  auto vec = face.get_vector();
+
+  // Start a change
+  SharedWriter writer(*impl);
+
+  // Generate a new ID for unknown faces
+  // The counter is shared, so IDs are unique across processes
+  int id;
+  do {
+    id = impl->m_header->unknown_id;
+    impl->m_header->unknown_id = id == std::numeric_limits<int>::min() ? -1 : id - 1;
+  } while (impl->find(id) != impl->m_header->count);
+
+  // Copy in the new face encoding
+  impl->append(id, vec);
+  impl->record({Change::Kind::INSERT, id, 0});
+
+  return id;
+}
+
+void SharedCache::remove(int id) {
+  // Start a change
+  SharedWriter writer(*impl);
+
+  // Look up the doomed face by its ID
+  auto index = impl->find(id);
+
+  // If face was not found
+  if (index == impl->m_header->count) {
+    throw std::runtime_error("unknown face id");
+  }
+
+  // Delete the encoding
+  impl->erase(index);
+  impl->record({Change::Kind::REMOVE, id, 0});
+}
+
+void SharedCache::rename(int id_old, int id_new) {
+  // Validate new face ID
+  validate_user_id(id_new);
+
+  // Start a change
+  SharedWriter writer(*impl);
+
+  // If old face was not found
+  if (impl->find(id_old) == impl->m_header->count) {
+    throw std::runtime_error("unknown old face id");
+  }
+
+  // If the new ID is in use, the face there is replaced
+  auto index_new = impl->find(id_new);
+  if (index_new != impl->m_header->count && id_new != id_old) {
+    impl->erase(index_new);
+  }
+
+  // Relabel the face
+  // Erasing may have moved it, so look it up again
+  impl->m_slots[impl->find(id_old)].id = id_new;
+  impl->record({Change::Kind::RENAME, id_old, id_new});
+}
+
+const Encoding& SharedCache::retrieve(int id) const {
+  // Copy out the first prototype encoding
+  thread_local Encoding::vector_type vec;
+  auto found = impl->read([&]() {
+    auto count = std::min(impl->m_header->count, impl->m_capacity);
+    for (std::uint32_t i = 0; i < count; ++i) {
+      if (impl->m_slots[i].id == id) {
+        vec = impl->prototypes(i)[0];
+        return true;
+      }
+    }
+    return false;
+  });
+
+  // If face was not found
+  if (!found) {
+    throw std::runtime_error("unknown face id");
+  }
+
+  // The copy is per thread, so it outlives any removal after it
+  thread_local Encoding copy;
+  copy.set_vector(vec);
+  return copy;
+}
+
+int SharedCache::query(const Encoding& face, double tol) const {
+  // Square the tolerance
+  // By comparing squares, we can avoid costly sqrt(3) calls
+  auto tol_sq = tol * tol;
+
+  auto vec = face.get_vector();
+
+  // Find the first matching face
+  // If no faces match, then the matched ID is zero
+  return impl->read([&]() {
+    auto count = std::min(impl->m_header->count, impl->m_capacity);
+    for (std::uint32_t i = 0; i < count; ++i) {
+      if (slot_match(impl->m_slots[i], impl->prototypes(i), impl->m_max_prototypes, vec, tol, tol_sq)) {
+        return static_cast<int>(impl->m_slots[i].id);
+      }
+    }
+    return 0;
+  });
+}
+
+std::map<int, int> SharedCache::consolidate_unknowns(double tol) {
+  // Copy out the unknown faces
+  // Clustering takes a while, so it runs on the copy without holding anything up
+  std::vector<ClusterFace> faces;
+  impl->read([&]() {
+    faces.clear();
+
+    auto count = std::min(impl->m_header->count, impl->m_capacity);
+    for (std::uint32_t i = 0; i < count; ++i) {
+      auto& slot = impl->m_slots[i];
+      if (slot.id >= 0) {
+        continue;
+      }
+
+      ClusterFace face {slot.id, {}, slot.centroid, slot.radius};
+      auto protos = impl->prototypes(i);
+      face.prototypes.assign(protos, protos + std::min(slot.prototypes, impl->m_max_prototypes));
+      faces.push_back(std::move(face));
+    }
+    return true;
+  });
+
+  auto clusters = cluster_faces(faces, tol, ClusterLimits());
+
+  // Start a change
+  SharedWriter writer(*impl);
+
+  std::map<int, int> merged;
+  for (auto& cluster : clusters) {
+    // Faces may have been removed by other processes in the meantime, so skip those
+    std::vector<int> members;
+    for (auto index : cluster) {
+      if (impl->find(faces[index].id) != impl->m_header->count) {
+        members.push_back(faces[index].id);
+      }
+    }
+    if (members.size() < 2) {
+      continue;
+    }
+
+    // Keep the oldest face, which has the ID closest to zero
+    auto survivor_id = *std::max_element(members.begin(), members.end());
+
+    for (auto id : members) {
+      if (id == survivor_id) {
+        continue;
+      }
+
+      // Erasing moves slots around, so look both up again every time
+      auto index = impl->find(id);
+      auto& slot = impl->m_slots[index];
+      auto protos = impl->prototypes(index);
+      auto survivor_index = impl->find(survivor_id);
+      auto& survivor = impl->m_slots[survivor_index];
+      auto survivor_protos = impl->prototypes(survivor_index);
+
+      // Fold the face into the survivor
+      // Slots only have room for so many prototypes, so any more are dropped
+      for (std::uint32_t p = 0; p < slot.prototypes && survivor.prototypes < impl->m_max_prototypes; ++p) {
+        survivor_protos[survivor.prototypes++] = protos[p];
+      }
+      slot_update(survivor, survivor_protos);
+
+      // To anybody following along, the face was renamed to the survivor
+      impl->erase(index);
+      impl->record({Change::Kind::RENAME, id, survivor_id});
+      merged[id] = survivor_id;
+    }
+
+    // The survivor has new prototypes, which counts as an insertion
+    impl->record({Change::Kind::INSERT, survivor_id, 0});
+  }
+
+  return merged;
+}
+
+std::uint64_t SharedCache::get_epoch() const {
+  return impl->m_header->epoch.load(std::memory_order_acquire);
+}
+
+bool SharedCache::get_changes(std::uint64_t since, std::vector<Change>& changes) const {
+  // Append straight to the caller's changes, and take back whatever a raced read appended
+  // That way the recognizer's scratch space gets reused instead of allocating here
+  auto base = changes.size();
+  return impl->read([&]() {
+    changes.resize(base);
+
+    // If nothing happened since, there is nothing to do
+    auto epoch = impl->m_header->epoch.load(std::memory_order_relaxed);
+    if (since >= epoch) {
+      return true;
+    }
+
+    // If the change right after the given epoch was overwritten, we can't help
+    if (epoch - since > impl->m_journal_size) {
+      return false;
+    }
+
+    for (auto e = since + 1; e <= epoch; ++e) {
+      changes.push_back(impl->m_journal[e % impl->m_journal_size]);
+    }
+    return true;
+  });
+}
+
+std::string SharedCache::get_name() const {
+  return impl->m_name;
+}
+
+std::size_t SharedCache::get_capacity() const {
+  return impl->m_capacity;
+}
+
+std::size_t SharedCache::get_journal_size() const {
+  return impl->m_journal_size;
+}
+
+std::size_t SharedCache::get_max_prototypes() const {
+  return impl->m_max_prototypes;
+}
+
+std::size_t SharedCache::get_size() const {
+  return impl->read([&]() {
+    return std::min(impl->m_header->count, impl->m_capacity);
+  });
+}
+
+bool SharedCache::unlink(const std::string& name) {
+  if (shm_unlink(name.c_str()) == -1) {
+    if (errno == ENOENT) {
+      return false;
+    }
+    throw_errno("cannot unlink shared cache " + name);
+  }
+  return true;
+}
+
+} // namespace caches
+} // namespace faces
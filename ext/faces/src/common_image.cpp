@@ -30,10 +30,10 @@ SF__CommonImage::SF__CommonImage(const faces::Image& pCom)
     return ((decltype(this)) self)->mCom.height;
   };
   base.getData = [](SFImage self) {
-    return (void*) ((decltype(this)) self)->mCom.data.data();
+    return (void*) ((decltype(this)) self)->mCom.pixels();
   };
   base.getWidthStep = [](SFImage self) {
-    return ((decltype(this)) self)->mCom.width * 3;
+    return ((decltype(this)) self)->mCom.step();
   };
 }
 
@@ -11,7 +11,9 @@
 #include <faces/source.h>
 
 /**
- * A spdyface image backed by a faces::Image.
+ * A spdyface image backed by a faces::Image. Row stride and borrowed memory are
+ * passed through as-is, but spdyface expects packed RGB pixels, so images in
+ * other formats must go through the preprocessing stage first.
  */
 typedef struct SF__CommonImage* SFCommonImage;
 
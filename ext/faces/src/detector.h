@@ -0,0 +1,41 @@
+/*
+ * spdyface
+ * Copyright (c) 2019 Tyler Filla
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SPDYFACE__DETECTOR_DRIVER_H
+#define SPDYFACE__DETECTOR_DRIVER_H
+
+#include <spdyface.h>
+
+struct SF__Detector {
+  /**
+   * @param self This detector
+   * @param image The image to search
+   * @param cb The callback for each face found (nonzero return stops the search)
+   * @param user The user data for the callback
+   * @return Zero on success, otherwise nonzero
+   */
+  int (* detect)(SFDetector self, SFImage image, int (* cb)(SFImage image, SFRectangle* bounds, void* user),
+      void* user);
+};
+
+#endif // #ifndef SPDYFACE__DETECTOR_DRIVER_H
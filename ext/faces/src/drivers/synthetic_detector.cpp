@@ -0,0 +1,84 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#include "synthetic_detector.h"
+#include "../detector.h"
+#include "../image.h"
+
+struct SF__SyntheticDetector {
+  SF__Detector base;
+
+  /** The number of faces to report per frame. */
+  std::atomic<int> mFaces;
+
+  /** The CPU time to burn per frame in microseconds. */
+  std::atomic<int> mCost;
+
+  SF__SyntheticDetector();
+};
+
+SF__SyntheticDetector::SF__SyntheticDetector()
+    : base()
+    , mFaces(1)
+    , mCost(0) {
+  base.detect = [](SFDetector self, SFImage image, int (* cb)(SFImage, SFRectangle*, void*), void* user) {
+    auto detector = (decltype(this)) self;
+    auto driver = (SF__Image*) image;
+
+    // Spin for the configured cost to stand in for a real detector
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(detector->mCost.load());
+    while (std::chrono::steady_clock::now() < deadline) {
+    }
+
+    // Read the frame tag out of the first pixels
+    std::uint32_t tag = 0;
+    if (driver->getWidthStep(image) * driver->getHeight(image) >= (int) sizeof(tag)) {
+      std::memcpy(&tag, driver->getData(image), sizeof(tag));
+    }
+
+    // Report the made-up faces
+    auto faces = detector->mFaces.load();
+    for (int i = 0; i < faces; ++i) {
+      SFRectangle bounds;
+      bounds.left = (int) (tag & 0x7fffffffu);
+      bounds.top = i * SF_SYNTHETIC_FACE_SIZE;
+      bounds.right = bounds.left + SF_SYNTHETIC_FACE_SIZE;
+      bounds.bottom = bounds.top + SF_SYNTHETIC_FACE_SIZE;
+
+      if (cb(image, &bounds, user)) {
+        break;
+      }
+    }
+
+    return 0;
+  };
+}
+
+int sfSyntheticDetectorCreate(SFSyntheticDetector* detector) {
+  *detector = new SF__SyntheticDetector();
+  return 0;
+}
+
+int sfSyntheticDetectorConfigure(SFSyntheticDetector detector, int faces, int cost) {
+  if (faces < 0 || cost < 0) {
+    return 1;
+  }
+
+  detector->mFaces = faces;
+  detector->mCost = cost;
+  return 0;
+}
+
+int sfSyntheticDetectorDestroy(SFSyntheticDetector detector) {
+  delete detector;
+  return 0;
+}
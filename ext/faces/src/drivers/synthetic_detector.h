@@ -0,0 +1,53 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef DRIVERS_SYNTHETIC_DETECTOR_H
+#define DRIVERS_SYNTHETIC_DETECTOR_H
+
+#include <spdyface.h>
+
+/** The side length of synthetic faces in pixels. */
+#define SF_SYNTHETIC_FACE_SIZE 64
+
+/**
+ * A spdyface detector that makes up faces instead of looking for them. It
+ * burns a configurable amount of CPU time per frame and reports a configurable
+ * number of faces, so the rest of the pipeline can be measured without models.
+ *
+ * Face i is reported at x = frame tag and y = i * size, where the frame tag is
+ * the first four bytes of the frame data. This moves every face on every frame
+ * and lets event consumers tell which frame an event came from.
+ */
+typedef struct SF__SyntheticDetector* SFSyntheticDetector;
+
+/**
+ * Create a synthetic detector.
+ *
+ * @param detector The detector destination
+ * @return Zero on success, otherwise nonzero
+ */
+int sfSyntheticDetectorCreate(SFSyntheticDetector* detector);
+
+/**
+ * Configure a synthetic detector.
+ *
+ * @param detector The detector
+ * @param faces The number of faces to report per frame
+ * @param cost The CPU time to burn per frame in microseconds
+ * @return Zero on success, otherwise nonzero
+ */
+int sfSyntheticDetectorConfigure(SFSyntheticDetector detector, int faces, int cost);
+
+/**
+ * Destroy a synthetic detector.
+ *
+ * @param detector The detector
+ * @return Zero on success, otherwise nonzero
+ */
+int sfSyntheticDetectorDestroy(SFSyntheticDetector detector);
+
+#endif // #ifndef DRIVERS_SYNTHETIC_DETECTOR_H
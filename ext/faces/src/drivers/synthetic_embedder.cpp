@@ -0,0 +1,66 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <atomic>
+#include <chrono>
+
+#include "synthetic_detector.h"
+#include "synthetic_embedder.h"
+#include "../embedder.h"
+
+struct SF__SyntheticEmbedder {
+  SF__Embedder base;
+
+  /** The CPU time to burn per face in microseconds. */
+  std::atomic<int> mCost;
+
+  SF__SyntheticEmbedder();
+};
+
+SF__SyntheticEmbedder::SF__SyntheticEmbedder()
+    : base()
+    , mCost(0) {
+  base.embed = [](SFEmbedder self, SFImage, SFRectangle* bounds, double* vector) {
+    auto embedder = (decltype(this)) self;
+
+    // Spin for the configured cost to stand in for a real embedder
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(embedder->mCost.load());
+    while (std::chrono::steady_clock::now() < deadline) {
+    }
+
+    // Recover the face slot from where the synthetic detector put it
+    auto slot = bounds->top / SF_SYNTHETIC_FACE_SIZE;
+
+    // Give each slot a distinct unit vector
+    // Any two of these are sqrt(2) apart, which is well outside match tolerance
+    for (int i = 0; i < 128; ++i) {
+      vector[i] = 0;
+    }
+    vector[slot % 128] = 1;
+
+    return 0;
+  };
+}
+
+int sfSyntheticEmbedderCreate(SFSyntheticEmbedder* embedder) {
+  *embedder = new SF__SyntheticEmbedder();
+  return 0;
+}
+
+int sfSyntheticEmbedderConfigure(SFSyntheticEmbedder embedder, int cost) {
+  if (cost < 0) {
+    return 1;
+  }
+
+  embedder->mCost = cost;
+  return 0;
+}
+
+int sfSyntheticEmbedderDestroy(SFSyntheticEmbedder embedder) {
+  delete embedder;
+  return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef DRIVERS_SYNTHETIC_EMBEDDER_H
+#define DRIVERS_SYNTHETIC_EMBEDDER_H
+
+#include <spdyface.h>
+
+/**
+ * A spdyface embedder that makes up encodings. It burns a configurable amount
+ * of CPU time per face and gives each face slot of the synthetic detector its
+ * own stable encoding, so faces are recognized again on later frames. Up to
+ * 128 slots get distinct encodings.
+ */
+typedef struct SF__SyntheticEmbedder* SFSyntheticEmbedder;
+
+/**
+ * Create a synthetic embedder.
+ *
+ * @param embedder The embedder destination
+ * @return Zero on success, otherwise nonzero
+ */
+int sfSyntheticEmbedderCreate(SFSyntheticEmbedder* embedder);
+
+/**
+ * Configure a synthetic embedder.
+ *
+ * @param embedder The embedder
+ * @param cost The CPU time to burn per face in microseconds
+ * @return Zero on success, otherwise nonzero
+ */
+int sfSyntheticEmbedderConfigure(SFSyntheticEmbedder embedder, int cost);
+
+/**
+ * Destroy a synthetic embedder.
+ *
+ * @param embedder The embedder
+ * @return Zero on success, otherwise nonzero
+ */
+int sfSyntheticEmbedderDestroy(SFSyntheticEmbedder embedder);
+
+#endif // #ifndef DRIVERS_SYNTHETIC_EMBEDDER_H
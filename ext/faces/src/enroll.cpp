@@ -0,0 +1,717 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <faces/enroll.h>
+#include <faces/trace.h>
+#include <spdyface.h>
+
+#include "common_image.h"
+#include "models.h"
+#include "placement.h"
+#include "preprocess.h"
+#include "drivers/synthetic_detector.h"
+#include "drivers/synthetic_embedder.h"
+#include "sources/buffer.h"
+
+namespace faces {
+
+namespace py = pybind11;
+
+namespace {
+
+/** The memo file magic number. */
+constexpr char kMemoMagic[8] = {'F', 'A', 'C', 'E', 'M', 'E', 'M', 'O'};
+
+/** The memo file version. Bump this whenever encodings would come out differently. */
+constexpr std::uint32_t kMemoVersion = 2;
+
+/** A photo key. */
+struct MemoKey {
+  /** The low half of the hash. */
+  std::uint64_t lo;
+
+  /** The high half of the hash. */
+  std::uint64_t hi;
+
+  bool operator==(const MemoKey& rhs) const {
+    return lo == rhs.lo && hi == rhs.hi;
+  }
+};
+
+/** Hashes photo keys for the memo table. They're hashes already, so half of one will do. */
+struct MemoKeyHash {
+  std::size_t operator()(const MemoKey& key) const {
+    return static_cast<std::size_t>(key.lo);
+  }
+};
+
+/** A memo file record. */
+struct MemoRecord {
+  /** The photo key. */
+  MemoKey key;
+
+  /** The photo width. */
+  std::int32_t width;
+
+  /** The photo height. */
+  std::int32_t height;
+
+  /** The photo pixel format. */
+  std::uint32_t format;
+
+  /** One if a face was found, otherwise zero. */
+  std::uint32_t found;
+
+  /** The face vector. */
+  double vector[128];
+};
+
+/**
+ * A 128-bit MurmurHash3 (x64 flavor), fed sixteen bytes at a time. A memo
+ * file can collect photos for years, and a collision hands one photo the face
+ * of another, so 64 bits is cutting it too close. It still goes through
+ * multi-megapixel photos about as fast as a 64-bit FNV-1a would.
+ */
+class Hasher {
+  /** The first half of the hash so far. */
+  std::uint64_t m_h1;
+
+  /** The second half of the hash so far. */
+  std::uint64_t m_h2;
+
+  /** The bytes fed but not yet hashed, as they don't fill a block. */
+  unsigned char m_tail[16];
+
+  /** The number of bytes in the tail. */
+  std::size_t m_tail_size;
+
+  /** The number of bytes fed so far. */
+  std::uint64_t m_size;
+
+  static std::uint64_t rotl(std::uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  static std::uint64_t fmix(std::uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+  }
+
+  static std::uint64_t mix_k1(std::uint64_t k1) {
+    return rotl(k1 * 0x87c37b91114253d5ull, 31) * 0x4cf5ad432745937full;
+  }
+
+  static std::uint64_t mix_k2(std::uint64_t k2) {
+    return rotl(k2 * 0x4cf5ad432745937full, 33) * 0x87c37b91114253d5ull;
+  }
+
+  /**
+   * Hash a full block.
+   *
+   * @param block The sixteen bytes
+   */
+  void mix_block(const unsigned char* block) {
+    std::uint64_t k1;
+    std::uint64_t k2;
+    std::memcpy(&k1, block, sizeof(k1));
+    std::memcpy(&k2, block + 8, sizeof(k2));
+
+    m_h1 ^= mix_k1(k1);
+    m_h1 = rotl(m_h1, 27);
+    m_h1 += m_h2;
+    m_h1 = m_h1 * 5 + 0x52dce729;
+
+    m_h2 ^= mix_k2(k2);
+    m_h2 = rotl(m_h2, 31);
+    m_h2 += m_h1;
+    m_h2 = m_h2 * 5 + 0x38495ab5;
+  }
+
+public:
+  Hasher() : m_h1(0), m_h2(0), m_tail(), m_tail_size(0), m_size(0) {
+  }
+
+  /**
+   * Feed bytes to the hash.
+   *
+   * @param data The bytes
+   * @param size The number of bytes
+   */
+  void put_bytes(const void* data, std::size_t size) {
+    auto bytes = static_cast<const unsigned char*>(data);
+    m_size += size;
+
+    // Top up the tail left over from last time first
+    if (m_tail_size > 0) {
+      auto n = std::min(size, sizeof(m_tail) - m_tail_size);
+      std::memcpy(m_tail + m_tail_size, bytes, n);
+      m_tail_size += n;
+      bytes += n;
+      size -= n;
+
+      if (m_tail_size < sizeof(m_tail)) {
+        return;
+      }
+
+      mix_block(m_tail);
+      m_tail_size = 0;
+    }
+
+    for (; size >= sizeof(m_tail); bytes += sizeof(m_tail), size -= sizeof(m_tail)) {
+      mix_block(bytes);
+    }
+
+    std::memcpy(m_tail, bytes, size);
+    m_tail_size = size;
+  }
+
+  /**
+   * Feed a value to the hash.
+   *
+   * @param value The value
+   */
+  template<class T>
+  void put(T value) {
+    put_bytes(&value, sizeof(value));
+  }
+
+  /**
+   * @return The hash
+   */
+  MemoKey get() const {
+    auto h1 = m_h1;
+    auto h2 = m_h2;
+
+    // Mix in whatever is left, zero padded
+    if (m_tail_size > 0) {
+      unsigned char block[sizeof(m_tail)] {};
+      std::memcpy(block, m_tail, m_tail_size);
+
+      std::uint64_t k1;
+      std::uint64_t k2;
+      std::memcpy(&k1, block, sizeof(k1));
+      std::memcpy(&k2, block + 8, sizeof(k2));
+
+      h1 ^= mix_k1(k1);
+      h2 ^= mix_k2(k2);
+    }
+
+    h1 ^= m_size;
+    h2 ^= m_size;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix(h1);
+    h2 = fmix(h2);
+    h1 += h2;
+    h2 += h1;
+    return {h1, h2};
+  }
+};
+
+/**
+ * Compute the memo key of a photo. This covers the pixels (but not row
+ * padding) and every setting that changes the encoding.
+ *
+ * @param image The photo
+ * @param options The settings
+ * @return The key
+ */
+MemoKey memo_key(const Image& image, const EnrollOptions& options) {
+  Hasher hasher;
+  hasher.put(static_cast<std::uint32_t>(options.backend));
+  hasher.put(static_cast<std::uint32_t>(options.preprocess.resize));
+  hasher.put(static_cast<std::uint32_t>(options.preprocess.blur));
+  hasher.put(image.width);
+  hasher.put(image.height);
+  hasher.put(static_cast<std::uint32_t>(image.format));
+
+  auto row = static_cast<std::size_t>(image.width) * bytes_per_pixel(image.format);
+  for (int y = 0; y < image.height; ++y) {
+    hasher.put_bytes(image.pixels() + static_cast<std::size_t>(image.step()) * y, row);
+  }
+
+  return hasher.get();
+}
+
+/**
+ * A memo file of photo encodings. New entries are appended, so a run that
+ * dies halfway loses nothing it already saved.
+ */
+class Memo {
+  /** The file path. */
+  std::string m_path;
+
+  /** Whether the file exists with a good header. */
+  bool m_valid;
+
+  /** A remembered photo. */
+  struct Entry {
+    /** The photo width. */
+    int width;
+
+    /** The photo height. */
+    int height;
+
+    /** The photo pixel format. */
+    PixelFormat format;
+
+    /** The face encoding, or empty if there was no face. */
+    std::optional<Encoding> face;
+  };
+
+  /** The remembered photos by photo key. */
+  std::unordered_map<MemoKey, Entry, MemoKeyHash> m_entries;
+
+  /** New records to be saved. */
+  std::vector<MemoRecord> m_pending;
+
+public:
+  /**
+   * Load a memo file. A missing file, or one from another version, starts
+   * out empty.
+   *
+   * @param p_path The file path
+   */
+  explicit Memo(std::string p_path);
+
+  /**
+   * Look up a photo. A photo whose key matches but whose dimensions or format
+   * don't is taken as new.
+   *
+   * @param key The photo key
+   * @param image The photo
+   * @return The remembered encoding, or null if the photo is new
+   */
+  const std::optional<Encoding>* find(const MemoKey& key, const Image& image) const;
+
+  /**
+   * Remember a photo.
+   *
+   * @param key The photo key
+   * @param image The photo
+   * @param face The face encoding, or empty if there was no face
+   */
+  void add(const MemoKey& key, const Image& image, const std::optional<Encoding>& face);
+
+  /** Save the new entries. */
+  void save();
+};
+
+Memo::Memo(std::string p_path) : m_path(std::move(p_path)), m_valid(false), m_entries(), m_pending() {
+  std::ifstream file(m_path, std::ios::binary);
+  if (!file) {
+    return;
+  }
+
+  // Check the header
+  char magic[sizeof(kMemoMagic)];
+  std::uint32_t version;
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(&version), sizeof(version));
+  if (!file || std::memcmp(magic, kMemoMagic, sizeof(magic)) != 0 || version != kMemoVersion) {
+    return;
+  }
+  m_valid = true;
+
+  // Read records until the end
+  // A record cut short by a crash is simply not there
+  MemoRecord record;
+  while (file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+    std::optional<Encoding> face;
+    if (record.found) {
+      Encoding::vector_type vec;
+      std::copy(std::begin(record.vector), std::end(record.vector), vec.begin());
+      face.emplace();
+      face->set_vector(vec);
+    }
+
+    m_entries[record.key] = {record.width, record.height, static_cast<PixelFormat>(record.format), std::move(face)};
+  }
+}
+
+const std::optional<Encoding>* Memo::find(const MemoKey& key, const Image& image) const {
+  auto it = m_entries.find(key);
+  if (it == m_entries.end()) {
+    return nullptr;
+  }
+
+  // The key covers these too, but checking costs nothing and rules out the most likely mix-ups
+  auto& entry = it->second;
+  if (entry.width != image.width || entry.height != image.height || entry.format != image.format) {
+    return nullptr;
+  }
+
+  return &entry.face;
+}
+
+void Memo::add(const MemoKey& key, const Image& image, const std::optional<Encoding>& face) {
+  MemoRecord record {};
+  record.key = key;
+  record.width = image.width;
+  record.height = image.height;
+  record.format = static_cast<std::uint32_t>(image.format);
+  if (face) {
+    record.found = 1;
+    auto vec = face->get_vector();
+    std::copy(vec.begin(), vec.end(), std::begin(record.vector));
+  }
+
+  m_pending.push_back(record);
+  m_entries[key] = {image.width, image.height, image.format, face};
+}
+
+void Memo::save() {
+  if (m_pending.empty()) {
+    return;
+  }
+
+  // Start the file over if it's missing or unreadable, otherwise add on
+  auto mode = std::ios::binary | (m_valid ? std::ios::app : std::ios::trunc);
+  std::ofstream file(m_path, mode);
+  if (!m_valid) {
+    file.write(kMemoMagic, sizeof(kMemoMagic));
+    file.write(reinterpret_cast<const char*>(&kMemoVersion), sizeof(kMemoVersion));
+  }
+  file.write(reinterpret_cast<const char*>(m_pending.data()),
+      static_cast<std::streamsize>(m_pending.size() * sizeof(MemoRecord)));
+
+  // The memo only saves time, so failing to write it is no reason to fail enrollment
+  if (!file.flush()) {
+    std::cerr << "Failed to write enrollment memo " << m_path << "\n";
+    return;
+  }
+
+  m_valid = true;
+  m_pending.clear();
+}
+
+/** The detection and embedding pipeline of one enrollment worker. */
+class Pipeline {
+  /** The detection and embedding backend. */
+  Recognizer::Backend m_backend;
+
+  /** The spdyface context. */
+  SFContext m_spdy;
+
+  /** The dlib models, if using them. */
+  std::shared_ptr<Models> m_models;
+
+  /** The synthetic face detector. */
+  SFSyntheticDetector m_synthetic_detector;
+
+  /** The synthetic face embedder. */
+  SFSyntheticEmbedder m_synthetic_embedder;
+
+  /** The current photo. */
+  Image m_frame;
+
+  /** The spdyface common image view of the current photo. */
+  SFCommonImage m_com_image;
+
+  /** The preprocessing stage. */
+  Preprocessor m_preprocessor;
+
+  /** The spdyface common image view of the preprocessed photo. */
+  SFCommonImage m_com_image_pre;
+
+public:
+  /**
+   * Set up a pipeline. This waits for the models to load.
+   *
+   * @param p_backend The detection and embedding backend
+   * @param p_models The dlib models (for the dlib backend)
+   * @param preprocess The preprocessing settings
+   */
+  Pipeline(Recognizer::Backend p_backend, std::shared_ptr<Models> p_models, const Preprocess& preprocess);
+
+  Pipeline(const Pipeline& rhs) = delete;
+
+  ~Pipeline();
+
+  Pipeline& operator=(const Pipeline& rhs) = delete;
+
+  /**
+   * Encode the largest face in a photo.
+   *
+   * @param image The photo
+   * @return The face encoding, or empty if there was no face
+   */
+  std::optional<Encoding> encode(const Image& image);
+};
+
+Pipeline::Pipeline(Recognizer::Backend p_backend, std::shared_ptr<Models> p_models, const Preprocess& preprocess)
+    : m_backend(p_backend)
+    , m_spdy()
+    , m_models(std::move(p_models))
+    , m_synthetic_detector()
+    , m_synthetic_embedder()
+    , m_frame()
+    , m_com_image()
+    , m_preprocessor()
+    , m_com_image_pre() {
+  // Wait for the models first, as this is what fails if anything does (when they fail to load)
+  if (m_models) {
+    m_models->get_ready().get();
+  }
+
+  // Create spdyface context
+  if (sfCreate(&m_spdy)) {
+    throw std::runtime_error("failed to create spdyface context");
+  }
+
+  if (m_backend == Recognizer::Backend::SYNTHETIC) {
+    // Create synthetic face detector and embedder
+    if (sfSyntheticDetectorCreate(&m_synthetic_detector) || sfSyntheticEmbedderCreate(&m_synthetic_embedder)) {
+      throw std::runtime_error("failed to create synthetic drivers");
+    }
+    sfUseDetector(m_spdy, (SFDetector) m_synthetic_detector);
+    sfUseEmbedder(m_spdy, (SFEmbedder) m_synthetic_embedder);
+  }
+
+  // Create common image views
+  if (sfCommonImageCreate(&m_com_image, m_frame) || sfCommonImageCreate(&m_com_image_pre, m_preprocessor.output())) {
+    throw std::runtime_error("failed to create common image");
+  }
+
+  m_preprocessor.set_config(preprocess);
+}
+
+Pipeline::~Pipeline() {
+  // Clean up spdyface things
+  if (m_com_image_pre) {
+    sfCommonImageDestroy(m_com_image_pre);
+  }
+  if (m_com_image) {
+    sfCommonImageDestroy(m_com_image);
+  }
+  if (m_synthetic_embedder) {
+    sfSyntheticEmbedderDestroy(m_synthetic_embedder);
+  }
+  if (m_synthetic_detector) {
+    sfSyntheticDetectorDestroy(m_synthetic_detector);
+  }
+  if (m_spdy) {
+    sfDestroy(m_spdy);
+  }
+}
+
+std::optional<Encoding> Pipeline::encode(const Image& image) {
+  trace::Span span_encode("encode photo");
+
+  // Borrow the photo into view
+  m_frame.width = image.width;
+  m_frame.height = image.height;
+  m_frame.stride = image.step();
+  m_frame.format = image.format;
+  m_frame.borrowed = image.pixels();
+  m_frame.borrowed_size = image.size();
+
+  // Run the photo through the preprocessing stage
+  auto view = m_com_image;
+  if (!m_preprocessor.is_identity(m_frame)) {
+    m_preprocessor.process(m_frame);
+    view = m_com_image_pre;
+  }
+
+  // Each set of drivers serves one user at a time, so lease one for this photo
+  std::optional<Models::Lease> lease;
+  if (m_models) {
+    lease.emplace(*m_models);
+    sfUseDetector(m_spdy, (SFDetector) lease->get_detector());
+    sfUseEmbedder(m_spdy, (SFEmbedder) lease->get_embedder());
+  }
+
+  // Find the largest face
+  // Photos of friends may catch somebody in the background, but the friend is front and center
+  std::optional<SFRectangle> largest;
+  sfDetect(m_spdy, (SFImage) view, [](SFContext, SFImage, SFRectangle* bounds, void* user) {
+    auto largest = static_cast<std::optional<SFRectangle>*>(user);
+    auto area = [](const SFRectangle& rect) {
+      return static_cast<long long>(rect.right - rect.left) * (rect.bottom - rect.top);
+    };
+
+    if (!*largest || area(*bounds) > area(**largest)) {
+      *largest = *bounds;
+    }
+    return 0;
+  }, &largest);
+
+  if (!largest) {
+    return std::nullopt;
+  }
+
+  // Embed the face into a 128-dimensional vector encoding
+  Encoding::vector_type vec {};
+  sfEmbed(m_spdy, (SFImage) view, &*largest, vec.data());
+
+  Encoding enc;
+  enc.set_vector(vec);
+  return enc;
+}
+
+} // namespace
+
+std::vector<std::optional<Encoding>> enroll_many(const std::vector<Image>& images, const EnrollOptions& options) {
+  trace::Span span_enroll("enroll");
+
+  std::vector<std::optional<Encoding>> encodings(images.size());
+
+  // Look the photos up in the memo
+  // The ones it doesn't know are left for the workers
+  std::optional<Memo> memo;
+  if (!options.memo.empty()) {
+    memo.emplace(options.memo);
+  }
+
+  std::vector<MemoKey> keys(images.size());
+  std::vector<std::size_t> pending;
+  for (std::size_t i = 0; i < images.size(); ++i) {
+    if (!images[i].fits()) {
+      throw std::runtime_error("photo size does not match its dimensions");
+    }
+
+    if (memo) {
+      keys[i] = memo_key(images[i], options);
+      if (auto face = memo->find(keys[i], images[i])) {
+        encodings[i] = *face;
+        continue;
+      }
+    }
+
+    pending.push_back(i);
+  }
+
+  if (pending.empty()) {
+    return encodings;
+  }
+
+  // Use a worker per core, but no more workers than photos
+  std::size_t threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, pending.size());
+
+  std::atomic<std::size_t> next {0};
+  std::mutex error_mutex;
+  std::exception_ptr error;
+
+  auto work = [&](std::shared_ptr<Models> models) {
+    trace::set_thread_name("enroll worker");
+
+    try {
+      ThreadPlacement placement(options.placement);
+      Pipeline pipeline(options.backend, std::move(models), options.preprocess);
+
+      // Take photos until they run out
+      for (std::size_t n; (n = next++) < pending.size();) {
+        auto i = pending[n];
+        encodings[i] = pipeline.encode(images[i]);
+      }
+    } catch (...) {
+      // Keep the first error, and make everybody else stop
+      std::lock_guard lock(error_mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+      next = pending.size();
+    }
+  };
+
+  // The first worker shares the models with recognizers, and the rest load their own
+  // Growing the shared models instead would keep the extra drivers loaded long after enrollment
+  std::vector<std::thread> workers;
+  for (std::size_t w = 0; w < threads; ++w) {
+    std::shared_ptr<Models> models;
+    if (options.backend == Recognizer::Backend::DLIB) {
+      models = w == 0 ? Models::acquire() : Models::create();
+    }
+
+    workers.emplace_back(work, std::move(models));
+  }
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  // Remember the new photos for next time
+  if (memo) {
+    for (auto i : pending) {
+      memo->add(keys[i], images[i], encodings[i]);
+    }
+    memo->save();
+  }
+
+  return encodings;
+}
+
+py::list enroll_many(const py::sequence& images, const std::vector<int>& ids, Cache* cache,
+    const EnrollOptions& options) {
+  if (ids.size() != images.size()) {
+    throw std::runtime_error("need one face ID per photo");
+  }
+
+  // Describe the photos
+  // Their memory is borrowed, and stays alive as long as we hang on to its owners
+  std::vector<Image> photos;
+  std::vector<py::object> keep(images.size());
+  photos.reserve(images.size());
+  for (std::size_t i = 0; i < images.size(); ++i) {
+    photos.push_back(sources::borrow_image(images[i], keep[i]));
+  }
+
+  std::vector<std::optional<Encoding>> encodings;
+  {
+    py::gil_scoped_release release;
+    encodings = enroll_many(photos, options);
+
+    // Fill the cache
+    // The first photo of a face inserts it, and the rest become extra prototypes
+    if (cache) {
+      std::unordered_set<int> inserted;
+      for (std::size_t i = 0; i < encodings.size(); ++i) {
+        if (!encodings[i]) {
+          continue;
+        }
+
+        if (inserted.insert(ids[i]).second) {
+          cache->insert(ids[i], *encodings[i]);
+        } else {
+          cache->insert_prototype(ids[i], *encodings[i]);
+        }
+      }
+    }
+  }
+
+  py::list result;
+  for (auto& enc : encodings) {
+    result.append(enc ? py::cast(*enc) : py::none());
+  }
+  return result;
+}
+
+} // namespace faces
@@ -0,0 +1,230 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include <faces/trace.h>
+
+#include "models.h"
+
+namespace faces {
+
+namespace {
+
+/** The registry mutex. */
+std::mutex g_registry_mutex;
+
+/** The models in use, if any. */
+std::weak_ptr<Models> g_registry;
+
+/**
+ * The most sets of drivers to load. Every set holds its own copy of the models,
+ * and past a couple of sets the detectors mostly fight over the memory bus, so
+ * this starts low (TODO: Measure this on the Pi).
+ */
+std::atomic<std::size_t> g_max_drivers {std::min(2u, std::max(1u, std::thread::hardware_concurrency()))};
+
+/** How long an extra set may sit idle before it is unloaded (TODO: Extract this). */
+constexpr std::chrono::seconds kIdleGrace(30);
+
+} // namespace
+
+Models::Drivers::~Drivers() {
+  if (embedder) {
+    sfDlibV1EmbedderDestroy(embedder);
+  }
+  if (detector) {
+    sfDlibFFDDetectorDestroy(detector);
+  }
+}
+
+Models::Lease::Lease(Models& p_models) : m_models(p_models), m_drivers() {
+  std::unique_lock lock(m_models.m_mutex);
+  ++m_models.m_leases;
+
+  // If every set is out, and more users want one than there are sets loaded or loading, start loading another
+  auto sets = m_models.m_drivers.size() + m_models.m_loading;
+  if (m_models.m_free.empty() && !m_models.m_grow_failed && m_models.m_leases > sets
+      && sets < g_max_drivers.load(std::memory_order_relaxed)) {
+    ++m_models.m_loading;
+    m_models.m_growing.push_back(std::async(std::launch::async, &Models::grow, &m_models));
+  }
+
+  // Take whichever set comes free first, be it returned or newly loaded
+  if (m_models.m_free.empty()) {
+    trace::Span span_wait("wait drivers");
+    m_models.m_cond.wait(lock, [&]() { return !m_models.m_free.empty(); });
+  }
+
+  m_drivers = m_models.m_free.back();
+  m_models.m_free.pop_back();
+}
+
+Models::Lease::~Lease() {
+  auto now = std::chrono::steady_clock::now();
+
+  std::unique_ptr<Drivers> idle;
+  {
+    std::lock_guard lock(m_models.m_mutex);
+    --m_models.m_leases;
+    m_drivers->returned = now;
+    m_models.m_free.push_back(m_drivers);
+    m_models.m_cond.notify_one();
+
+    // Sets are leased last in, first out, so when demand drops the extra ones are left to age
+    idle = m_models.trim(now);
+  }
+
+  // Unload outside the lock, so users don't wait on it
+}
+
+SFDlibFFDDetector Models::Lease::get_detector() const {
+  return m_drivers->detector;
+}
+
+SFDlibV1Embedder Models::Lease::get_embedder() const {
+  return m_drivers->embedder;
+}
+
+Models::Models()
+    : m_ready()
+    , m_mutex()
+    , m_cond()
+    , m_drivers()
+    , m_free()
+    , m_growing()
+    , m_leases(0)
+    , m_loading(0)
+    , m_grow_failed(false) {
+  // Returning a set never allocates, so leasing stays allocation free once the pool is grown
+  m_drivers.reserve(get_max_drivers());
+  m_free.reserve(get_max_drivers());
+}
+
+Models::~Models() {
+  // Let loading finish before tearing down what it made
+  if (m_ready.valid()) {
+    m_ready.wait();
+  }
+  for (auto& growing : m_growing) {
+    growing.wait();
+  }
+}
+
+std::unique_ptr<Models::Drivers> Models::load_drivers() {
+  trace::Span span_load("load models");
+
+  auto drivers = std::make_unique<Drivers>();
+
+  // Create face detector
+  if (sfDlibFFDDetectorCreate(&drivers->detector)) {
+    drivers->detector = nullptr;
+    std::cerr << "Failed to create face detector\n";
+    throw std::runtime_error("failed to load face detector");
+  }
+
+  // Create face embedder
+  if (sfDlibV1EmbedderCreate(&drivers->embedder)) {
+    drivers->embedder = nullptr;
+    std::cerr << "Failed to create face embedder\n";
+    throw std::runtime_error("failed to load face embedder");
+  }
+
+  return drivers;
+}
+
+void Models::load() {
+  trace::set_thread_name("model loader");
+
+  auto drivers = load_drivers();
+
+  std::lock_guard lock(m_mutex);
+  drivers->returned = std::chrono::steady_clock::now();
+  m_free.push_back(drivers.get());
+  m_drivers.push_back(std::move(drivers));
+}
+
+void Models::grow() {
+  trace::set_thread_name("model loader");
+
+  std::unique_ptr<Drivers> drivers;
+  try {
+    drivers = load_drivers();
+  } catch (const std::exception&) {
+    // Make do with the sets already loaded
+  }
+
+  std::lock_guard lock(m_mutex);
+  --m_loading;
+  if (drivers) {
+    drivers->returned = std::chrono::steady_clock::now();
+    m_free.push_back(drivers.get());
+    m_drivers.push_back(std::move(drivers));
+    m_cond.notify_one();
+  } else {
+    m_grow_failed = true;
+  }
+}
+
+std::unique_ptr<Models::Drivers> Models::trim(std::chrono::steady_clock::time_point now) {
+  // One set always stays
+  if (m_drivers.size() <= 1 || m_free.empty()) {
+    return nullptr;
+  }
+
+  // The set that went back longest ago is the one to go
+  auto oldest = m_free.front();
+  if (m_drivers.size() <= g_max_drivers.load(std::memory_order_relaxed) && now - oldest->returned < kIdleGrace) {
+    return nullptr;
+  }
+
+  m_free.erase(m_free.begin());
+
+  auto it = std::find_if(m_drivers.begin(), m_drivers.end(), [&](auto& drivers) { return drivers.get() == oldest; });
+  auto drivers = std::move(*it);
+  m_drivers.erase(it);
+  return drivers;
+}
+
+std::shared_ptr<Models> Models::acquire() {
+  std::lock_guard lock(g_registry_mutex);
+
+  // Share the models if somebody has them already
+  if (auto models = g_registry.lock()) {
+    return models;
+  }
+
+  // Otherwise, start loading them
+  auto models = create();
+  g_registry = models;
+  return models;
+}
+
+std::shared_ptr<Models> Models::create() {
+  // The constructor is private, so no make_shared
+  std::shared_ptr<Models> models(new Models());
+  models->m_ready = std::async(std::launch::async, &Models::load, models.get()).share();
+  return models;
+}
+
+std::shared_future<void> Models::get_ready() const {
+  return m_ready;
+}
+
+std::size_t Models::get_max_drivers() {
+  return g_max_drivers.load(std::memory_order_relaxed);
+}
+
+void Models::set_max_drivers(std::size_t p_max_drivers) {
+  g_max_drivers.store(p_max_drivers, std::memory_order_relaxed);
+}
+
+} // namespace faces
@@ -0,0 +1,191 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef MODELS_H
+#define MODELS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <spdyface.h>
+#include <spdyface/dlib_ffd_detector.h>
+#include <spdyface/dlib_v1_embedder.h>
+
+namespace faces {
+
+/**
+ * The dlib face detector and embedder, loaded once per process and shared by
+ * every recognizer using them. Loading takes a while, so it happens in the
+ * background, and recognizers hold off on frames until it is done.
+ *
+ * The drivers keep scratch state between calls, so one set of them serves one
+ * user at a time. Users lease a set around detection. When more users want a set
+ * than there are sets, another is loaded in the background (up to the cap set
+ * with set_max_drivers()), and the user takes whichever set comes back first.
+ * Every set holds its own copy of the models, so extra sets that sit idle for a
+ * while are unloaded again as sets go back. One set stays loaded until the
+ * models go.
+ */
+class Models {
+public:
+  /** One set of drivers. */
+  struct Drivers {
+    /** The face detector. */
+    SFDlibFFDDetector detector = nullptr;
+
+    /** The face embedder. */
+    SFDlibV1Embedder embedder = nullptr;
+
+    /** When the set last went back. */
+    std::chrono::steady_clock::time_point returned;
+
+    Drivers() = default;
+
+    Drivers(const Drivers& rhs) = delete;
+
+    ~Drivers();
+
+    Drivers& operator=(const Drivers& rhs) = delete;
+  };
+
+  /** A set of drivers on lease. The set goes back when this goes away. */
+  class Lease {
+    /** The models. */
+    Models& m_models;
+
+    /** The leased drivers. */
+    Drivers* m_drivers;
+
+  public:
+    /**
+     * Lease a set of drivers, waiting for one to come free if need be. The
+     * models must be ready.
+     *
+     * @param p_models The models
+     */
+    explicit Lease(Models& p_models);
+
+    Lease(const Lease& rhs) = delete;
+
+    ~Lease();
+
+    Lease& operator=(const Lease& rhs) = delete;
+
+    /**
+     * @return The face detector
+     */
+    SFDlibFFDDetector get_detector() const;
+
+    /**
+     * @return The face embedder
+     */
+    SFDlibV1Embedder get_embedder() const;
+  };
+
+private:
+  /** Becomes ready when the first set loads. It holds the error if loading failed. */
+  std::shared_future<void> m_ready;
+
+  /** Guards the pool. */
+  std::mutex m_mutex;
+
+  /** Signaled when a set comes back or finishes loading. */
+  std::condition_variable m_cond;
+
+  /** All loaded sets. */
+  std::vector<std::unique_ptr<Drivers>> m_drivers;
+
+  /** The sets not on lease, least recently returned first. */
+  std::vector<Drivers*> m_free;
+
+  /** Loads of extra sets, finished or not. */
+  std::vector<std::future<void>> m_growing;
+
+  /** The number of leases held or waiting. */
+  std::size_t m_leases;
+
+  /** The number of extra sets loading. */
+  std::size_t m_loading;
+
+  /** Whether an extra set failed to load. No more are tried after that. */
+  bool m_grow_failed;
+
+  Models();
+
+  /**
+   * Load a set of drivers. This throws if it cannot be done.
+   *
+   * @return The drivers
+   */
+  static std::unique_ptr<Drivers> load_drivers();
+
+  /** Load the first set. This runs in the background. */
+  void load();
+
+  /** Load an extra set. This runs in the background. */
+  void grow();
+
+  /**
+   * Take out an extra set that is over the cap or has been idle too long, if
+   * there is one. The caller unloads it, after letting go of the pool.
+   *
+   * @param now The current time
+   * @return The set, or nullptr if none
+   */
+  std::unique_ptr<Drivers> trim(std::chrono::steady_clock::time_point now);
+
+public:
+  Models(const Models& rhs) = delete;
+
+  ~Models();
+
+  Models& operator=(const Models& rhs) = delete;
+
+  /**
+   * Get the models, starting to load them if nobody has them yet. They go
+   * away when the last user lets go.
+   *
+   * @return The models
+   */
+  static std::shared_ptr<Models> acquire();
+
+  /**
+   * Load a private set of models, not shared with anybody. This is for
+   * bursts of parallel work (like enrollment), where growing the shared
+   * models would keep the extra sets loaded after the burst.
+   *
+   * @return The models
+   */
+  static std::shared_ptr<Models> create();
+
+  /**
+   * @return A future that becomes ready when loading finishes
+   */
+  std::shared_future<void> get_ready() const;
+
+  /**
+   * @return The most sets of drivers to load
+   */
+  static std::size_t get_max_drivers();
+
+  /**
+   * Set the most sets of drivers to load. Lowering the cap unloads sets over
+   * it as they go back.
+   *
+   * @param p_max_drivers The most sets of drivers to load
+   */
+  static void set_max_drivers(std::size_t p_max_drivers);
+};
+
+} // namespace faces
+
+#endif // #ifndef MODELS_H
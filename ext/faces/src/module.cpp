@@ -9,23 +9,38 @@
 
 #include <faces/cache.h>
 #include <faces/encoding.h>
+#include <faces/enroll.h>
+#include <faces/placement.h>
+#include <faces/preprocess.h>
 #include <faces/recognizer.h>
 #include <faces/source.h>
+#include <faces/trace.h>
 #include <faces/caches/basic_cache.h>
+#include <faces/caches/shared_cache.h>
 #include <faces/sources/pil_source.h>
+#include <faces/sources/shm_source.h>
 
 PYBIND11_MODULE(faces, m) {
   // faces
   faces::cache::bind(m);
   faces::encoding::bind(m);
+  faces::placement::bind(m);
+  faces::preprocess::bind(m);
   faces::recognizer::bind(m);
+  faces::enroll::bind(m);
   faces::source::bind(m);
 
   // faces.caches
   auto m_caches = m.def_submodule("caches");
   faces::caches::basic_cache::bind(m_caches);
+  faces::caches::shared_cache::bind(m_caches);
 
   // faces.sources
   auto m_sources = m.def_submodule("sources");
   faces::sources::pil_source::bind(m_sources);
+  faces::sources::shm_source::bind(m_sources);
+
+  // faces.trace
+  auto m_trace = m.def_submodule("trace");
+  faces::trace::bind(m_trace);
 }
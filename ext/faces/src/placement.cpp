@@ -0,0 +1,224 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "placement.h"
+
+namespace faces {
+
+#ifdef __linux__
+
+namespace {
+
+/** Guards the reservations. */
+std::mutex g_reservations_mutex;
+
+/** The threads holding reservations. These are never moved off of their CPUs. */
+std::set<long> g_reservations;
+
+/** A thread moved off of reserved CPUs. */
+struct Eviction {
+  /** The CPUs it had before it was first moved. */
+  cpu_set_t original;
+
+  /** The CPUs we last left it with. */
+  cpu_set_t narrowed;
+};
+
+/** The threads moved off of reserved CPUs, by thread ID. These get their CPUs back once nothing is reserved. */
+std::map<long, Eviction> g_evictions;
+
+/**
+ * Give up on a placement.
+ *
+ * @param what What could not be done
+ * @param err The error number
+ */
+[[noreturn]] void fail(const std::string& what, int err) {
+  throw std::runtime_error("thread placement failed: " + what + ": " + std::strerror(err));
+}
+
+/**
+ * Move every other thread in the process off of some CPUs. Threads holding
+ * reservations and threads that would be left with no CPUs are skipped. The
+ * reservation mutex must be held.
+ *
+ * @param self The calling thread
+ * @param cpus The CPUs
+ */
+void evict(long self, const cpu_set_t& cpus) {
+  auto dir = opendir("/proc/self/task");
+  if (!dir) {
+    fail("cannot list threads", errno);
+  }
+
+  while (auto entry = readdir(dir)) {
+    // Skip the dot entries
+    auto tid = std::strtol(entry->d_name, nullptr, 10);
+    if (tid <= 0 || tid == self || g_reservations.count(tid)) {
+      continue;
+    }
+
+    // Threads may exit as we go, so failures here only mean one fewer to move
+    cpu_set_t mask;
+    if (sched_getaffinity(tid, sizeof(mask), &mask) != 0) {
+      continue;
+    }
+
+    cpu_set_t rest;
+    CPU_XOR(&rest, &mask, &cpus);
+    CPU_AND(&rest, &rest, &mask);
+    if (CPU_COUNT(&rest) == 0 || CPU_EQUAL(&rest, &mask)) {
+      continue;
+    }
+
+    if (sched_setaffinity(tid, sizeof(rest), &rest) != 0) {
+      continue;
+    }
+
+    // Remember where the thread was first, so moving it again doesn't lose that
+    auto it = g_evictions.find(tid);
+    if (it == g_evictions.end()) {
+      g_evictions.emplace(tid, Eviction {mask, rest});
+    } else {
+      it->second.narrowed = rest;
+    }
+  }
+
+  closedir(dir);
+}
+
+/**
+ * Give the threads moved off of reserved CPUs their CPUs back. Threads that
+ * changed their CPUs since are left alone, as are thread IDs that now belong
+ * to other threads (as best we can tell). The reservation mutex must be held.
+ */
+void restore() {
+  for (auto& [tid, eviction] : g_evictions) {
+    cpu_set_t mask;
+    if (sched_getaffinity(tid, sizeof(mask), &mask) != 0 || !CPU_EQUAL(&mask, &eviction.narrowed)) {
+      continue;
+    }
+
+    sched_setaffinity(tid, sizeof(eviction.original), &eviction.original);
+  }
+
+  g_evictions.clear();
+}
+
+} // namespace
+
+ThreadPlacement::ThreadPlacement(const Placement& placement) : m_tid(0) {
+  long tid = syscall(SYS_gettid);
+
+  // Pin the thread to its CPUs
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (!placement.cpus.empty()) {
+    for (auto cpu : placement.cpus) {
+      if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        fail("bad CPU " + std::to_string(cpu), EINVAL);
+      }
+      CPU_SET(cpu, &cpus);
+    }
+
+    if (auto err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+      fail("cannot set affinity", err);
+    }
+  } else if (placement.reserve) {
+    fail("no CPUs to reserve", EINVAL);
+  }
+
+  // Set the scheduling policy
+  if (placement.policy != Placement::Policy::INHERIT) {
+    int policy = SCHED_OTHER;
+    sched_param param {};
+    switch (placement.policy) {
+      case Placement::Policy::INHERIT:
+      case Placement::Policy::OTHER:
+        policy = SCHED_OTHER;
+        break;
+      case Placement::Policy::BATCH:
+        policy = SCHED_BATCH;
+        break;
+      case Placement::Policy::IDLE:
+        policy = SCHED_IDLE;
+        break;
+      case Placement::Policy::FIFO:
+        policy = SCHED_FIFO;
+        param.sched_priority = placement.priority;
+        break;
+      case Placement::Policy::RR:
+        policy = SCHED_RR;
+        param.sched_priority = placement.priority;
+        break;
+    }
+
+    if (auto err = pthread_setschedparam(pthread_self(), policy, &param)) {
+      fail("cannot set scheduling policy", err);
+    }
+
+    // On Linux, the nice value belongs to the thread, not the process
+    if (policy == SCHED_OTHER || policy == SCHED_BATCH) {
+      if (setpriority(PRIO_PROCESS, tid, placement.nice) != 0) {
+        fail("cannot set nice value", errno);
+      }
+    }
+  }
+
+  // Keep the rest of the process off of the CPUs
+  if (placement.reserve) {
+    std::lock_guard lock(g_reservations_mutex);
+    evict(tid, cpus);
+    g_reservations.insert(tid);
+    m_tid = tid;
+  }
+}
+
+ThreadPlacement::~ThreadPlacement() {
+  if (m_tid) {
+    std::lock_guard lock(g_reservations_mutex);
+    g_reservations.erase(m_tid);
+
+    // The last reservation is gone, so nothing needs to be kept off of any CPU
+    if (g_reservations.empty()) {
+      restore();
+    }
+  }
+}
+
+#else
+
+ThreadPlacement::ThreadPlacement(const Placement& placement) : m_tid(0) {
+  if (!placement.cpus.empty() || placement.reserve || placement.policy != Placement::Policy::INHERIT) {
+    throw std::runtime_error("thread placement failed: not supported on this platform");
+  }
+}
+
+ThreadPlacement::~ThreadPlacement() {
+}
+
+#endif
+
+} // namespace faces
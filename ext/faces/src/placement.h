@@ -0,0 +1,42 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <faces/placement.h>
+
+namespace faces {
+
+/**
+ * A placement applied to the calling thread. The thread keeps any CPUs it
+ * reserves for as long as it keeps this, even when other threads reserve CPUs
+ * after it. Once the last reservation in the process is gone, the threads moved
+ * off of reserved CPUs get their old CPUs back.
+ */
+class ThreadPlacement {
+  /** The kernel thread ID, or zero if the placement reserved nothing. */
+  long m_tid;
+
+public:
+  /**
+   * Apply a placement to the calling thread. This throws if it cannot be done.
+   *
+   * @param placement The placement
+   */
+  explicit ThreadPlacement(const Placement& placement);
+
+  ThreadPlacement(const ThreadPlacement& rhs) = delete;
+
+  ~ThreadPlacement();
+
+  ThreadPlacement& operator=(const ThreadPlacement& rhs) = delete;
+};
+
+} // namespace faces
+
+#endif // #ifndef PLACEMENT_H
@@ -0,0 +1,55 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <new>
+
+#include "pool.h"
+
+namespace faces {
+
+BlockPool::BlockPool() : m_mutex(), m_free(), m_block_size(0) {
+}
+
+BlockPool::~BlockPool() {
+  for (auto block : m_free) {
+    ::operator delete(block);
+  }
+}
+
+void* BlockPool::allocate(std::size_t size) {
+  {
+    std::lock_guard lock(m_mutex);
+
+    // The first allocation sets the block size
+    if (m_block_size == 0) {
+      m_block_size = size;
+    }
+
+    // Reuse a free block, if there is one
+    if (size == m_block_size && !m_free.empty()) {
+      auto block = m_free.back();
+      m_free.pop_back();
+      return block;
+    }
+  }
+
+  return ::operator new(size);
+}
+
+void BlockPool::deallocate(void* block, std::size_t size) {
+  // Blocks of other sizes are not ours to keep
+  std::unique_lock lock(m_mutex);
+  if (size != m_block_size) {
+    lock.unlock();
+    ::operator delete(block);
+    return;
+  }
+
+  m_free.push_back(block);
+}
+
+} // namespace faces
@@ -0,0 +1,106 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace faces {
+
+/**
+ * A free list of same-sized memory blocks. Blocks given back are kept for the
+ * next taker instead of being freed, so once the pool has handed out as many
+ * blocks as are ever in use at once, it stops allocating. The block size is
+ * set by the first allocation, and other sizes go straight to the heap.
+ */
+class BlockPool {
+  /** Guards the free list. Blocks may come back on any thread. */
+  std::mutex m_mutex;
+
+  /** The free blocks. */
+  std::vector<void*> m_free;
+
+  /** The block size in bytes, or zero until the first allocation. */
+  std::size_t m_block_size;
+
+public:
+  BlockPool();
+
+  BlockPool(const BlockPool& rhs) = delete;
+
+  ~BlockPool();
+
+  BlockPool& operator=(const BlockPool& rhs) = delete;
+
+  /**
+   * Take a block.
+   *
+   * @param size The size in bytes
+   * @return The block
+   */
+  void* allocate(std::size_t size);
+
+  /**
+   * Give a block back.
+   *
+   * @param block The block
+   * @param size The size in bytes (the same as when it was taken)
+   */
+  void deallocate(void* block, std::size_t size);
+};
+
+/**
+ * A standard allocator that takes its memory from a block pool. This suits
+ * things that allocate one object at a time, like shared pointer control
+ * blocks. Every copy shares the pool, so it lives as long as any memory
+ * taken from it might.
+ */
+template<class T>
+class PoolAllocator {
+  template<class U>
+  friend class PoolAllocator;
+
+  /** The block pool. */
+  std::shared_ptr<BlockPool> m_pool;
+
+public:
+  using value_type = T;
+
+  explicit PoolAllocator(std::shared_ptr<BlockPool> p_pool) : m_pool(std::move(p_pool)) {
+  }
+
+  template<class U>
+  PoolAllocator(const PoolAllocator<U>& rhs) : m_pool(rhs.m_pool) {
+  }
+
+  T* allocate(std::size_t n) {
+    return static_cast<T*>(m_pool->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, std::size_t n) {
+    m_pool->deallocate(ptr, n * sizeof(T));
+  }
+
+  template<class U>
+  bool operator==(const PoolAllocator<U>& rhs) const {
+    return m_pool == rhs.m_pool;
+  }
+
+  template<class U>
+  bool operator!=(const PoolAllocator<U>& rhs) const {
+    return m_pool != rhs.m_pool;
+  }
+};
+
+} // namespace faces
+
+#endif // #ifndef POOL_H
@@ -0,0 +1,548 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "preprocess.h"
+
+namespace faces {
+
+namespace {
+
+/**
+ * Apply the 1-4-6-4-1 kernel across five rows of bytes: out = (a + 4b + 6c +
+ * 4d + e + 8) / 16. Both blur passes reduce to this, since a horizontal pass
+ * over packed pixels is just five views of one row offset by whole pixels.
+ */
+void tap5(const std::uint8_t* a, const std::uint8_t* b, const std::uint8_t* c, const std::uint8_t* d,
+    const std::uint8_t* e, std::uint8_t* out, std::size_t n) {
+  std::size_t i = 0;
+
+#ifdef __SSE2__
+  const auto zero = _mm_setzero_si128();
+  const auto eight = _mm_set1_epi16(8);
+
+  // Widen to 16 bits, sum, and narrow back, sixteen bytes at a time
+  auto half = [&](__m128i va, __m128i vb, __m128i vc, __m128i vd, __m128i ve) {
+    auto outer = _mm_add_epi16(va, ve);
+    auto inner = _mm_slli_epi16(_mm_add_epi16(vb, vd), 2);
+    auto center = _mm_add_epi16(_mm_slli_epi16(vc, 2), _mm_slli_epi16(vc, 1));
+    auto sum = _mm_add_epi16(_mm_add_epi16(outer, inner), _mm_add_epi16(center, eight));
+    return _mm_srli_epi16(sum, 4);
+  };
+
+  for (; i + 16 <= n; i += 16) {
+    auto va = _mm_loadu_si128((const __m128i*) (a + i));
+    auto vb = _mm_loadu_si128((const __m128i*) (b + i));
+    auto vc = _mm_loadu_si128((const __m128i*) (c + i));
+    auto vd = _mm_loadu_si128((const __m128i*) (d + i));
+    auto ve = _mm_loadu_si128((const __m128i*) (e + i));
+
+    auto lo = half(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero), _mm_unpacklo_epi8(vc, zero),
+        _mm_unpacklo_epi8(vd, zero), _mm_unpacklo_epi8(ve, zero));
+    auto hi = half(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero), _mm_unpackhi_epi8(vc, zero),
+        _mm_unpackhi_epi8(vd, zero), _mm_unpackhi_epi8(ve, zero));
+
+    _mm_storeu_si128((__m128i*) (out + i), _mm_packus_epi16(lo, hi));
+  }
+#endif
+
+  // Finish the tail one byte at a time
+  for (; i < n; ++i) {
+    out[i] = static_cast<std::uint8_t>((a[i] + 4 * b[i] + 6 * c[i] + 4 * d[i] + e[i] + 8) >> 4);
+  }
+}
+
+/** Average two rows of bytes, rounding up. */
+void average_rows(const std::uint8_t* a, const std::uint8_t* b, std::uint8_t* out, std::size_t n) {
+  std::size_t i = 0;
+
+#ifdef __SSE2__
+  for (; i + 16 <= n; i += 16) {
+    auto va = _mm_loadu_si128((const __m128i*) (a + i));
+    auto vb = _mm_loadu_si128((const __m128i*) (b + i));
+    _mm_storeu_si128((__m128i*) (out + i), _mm_avg_epu8(va, vb));
+  }
+#endif
+
+  for (; i < n; ++i) {
+    out[i] = static_cast<std::uint8_t>((a[i] + b[i] + 1) >> 1);
+  }
+}
+
+#ifdef __SSE2__
+
+/**
+ * Load four packed 3-byte pixels into the 32-bit lanes of a register, with
+ * the top byte of each lane zeroed. This reads sixteen bytes.
+ */
+inline __m128i load_pixels3(const std::uint8_t* src) {
+  auto v = _mm_loadu_si128((const __m128i*) src);
+
+  // Give each 64-bit half two pixels, then move the second of each up a byte
+  auto pairs = _mm_unpacklo_epi64(v, _mm_srli_si128(v, 6));
+  auto first = _mm_set_epi32(0, 0xffffff, 0, 0xffffff);
+  auto second = _mm_set_epi32(0xffffff, 0, 0xffffff, 0);
+  return _mm_or_si128(_mm_and_si128(pairs, first), _mm_and_si128(_mm_slli_epi64(pairs, 8), second));
+}
+
+/** Swap the first and third bytes of each 32-bit lane, and zero the fourth. */
+inline __m128i swap_rb(__m128i p) {
+  auto low = _mm_set1_epi32(0xff);
+  auto r = _mm_slli_epi32(_mm_and_si128(p, low), 16);
+  auto g = _mm_and_si128(p, _mm_set1_epi32(0xff00));
+  auto b = _mm_and_si128(_mm_srli_epi32(p, 16), low);
+  return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+/** Squeeze four pixels in 32-bit lanes (top bytes zero) into the first twelve bytes of a register. */
+inline __m128i squeeze_pixels3(__m128i p) {
+  // Close the gap in each 64-bit half, leaving six bytes there
+  auto low = _mm_set_epi32(0, -1, 0, -1);
+  auto halves = _mm_or_si128(_mm_and_si128(p, low), _mm_srli_epi64(_mm_andnot_si128(low, p), 8));
+
+  // Then close the gap between the halves
+  auto first = _mm_set_epi32(0, 0, -1, -1);
+  return _mm_or_si128(_mm_and_si128(halves, first), _mm_srli_si128(_mm_andnot_si128(first, halves), 2));
+}
+
+/** Store sixteen pixels in 32-bit lanes (top bytes zero) as 48 packed bytes. */
+inline void store_pixels3(__m128i p0, __m128i p1, __m128i p2, __m128i p3, std::uint8_t* dst) {
+  auto c0 = squeeze_pixels3(p0);
+  auto c1 = squeeze_pixels3(p1);
+  auto c2 = squeeze_pixels3(p2);
+  auto c3 = squeeze_pixels3(p3);
+
+  _mm_storeu_si128((__m128i*) dst, _mm_or_si128(c0, _mm_slli_si128(c1, 12)));
+  _mm_storeu_si128((__m128i*) (dst + 16), _mm_or_si128(_mm_srli_si128(c1, 4), _mm_slli_si128(c2, 8)));
+  _mm_storeu_si128((__m128i*) (dst + 32), _mm_or_si128(_mm_srli_si128(c2, 8), _mm_slli_si128(c3, 4)));
+}
+
+/**
+ * Compute the luma of four pixels in 32-bit lanes. The weighted sum fits in
+ * 16 bits, so 16-bit multiplies do (SSE2 has no 32-bit one).
+ *
+ * @param p The pixels
+ * @param w0 The weight of the first byte of each pixel
+ * @param w2 The weight of the third byte of each pixel
+ */
+inline __m128i luma_pixels(__m128i p, __m128i w0, __m128i w2) {
+  auto low = _mm_set1_epi32(0xff);
+  auto c0 = _mm_and_si128(p, low);
+  auto c1 = _mm_and_si128(_mm_srli_epi32(p, 8), low);
+  auto c2 = _mm_and_si128(_mm_srli_epi32(p, 16), low);
+
+  auto sum = _mm_add_epi16(_mm_mullo_epi16(c0, w0), _mm_mullo_epi16(c1, _mm_set1_epi32(150)));
+  sum = _mm_add_epi16(sum, _mm_mullo_epi16(c2, w2));
+  sum = _mm_add_epi16(sum, _mm_set1_epi32(128));
+  return _mm_srli_epi32(sum, 8);
+}
+
+/** Store sixteen lumas in 32-bit lanes as bytes. */
+inline void store_luma(__m128i y0, __m128i y1, __m128i y2, __m128i y3, std::uint8_t* dst) {
+  auto lo = _mm_packs_epi32(y0, y1);
+  auto hi = _mm_packs_epi32(y2, y3);
+  _mm_storeu_si128((__m128i*) dst, _mm_packus_epi16(lo, hi));
+}
+
+#endif
+
+/** Blur one row horizontally, clamping at the edges. */
+void blur_row(const std::uint8_t* in, std::uint8_t* out, int width, int channels) {
+  auto at = [&](int x, int ch) {
+    return in[std::clamp(x, 0, width - 1) * channels + ch];
+  };
+
+  // The edge pixels need clamping, so do them by hand
+  auto edge = [&](int x) {
+    for (int ch = 0; ch < channels; ++ch) {
+      out[x * channels + ch] = static_cast<std::uint8_t>((at(x - 2, ch) + 4 * at(x - 1, ch) + 6 * at(x, ch)
+          + 4 * at(x + 1, ch) + at(x + 2, ch) + 8) >> 4);
+    }
+  };
+
+  // If the row is too narrow for an interior
+  if (width < 5) {
+    for (int x = 0; x < width; ++x) {
+      edge(x);
+    }
+    return;
+  }
+
+  edge(0);
+  edge(1);
+
+  // The interior is five shifted views of the same row
+  auto c = static_cast<std::size_t>(channels);
+  tap5(in, in + c, in + 2 * c, in + 3 * c, in + 4 * c, out + 2 * c, (width - 4) * c);
+
+  edge(width - 2);
+  edge(width - 1);
+}
+
+} // namespace
+
+void convert_row_rgb(PixelFormat format, const std::uint8_t* src, std::uint8_t* dst, int width) {
+  int x = 0;
+
+#ifdef __SSE2__
+  // Sixteen pixels at a time, each in a 32-bit lane
+  // Three-byte pixels are loaded sixteen bytes at a time, so stay clear of the end of the row
+  switch (format) {
+    case PixelFormat::RGB:
+      break;
+    case PixelFormat::BGR: {
+      // Each byte comes from two bytes on, where it is the start of a pixel, from two bytes back, where it is the
+      // end, or from where it is, in between
+      // That reaches back before the row for the first pixel, so it goes by hand
+      if (width > 0) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        x = 1;
+      }
+
+      __m128i ahead[3];
+      __m128i here[3];
+      __m128i behind[3];
+      for (int k = 0; k < 3; ++k) {
+        std::uint8_t m[3][16];
+        for (int b = 0; b < 16; ++b) {
+          auto phase = (16 * k + b) % 3;
+          m[0][b] = phase == 0 ? 0xff : 0;
+          m[1][b] = phase == 1 ? 0xff : 0;
+          m[2][b] = phase == 2 ? 0xff : 0;
+        }
+        ahead[k] = _mm_loadu_si128((const __m128i*) m[0]);
+        here[k] = _mm_loadu_si128((const __m128i*) m[1]);
+        behind[k] = _mm_loadu_si128((const __m128i*) m[2]);
+      }
+
+      for (; x + 17 <= width; x += 16) {
+        for (int k = 0; k < 3; ++k) {
+          auto at = 3 * x + 16 * k;
+          auto v = _mm_and_si128(_mm_loadu_si128((const __m128i*) (src + at + 2)), ahead[k]);
+          v = _mm_or_si128(v, _mm_and_si128(_mm_loadu_si128((const __m128i*) (src + at)), here[k]));
+          v = _mm_or_si128(v, _mm_and_si128(_mm_loadu_si128((const __m128i*) (src + at - 2)), behind[k]));
+          _mm_storeu_si128((__m128i*) (dst + at), v);
+        }
+      }
+      break;
+    }
+    case PixelFormat::RGBA: {
+      auto rgb = _mm_set1_epi32(0xffffff);
+      for (; x + 16 <= width; x += 16) {
+        auto in = (const __m128i*) (src + 4 * x);
+        store_pixels3(_mm_and_si128(_mm_loadu_si128(in), rgb), _mm_and_si128(_mm_loadu_si128(in + 1), rgb),
+            _mm_and_si128(_mm_loadu_si128(in + 2), rgb), _mm_and_si128(_mm_loadu_si128(in + 3), rgb), dst + 3 * x);
+      }
+      break;
+    }
+    case PixelFormat::BGRA:
+      for (; x + 16 <= width; x += 16) {
+        auto in = (const __m128i*) (src + 4 * x);
+        store_pixels3(swap_rb(_mm_loadu_si128(in)), swap_rb(_mm_loadu_si128(in + 1)),
+            swap_rb(_mm_loadu_si128(in + 2)), swap_rb(_mm_loadu_si128(in + 3)), dst + 3 * x);
+      }
+      break;
+    case PixelFormat::GRAY: {
+      // Widen each byte to a lane, then copy it into the two bytes above
+      auto zero = _mm_setzero_si128();
+      auto spread = [](__m128i p) {
+        return _mm_or_si128(_mm_or_si128(p, _mm_slli_epi32(p, 8)), _mm_slli_epi32(p, 16));
+      };
+      for (; x + 16 <= width; x += 16) {
+        auto v = _mm_loadu_si128((const __m128i*) (src + x));
+        auto lo = _mm_unpacklo_epi8(v, zero);
+        auto hi = _mm_unpackhi_epi8(v, zero);
+        store_pixels3(spread(_mm_unpacklo_epi16(lo, zero)), spread(_mm_unpackhi_epi16(lo, zero)),
+            spread(_mm_unpacklo_epi16(hi, zero)), spread(_mm_unpackhi_epi16(hi, zero)), dst + 3 * x);
+      }
+      break;
+    }
+  }
+#endif
+
+  // Finish the tail one pixel at a time
+  switch (format) {
+    case PixelFormat::RGB:
+      std::memcpy(dst, src, width * 3ul);
+      break;
+    case PixelFormat::BGR:
+      for (; x < width; ++x) {
+        dst[3 * x + 0] = src[3 * x + 2];
+        dst[3 * x + 1] = src[3 * x + 1];
+        dst[3 * x + 2] = src[3 * x + 0];
+      }
+      break;
+    case PixelFormat::RGBA:
+      for (; x < width; ++x) {
+        dst[3 * x + 0] = src[4 * x + 0];
+        dst[3 * x + 1] = src[4 * x + 1];
+        dst[3 * x + 2] = src[4 * x + 2];
+      }
+      break;
+    case PixelFormat::BGRA:
+      for (; x < width; ++x) {
+        dst[3 * x + 0] = src[4 * x + 2];
+        dst[3 * x + 1] = src[4 * x + 1];
+        dst[3 * x + 2] = src[4 * x + 0];
+      }
+      break;
+    case PixelFormat::GRAY:
+      for (; x < width; ++x) {
+        dst[3 * x + 0] = dst[3 * x + 1] = dst[3 * x + 2] = src[x];
+      }
+      break;
+  }
+}
+
+void convert_row_gray(PixelFormat format, const std::uint8_t* src, std::uint8_t* dst, int width) {
+  // Fixed-point BT.601 luma weights (they sum to 256)
+  auto luma = [](int r, int g, int b) {
+    return static_cast<std::uint8_t>((77 * r + 150 * g + 29 * b + 128) >> 8);
+  };
+
+  int x = 0;
+
+#ifdef __SSE2__
+  // Sixteen pixels at a time, each in a 32-bit lane
+  // Three-byte pixels are loaded sixteen bytes at a time, so stay clear of the end of the row
+  auto red = _mm_set1_epi32(77);
+  auto blue = _mm_set1_epi32(29);
+  switch (format) {
+    case PixelFormat::RGB:
+    case PixelFormat::BGR: {
+      auto w0 = format == PixelFormat::RGB ? red : blue;
+      auto w2 = format == PixelFormat::RGB ? blue : red;
+      for (; x + 18 <= width; x += 16) {
+        auto in = src + 3 * x;
+        store_luma(luma_pixels(load_pixels3(in), w0, w2), luma_pixels(load_pixels3(in + 12), w0, w2),
+            luma_pixels(load_pixels3(in + 24), w0, w2), luma_pixels(load_pixels3(in + 36), w0, w2), dst + x);
+      }
+      break;
+    }
+    case PixelFormat::RGBA:
+    case PixelFormat::BGRA: {
+      auto w0 = format == PixelFormat::RGBA ? red : blue;
+      auto w2 = format == PixelFormat::RGBA ? blue : red;
+      for (; x + 16 <= width; x += 16) {
+        auto in = (const __m128i*) (src + 4 * x);
+        store_luma(luma_pixels(_mm_loadu_si128(in), w0, w2), luma_pixels(_mm_loadu_si128(in + 1), w0, w2),
+            luma_pixels(_mm_loadu_si128(in + 2), w0, w2), luma_pixels(_mm_loadu_si128(in + 3), w0, w2), dst + x);
+      }
+      break;
+    }
+    case PixelFormat::GRAY:
+      break;
+  }
+#endif
+
+  // Finish the tail one pixel at a time
+  switch (format) {
+    case PixelFormat::RGB:
+      for (; x < width; ++x) {
+        dst[x] = luma(src[3 * x + 0], src[3 * x + 1], src[3 * x + 2]);
+      }
+      break;
+    case PixelFormat::BGR:
+      for (; x < width; ++x) {
+        dst[x] = luma(src[3 * x + 2], src[3 * x + 1], src[3 * x + 0]);
+      }
+      break;
+    case PixelFormat::RGBA:
+      for (; x < width; ++x) {
+        dst[x] = luma(src[4 * x + 0], src[4 * x + 1], src[4 * x + 2]);
+      }
+      break;
+    case PixelFormat::BGRA:
+      for (; x < width; ++x) {
+        dst[x] = luma(src[4 * x + 2], src[4 * x + 1], src[4 * x + 0]);
+      }
+      break;
+    case PixelFormat::GRAY:
+      std::memcpy(dst, src, static_cast<std::size_t>(width));
+      break;
+  }
+}
+
+void downscale_half(const std::uint8_t* src, int width, int height, int channels, std::uint8_t* dst,
+    std::vector<std::uint8_t>& scratch) {
+  auto out_width = width / 2;
+  auto out_height = height / 2;
+  auto row_bytes = static_cast<std::size_t>(width) * channels;
+
+  scratch.resize(row_bytes);
+
+  for (int y = 0; y < out_height; ++y) {
+    // Average the row pair vertically
+    average_rows(src + 2 * y * row_bytes, src + (2 * y + 1) * row_bytes, scratch.data(), row_bytes);
+
+    // Then average neighboring pixels horizontally
+    auto out = dst + static_cast<std::size_t>(y) * out_width * channels;
+    for (int x = 0; x < out_width; ++x) {
+      for (int ch = 0; ch < channels; ++ch) {
+        out[x * channels + ch] = static_cast<std::uint8_t>(
+            (scratch[2 * x * channels + ch] + scratch[(2 * x + 1) * channels + ch] + 1) >> 1);
+      }
+    }
+  }
+}
+
+void upscale_double(const std::uint8_t* src, int width, int height, int channels, std::uint8_t* dst) {
+  auto out_width = width * 2;
+  auto out_row_bytes = static_cast<std::size_t>(out_width) * channels;
+
+  // Expand each source row horizontally into the even output rows
+  for (int y = 0; y < height; ++y) {
+    auto in = src + static_cast<std::size_t>(y) * width * channels;
+    auto out = dst + 2 * y * out_row_bytes;
+
+    int x = 0;
+
+#ifdef __SSE2__
+    // For RGB, sixteen pixels at a time, each in a 32-bit lane
+    // Each pixel is followed by its average with the next, which is the same row loaded a pixel on
+    // Pixels are loaded sixteen bytes at a time, so stay clear of the end of the row
+    if (channels == 3) {
+      for (; x + 19 <= width; x += 16) {
+        __m128i spread[8];
+        for (int i = 0; i < 4; ++i) {
+          auto p = load_pixels3(in + 3 * (x + 4 * i));
+          auto mid = _mm_avg_epu8(p, load_pixels3(in + 3 * (x + 4 * i + 1)));
+          spread[2 * i] = _mm_unpacklo_epi32(p, mid);
+          spread[2 * i + 1] = _mm_unpackhi_epi32(p, mid);
+        }
+        store_pixels3(spread[0], spread[1], spread[2], spread[3], out + 6 * x);
+        store_pixels3(spread[4], spread[5], spread[6], spread[7], out + 6 * x + 48);
+      }
+    }
+#endif
+
+    // Finish the tail one pixel at a time
+    for (; x < width; ++x) {
+      auto next = std::min(x + 1, width - 1);
+      for (int ch = 0; ch < channels; ++ch) {
+        out[2 * x * channels + ch] = in[x * channels + ch];
+        out[(2 * x + 1) * channels + ch] = static_cast<std::uint8_t>(
+            (in[x * channels + ch] + in[next * channels + ch] + 1) >> 1);
+      }
+    }
+  }
+
+  // Interpolate the odd output rows between their even neighbors
+  for (int y = 0; y < height; ++y) {
+    auto above = dst + 2 * y * out_row_bytes;
+    auto below = y + 1 < height ? above + 2 * out_row_bytes : above;
+    average_rows(above, below, above + out_row_bytes, out_row_bytes);
+  }
+}
+
+void blur_binomial5(std::uint8_t* data, int width, int height, int channels, std::vector<std::uint8_t>& scratch) {
+  auto row_bytes = static_cast<std::size_t>(width) * channels;
+
+  scratch.resize(row_bytes * height);
+
+  // Horizontal pass into scratch
+  for (int y = 0; y < height; ++y) {
+    blur_row(data + y * row_bytes, scratch.data() + y * row_bytes, width, channels);
+  }
+
+  // Vertical pass back into the image, clamping rows at the edges
+  auto row = [&](int y) {
+    return scratch.data() + std::clamp(y, 0, height - 1) * row_bytes;
+  };
+  for (int y = 0; y < height; ++y) {
+    tap5(row(y - 2), row(y - 1), row(y), row(y + 1), row(y + 2), data + y * row_bytes, row_bytes);
+  }
+}
+
+Preprocessor::Preprocessor()
+    : m_config()
+    , m_output()
+    , m_stage()
+    , m_scratch() {
+}
+
+bool Preprocessor::is_identity(const Image& input) const {
+  return input.format == PixelFormat::RGB && m_config.resize == Preprocess::Resize::NONE && !m_config.blur;
+}
+
+void Preprocessor::process(const Image& input) {
+  // Nothing to do for the identity
+  if (is_identity(input)) {
+    return;
+  }
+
+  // Guard against frames shorter than their dimensions claim
+  if (!input.fits()) {
+    m_output.width = 0;
+    m_output.height = 0;
+    m_output.data.clear();
+    return;
+  }
+
+  auto src = reinterpret_cast<const std::uint8_t*>(input.pixels());
+  auto src_step = static_cast<std::size_t>(input.step());
+
+  // Convert to packed RGB, dropping any row padding
+  // When no resize follows, convert straight into the output
+  auto& converted = m_config.resize == Preprocess::Resize::NONE ? m_output : m_stage;
+  converted.width = input.width;
+  converted.height = input.height;
+  converted.data.resize(static_cast<std::size_t>(input.width) * input.height * 3);
+  for (int y = 0; y < input.height; ++y) {
+    convert_row_rgb(input.format, src + y * src_step,
+        reinterpret_cast<std::uint8_t*>(converted.data.data()) + y * input.width * 3ul, input.width);
+  }
+
+  // Resize into the output
+  switch (m_config.resize) {
+    case Preprocess::Resize::NONE:
+      break;
+    case Preprocess::Resize::HALF:
+      m_output.width = m_stage.width / 2;
+      m_output.height = m_stage.height / 2;
+      m_output.data.resize(static_cast<std::size_t>(m_output.width) * m_output.height * 3);
+      downscale_half(reinterpret_cast<const std::uint8_t*>(m_stage.data.data()), m_stage.width, m_stage.height, 3,
+          reinterpret_cast<std::uint8_t*>(m_output.data.data()), m_scratch);
+      break;
+    case Preprocess::Resize::DOUBLE:
+      m_output.width = m_stage.width * 2;
+      m_output.height = m_stage.height * 2;
+      m_output.data.resize(static_cast<std::size_t>(m_output.width) * m_output.height * 3);
+      upscale_double(reinterpret_cast<const std::uint8_t*>(m_stage.data.data()), m_stage.width, m_stage.height, 3,
+          reinterpret_cast<std::uint8_t*>(m_output.data.data()));
+      break;
+  }
+
+  // Denoise the output in place
+  if (m_config.blur && m_output.width > 0 && m_output.height > 0) {
+    blur_binomial5(reinterpret_cast<std::uint8_t*>(m_output.data.data()), m_output.width, m_output.height, 3,
+        m_scratch);
+  }
+}
+
+int Preprocessor::unmap(int value) const {
+  switch (m_config.resize) {
+    case Preprocess::Resize::NONE:
+      return value;
+    case Preprocess::Resize::HALF:
+      return value * 2;
+    case Preprocess::Resize::DOUBLE:
+      return value / 2;
+  }
+
+  return value;
+}
+
+} // namespace faces
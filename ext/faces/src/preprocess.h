@@ -0,0 +1,146 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <faces/preprocess.h>
+#include <faces/source.h>
+
+namespace faces {
+
+/**
+ * Convert a row of pixels to packed RGB.
+ *
+ * @param format The source pixel format
+ * @param src The source row
+ * @param dst The destination row
+ * @param width The number of pixels
+ */
+void convert_row_rgb(PixelFormat format, const std::uint8_t* src, std::uint8_t* dst, int width);
+
+/**
+ * Convert a row of pixels to luminance.
+ *
+ * @param format The source pixel format
+ * @param src The source row
+ * @param dst The destination row
+ * @param width The number of pixels
+ */
+void convert_row_gray(PixelFormat format, const std::uint8_t* src, std::uint8_t* dst, int width);
+
+/**
+ * Halve a packed image in both dimensions by averaging 2x2 blocks.
+ *
+ * @param src The source pixels
+ * @param width The source width
+ * @param height The source height
+ * @param channels The number of channels
+ * @param dst The destination pixels ((width / 2) x (height / 2))
+ * @param scratch Reusable scratch memory
+ */
+void downscale_half(const std::uint8_t* src, int width, int height, int channels, std::uint8_t* dst,
+    std::vector<std::uint8_t>& scratch);
+
+/**
+ * Double a packed image in both dimensions with bilinear interpolation.
+ *
+ * @param src The source pixels
+ * @param width The source width
+ * @param height The source height
+ * @param channels The number of channels
+ * @param dst The destination pixels ((width * 2) x (height * 2))
+ */
+void upscale_double(const std::uint8_t* src, int width, int height, int channels, std::uint8_t* dst);
+
+/**
+ * Blur a packed image in place with a separable 5-tap binomial kernel. This
+ * approximates a Gaussian blur with a sigma of one pixel.
+ *
+ * @param data The pixels
+ * @param width The image width
+ * @param height The image height
+ * @param channels The number of channels
+ * @param scratch Reusable scratch memory
+ */
+void blur_binomial5(std::uint8_t* data, int width, int height, int channels, std::vector<std::uint8_t>& scratch);
+
+/**
+ * The preprocessing stage in front of the detector. It writes into buffers it
+ * owns and reuses from frame to frame, so steady-state operation does not
+ * allocate.
+ */
+class Preprocessor {
+  /** The preprocessing settings. */
+  Preprocess m_config;
+
+  /** The output frame. The detector reads from this. */
+  Image m_output;
+
+  /** An intermediate frame. */
+  Image m_stage;
+
+  /** Scratch memory for the kernels. */
+  std::vector<std::uint8_t> m_scratch;
+
+public:
+  Preprocessor();
+
+  /**
+   * @return The preprocessing settings
+   */
+  const Preprocess& get_config() const {
+    return m_config;
+  }
+
+  /**
+   * @param p_config The preprocessing settings
+   */
+  void set_config(const Preprocess& p_config) {
+    m_config = p_config;
+  }
+
+  /**
+   * @return The output frame buffer
+   */
+  const Image& output() const {
+    return m_output;
+  }
+
+  /**
+   * Check whether a frame needs any work at all. Packed or strided RGB frames
+   * can go straight to the detector if no resizing or denoising is configured.
+   *
+   * @param input The input frame
+   * @return True if the frame can pass through untouched, otherwise false
+   */
+  bool is_identity(const Image& input) const;
+
+  /**
+   * Preprocess a frame into the output buffer. Does nothing if the frame
+   * passes through untouched, in which case it should be used directly.
+   *
+   * @param input The input frame
+   */
+  void process(const Image& input);
+
+  /**
+   * Map a coordinate in the output frame back to the input frame.
+   *
+   * @param value The output coordinate
+   * @return The input coordinate
+   */
+  int unmap(int value) const;
+};
+
+} // namespace faces
+
+#endif // #ifndef PREPROCESS_H
@@ -5,152 +5,176 @@
  * InsertLicenseText
  */
 
-#include <atomic>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <future>
 #include <iostream>
-#include <map>
-#include <mutex>
+#include <limits>
+#include <optional>
 #include <thread>
 #include <vector>
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include <faces/cache.h>
 #include <faces/encoding.h>
 #include <faces/recognizer.h>
 #include <faces/source.h>
+#include <faces/trace.h>
 
-#include <spdyface.h>
-#include <spdyface/dlib_ffd_detector.h>
-#include <spdyface/dlib_v1_embedder.h>
-
-#include "common_image.h"
+#include "alloc_counter.h"
+#include "placement.h"
+#include "recognizer_impl.h"
 
 namespace faces {
 
-struct RecognizerImpl {
-  /** The recognizer object. */
-  Recognizer& m_recognizer;
-
-  /** The spdyface context. */
-  SFContext m_spdy;
-
-  /** The face detector. */
-  SFDlibFFDDetector m_detector;
-
-  /** The face embedder. */
-  SFDlibV1Embedder m_embedder;
-
-  /** The last video frame received. */
-  Image m_frame;
-
-  /**
-   * The spdyface common image view. The phrase "common image" is specific to
-   * cozmonaut. It preserves the binary format of raw images in Python's PIL
-   * (Python Image Library), which is used by the Cozmo SDK.
-   */
-  SFCommonImage m_com_image;
-
-  /** The continuous recognition thread. */
-  std::thread m_crt;
-
-  /** Kill switch for the continuous recognition thread. */
-  std::atomic_flag m_crt_kill;
-
-  /** Mutex for interfacing with the continuous recognition thread. */
-  std::mutex m_crt_mutex;
-
-  /** All registered face appearance callbacks. */
-  std::vector<Recognizer::CbFaceAppear> m_cbs_face_appear;
-
-  /** All registered face disappearance callbacks. */
-  std::vector<Recognizer::CbFaceDisappear> m_cbs_face_disappear;
-
-  /** All registered face movement callbacks. */
-  std::vector<Recognizer::CbFaceMove> m_cbs_face_move;
-
-  /** Pending face appearance events. */
-  std::vector<std::tuple<Recognizer&, int, std::tuple<int, int, int, int>, Encoding>> m_evts_face_appear;
-
-  /** Pending face disappearance events. */
-  std::vector<std::tuple<Recognizer&, int>> m_evts_face_disappear;
-
-  /** Pending face movement events. */
-  std::vector<std::tuple<Recognizer&, int, std::tuple<int, int, int, int>>> m_evts_face_move;
-
-  /** The face cache. */
-  Cache* m_cache;
-
-  /** The video source. */
-  Source* m_source;
-
-  /** A map of face IDs to the numbers of frames they've been off screen. */
-  std::map<int, int> m_lifetimes;
-
-  explicit RecognizerImpl(Recognizer& p_recognizer);
-
-  ~RecognizerImpl();
-
-  /** Main function for the continuous recognition thread. */
-  void crt_main();
-
-  /** The continuous recognition loop. */
-  void crt_loop();
-};
-
-RecognizerImpl::RecognizerImpl(Recognizer& p_recognizer)
+RecognizerImpl::RecognizerImpl(Recognizer& p_recognizer, Recognizer::Backend p_backend)
     : m_recognizer(p_recognizer)
+    , m_backend(p_backend)
     , m_spdy()
-    , m_detector()
-    , m_embedder()
+    , m_models()
+    , m_models_ready(false)
+    , m_synthetic_detector()
+    , m_synthetic_embedder()
     , m_com_image()
+    , m_preprocessor()
+    , m_com_image_pre()
+    , m_scene_gate()
+    , m_scene_gating()
+    , m_sampling()
+    , m_idle(false)
+    , m_last_active(0)
+    , m_wake_count(0)
+    , m_next_frame(0)
     , m_crt()
+    , m_crt_placement()
     , m_crt_kill(true)
     , m_crt_mutex()
+    , m_cbs_mutex()
     , m_cbs_face_appear()
     , m_cbs_face_disappear()
     , m_cbs_face_move()
     , m_evts_face_appear()
+    , m_evts_face_appear_encs()
     , m_evts_face_disappear()
     , m_evts_face_move()
+    , m_evt_seq(0)
+    , m_stats()
     , m_cache()
     , m_source()
-    , m_lifetimes() {
+    , m_notify_read(-1)
+    , m_notify_write(-1)
+    , m_notify_armed(false)
+    , m_stream(0)
+    , m_frame_time(0)
+    , m_tracks()
+    , m_next_track(1)
+    , m_cache_epoch(0)
+    , m_cache_changes()
+    , m_cache_touched() {
+  // Create event notifier
+  // Without one, callers have to fall back to polling on a timer
+#if defined(__linux__)
+  m_notify_read = m_notify_write = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_notify_read < 0) {
+    std::cerr << "Failed to create event notifier\n";
+  }
+#elif !defined(_WIN32)
+  int fds[2];
+  if (pipe(fds) == 0) {
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    m_notify_read = fds[0];
+    m_notify_write = fds[1];
+  } else {
+    std::cerr << "Failed to create event notifier\n";
+  }
+#endif
+
   // Create spdyface context
   if (sfCreate(&m_spdy)) {
     std::cerr << "Failed to create spdyface context\n";
     return;
   }
 
-  // Create face detector
-  if (sfDlibFFDDetectorCreate(&m_detector)) {
-    std::cerr << "Failed to create face detector\n";
-    return;
-  }
-  sfUseDetector(m_spdy, (SFDetector) m_detector);
+  if (m_backend == Recognizer::Backend::SYNTHETIC) {
+    // Create synthetic face detector
+    if (sfSyntheticDetectorCreate(&m_synthetic_detector)) {
+      std::cerr << "Failed to create synthetic face detector\n";
+      return;
+    }
+    sfUseDetector(m_spdy, (SFDetector) m_synthetic_detector);
 
-  // Create face embedder
-  if (sfDlibV1EmbedderCreate(&m_embedder)) {
-    std::cerr << "Failed to create face embedder\n";
-    return;
+    // Create synthetic face embedder
+    if (sfSyntheticEmbedderCreate(&m_synthetic_embedder)) {
+      std::cerr << "Failed to create synthetic face embedder\n";
+      return;
+    }
+    sfUseEmbedder(m_spdy, (SFEmbedder) m_synthetic_embedder);
+  } else {
+    // Get the face detector and embedder
+    // These load in the background, so construction does not wait on them
+    m_models = Models::acquire();
   }
-  sfUseEmbedder(m_spdy, (SFEmbedder) m_embedder);
 
   // Create common image view
   if (sfCommonImageCreate(&m_com_image, m_frame)) {
     std::cerr << "Failed to create common image\n";
     return;
   }
+
+  // Create common image view of preprocessor output
+  if (sfCommonImageCreate(&m_com_image_pre, m_preprocessor.output())) {
+    std::cerr << "Failed to create common image\n";
+    return;
+  }
 }
 
 RecognizerImpl::~RecognizerImpl() {
   // Clean up spdyface things
+  sfCommonImageDestroy(m_com_image_pre);
   sfCommonImageDestroy(m_com_image);
-  sfDlibFFDDetectorDestroy(m_detector);
-  sfDlibV1EmbedderDestroy(m_embedder);
+  if (m_backend == Recognizer::Backend::SYNTHETIC) {
+    sfSyntheticDetectorDestroy(m_synthetic_detector);
+    sfSyntheticEmbedderDestroy(m_synthetic_embedder);
+  }
   sfDestroy(m_spdy);
+
+  // Clean up event notifier
+#ifndef _WIN32
+  if (m_notify_write >= 0 && m_notify_write != m_notify_read) {
+    close(m_notify_write);
+  }
+  if (m_notify_read >= 0) {
+    close(m_notify_read);
+  }
+#endif
 }
 
-void RecognizerImpl::crt_main() {
-  // Reset the kill switch
-  m_crt_kill.test_and_set();
+void RecognizerImpl::crt_main(Placement placement, std::promise<void> placed) {
+  // Label this thread in trace output
+  trace::set_thread_name("recognizer crt");
+
+  // Put this thread where it was asked to go
+  // If that fails, start() hears about it and cleans up after us
+  std::optional<ThreadPlacement> thread_placement;
+  try {
+    thread_placement.emplace(placement);
+  } catch (...) {
+    placed.set_exception(std::current_exception());
+    return;
+  }
+  placed.set_value();
 
   // While the kill switch has not been triggered
   while (m_crt_kill.test_and_set()) {
@@ -160,95 +184,574 @@ void RecognizerImpl::crt_main() {
 }
 
 void RecognizerImpl::crt_loop() {
-  // Receive the next frame
+  // Hold off on frames until the models are loaded
+  if (m_models && !m_models_ready && !wait_models()) {
+    return;
+  }
+
+  // Sleep until the next frame is due, if sampling below the source's frame rate
+  // Sleep no more than one hundred milliseconds at a time, so stopping stays quick (TODO: Extract this)
+  auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  if (now < m_next_frame) {
+    trace::Span span_sleep("sleep");
+    std::this_thread::sleep_for(std::min(std::chrono::nanoseconds(m_next_frame - now),
+        std::chrono::nanoseconds(std::chrono::milliseconds(100))));
+    return;
+  }
+
+  // Note the allocation count, so we can tell what this frame allocated
+  auto allocs = alloc_counter::get_thread_count();
+
+  // Receive the next frame into the last one
+  // Nothing else touches the frame, so this can happen before locking
   // Time out after one hundred milliseconds (TODO: Extract this)
-  auto frame = m_source->wait(100); // Need to lock m_source
+  bool received;
+  {
+    trace::Span span_wait("wait");
+    received = m_source->wait_into(100, m_frame); // Need to lock m_source
+  }
 
   // If no frame was received, stop the iteration
-  if (!frame) {
+  if (!received) {
 //  std::cout << "No frame was received\n";
     return;
   }
 
+  trace::Span span_frame("frame");
+
   // Lock the interface mutex
   // We don't want things changing underneath us
-  std::lock_guard lock(m_crt_mutex);
+  // The acquisition gets its own span so contention with poll() shows up
+  std::unique_lock lock(m_crt_mutex, std::defer_lock);
+  {
+    trace::Span span_lock("lock crt_mutex");
+    lock.lock();
+  }
 
-  // Move frame into view
-  m_frame = std::move(*frame);
+  // Stamp the frame
+  m_frame_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+
+  // Catch up with changes to the cache
+  sync_cache();
+
+  // Skip detection if the scene has not changed
+  bool gated = gate_scene();
+
+  // Run the frame through the preprocessing stage
+  // Unless there is nothing to do, the detector reads from the preprocessor's buffer
+  // Strided and borrowed RGB frames count as nothing to do
+  auto view = m_com_image;
+  const Image* input = &m_frame;
+  if (!gated && !m_preprocessor.is_identity(m_frame)) {
+    trace::Span span_preprocess("preprocess");
+    m_preprocessor.process(m_frame);
+    view = m_com_image_pre;
+    input = &m_preprocessor.output();
+  }
+
+  // Skip frames whose pixel memory does not match their dimensions
+  if (!input->fits()) {
+    return;
+  }
 
   // Detect all faces in the frame
-  sfDetect(m_spdy, (SFImage) m_com_image, [](SFContext ctx, SFImage image, SFRectangle* bounds, void* user) {
-    // Recover pointer to implementation struct
-    auto impl = static_cast<RecognizerImpl*>(user);
-
-    // Embed the face into a 128-dimensional vector encoding
-    std::array<double, 128> vec {};
-    sfEmbed(ctx, image, bounds, vec.data());
-
-    // Construct the libfaces encoding for this face
-    Encoding enc;
-    enc.set_vector(vec);
-
-    // Query for the face in the cache with a tolerance of 0.6 (TODO: Extract this)
-    int id = impl->m_cache->query(enc, 0.6);
-
-    // If the queried returned zero, ...
-    if (id == 0) {
-      // ...then there was a cache miss
-      // THIS IS A NEVER-BEFORE-SEEN FACE
-
-      // Insert the face into the cache with an unspecified ID
-      // The cache will pick an ID to its liking and return it
-      // We know for a fact (by our definition) that the ID will be negative
-      // Negative IDs represent faces that the user hasn't specified explicitly
-      // When the user loads up faces into the cache, they must use positive IDs
-      // Our code, being above the law, can then use negative IDs for its own purposes
-      id = impl->m_cache->insert_unknown(enc);
+  if (!gated) {
+    trace::Span span_detect("detect");
+
+    // Each set of shared drivers serves one recognizer at a time, so lease one for this frame
+    std::optional<Models::Lease> lease;
+    if (m_models) {
+      lease.emplace(*m_models);
+      sfUseDetector(m_spdy, (SFDetector) lease->get_detector());
+      sfUseEmbedder(m_spdy, (SFEmbedder) lease->get_embedder());
     }
 
-    // Try to find the lifetime for this face
-    // FIXME: Renames will cause faces to be lost
-    auto lifetime_it = impl->m_lifetimes.find(id);
+    sfDetect(m_spdy, (SFImage) view, [](SFContext ctx, SFImage image, SFRectangle* bounds, void* user) {
+      // Recover pointer to implementation struct
+      auto impl = static_cast<RecognizerImpl*>(user);
 
-    // If no lifetime exists for this face
-    if (lifetime_it == impl->m_lifetimes.end()) {
-      // Enqueue an appearance event
-      impl->m_evts_face_appear.emplace_back(impl->m_recognizer, id,
-          std::tuple {bounds->left, bounds->top, bounds->right, bounds->bottom}, enc);
-    } else {
-      // Enqueue a movement event
-      impl->m_evts_face_move.emplace_back(impl->m_recognizer, id,
-          std::tuple {bounds->left, bounds->top, bounds->right, bounds->bottom});
-    }
+      // Map the face rectangle back to the coordinates of the original frame
+      auto& pre = impl->m_preprocessor;
+      std::tuple rect {pre.unmap(bounds->left), pre.unmap(bounds->top), pre.unmap(bounds->right),
+          pre.unmap(bounds->bottom)};
+
+      // Try to find the track this face continues
+      auto track = impl->match_track(rect);
+
+      // If the track already knows who this is, we're done
+      // Identity was settled when the track began, so there is no need to embed or query again
+      if (track && track->face != 0 && !track->resolve) {
+        trace::Span span_enqueue("enqueue", track->face);
+
+        track->rect = rect;
+        track->lifetime = 15; // TODO: Extract this
+        track->seen = true;
+
+        // Enqueue a movement event
+        impl->enqueue_face_move(track->id, track->face, rect);
+
+        return 0;
+      }
+
+      // Embed the face into a vector encoding
+      // The embedder fills in 128 doubles, so the encoding had better hold that many
+      static_assert(std::is_same_v<Encoding::vector_type, std::array<double, 128>>);
+      Encoding::vector_type vec {};
+      {
+        trace::Span span_embed("embed");
+        sfEmbed(ctx, image, bounds, vec.data());
+      }
+
+      // Construct the libfaces encoding for this face
+      Encoding enc;
+      enc.set_vector(vec);
+
+      // If the track is collecting samples of an unknown face, this is one more
+      // We go by the mean of the samples, which is steadier than any one of them
+      bool sampling = track && track->face == 0;
+      if (sampling) {
+        track->add_sample(vec);
+        enc.set_vector(track->mean());
+      }
+
+      // Query for the face in the cache with a tolerance of 0.6 (TODO: Extract this)
+      int id;
+      {
+        trace::Span span_query("query");
+        id = impl->m_cache->query(enc, 0.6);
+        span_query.set_arg(id);
+      }
+
+      // If the queried returned zero, ...
+      if (id == 0) {
+        // ...then there was a cache miss
+        // Before we believe that, we want a few frames' worth of samples (TODO: Extract this)
+        // Otherwise, one person walking by would leave a trail of unknown faces in the cache
+        if (!sampling || track->samples < 5) {
+          if (!track) {
+            // Start a new track without a face ID
+            // It stays quiet until it has one
+            impl->m_tracks.push_back({impl->m_next_track++, 0, rect, 0, false, false, false, {}, 0});
+            track = &impl->m_tracks.back();
+          } else if (!sampling) {
+            // The track turned out to be someone we don't know after the cache changed
+            impl->enqueue_face_disappear(track->id, track->face, track->rect);
+            track->face = 0;
+            track->sum = {};
+            track->samples = 0;
+          }
+
+          if (!sampling) {
+            track->add_sample(vec);
+          }
+
+          track->rect = rect;
+          track->lifetime = 15; // TODO: Extract this
+          track->seen = true;
+          track->resolve = false;
+
+          return 0;
+        }
+
+        // THIS IS A NEVER-BEFORE-SEEN FACE
+
+        // Insert the face into the cache with an unspecified ID
+        // The cache will pick an ID to its liking and return it
+        // We know for a fact (by our definition) that the ID will be negative
+        // Negative IDs represent faces that the user hasn't specified explicitly
+        // When the user loads up faces into the cache, they must use positive IDs
+        // Our code, being above the law, can then use negative IDs for its own purposes
+        id = impl->m_cache->insert_unknown(enc);
+        ++impl->m_stats.unknowns_inserted;
+      }
+
+      trace::Span span_enqueue("enqueue", id);
+
+      // If no track overlaps, the face may have jumped
+      // Pick up a track with the same identity that has not been seen yet
+      if (!track) {
+        for (auto& other : impl->m_tracks) {
+          if (!other.seen && other.face == id) {
+            track = &other;
+            break;
+          }
+        }
+      }
 
-    // Reset the lifetime of the face
-    impl->m_lifetimes[id] = 15; // TODO: Extract this
+      if (!track) {
+        // Start a new track
+        impl->m_tracks.push_back({impl->m_next_track++, id, rect, 0, false, false, false, {}, 0});
+        track = &impl->m_tracks.back();
+
+        // Enqueue an appearance event
+        impl->enqueue_face_appear(track->id, id, rect, enc);
+      } else if (track->face == 0) {
+        // The track finally has a face ID
+        impl->enqueue_face_appear(track->id, id, rect, enc);
+        track->face = id;
+      } else if (track->face != id) {
+        // The track turned out to be someone else after the cache changed
+        // As far as face IDs go, the old face left and a new one came
+        impl->enqueue_face_disappear(track->id, track->face, track->rect);
+        impl->enqueue_face_appear(track->id, id, rect, enc);
+        track->face = id;
+      } else {
+        // Enqueue a movement event
+        impl->enqueue_face_move(track->id, id, rect);
+      }
+
+      // Reset the lifetime of the track
+      track->rect = rect;
+      track->lifetime = 15; // TODO: Extract this
+      track->seen = true;
+      track->resolve = false;
 
-    // Returning zero means continue with faces in this frame
-    // Otherwise, nonzero would tell spdyface to stop looking at this frame
-    return 0;
-  }, this);
+      // Returning zero means continue with faces in this frame
+      // Otherwise, nonzero would tell spdyface to stop looking at this frame
+      return 0;
+    }, this);
+  }
 
   // Clean up stale face tracks
-  std::vector<int> stale_tracks;
-  for (auto&&[id, maturity] : m_lifetimes) {
+  // Stale tracks are swapped out to the end of the table and dropped from there
+  m_cache_touched.clear();
+  for (std::size_t i = 0; i < m_tracks.size();) {
+    auto& track = m_tracks[i];
+
+    // Note the faces still in view
+    if (track.seen && track.face != 0) {
+      m_cache_touched.push_back(track.face);
+    }
+
     // Reduce all tracks' lifetimes by one
     // If a track's lifetime drops below zero, the track is stale
-    if (--maturity < 0) {
-      stale_tracks.push_back(id);
+    track.seen_last = track.seen;
+    track.seen = false;
+    if (--track.lifetime >= 0) {
+      ++i;
+      continue;
     }
-  }
-  for (auto&& id : stale_tracks) {
-    m_lifetimes.erase(id);
 
     // Enqueue a disappearance event
-    m_evts_face_disappear.emplace_back(m_recognizer, id);
+    // Tracks that never got a face ID never appeared, so they leave quietly
+    if (track.face != 0) {
+      enqueue_face_disappear(track.id, track.face, track.rect);
+    }
+
+    std::swap(track, m_tracks.back());
+    m_tracks.pop_back();
+  }
+
+  // Tell the cache the faces still in view are in use
+  // Tracked faces skip the query that would otherwise do this, so without it, the cache would forget them
+  if (!m_cache_touched.empty()) {
+    trace::Span span_touch("touch", static_cast<std::int64_t>(m_cache_touched.size()));
+    m_cache->touch(m_cache_touched);
+  }
+
+  // Slow down or speed up with the faces in view
+  update_sampling();
+
+  // Count the frame and anything it allocated
+  auto frame_allocs = alloc_counter::get_thread_count() - allocs;
+  ++m_stats.frames;
+  m_stats.frame_allocations += frame_allocs;
+  if (frame_allocs) {
+    ++m_stats.allocating_frames;
+  }
+
+  // Wake up whoever is waiting on the notifier
+  if (!m_evts_face_appear.empty() || !m_evts_face_disappear.empty() || !m_evts_face_move.empty()) {
+    notify();
+  }
+}
+
+bool RecognizerImpl::wait_models() {
+  auto ready = m_models->get_ready();
+
+  // Wait for loading to finish
+  // Time out after one hundred milliseconds, like waiting for frames (TODO: Extract this)
+  {
+    trace::Span span_wait("wait models");
+    if (ready.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+      return false;
+    }
+  }
+
+  // If loading failed, there is nothing to recognize with
+  // Idle instead of spinning, and let wait_ready() report the error
+  try {
+    ready.get();
+  } catch (const std::exception&) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    return false;
+  }
+
+  m_models_ready = true;
+  return true;
+}
+
+void RecognizerImpl::notify() {
+  // One signal per poll is plenty
+  if (m_notify_armed || m_notify_write < 0) {
+    return;
+  }
+
+#ifndef _WIN32
+  // A full pipe or a saturated eventfd is still readable, so failure is fine
+  std::uint64_t one = 1;
+  if (write(m_notify_write, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    return;
+  }
+#endif
+
+  m_notify_armed = true;
+}
+
+void RecognizerImpl::drain_notify() {
+  if (!m_notify_armed) {
+    return;
+  }
+
+#ifndef _WIN32
+  // An eventfd resets in one read, while a pipe may take a few
+  std::uint64_t buf[8];
+  while (read(m_notify_read, buf, sizeof(buf)) > 0 && m_notify_read != m_notify_write) {
+  }
+#endif
+
+  m_notify_armed = false;
+}
+
+void Track::add_sample(const Encoding::vector_type& vec) {
+  for (std::size_t i = 0; i < vec.size(); ++i) {
+    sum[i] += vec[i];
+  }
+  ++samples;
+}
+
+Encoding::vector_type Track::mean() const {
+  Encoding::vector_type vec {};
+  for (std::size_t i = 0; i < vec.size(); ++i) {
+    vec[i] = sum[i] / samples;
+  }
+  return vec;
+}
+
+void RecognizerImpl::sync_cache() {
+  if (!m_cache) {
+    return;
+  }
+
+  // Most of the time, nothing has changed
+  auto epoch = m_cache->get_epoch();
+  if (epoch == m_cache_epoch) {
+    return;
+  }
+
+  // If the changes are forgotten, every track has to look its face up again
+  m_cache_changes.clear();
+  if (!m_cache->get_changes(m_cache_epoch, m_cache_changes)) {
+    for (auto& track : m_tracks) {
+      track.resolve = true;
+    }
+  }
+
+  for (auto& change : m_cache_changes) {
+    for (auto& track : m_tracks) {
+      switch (change.kind) {
+        case Cache::Change::Kind::INSERT:
+          // A new known face may be one of the unknown faces we are tracking
+          // Unknown faces are only ever inserted by us, and they are spoken for
+          if (change.id > 0 && track.face < 0) {
+            track.resolve = true;
+          }
+          break;
+        case Cache::Change::Kind::REMOVE:
+          // The face is gone, so the track has to be someone else now
+          if (track.face == change.id) {
+            track.resolve = true;
+          }
+          break;
+        case Cache::Change::Kind::RENAME:
+          // Same face, new name
+          if (track.face == change.id) {
+            track.face = change.id_new;
+          }
+          break;
+      }
+    }
+  }
+
+  m_cache_epoch = epoch;
+}
+
+bool RecognizerImpl::gate_scene() {
+  // The gate is off by default
+  // It also has nothing to look at if the frame is broken
+  if (m_scene_gating.threshold <= 0 || !m_frame.fits()) {
+    return false;
+  }
+
+  trace::Span span_gate("gate");
+
+  // Tracks still working out who they are need to see their faces again
+  // That takes detection, however still the scene
+  bool force = std::any_of(m_tracks.begin(), m_tracks.end(), [](const Track& track) {
+    return track.face == 0 || track.resolve;
+  });
+
+  if (!m_scene_gate.unchanged(m_frame, m_scene_gating.threshold, force)) {
+    return false;
+  }
+
+  // Carry over the faces seen in the last frame that went through detection
+  // They are where they were, so there is nothing to tell anyone
+  for (auto& track : m_tracks) {
+    if (track.seen_last) {
+      track.lifetime = 15; // TODO: Extract this
+      track.seen = true;
+    }
+  }
+
+  ++m_stats.frames_gated;
+  return true;
+}
+
+void RecognizerImpl::update_sampling() {
+  if (!m_sampling.adaptive) {
+    // Without adaptive sampling, we are never idle
+    if (m_idle) {
+      m_idle = false;
+      ++m_stats.idle_exits;
+    }
+    m_next_frame = 0;
+    return;
+  }
+
+  // Any face in view counts as activity, even one that is still working out who it is
+  // Tracks linger for a while after their face is gone, so only the ones seen this frame count
+  bool active = std::any_of(m_tracks.begin(), m_tracks.end(), [](const Track& track) {
+    return track.seen_last;
+  });
+  if (active) {
+    m_last_active = m_frame_time;
+  }
+
+  if (m_idle) {
+    // Wake up once faces have been in view for enough probe frames in a row
+    // One stray detection is not enough to bring the recognizer to full rate
+    m_wake_count = active ? m_wake_count + 1 : 0;
+    if (m_wake_count >= std::max(1, m_sampling.wake_frames)) {
+      m_idle = false;
+      m_wake_count = 0;
+      ++m_stats.idle_exits;
+    }
+  } else if (m_frame_time - m_last_active >= static_cast<std::int64_t>(m_sampling.idle_after * 1e9)) {
+    // Nobody has been around for a while, so go idle
+    m_idle = true;
+    m_wake_count = 0;
+    ++m_stats.idle_entries;
+  }
+
+  // Work out when the next frame is due
+  auto rate = m_idle ? m_sampling.idle_rate : m_sampling.active_rate;
+  m_next_frame = rate > 0 ? m_frame_time + static_cast<std::int64_t>(1e9 / rate) : 0;
+}
+
+Track* RecognizerImpl::match_track(const std::tuple<int, int, int, int>& rect) {
+  auto[left, top, right, bottom] = rect;
+  auto area = static_cast<long long>(right - left) * (bottom - top);
+
+  Track* best = nullptr;
+  double best_iou = 0.3; // TODO: Extract this
+
+  for (auto& track : m_tracks) {
+    if (track.seen) {
+      continue;
+    }
+
+    // Compute the intersection over union of the two rectangles
+    auto[t_left, t_top, t_right, t_bottom] = track.rect;
+    auto i_width = std::min(right, t_right) - std::max(left, t_left);
+    auto i_height = std::min(bottom, t_bottom) - std::max(top, t_top);
+    if (i_width <= 0 || i_height <= 0) {
+      continue;
+    }
+
+    auto i_area = static_cast<long long>(i_width) * i_height;
+    auto t_area = static_cast<long long>(t_right - t_left) * (t_bottom - t_top);
+    auto iou = static_cast<double>(i_area) / static_cast<double>(area + t_area - i_area);
+
+    if (iou > best_iou) {
+      best = &track;
+      best_iou = iou;
+    }
+  }
+
+  return best;
+}
+
+Recognizer::Event RecognizerImpl::make_event(int track, int id, std::tuple<int, int, int, int> rect) {
+  auto[left, top, right, bottom] = rect;
+  return {id, track, left, top, right, bottom, m_stream, m_frame_time, m_evt_seq++};
+}
+
+void RecognizerImpl::enqueue_face_appear(int track, int id, std::tuple<int, int, int, int> rect,
+    const Encoding& enc) {
+  m_evts_face_appear.push_back(make_event(track, id, rect));
+  m_evts_face_appear_encs.push_back(enc);
+}
+
+std::size_t RecognizerImpl::find_face_move(int track) const {
+  for (std::size_t i = 0; i < m_evts_face_move.size(); ++i) {
+    if (m_evts_face_move[i].track == track) {
+      return i;
+    }
+  }
+  return m_evts_face_move.size();
+}
+
+void RecognizerImpl::enqueue_face_move(int track, int id, std::tuple<int, int, int, int> rect) {
+  ++m_stats.moves_enqueued;
+
+  // If the track already has a pending movement, just move it along
+  // Nobody cares where a face was before poll() got around to it
+  auto index = find_face_move(track);
+  if (index != m_evts_face_move.size()) {
+    m_evts_face_move[index] = make_event(track, id, rect);
+    ++m_stats.moves_coalesced;
+    return;
+  }
+
+  m_evts_face_move.push_back(make_event(track, id, rect));
+}
+
+void RecognizerImpl::enqueue_face_disappear(int track, int id, std::tuple<int, int, int, int> rect) {
+  // Drop the pending movement of the track, if any
+  // The last pending movement takes its slot
+  auto index = find_face_move(track);
+  if (index != m_evts_face_move.size()) {
+    m_evts_face_move[index] = m_evts_face_move.back();
+    m_evts_face_move.pop_back();
+
+    ++m_stats.moves_coalesced;
   }
+
+  m_evts_face_disappear.push_back(make_event(track, id, rect));
+}
+
+RecognizerImpl& get_impl(Recognizer& rec) {
+  return *rec.impl;
 }
 
-Recognizer::Recognizer() : impl() {
-  impl = std::make_unique<RecognizerImpl>(*this);
+Recognizer::Recognizer() : Recognizer(Backend::DLIB) {
+}
+
+Recognizer::Recognizer(Backend backend) : impl() {
+  impl = std::make_unique<RecognizerImpl>(*this, backend);
 }
 
 Recognizer::~Recognizer() {
@@ -259,6 +762,13 @@ Recognizer::~Recognizer() {
   //     problem (std::runtime_error), and that's just a fact of life.
   //  2. It's bad to throw stuff out of destructors, period.
   try {
+    // Let other Python threads run while the thread winds down
+    // Python deletes us with the GIL held, but C++ code may not have it at all
+    std::optional<pybind11::gil_scoped_release> release;
+    if (Py_IsInitialized() && PyGILState_Check()) {
+      release.emplace();
+    }
+
     stop();
   } catch (...) {
   }
@@ -276,6 +786,12 @@ void Recognizer::set_cache(Cache* p_cache) {
   std::lock_guard lock(impl->m_crt_mutex);
 
   impl->m_cache = p_cache;
+
+  // Epochs mean nothing across caches, so all tracks look their faces up again
+  impl->m_cache_epoch = p_cache ? p_cache->get_epoch() : 0;
+  for (auto& track : impl->m_tracks) {
+    track.resolve = true;
+  }
 }
 
 Source* Recognizer::get_source() const {
@@ -290,32 +806,179 @@ void Recognizer::set_source(Source* p_source) {
   std::lock_guard lock(impl->m_crt_mutex);
 
   impl->m_source = p_source;
+
+  // Frames from a new source have nothing to do with the old ones
+  impl->m_scene_gate.reset();
 }
 
-void Recognizer::register_face_appear(CbFaceAppear cb) {
+Preprocess Recognizer::get_preprocess() const {
+  // Lock the interface mutex
+  std::lock_guard lock(impl->m_crt_mutex);
+
+  return impl->m_preprocessor.get_config();
+}
+
+void Recognizer::set_preprocess(const Preprocess& p_preprocess) {
+  // Lock the interface mutex
+  std::lock_guard lock(impl->m_crt_mutex);
+
+  impl->m_preprocessor.set_config(p_preprocess);
+}
+
+Placement Recognizer::get_placement() const {
+  // Lock the interface mutex
+  std::lock_guard lock(impl->m_crt_mutex);
+
+  return impl->m_crt_placement;
+}
+
+void Recognizer::set_placement(const Placement& p_placement) {
+  // Lock the interface mutex
+  std::lock_guard lock(impl->m_crt_mutex);
+
+  impl->m_crt_placement = p_placement;
+}
+
+Recognizer::Sampling Recognizer::get_sampling() const {
+  // Lock the interface mutex
+  std::lock_guard lock(impl->m_crt_mutex);
+
+  return impl->m_sampling;
+}
+
+void Recognizer::set_sampling(const Sampling& p_sampling) {
+  // Lock the interface mutex
+  std::lock_guard lock(impl->m_crt_mutex);
+
+  impl->m_sampling = p_sampling;
+
+  // Give whoever is in view the full grace period before going idle
+  impl->m_last_active = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  impl->m_wake_count = 0;
+}
+
+Recognizer::SceneGating Recognizer::get_scene_gating() const {
+  // Lock the interface mutex
+  std::lock_guard lock(impl->m_crt_mutex);
+
+  return impl->m_scene_gating;
+}
+
+void Recognizer::set_scene_gating(const SceneGating& p_scene_gating) {
+  // Lock the interface mutex
+  std::lock_guard lock(impl->m_crt_mutex);
+
+  // Frames compared the old way say nothing about the new way, so this resets the gate
+  impl->m_scene_gate.configure(p_scene_gating.thumb_width, p_scene_gating.thumb_height, p_scene_gating.rows_per_cell,
+      p_scene_gating.max_skipped);
+  impl->m_scene_gating = p_scene_gating;
+}
+
+double Recognizer::get_scene_threshold() const {
+  // Lock the interface mutex
+  std::lock_guard lock(impl->m_crt_mutex);
+
+  return impl->m_scene_gating.threshold;
+}
+
+void Recognizer::set_scene_threshold(double p_scene_threshold) {
+  // Lock the interface mutex
+  std::lock_guard lock(impl->m_crt_mutex);
+
+  impl->m_scene_gating.threshold = p_scene_threshold;
+  impl->m_scene_gate.reset();
+}
+
+int Recognizer::get_event_fd() const {
+  return impl->m_notify_read;
+}
+
+std::shared_future<void> Recognizer::get_ready() const {
+  // Synthetic drivers have nothing to load
+  if (!impl->m_models) {
+    std::promise<void> ready;
+    ready.set_value();
+    return ready.get_future().share();
+  }
+
+  return impl->m_models->get_ready();
+}
+
+int Recognizer::get_max_drivers() {
+  return static_cast<int>(Models::get_max_drivers());
+}
+
+void Recognizer::set_max_drivers(int p_max_drivers) {
+  if (p_max_drivers < 1) {
+    throw std::runtime_error("need at least one set of models");
+  }
+
+  Models::set_max_drivers(static_cast<std::size_t>(p_max_drivers));
+}
+
+int Recognizer::get_stream() const {
+  // Lock the interface mutex
+  std::lock_guard lock(impl->m_crt_mutex);
+
+  return impl->m_stream;
+}
+
+void Recognizer::set_stream(int p_stream) {
+  // Lock the interface mutex
+  std::lock_guard lock(impl->m_crt_mutex);
+
+  impl->m_stream = p_stream;
+}
+
+Recognizer::Stats Recognizer::get_stats() const {
   // Lock the interface mutex
   std::lock_guard lock(impl->m_crt_mutex);
 
+  auto stats = impl->m_stats;
+  stats.allocations_counted = alloc_counter::enabled;
+  return stats;
+}
+
+void Recognizer::register_face_appear(CbFaceAppear cb) {
+  // Lock the callback mutex
+  std::lock_guard lock(impl->m_cbs_mutex);
+
   // Save the callback
   impl->m_cbs_face_appear.push_back(cb);
 }
 
 void Recognizer::register_face_disappear(CbFaceDisappear cb) {
-  // Lock the interface mutex
-  std::lock_guard lock(impl->m_crt_mutex);
+  // Lock the callback mutex
+  std::lock_guard lock(impl->m_cbs_mutex);
 
   // Save the callback
   impl->m_cbs_face_disappear.push_back(cb);
 }
 
 void Recognizer::register_face_move(CbFaceMove cb) {
-  // Lock the interface mutex
-  std::lock_guard lock(impl->m_crt_mutex);
+  // Lock the callback mutex
+  std::lock_guard lock(impl->m_cbs_mutex);
 
   // Save the callback
   impl->m_cbs_face_move.push_back(cb);
 }
 
+void Recognizer::configure_synthetic(int faces, int detect_cost, int embed_cost) {
+  // Only synthetic drivers can be configured
+  if (impl->m_backend != Backend::SYNTHETIC) {
+    throw std::runtime_error("synthetic configuration failed: recognizer is not synthetic");
+  }
+
+  // Lock the interface mutex
+  std::lock_guard lock(impl->m_crt_mutex);
+
+  if (sfSyntheticDetectorConfigure(impl->m_synthetic_detector, faces, detect_cost)
+      || sfSyntheticEmbedderConfigure(impl->m_synthetic_embedder, embed_cost)) {
+    throw std::runtime_error("synthetic configuration failed: invalid parameters");
+  }
+}
+
 void Recognizer::start() {
   // If the continuous recognition thread is joinable
   // This would indicate the thread has not been explicitly stopped
@@ -324,8 +987,27 @@ void Recognizer::start() {
     throw std::runtime_error("continuous recognition thread start failed: not stopped");
   }
 
+  // Reset the kill switch
+  // This happens before the thread exists, so a stop() that comes right after is never lost
+  impl->m_crt_kill.test_and_set();
+
   // Spin up the continuous recognition thread
-  impl->m_crt = std::thread(&RecognizerImpl::crt_main, impl.get());
+  // Wait for it to be placed, so a placement that cannot be honored fails here
+  Placement placement;
+  {
+    std::lock_guard lock(impl->m_crt_mutex);
+    placement = impl->m_crt_placement;
+  }
+  std::promise<void> placed;
+  auto placed_future = placed.get_future();
+  impl->m_crt = std::thread(&RecognizerImpl::crt_main, impl.get(), std::move(placement), std::move(placed));
+
+  try {
+    placed_future.get();
+  } catch (...) {
+    impl->m_crt.join();
+    throw;
+  }
 }
 
 void Recognizer::stop() {
@@ -341,33 +1023,116 @@ void Recognizer::stop() {
 }
 
 void Recognizer::poll() {
-  // Lock the interface mutex
-  std::lock_guard lock(impl->m_crt_mutex);
+  // Take all pending events and send them out
+  auto batch = poll_batch();
+  dispatch(batch);
+}
 
-  // Generic event dispatcher algorithm
-  auto dispatch = [&](auto& evts, const auto& cbs) -> void {
-    // For each pending event
-    for (auto& evt : evts) {
-      // For each receiving callback
-      for (auto& cb : cbs) {
-        impl->m_crt_mutex.unlock();
+void Recognizer::dispatch(EventBatch& batch) {
+  // Take the callbacks to send the events to
+  // Callbacks are free to call back into us, so the mutex is not held while they run
+  decltype(impl->m_cbs_face_appear) cbs_face_appear;
+  decltype(impl->m_cbs_face_disappear) cbs_face_disappear;
+  decltype(impl->m_cbs_face_move) cbs_face_move;
+  {
+    std::lock_guard lock(impl->m_cbs_mutex);
+    cbs_face_appear = impl->m_cbs_face_appear;
+    cbs_face_disappear = impl->m_cbs_face_disappear;
+    cbs_face_move = impl->m_cbs_face_move;
+  }
+
+  trace::Span span_dispatch("dispatch",
+      static_cast<std::int64_t>(batch.appear.size() + batch.disappear.size() + batch.move.size()));
+
+  // Movements are coalesced in place, so they can be out of order
+  std::sort(batch.move.begin(), batch.move.end(), [](const Event& a, const Event& b) {
+    return a.seq < b.seq;
+  });
+
+  // Merge the three kinds of events back into the order they happened in
+  // Appearances and disappearances of the same face must not trade places
+  std::size_t i_appear = 0;
+  std::size_t i_disappear = 0;
+  std::size_t i_move = 0;
+  auto next_seq = [](const std::vector<Event>& evts, std::size_t i) {
+    return i < evts.size() ? evts[i].seq : std::numeric_limits<std::int64_t>::max();
+  };
 
-        // Send the event to the callback
-        // The events here are std::tuple objects with callback arguments
-        std::apply(cb, evt);
+  while (i_appear < batch.appear.size() || i_disappear < batch.disappear.size() || i_move < batch.move.size()) {
+    auto seq_appear = next_seq(batch.appear, i_appear);
+    auto seq_disappear = next_seq(batch.disappear, i_disappear);
+    auto seq_move = next_seq(batch.move, i_move);
 
-        impl->m_crt_mutex.lock();
+    if (seq_appear < seq_disappear && seq_appear < seq_move) {
+      auto& evt = batch.appear[i_appear];
+      for (auto& cb : cbs_face_appear) {
+        cb(*this, evt.id, std::tuple {evt.left, evt.top, evt.right, evt.bottom}, batch.encodings[i_appear]);
       }
+      ++i_appear;
+    } else if (seq_disappear < seq_move) {
+      auto& evt = batch.disappear[i_disappear];
+      for (auto& cb : cbs_face_disappear) {
+        cb(*this, evt.id);
+      }
+      ++i_disappear;
+    } else {
+      auto& evt = batch.move[i_move];
+      for (auto& cb : cbs_face_move) {
+        cb(*this, evt.id, std::tuple {evt.left, evt.top, evt.right, evt.bottom});
+      }
+      ++i_move;
     }
+  }
+}
 
-    // Clear all pending events
-    evts.clear();
-  };
+Recognizer::EventBatch Recognizer::poll_batch() {
+  // Lock the interface mutex
+  std::unique_lock lock(impl->m_crt_mutex, std::defer_lock);
+  {
+    trace::Span span_lock("lock crt_mutex");
+    lock.lock();
+  }
+
+  // Copy out all pending events
+  // The continuous recognition thread keeps its queues, emptied, to fill again without allocating
+  EventBatch batch;
+  batch.appear = impl->m_evts_face_appear;
+  batch.encodings = impl->m_evts_face_appear_encs;
+  batch.disappear = impl->m_evts_face_disappear;
+  batch.move = impl->m_evts_face_move;
+  impl->m_evts_face_appear.clear();
+  impl->m_evts_face_appear_encs.clear();
+  impl->m_evts_face_disappear.clear();
+  impl->m_evts_face_move.clear();
+
+  // Nothing is pending anymore
+  impl->drain_notify();
+
+  return batch;
+}
+
+void Recognizer::poll_batch(EventBatch& batch) {
+  // Empty the batch first, so the queues get its memory but none of its events
+  batch.appear.clear();
+  batch.encodings.clear();
+  batch.disappear.clear();
+  batch.move.clear();
+
+  // Lock the interface mutex
+  std::unique_lock lock(impl->m_crt_mutex, std::defer_lock);
+  {
+    trace::Span span_lock("lock crt_mutex");
+    lock.lock();
+  }
+
+  // Trade the pending events for the emptied batch
+  batch.appear.swap(impl->m_evts_face_appear);
+  batch.encodings.swap(impl->m_evts_face_appear_encs);
+  batch.disappear.swap(impl->m_evts_face_disappear);
+  batch.move.swap(impl->m_evts_face_move);
 
-  // Dispatch all three kinds of events
-  dispatch(impl->m_evts_face_appear, impl->m_cbs_face_appear);
-  dispatch(impl->m_evts_face_disappear, impl->m_cbs_face_disappear);
-  dispatch(impl->m_evts_face_move, impl->m_cbs_face_move);
+  // Nothing is pending anymore
+  impl->drain_notify();
 }
 
 } // namespace faces
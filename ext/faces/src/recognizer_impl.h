@@ -0,0 +1,356 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef RECOGNIZER_IMPL_H
+#define RECOGNIZER_IMPL_H
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <faces/cache.h>
+#include <faces/encoding.h>
+#include <faces/placement.h>
+#include <faces/recognizer.h>
+#include <faces/source.h>
+
+#include <spdyface.h>
+
+#include "common_image.h"
+#include "models.h"
+#include "preprocess.h"
+#include "scene_gate.h"
+#include "drivers/synthetic_detector.h"
+#include "drivers/synthetic_embedder.h"
+
+namespace faces {
+
+/** A face track. This follows one face on camera from frame to frame. */
+struct Track {
+  /** The track ID. This never changes. */
+  int id;
+
+  /**
+   * The face ID in the cache. This changes with renames. It is zero while
+   * the track is still collecting samples of a face the cache does not know.
+   */
+  int face;
+
+  /** The last known bounding rectangle. */
+  std::tuple<int, int, int, int> rect;
+
+  /** The number of frames left before the track goes stale. */
+  int lifetime;
+
+  /** Whether the face was seen in the current frame. */
+  bool seen;
+
+  /** Whether the face ID needs to be looked up again, as the cache changed under it. */
+  bool resolve;
+
+  /** Whether the face was seen in the last frame that went through detection. */
+  bool seen_last;
+
+  /** The sum of the sampled face vectors. */
+  Encoding::vector_type sum;
+
+  /** The number of sampled face vectors. */
+  int samples;
+
+  /**
+   * Add a face vector sample.
+   *
+   * @param vec The face vector
+   */
+  void add_sample(const Encoding::vector_type& vec);
+
+  /**
+   * @return The mean of the sampled face vectors
+   */
+  Encoding::vector_type mean() const;
+};
+
+struct RecognizerImpl {
+  /** The recognizer object. */
+  Recognizer& m_recognizer;
+
+  /** The detection and embedding backend. */
+  Recognizer::Backend m_backend;
+
+  /** The spdyface context. */
+  SFContext m_spdy;
+
+  /** The shared dlib models, if using them. */
+  std::shared_ptr<Models> m_models;
+
+  /** Whether the shared models have loaded. Only the continuous recognition thread uses this. */
+  bool m_models_ready;
+
+  /** The synthetic face detector. */
+  SFSyntheticDetector m_synthetic_detector;
+
+  /** The synthetic face embedder. */
+  SFSyntheticEmbedder m_synthetic_embedder;
+
+  /** The last video frame received. */
+  Image m_frame;
+
+  /**
+   * The spdyface common image view. The phrase "common image" is specific to
+   * cozmonaut. It preserves the binary format of raw images in Python's PIL
+   * (Python Image Library), which is used by the Cozmo SDK.
+   */
+  SFCommonImage m_com_image;
+
+  /** The preprocessing stage. */
+  Preprocessor m_preprocessor;
+
+  /** The spdyface common image view of the preprocessed frame. */
+  SFCommonImage m_com_image_pre;
+
+  /** The scene change gate. */
+  SceneGate m_scene_gate;
+
+  /** The scene gate settings. */
+  Recognizer::SceneGating m_scene_gating;
+
+  /** The adaptive sampling settings. */
+  Recognizer::Sampling m_sampling;
+
+  /** Whether adaptive sampling is idle. */
+  bool m_idle;
+
+  /** When faces were last in view in nanoseconds on the steady clock. */
+  std::int64_t m_last_active;
+
+  /** The number of probe frames in a row with faces in view. */
+  int m_wake_count;
+
+  /**
+   * When the next frame is due in nanoseconds on the steady clock. Only the
+   * continuous recognition thread uses this.
+   */
+  std::int64_t m_next_frame;
+
+  /** The continuous recognition thread. */
+  std::thread m_crt;
+
+  /** The placement of the continuous recognition thread. */
+  Placement m_crt_placement;
+
+  /** Kill switch for the continuous recognition thread. */
+  std::atomic_flag m_crt_kill;
+
+  /** Mutex for interfacing with the continuous recognition thread. */
+  std::mutex m_crt_mutex;
+
+  /**
+   * Mutex for the callback lists. This is separate from the interface mutex,
+   * which the continuous recognition thread holds for whole frames, so that
+   * dispatch (which runs with the GIL held) never waits on recognition.
+   */
+  std::mutex m_cbs_mutex;
+
+  /** All registered face appearance callbacks. */
+  std::vector<Recognizer::CbFaceAppear> m_cbs_face_appear;
+
+  /** All registered face disappearance callbacks. */
+  std::vector<Recognizer::CbFaceDisappear> m_cbs_face_disappear;
+
+  /** All registered face movement callbacks. */
+  std::vector<Recognizer::CbFaceMove> m_cbs_face_move;
+
+  /** Pending face appearance events. */
+  std::vector<Recognizer::Event> m_evts_face_appear;
+
+  /** The face encodings of the pending face appearance events. */
+  std::vector<Encoding> m_evts_face_appear_encs;
+
+  /** Pending face disappearance events. */
+  std::vector<Recognizer::Event> m_evts_face_disappear;
+
+  /**
+   * Pending face movement events. There is at most one per face. Finding the
+   * one for a track is a scan, as there are only ever a few.
+   */
+  std::vector<Recognizer::Event> m_evts_face_move;
+
+  /** The sequence number of the next event. */
+  std::int64_t m_evt_seq;
+
+  /** The recognizer counters. */
+  Recognizer::Stats m_stats;
+
+  /** The face cache. */
+  Cache* m_cache;
+
+  /** The video source. */
+  Source* m_source;
+
+  /**
+   * The readable end of the event notifier. It becomes readable whenever
+   * events are pending. This is an eventfd on Linux and a pipe elsewhere.
+   */
+  int m_notify_read;
+
+  /** The writable end of the event notifier. Same as the readable end for an eventfd. */
+  int m_notify_write;
+
+  /** Whether the notifier has been signaled since the last poll. */
+  bool m_notify_armed;
+
+  /** The stream number stamped on events. */
+  int m_stream;
+
+  /** When the current frame was received in nanoseconds on the steady clock. */
+  std::int64_t m_frame_time;
+
+  /**
+   * All live face tracks. This is a flat table, as there are only ever a few
+   * faces on camera, and scanning it beats chasing pointers.
+   */
+  std::vector<Track> m_tracks;
+
+  /** The next track ID. */
+  int m_next_track;
+
+  /** The cache epoch the tracks are up to date with. */
+  std::uint64_t m_cache_epoch;
+
+  /** Scratch space for cache changes. */
+  std::vector<Cache::Change> m_cache_changes;
+
+  /** Scratch space for the face IDs of the tracks seen in a frame. */
+  std::vector<int> m_cache_touched;
+
+  RecognizerImpl(Recognizer& p_recognizer, Recognizer::Backend p_backend);
+
+  ~RecognizerImpl();
+
+  /**
+   * Main function for the continuous recognition thread.
+   *
+   * @param placement The thread placement
+   * @param placed Set once the thread is placed, or to the error if it could not be
+   */
+  void crt_main(Placement placement, std::promise<void> placed);
+
+  /** The continuous recognition loop. */
+  void crt_loop();
+
+  /**
+   * Check that the shared models are loaded. This waits a little for them if
+   * need be.
+   *
+   * @return True if the models are ready, otherwise false
+   */
+  bool wait_models();
+
+  /**
+   * Catch the tracks up with changes to the cache. Renames carry over, and
+   * tracks whose faces were otherwise affected get their face IDs looked up
+   * again the next time they are seen. The interface mutex must be held.
+   */
+  void sync_cache();
+
+  /**
+   * Check whether the current frame can skip detection, because its scene has
+   * not changed since the last frame that went through it. If so, the faces
+   * seen in that frame are carried over to this one. The interface mutex must
+   * be held.
+   *
+   * @return True if detection should be skipped, otherwise false
+   */
+  bool gate_scene();
+
+  /**
+   * Switch adaptive sampling between idle and active as faces come and go, and
+   * work out when the next frame is due. The interface mutex must be held.
+   */
+  void update_sampling();
+
+  /**
+   * Find the track a face continues from the last frame. This is the track
+   * not yet seen this frame whose last rectangle overlaps the most.
+   *
+   * @param rect The face bounding rectangle
+   * @return The track, or null if none
+   */
+  Track* match_track(const std::tuple<int, int, int, int>& rect);
+
+  /** Signal the event notifier, unless it is already signaled. The interface mutex must be held. */
+  void notify();
+
+  /** Reset the event notifier. The interface mutex must be held. */
+  void drain_notify();
+
+  /**
+   * Make an event record for the current frame. This takes the next sequence number.
+   *
+   * @param track The track ID
+   * @param id The face ID
+   * @param rect The face bounding rectangle
+   * @return The event record
+   */
+  Recognizer::Event make_event(int track, int id, std::tuple<int, int, int, int> rect);
+
+  /**
+   * Enqueue a face appearance event. The interface mutex must be held.
+   *
+   * @param track The track ID
+   * @param id The face ID
+   * @param rect The face bounding rectangle
+   * @param enc The face encoding
+   */
+  void enqueue_face_appear(int track, int id, std::tuple<int, int, int, int> rect, const Encoding& enc);
+
+  /**
+   * Find the pending movement event of a track.
+   *
+   * @param track The track ID
+   * @return The event index, or the number of pending movements if none
+   */
+  std::size_t find_face_move(int track) const;
+
+  /**
+   * Enqueue a face movement event. If the track already has one pending, that
+   * one is updated in place instead. The interface mutex must be held.
+   *
+   * @param track The track ID
+   * @param id The face ID
+   * @param rect The face bounding rectangle
+   */
+  void enqueue_face_move(int track, int id, std::tuple<int, int, int, int> rect);
+
+  /**
+   * Enqueue a face disappearance event. Any pending movement of the track is
+   * dropped. The interface mutex must be held.
+   *
+   * @param track The track ID
+   * @param id The face ID
+   * @param rect The last known face bounding rectangle
+   */
+  void enqueue_face_disappear(int track, int id, std::tuple<int, int, int, int> rect);
+};
+
+/**
+ * Get the implementation behind a recognizer. This is for in-tree tools (like
+ * the benchmarks) that need to reach past the public interface.
+ *
+ * @param rec The recognizer
+ * @return The recognizer implementation
+ */
+RecognizerImpl& get_impl(Recognizer& rec);
+
+} // namespace faces
+
+#endif // #ifndef RECOGNIZER_IMPL_H
@@ -0,0 +1,168 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "preprocess.h"
+#include "scene_gate.h"
+
+namespace faces {
+
+namespace {
+
+/**
+ * Find the largest absolute difference between two runs of bytes.
+ *
+ * @param a The first run
+ * @param b The second run
+ * @param n The number of bytes
+ * @return The largest difference
+ */
+int max_abs_diff(const std::uint8_t* a, const std::uint8_t* b, std::size_t n) {
+  std::size_t i = 0;
+  int result = 0;
+
+#ifdef __SSE2__
+  // Saturating subtraction both ways leaves the difference in one and zero in the other
+  auto vmax = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    auto va = _mm_loadu_si128((const __m128i*) (a + i));
+    auto vb = _mm_loadu_si128((const __m128i*) (b + i));
+    auto diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+    vmax = _mm_max_epu8(vmax, diff);
+  }
+
+  // Fold the lanes down to one
+  vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 8));
+  vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 4));
+  vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 2));
+  vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 1));
+  result = _mm_cvtsi128_si32(vmax) & 0xff;
+#endif
+
+  // Finish the tail one byte at a time
+  for (; i < n; ++i) {
+    result = std::max(result, std::abs(a[i] - b[i]));
+  }
+
+  return result;
+}
+
+} // namespace
+
+SceneGate::SceneGate()
+    : m_thumb_width(0)
+    , m_thumb_height(0)
+    , m_rows_per_cell(0)
+    , m_max_skipped(0)
+    , m_last()
+    , m_thumb()
+    , m_sums()
+    , m_row()
+    , m_width(0)
+    , m_height(0)
+    , m_format(PixelFormat::RGB)
+    , m_primed(false)
+    , m_skipped(0) {
+  configure(32, 24, 4, 30);
+}
+
+void SceneGate::configure(int thumb_width, int thumb_height, int rows_per_cell, int max_skipped) {
+  if (thumb_width < 1 || thumb_height < 1 || rows_per_cell < 1 || max_skipped < 0) {
+    throw std::runtime_error("invalid scene gate settings");
+  }
+
+  m_thumb_width = thumb_width;
+  m_thumb_height = thumb_height;
+  m_rows_per_cell = rows_per_cell;
+  m_max_skipped = max_skipped;
+
+  // Size the thumbnails up front, so comparing frames never allocates
+  auto cells = static_cast<std::size_t>(thumb_width) * thumb_height;
+  m_last.assign(cells, 0);
+  m_thumb.assign(cells, 0);
+  m_sums.assign(thumb_width, 0);
+
+  reset();
+}
+
+void SceneGate::make_thumb(const Image& frame) {
+  auto pixels = reinterpret_cast<const std::uint8_t*>(frame.pixels());
+  auto step = frame.step();
+
+  m_row.resize(frame.width);
+
+  for (int ty = 0; ty < m_thumb_height; ++ty) {
+    // The band of frame rows this row of cells covers
+    // Frames shorter than the thumbnail repeat rows
+    int y0 = ty * frame.height / m_thumb_height;
+    int y1 = std::max(y0 + 1, (ty + 1) * frame.height / m_thumb_height);
+
+    // Sample a few rows spread over the band
+    // Averaging over whole cells keeps sensor noise from looking like a change
+    int rows = std::min(m_rows_per_cell, y1 - y0);
+    std::fill(m_sums.begin(), m_sums.end(), 0);
+    for (int r = 0; r < rows; ++r) {
+      int y = y0 + (2 * r + 1) * (y1 - y0) / (2 * rows);
+      convert_row_gray(frame.format, pixels + static_cast<std::size_t>(step) * y, m_row.data(), frame.width);
+
+      for (int tx = 0; tx < m_thumb_width; ++tx) {
+        int x0 = tx * frame.width / m_thumb_width;
+        int x1 = std::max(x0 + 1, (tx + 1) * frame.width / m_thumb_width);
+
+        std::uint32_t sum = 0;
+        for (int x = x0; x < x1; ++x) {
+          sum += m_row[x];
+        }
+        m_sums[tx] += sum;
+      }
+    }
+
+    // Average each cell
+    for (int tx = 0; tx < m_thumb_width; ++tx) {
+      int x0 = tx * frame.width / m_thumb_width;
+      int x1 = std::max(x0 + 1, (tx + 1) * frame.width / m_thumb_width);
+      std::uint32_t count = rows * (x1 - x0);
+      m_thumb[ty * m_thumb_width + tx] = static_cast<std::uint8_t>((m_sums[tx] + count / 2) / count);
+    }
+  }
+}
+
+bool SceneGate::unchanged(const Image& frame, double threshold, bool force) {
+  make_thumb(frame);
+
+  // Hold the frame back if it looks like the last one let through
+  // Every so often, one goes through anyway, in case something slipped by
+  bool same = frame.width == m_width && frame.height == m_height && frame.format == m_format;
+  if (!force && m_primed && same && m_skipped < m_max_skipped
+      && max_abs_diff(m_thumb.data(), m_last.data(), m_thumb.size()) <= threshold) {
+    ++m_skipped;
+    return true;
+  }
+
+  // Compare against this frame from now on
+  m_last = m_thumb;
+  m_width = frame.width;
+  m_height = frame.height;
+  m_format = frame.format;
+  m_primed = true;
+  m_skipped = 0;
+  return false;
+}
+
+void SceneGate::reset() {
+  m_primed = false;
+  m_skipped = 0;
+}
+
+} // namespace faces
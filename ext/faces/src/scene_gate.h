@@ -0,0 +1,106 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef SCENE_GATE_H
+#define SCENE_GATE_H
+
+#include <cstdint>
+#include <vector>
+
+#include <faces/source.h>
+
+namespace faces {
+
+/**
+ * A gate in front of the detector that lets through only frames whose scene
+ * has changed. Each frame is boiled down to a small grayscale thumbnail, and
+ * the thumbnail is compared with that of the last frame let through. If no
+ * patch of the frame has changed in brightness by more than a threshold, the
+ * faces in it have not moved either, so detecting them again would only tell
+ * us what we already know.
+ */
+class SceneGate {
+  /** The thumbnail width. */
+  int m_thumb_width;
+
+  /** The thumbnail height. */
+  int m_thumb_height;
+
+  /** The number of pixel rows sampled per row of thumbnail cells. */
+  int m_rows_per_cell;
+
+  /** The number of frames that may be held back in a row before one is let through regardless. */
+  int m_max_skipped;
+
+  /** The thumbnail of the last frame let through. */
+  std::vector<std::uint8_t> m_last;
+
+  /** The thumbnail of the current frame. */
+  std::vector<std::uint8_t> m_thumb;
+
+  /** Column sums for one row of thumbnail cells. */
+  std::vector<std::uint32_t> m_sums;
+
+  /** Scratch memory for one row of luminance. */
+  std::vector<std::uint8_t> m_row;
+
+  /** The width of the last frame let through. */
+  int m_width;
+
+  /** The height of the last frame let through. */
+  int m_height;
+
+  /** The pixel format of the last frame let through. */
+  PixelFormat m_format;
+
+  /** Whether a frame has been let through since the last reset. */
+  bool m_primed;
+
+  /** The number of frames held back since the last one let through. */
+  int m_skipped;
+
+  /**
+   * Boil a frame down to its thumbnail.
+   *
+   * @param frame The frame (its pixel memory must fit its dimensions)
+   */
+  void make_thumb(const Image& frame);
+
+public:
+  SceneGate();
+
+  /**
+   * Change how frames are compared. This resets the gate. This throws if the
+   * settings make no sense.
+   *
+   * @param thumb_width The thumbnail width
+   * @param thumb_height The thumbnail height
+   * @param rows_per_cell The number of pixel rows sampled per row of thumbnail cells
+   * @param max_skipped The number of frames that may be held back in a row
+   * before one is let through regardless
+   */
+  void configure(int thumb_width, int thumb_height, int rows_per_cell, int max_skipped);
+
+  /**
+   * Check whether the scene in a frame is unchanged since the last frame let
+   * through. If it is not, this frame becomes the one to compare against.
+   *
+   * @param frame The frame (its pixel memory must fit its dimensions)
+   * @param threshold The largest change in brightness (out of 255) of any
+   * patch of the frame that still counts as the same scene
+   * @param force True to let the frame through regardless
+   * @return True if the frame should be held back, otherwise false
+   */
+  bool unchanged(const Image& frame, double threshold, bool force);
+
+  /** Forget the last frame let through, so the next frame goes through regardless. */
+  void reset();
+};
+
+} // namespace faces
+
+#endif // #ifndef SCENE_GATE_H
@@ -0,0 +1,109 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <stdexcept>
+#include <string>
+
+#include "buffer.h"
+
+namespace faces {
+namespace sources {
+
+namespace py = pybind11;
+
+py::object hold_buffer(const py::object& obj) {
+  // The memoryview releases its export only when it is destroyed
+  auto view = PyMemoryView_FromObject(obj.ptr());
+  if (!view) {
+    throw py::error_already_set();
+  }
+  return py::reinterpret_steal<py::object>(view);
+}
+
+Image borrow_buffer(const pybind11::buffer_info& info, PixelFormat format) {
+  auto channels = bytes_per_pixel(format);
+
+  // Check for rows of packed eight-bit pixels
+  // Rows themselves may be padded, which is what the stride is for
+  if (info.itemsize != 1) {
+    throw std::runtime_error("image buffer must have eight-bit elements");
+  }
+  if (info.ndim == 2) {
+    if (channels != 1 || info.strides[1] != 1) {
+      throw std::runtime_error("two-dimensional image buffer must be packed gray");
+    }
+  } else if (info.ndim == 3) {
+    if (info.shape[2] != channels || info.strides[2] != 1 || info.strides[1] != channels) {
+      throw std::runtime_error("image buffer pixels must be packed and match the pixel format");
+    }
+  } else {
+    throw std::runtime_error("image buffer must have two or three dimensions");
+  }
+  if (info.shape[0] <= 0 || info.shape[1] <= 0 || info.strides[0] < info.shape[1] * channels) {
+    throw std::runtime_error("image buffer rows must not overlap");
+  }
+
+  // Describe the buffer without copying it
+  Image image;
+  image.width = static_cast<int>(info.shape[1]);
+  image.height = static_cast<int>(info.shape[0]);
+  image.stride = static_cast<int>(info.strides[0]);
+  image.format = format;
+  image.borrowed = static_cast<const char*>(info.ptr);
+  image.borrowed_size = static_cast<std::size_t>(info.strides[0] * (info.shape[0] - 1) + info.shape[1] * channels);
+  return image;
+}
+
+Image borrow_image(const py::object& img, py::object& keep) {
+  // Anything that is not a PIL image but exposes its memory goes the zero-copy route
+  if (!py::hasattr(img, "mode") && PyObject_CheckBuffer(img.ptr())) {
+    // Keeping the exporter alive is not enough, as it could still move its memory
+    // The held export pins the memory for as long as the frame keeps it
+    keep = hold_buffer(img);
+    auto info = py::reinterpret_borrow<py::buffer>(keep).request();
+
+    auto format = PixelFormat::GRAY;
+    if (info.ndim == 3) {
+      format = info.shape[2] == 4 ? PixelFormat::RGBA : PixelFormat::RGB;
+    }
+
+    return borrow_buffer(info, format);
+  }
+
+  Image image;
+
+  // Get dimensions of image
+  image.width = py::cast<int>(img.attr("width"));
+  image.height = py::cast<int>(img.attr("height"));
+
+  // Map the PIL mode to a pixel format
+  // Modes we can't read directly get converted to RGB by PIL
+  auto mode = py::cast<std::string>(img.attr("mode"));
+  auto source = img;
+  if (mode == "RGB") {
+    image.format = PixelFormat::RGB;
+  } else if (mode == "RGBA" || mode == "RGBX") {
+    image.format = PixelFormat::RGBA;
+  } else if (mode == "L") {
+    image.format = PixelFormat::GRAY;
+  } else {
+    source = img.attr("convert")("RGB");
+    image.format = PixelFormat::RGB;
+  }
+
+  // Get raw bytes of the image
+  // Rather than copy them out, the frame borrows them from the bytes object
+  py::bytes bytes = source.attr("tobytes")("raw");
+  image.borrowed = PyBytes_AsString(bytes.ptr());
+  image.borrowed_size = static_cast<std::size_t>(PyBytes_Size(bytes.ptr()));
+
+  keep = std::move(bytes);
+  return image;
+}
+
+} // namespace sources
+} // namespace faces
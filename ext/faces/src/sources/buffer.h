@@ -0,0 +1,57 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef SOURCES_BUFFER_H
+#define SOURCES_BUFFER_H
+
+#include <pybind11/pybind11.h>
+#include <faces/source.h>
+
+namespace faces {
+namespace sources {
+
+/**
+ * Hold a buffer export of an object. While the returned memoryview lives, the
+ * exporter can't resize or free the memory behind it (a bytearray refuses to
+ * resize, for example), so a frame borrowing that memory can outlive the call
+ * that made it. The GIL must be held.
+ *
+ * @param obj The exporting object
+ * @return A memoryview holding the export
+ */
+pybind11::object hold_buffer(const pybind11::object& obj);
+
+/**
+ * Describe raw image memory as a frame, without copying it. The buffer must be
+ * laid out as (height, width) for gray or (height, width, channels) otherwise,
+ * with packed pixels. Rows may be padded. The frame borrows the memory, but
+ * does not own it.
+ *
+ * @param info The image buffer
+ * @param format The pixel format
+ * @return The frame
+ */
+Image borrow_buffer(const pybind11::buffer_info& info, PixelFormat format);
+
+/**
+ * Describe a PIL image or an image buffer as a frame, without copying it where
+ * possible. The pixel format of a buffer is guessed from its shape: two
+ * dimensions for gray, three or four channels for RGB(A). PIL modes that can't
+ * be read directly are converted to RGB. The frame borrows its memory from an
+ * object handed back for the caller to keep alive. For buffers, that object
+ * holds the export (see hold_buffer). The GIL must be held.
+ *
+ * @param img The image
+ * @param keep The object owning the memory
+ * @return The frame
+ */
+Image borrow_image(const pybind11::object& img, pybind11::object& keep);
+
+} // namespace sources
+} // namespace faces
+
+#endif // #ifndef SOURCES_BUFFER_H
@@ -5,18 +5,99 @@
  * InsertLicenseText
  */
 
-#include <algorithm>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <vector>
 
+#include <faces/trace.h>
 #include <faces/sources/pil_source.h>
 #include <pybind11/stl.h>
 
+#include "buffer.h"
+
 namespace faces {
 namespace sources {
 
 namespace py = pybind11;
 
+/**
+ * Python objects whose last C++ owner let go of them on a thread that did not
+ * hold the GIL (like the recognition thread dropping an old frame). Those can't
+ * be released on the spot, so they wait here for the next Python thread.
+ */
+struct Graveyard {
+  /** Guards the buried objects. */
+  std::mutex m_mutex;
+
+  /** The buried objects. */
+  std::vector<PyObject*> m_objects;
+
+  /**
+   * An empty list to swap in for the buried objects when draining. Burying
+   * happens on the recognition thread, so this way it reuses memory instead
+   * of allocating.
+   */
+  std::vector<PyObject*> m_spare;
+
+  Graveyard();
+
+  ~Graveyard();
+
+  /**
+   * Release an object now if we hold the GIL, otherwise bury it.
+   *
+   * @param obj The object
+   */
+  void release(PyObject* obj);
+
+  /** Release all buried objects. The GIL must be held. */
+  void drain();
+};
+
+Graveyard::Graveyard() : m_mutex(), m_objects(), m_spare() {
+}
+
+Graveyard::~Graveyard() {
+  // Anything still buried is leaked on purpose
+  // Taking the GIL from an arbitrary thread here could deadlock
+  if (Py_IsInitialized() && PyGILState_Check()) {
+    drain();
+  }
+}
+
+void Graveyard::release(PyObject* obj) {
+  if (Py_IsInitialized() && PyGILState_Check()) {
+    Py_DECREF(obj);
+    return;
+  }
+
+  std::lock_guard lock(m_mutex);
+  m_objects.push_back(obj);
+}
+
+void Graveyard::drain() {
+  // Take the buried objects, leaving the spare list in their place
+  std::vector<PyObject*> dead;
+  {
+    std::lock_guard lock(m_mutex);
+    dead.swap(m_spare);
+    dead.swap(m_objects);
+  }
+
+  for (auto obj : dead) {
+    Py_DECREF(obj);
+  }
+
+  // The emptied list is the next spare
+  dead.clear();
+  {
+    std::lock_guard lock(m_mutex);
+    m_spare.swap(dead);
+  }
+}
+
 struct PILSourceImpl {
   /** The pending frame. */
   Image m_image;
@@ -30,14 +111,71 @@ struct PILSourceImpl {
   /** The presence indicator. */
   bool m_present;
 
+  /** Python objects waiting to be released. Borrowed frames refer to this. */
+  std::shared_ptr<Graveyard> m_graveyard;
+
   PILSourceImpl();
+
+  ~PILSourceImpl();
+
+  /**
+   * Make an owner handle that keeps a Python object alive.
+   *
+   * @param obj The object
+   * @return The owner handle
+   */
+  std::shared_ptr<const void> own(py::object obj);
+
+  /**
+   * Submit a frame, replacing any unread one. The GIL must not be held, as
+   * the recognition thread may be holding the mutex. The replaced frame is
+   * handed back so the caller can let go of it with the GIL held.
+   *
+   * @param image The frame
+   * @return The replaced frame
+   */
+  Image submit(Image image);
 };
 
 PILSourceImpl::PILSourceImpl()
     : m_image()
     , m_cond()
     , m_mutex()
-    , m_present(false) {
+    , m_present(false)
+    , m_graveyard(std::make_shared<Graveyard>()) {
+}
+
+PILSourceImpl::~PILSourceImpl() {
+  m_graveyard->drain();
+}
+
+std::shared_ptr<const void> PILSourceImpl::own(py::object obj) {
+  // Take over the reference from the object handle
+  // The deleter gives it back to Python when the last frame copy is gone
+  auto ptr = obj.release().ptr();
+  auto graveyard = m_graveyard;
+  return std::shared_ptr<const void>(ptr, [graveyard](const void* p) {
+    graveyard->release((PyObject*) p);
+  });
+}
+
+Image PILSourceImpl::submit(Image image) {
+  std::lock_guard lock(m_mutex);
+
+  // If an unread frame is still present
+  if (m_present) {
+//  std::cout << "dropping a frame\n";
+  }
+
+  // Move new frame over old frame
+  // The old data goes back to the caller
+  std::swap(m_image, image);
+
+  // You've got mail!
+  m_present = true;
+  m_cond.notify_all();
+
+  return image;
 }
 
 PILSource::PILSource() : impl() {
@@ -47,42 +185,56 @@ PILSource::PILSource() : impl() {
 PILSource::~PILSource() = default;
 
 void PILSource::update(const py::object& img) {
-  // The next frame
-  Image image;
-
-  // Get dimensions of image
-  image.width = py::cast<int>(img.attr("width"));
-  image.height = py::cast<int>(img.attr("height"));
+  trace::Span span_ingest("ingest");
 
-  // Get raw bytes of the image
-  // Strings are odd for working with raw bytes, but pybind11 has an implicit conversion available
-  // Also, this performs the necessary memory management to keep pointers from dangling
-  auto bytes = py::cast<std::string>(img.attr("tobytes")("raw"));
+  // Release frames the recognition thread let go of
+  impl->m_graveyard->drain();
 
-  // Copy image bytes into frame
-  image.data.reserve(bytes.size());
-  std::copy(bytes.begin(), bytes.end(), std::back_inserter(image.data));
+  // Describe the image, borrowing its memory
+  // The frame keeps whatever owns the memory alive
+  py::object keep;
+  auto image = borrow_image(img, keep);
+  image.owner = impl->own(std::move(keep));
 
   // Submit the frame
+  // The old frame lives until the end of this function, where we have the GIL again
+  Image old;
   {
-    std::lock_guard lock(impl->m_mutex);
+    py::gil_scoped_release release;
+    old = impl->submit(std::move(image));
+  }
+}
+
+void PILSource::update_buffer(const py::buffer& buf, PixelFormat format) {
+  trace::Span span_ingest("ingest");
 
-    // If an unread frame is still present
-    if (impl->m_present) {
-//    std::cout << "dropping a frame\n";
-    }
+  // Release frames the recognition thread let go of
+  impl->m_graveyard->drain();
 
-    // Move new frame over old frame
-    // This discards the old data
-    impl->m_image = std::move(image);
+  // Describe the memory behind the buffer without copying it
+  // The frame holds an export of the buffer, so Python can't resize or free the memory under it
+  auto view = hold_buffer(buf);
+  auto image = borrow_buffer(py::reinterpret_borrow<py::buffer>(view).request(), format);
+  image.owner = impl->own(std::move(view));
 
-    // You've got mail!
-    impl->m_present = true;
-    impl->m_cond.notify_all();
+  // Submit the frame
+  // The old frame lives until the end of this function, where we have the GIL again
+  Image old;
+  {
+    py::gil_scoped_release release;
+    old = impl->submit(std::move(image));
   }
 }
 
 std::optional<Image> PILSource::wait(unsigned long millis) {
+  Image frame;
+  if (!wait_into(millis, frame)) {
+    return std::nullopt;
+  }
+  return frame;
+}
+
+bool PILSource::wait_into(unsigned long millis, Image& frame) {
   // Acquire pending frame lock
   // This will unlock automatically when it goes out of scope
   // It can also be transferred somewhere else (like a condition variable)
@@ -98,14 +250,16 @@ std::optional<Image> PILSource::wait(unsigned long millis) {
 
   // If the condition variable timed out, return nothing
   if (!status) {
-    return std::nullopt;
+    return false;
   }
 
   // Mark pending frame no longer present
   impl->m_present = false;
 
-  // Return the frame
-  return impl->m_image;
+  // Copy the frame over the old one
+  // Borrowed frames have no data to copy, and copied data reuses the old frame's memory
+  frame = impl->m_image;
+  return true;
 }
 
 } // namespace sources
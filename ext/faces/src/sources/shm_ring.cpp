@@ -0,0 +1,612 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shm_ring.h"
+
+namespace faces {
+namespace sources {
+
+namespace {
+
+/** The segment magic number ("COZRING\0"). */
+constexpr std::uint64_t kMagic = 0x434f5a52494e4700;
+
+/** The segment layout version. Bump this when the layout changes. */
+constexpr std::uint32_t kVersion = 2;
+
+/** The head packs the slot index into its low bits, so the slot count is limited. */
+constexpr std::uint64_t kSlotBits = 8;
+
+/** The maximum number of slots. */
+constexpr std::size_t kMaxSlots = 1u << kSlotBits;
+
+/** The maximum number of consumers attached at once. */
+constexpr std::size_t kMaxConsumers = 16;
+
+/** The alignment of slot memory. Page alignment keeps rows friendly to SIMD and DMA alike. */
+constexpr std::size_t kSlotAlign = 4096;
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+static_assert(std::atomic<std::int32_t>::is_always_lock_free);
+
+/**
+ * Throw an error for a failed system call.
+ *
+ * @param what What failed
+ */
+[[noreturn]] void throw_errno(const std::string& what) {
+  throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+/**
+ * Round a size up to a multiple of the slot alignment.
+ *
+ * @param size The size
+ * @return The rounded size
+ */
+std::size_t align_up(std::size_t size) {
+  return (size + kSlotAlign - 1) / kSlotAlign * kSlotAlign;
+}
+
+/**
+ * Lock a robust mutex, taking it over from a dead owner if need be.
+ *
+ * @param mutex The mutex
+ */
+void lock_robust(pthread_mutex_t* mutex) {
+  auto err = pthread_mutex_lock(mutex);
+  if (err == EOWNERDEAD) {
+    pthread_mutex_consistent(mutex);
+  } else if (err != 0) {
+    errno = err;
+    throw_errno("cannot lock frame ring");
+  }
+}
+
+/**
+ * Check whether a process is still around. A process we may not signal is
+ * still there, so only ESRCH counts as dead.
+ *
+ * @param pid The process ID
+ * @return True if so, otherwise false
+ */
+bool is_alive(pid_t pid) {
+  return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+} // namespace
+
+/** The header at the start of the segment. */
+struct RingHeader {
+  /** The magic number. This is set last, once the segment is ready. */
+  std::atomic<std::uint64_t> magic;
+
+  /** The layout version. */
+  std::uint32_t version;
+
+  /** The number of slots. */
+  std::uint32_t slots;
+
+  /** The size of each slot in bytes. */
+  std::uint64_t slot_size;
+
+  /** The offset of the slot memory from the start of the segment. */
+  std::uint64_t data_offset;
+
+  /** Guards the condition variable. */
+  pthread_mutex_t mutex;
+
+  /** Signalled on every published frame. */
+  pthread_cond_t cond;
+
+  /** The newest published frame, as its sequence number shifted over its slot index (zero if none). */
+  std::atomic<std::uint64_t> head;
+
+  /** The number of frames dropped for lack of a free slot. */
+  std::atomic<std::uint64_t> dropped;
+
+  /**
+   * The process ID of each attached consumer, zero if the entry is free, or
+   * the negated process ID of whoever is reclaiming it from a dead consumer.
+   */
+  std::atomic<std::int32_t> consumers[kMaxConsumers];
+};
+
+/** The description of one slot. */
+struct alignas(64) RingSlot {
+  /** Set while the producer writes the slot. */
+  std::atomic<std::uint32_t> writing;
+
+  /** The sequence number of the frame in the slot. */
+  std::atomic<std::uint64_t> seq;
+
+  /** The frame width. */
+  std::int32_t width;
+
+  /** The frame height. */
+  std::int32_t height;
+
+  /** The distance between rows in bytes, or zero for packed rows. */
+  std::int32_t stride;
+
+  /** The pixel format. */
+  std::int32_t format;
+
+  /** The number of frames each consumer has pinning the slot, by consumer entry. */
+  std::atomic<std::uint32_t> readers[kMaxConsumers];
+};
+
+namespace {
+
+/**
+ * @return The offset of the slot table from the start of the segment
+ */
+std::size_t table_offset() {
+  // The slots are cache line aligned, so they don't share lines with the header or each other
+  return (sizeof(RingHeader) + alignof(RingSlot) - 1) / alignof(RingSlot) * alignof(RingSlot);
+}
+
+} // namespace
+
+ShmRing::ShmRing()
+    : m_name()
+    , m_map(nullptr)
+    , m_map_size(0)
+    , m_header(nullptr)
+    , m_slots(nullptr)
+    , m_data(nullptr)
+    , m_next_claim(0)
+    , m_claimed()
+    , m_consumer()
+    , m_pins(std::make_shared<BlockPool>()) {
+}
+
+ShmRing::~ShmRing() {
+  // Don't leave a half-written slot claimed forever
+  if (m_claimed) {
+    abandon();
+  }
+
+  // Every frame we pinned is gone by now, as they keep us alive
+  if (m_consumer) {
+    m_header->consumers[*m_consumer].store(0, std::memory_order_release);
+  }
+
+  if (m_map) {
+    munmap(m_map, m_map_size);
+  }
+}
+
+std::shared_ptr<ShmRing> ShmRing::open(const std::string& name, std::size_t slots, std::size_t slot_size,
+    double timeout) {
+  std::shared_ptr<ShmRing> ring(new ShmRing);
+  ring->m_name = name;
+
+  // Try to create the segment
+  // If somebody beat us to it, open theirs instead
+  bool created = true;
+  auto fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd == -1 && errno == EEXIST) {
+    created = false;
+    fd = shm_open(name.c_str(), O_RDWR, 0600);
+  }
+  if (fd == -1) {
+    throw_errno("cannot open frame ring " + name);
+  }
+
+  // The mapping outlives the descriptor
+  try {
+    if (created) {
+      ring->create(fd, slots, slot_size);
+    } else {
+      ring->attach(fd, timeout);
+    }
+  } catch (...) {
+    close(fd);
+    if (created) {
+      shm_unlink(name.c_str());
+    }
+    throw;
+  }
+
+  close(fd);
+  return ring;
+}
+
+void ShmRing::create(int fd, std::size_t slots, std::size_t slot_size) {
+  // We need at least three slots, so there's always one free with one being read and one published
+  if (slots < 3 || slots > kMaxSlots) {
+    throw std::runtime_error("frame ring must have between 3 and 256 slots");
+  }
+  if (slot_size == 0) {
+    throw std::runtime_error("frame ring slots cannot be empty");
+  }
+
+  auto data_offset = align_up(table_offset() + slots * sizeof(RingSlot));
+  auto slot_stride = align_up(slot_size);
+
+  m_map_size = data_offset + slots * slot_stride;
+  if (ftruncate(fd, static_cast<off_t>(m_map_size)) == -1) {
+    throw_errno("cannot size frame ring");
+  }
+
+  m_map = mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (m_map == MAP_FAILED) {
+    m_map = nullptr;
+    throw_errno("cannot map frame ring");
+  }
+
+  m_header = new(m_map) RingHeader;
+  m_header->version = kVersion;
+  m_header->slots = static_cast<std::uint32_t>(slots);
+  m_header->slot_size = slot_stride;
+  m_header->data_offset = data_offset;
+  m_header->head.store(0, std::memory_order_relaxed);
+  m_header->dropped.store(0, std::memory_order_relaxed);
+  for (auto& consumer : m_header->consumers) {
+    consumer.store(0, std::memory_order_relaxed);
+  }
+
+  locate();
+  for (std::size_t i = 0; i < slots; ++i) {
+    new(&m_slots[i]) RingSlot;
+    m_slots[i].writing.store(0, std::memory_order_relaxed);
+    m_slots[i].seq.store(0, std::memory_order_relaxed);
+    for (auto& readers : m_slots[i].readers) {
+      readers.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // Set up a mutex and condition variable that work across processes
+  // The mutex survives the death of its owner, and waits time out on the monotonic clock
+  pthread_mutexattr_t mattr;
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+  auto err = pthread_mutex_init(&m_header->mutex, &mattr);
+  pthread_mutexattr_destroy(&mattr);
+
+  pthread_condattr_t cattr;
+  pthread_condattr_init(&cattr);
+  pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+  pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+  if (err == 0) {
+    err = pthread_cond_init(&m_header->cond, &cattr);
+  }
+  pthread_condattr_destroy(&cattr);
+
+  if (err != 0) {
+    errno = err;
+    throw_errno("cannot set up frame ring");
+  }
+
+  // Let other processes in
+  m_header->magic.store(kMagic, std::memory_order_release);
+}
+
+void ShmRing::attach(int fd, double timeout) {
+  // The creator may still be setting up, so give it a moment
+  auto deadline = std::chrono::steady_clock::now()
+      + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+
+  // Wait for the header to be there
+  struct stat st {};
+  for (;;) {
+    if (fstat(fd, &st) == -1) {
+      throw_errno("cannot stat frame ring");
+    }
+
+    if (static_cast<std::size_t>(st.st_size) >= sizeof(RingHeader)) {
+      break;
+    }
+
+    if (std::chrono::steady_clock::now() > deadline) {
+      throw std::runtime_error("frame ring was never set up");
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  m_map_size = static_cast<std::size_t>(st.st_size);
+  m_map = mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (m_map == MAP_FAILED) {
+    m_map = nullptr;
+    throw_errno("cannot map frame ring");
+  }
+
+  m_header = static_cast<RingHeader*>(m_map);
+
+  // Wait for the rest of the setup
+  while (m_header->magic.load(std::memory_order_acquire) != kMagic) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      throw std::runtime_error("frame ring was never set up");
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // Make sure we agree on the layout
+  if (m_header->version != kVersion) {
+    throw std::runtime_error("frame ring has a different layout version");
+  }
+  if (m_header->data_offset + m_header->slots * m_header->slot_size != m_map_size) {
+    throw std::runtime_error("frame ring has the wrong size");
+  }
+
+  locate();
+}
+
+void ShmRing::locate() {
+  auto base = static_cast<char*>(m_map);
+  m_slots = reinterpret_cast<RingSlot*>(base + table_offset());
+  m_data = base + m_header->data_offset;
+}
+
+std::size_t ShmRing::get_slots() const {
+  return m_header->slots;
+}
+
+std::size_t ShmRing::get_slot_size() const {
+  return m_header->slot_size;
+}
+
+std::uint64_t ShmRing::get_dropped() const {
+  return m_header->dropped.load(std::memory_order_relaxed);
+}
+
+void ShmRing::recover() {
+  for (std::uint32_t i = 0; i < m_header->slots; ++i) {
+    m_slots[i].writing.store(0, std::memory_order_release);
+  }
+
+  reap();
+}
+
+bool ShmRing::reap() {
+  bool reaped = false;
+
+  for (std::uint32_t c = 0; c < kMaxConsumers; ++c) {
+    auto& consumer = m_header->consumers[c];
+
+    // Skip free entries and entries whose consumer (or reclaimer) is still around
+    auto pid = consumer.load(std::memory_order_acquire);
+    if (pid == 0 || is_alive(pid > 0 ? pid : -pid)) {
+      continue;
+    }
+
+    // Take the entry over, so nobody else reclaims it at the same time
+    // If we die halfway, the next one to come along sees we're gone and takes over from us
+    if (!consumer.compare_exchange_strong(pid, -static_cast<std::int32_t>(getpid()), std::memory_order_acquire)) {
+      continue;
+    }
+
+    // Drop every pin the dead consumer left behind, then free the entry
+    for (std::uint32_t i = 0; i < m_header->slots; ++i) {
+      m_slots[i].readers[c].store(0, std::memory_order_release);
+    }
+    consumer.store(0, std::memory_order_release);
+    reaped = true;
+  }
+
+  return reaped;
+}
+
+std::uint32_t ShmRing::join() {
+  if (m_consumer) {
+    return *m_consumer;
+  }
+
+  // Take a free entry, making room by reclaiming the entries of dead consumers if need be
+  auto pid = static_cast<std::int32_t>(getpid());
+  do {
+    for (std::uint32_t c = 0; c < kMaxConsumers; ++c) {
+      std::int32_t expected = 0;
+      if (m_header->consumers[c].compare_exchange_strong(expected, pid, std::memory_order_acq_rel)) {
+        m_consumer = c;
+        return c;
+      }
+    }
+  } while (reap());
+
+  throw std::runtime_error("frame ring has too many consumers");
+}
+
+bool ShmRing::is_pinned(const RingSlot& slot) const {
+  for (auto& readers : slot.readers) {
+    if (readers.load(std::memory_order_seq_cst) != 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+char* ShmRing::claim() {
+  if (m_claimed) {
+    throw std::runtime_error("a frame ring slot is already claimed");
+  }
+
+  // The newest frame is off limits, as consumers may be about to pin it
+  auto head = m_header->head.load(std::memory_order_acquire);
+  auto newest = head ? static_cast<std::uint32_t>(head & (kMaxSlots - 1)) : kMaxSlots;
+
+  // Take the first slot nobody is reading
+  // Going round robin keeps older frames around a little longer for slow consumers
+  auto slots = m_header->slots;
+  for (std::uint32_t n = 0; n < slots; ++n) {
+    auto i = (m_next_claim + n) % slots;
+    if (i == newest) {
+      continue;
+    }
+
+    // Mark the slot as being written, then make sure nobody pinned it
+    // A consumer pins first and checks the mark after, so one of us always backs off
+    auto& slot = m_slots[i];
+    if (is_pinned(slot)) {
+      continue;
+    }
+
+    slot.writing.store(1, std::memory_order_seq_cst);
+    if (is_pinned(slot)) {
+      slot.writing.store(0, std::memory_order_release);
+      continue;
+    }
+
+    m_claimed = i;
+    m_next_claim = (i + 1) % slots;
+    return m_data + i * m_header->slot_size;
+  }
+
+  // Every slot is pinned, so this frame has nowhere to go
+  // If consumers died holding pins, free their slots for the next frame
+  m_header->dropped.fetch_add(1, std::memory_order_relaxed);
+  reap();
+  return nullptr;
+}
+
+void ShmRing::publish(int width, int height, int stride, PixelFormat format) {
+  if (!m_claimed) {
+    throw std::runtime_error("no frame ring slot is claimed");
+  }
+
+  auto i = *m_claimed;
+  m_claimed.reset();
+
+  auto& slot = m_slots[i];
+  slot.width = width;
+  slot.height = height;
+  slot.stride = stride;
+  slot.format = static_cast<std::int32_t>(format);
+
+  // Number the frame and hand the slot over to readers
+  auto seq = (m_header->head.load(std::memory_order_relaxed) >> kSlotBits) + 1;
+  slot.seq.store(seq, std::memory_order_relaxed);
+  slot.writing.store(0, std::memory_order_release);
+
+  // Point the head at it and wake up consumers
+  lock_robust(&m_header->mutex);
+  m_header->head.store(seq << kSlotBits | i, std::memory_order_release);
+  pthread_cond_broadcast(&m_header->cond);
+  pthread_mutex_unlock(&m_header->mutex);
+}
+
+void ShmRing::abandon() {
+  if (m_claimed) {
+    m_slots[*m_claimed].writing.store(0, std::memory_order_release);
+    m_claimed.reset();
+  }
+}
+
+std::optional<Image> ShmRing::acquire(std::uint64_t& last, unsigned long millis) {
+  // Most of the time a frame is already waiting, and we can skip the lock altogether
+  auto head = m_header->head.load(std::memory_order_acquire);
+  if ((head >> kSlotBits) <= last) {
+    timespec deadline {};
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += static_cast<time_t>(millis / 1000);
+    deadline.tv_nsec += static_cast<long>(millis % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000;
+    }
+
+    // Wait for the producer to publish something new
+    lock_robust(&m_header->mutex);
+    for (;;) {
+      head = m_header->head.load(std::memory_order_acquire);
+      if ((head >> kSlotBits) > last) {
+        break;
+      }
+
+      auto err = pthread_cond_timedwait(&m_header->cond, &m_header->mutex, &deadline);
+      if (err == EOWNERDEAD) {
+        pthread_mutex_consistent(&m_header->mutex);
+      } else if (err == ETIMEDOUT) {
+        break;
+      }
+    }
+    pthread_mutex_unlock(&m_header->mutex);
+
+    if ((head >> kSlotBits) <= last) {
+      return std::nullopt;
+    }
+  }
+
+  // Pin the newest frame
+  // If the producer got around to writing over it first, there is an even newer one to try
+  for (;;) {
+    auto frame = pin(head);
+    if (frame) {
+      last = head >> kSlotBits;
+
+      // Don't trust the producer with our memory
+      // A malformed frame is skipped (and unpinned on the way out)
+      if (static_cast<unsigned>(frame->format) > static_cast<unsigned>(PixelFormat::GRAY) || !frame->fits()) {
+        return std::nullopt;
+      }
+
+      return frame;
+    }
+
+    head = m_header->head.load(std::memory_order_acquire);
+  }
+}
+
+std::optional<Image> ShmRing::pin(std::uint64_t head) {
+  auto i = static_cast<std::uint32_t>(head & (kMaxSlots - 1));
+  auto seq = head >> kSlotBits;
+  auto& slot = m_slots[i];
+
+  // Count ourselves in as a reader under our own entry, so our pins can be told apart if we die
+  // Then back off if the producer is writing the slot, or has written and published another frame in it
+  auto c = join();
+  auto& readers = slot.readers[c];
+  readers.fetch_add(1, std::memory_order_seq_cst);
+  if (slot.writing.load(std::memory_order_seq_cst) || slot.seq.load(std::memory_order_relaxed) != seq) {
+    readers.fetch_sub(1, std::memory_order_release);
+    return std::nullopt;
+  }
+
+  // Describe the frame in place
+  Image image;
+  image.width = slot.width;
+  image.height = slot.height;
+  image.stride = slot.stride;
+  image.format = static_cast<PixelFormat>(slot.format);
+  image.borrowed = m_data + i * m_header->slot_size;
+  image.borrowed_size = m_header->slot_size;
+
+  // The last copy of the frame unpins the slot
+  // It also keeps the ring mapped until then
+  // This happens every frame, so the control block comes from the pool
+  auto self = shared_from_this();
+  image.owner = std::shared_ptr<const void>(&slot, [self, &readers](const void*) {
+    readers.fetch_sub(1, std::memory_order_release);
+  }, PoolAllocator<char>(m_pins));
+
+  return image;
+}
+
+} // namespace sources
+} // namespace faces
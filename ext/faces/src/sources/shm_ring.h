@@ -0,0 +1,209 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef SOURCES_SHM_RING_H
+#define SOURCES_SHM_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <faces/source.h>
+
+#include "../pool.h"
+
+namespace faces {
+namespace sources {
+
+struct RingHeader;
+struct RingSlot;
+
+/**
+ * A ring of frame slots in POSIX shared memory. One producer process writes
+ * frames into free slots and publishes them, and consumers pin the newest
+ * published frame and read it in place. A pinned slot is never written over,
+ * so frames need no copying on the way out. If the consumers fall behind, the
+ * producer simply overwrites frames nobody pinned (the newest frame wins).
+ * Each consumer process counts its pins under its own entry, so the pins of a
+ * consumer that died are taken back instead of holding their slots forever.
+ *
+ * Rings are always handled through shared pointers, as frames handed out keep
+ * the mapping alive.
+ */
+class ShmRing : public std::enable_shared_from_this<ShmRing> {
+  /** The segment name. */
+  std::string m_name;
+
+  /** The mapped segment. */
+  void* m_map;
+
+  /** The size of the mapped segment. */
+  std::size_t m_map_size;
+
+  /** The segment header. */
+  RingHeader* m_header;
+
+  /** The slot table. */
+  RingSlot* m_slots;
+
+  /** The start of the slot memory. */
+  char* m_data;
+
+  /** The slot to try first when claiming. */
+  std::uint32_t m_next_claim;
+
+  /** The slot being written, if any. */
+  std::optional<std::uint32_t> m_claimed;
+
+  /** Our consumer entry, once we have pinned something. */
+  std::optional<std::uint32_t> m_consumer;
+
+  /** Recycles the control blocks of pinned frames, so pinning does not allocate. */
+  std::shared_ptr<BlockPool> m_pins;
+
+  ShmRing();
+
+public:
+  ShmRing(const ShmRing& rhs) = delete;
+
+  ~ShmRing();
+
+  ShmRing& operator=(const ShmRing& rhs) = delete;
+
+  /**
+   * Open a ring, creating it if it does not exist yet.
+   *
+   * @param name The segment name
+   * @param slots The number of slots (only used if creating)
+   * @param slot_size The size of each slot in bytes (only used if creating)
+   * @param timeout How long to wait in seconds for another process to finish creating the ring
+   * @return The ring
+   */
+  static std::shared_ptr<ShmRing> open(const std::string& name, std::size_t slots, std::size_t slot_size,
+      double timeout);
+
+  /**
+   * @return The segment name
+   */
+  const std::string& get_name() const {
+    return m_name;
+  }
+
+  /**
+   * @return The number of slots
+   */
+  std::size_t get_slots() const;
+
+  /**
+   * @return The size of each slot in bytes
+   */
+  std::size_t get_slot_size() const;
+
+  /**
+   * @return The number of frames dropped by the producer for lack of a free slot
+   */
+  std::uint64_t get_dropped() const;
+
+  /**
+   * Free any slots left claimed by a producer that died while writing, and any
+   * left pinned by consumers that died while reading. Only a new producer does
+   * this, before claiming anything. Slots pinned by dead consumers are also
+   * freed whenever the producer runs out of slots.
+   */
+  void recover();
+
+  /**
+   * Claim a free slot to write a frame into. Only the producer does this.
+   *
+   * @return The slot memory, or null if every slot is in use
+   */
+  char* claim();
+
+  /**
+   * Publish the frame in the claimed slot, waking up consumers.
+   *
+   * @param width The frame width
+   * @param height The frame height
+   * @param stride The distance between rows in bytes, or zero for packed rows
+   * @param format The pixel format
+   */
+  void publish(int width, int height, int stride, PixelFormat format);
+
+  /**
+   * Give up the claimed slot without publishing anything.
+   */
+  void abandon();
+
+  /**
+   * Wait for a frame newer than the last one and pin it. The frame borrows the
+   * slot memory, and the slot stays pinned until the last copy of the frame is
+   * gone.
+   *
+   * @param last The sequence number of the last frame seen (updated)
+   * @param millis The maximum number of milliseconds to wait
+   * @return The frame
+   */
+  std::optional<Image> acquire(std::uint64_t& last, unsigned long millis);
+
+private:
+  /**
+   * Set up a freshly created segment.
+   *
+   * @param fd The segment file descriptor
+   * @param slots The number of slots
+   * @param slot_size The size of each slot in bytes
+   */
+  void create(int fd, std::size_t slots, std::size_t slot_size);
+
+  /**
+   * Map an existing segment, waiting for its creator to finish setting it up.
+   *
+   * @param fd The segment file descriptor
+   * @param timeout How long to wait in seconds
+   */
+  void attach(int fd, double timeout);
+
+  /** Find the slot table and slot memory in the mapped segment. */
+  void locate();
+
+  /**
+   * Free the consumer entries of dead consumers, along with their pins.
+   *
+   * @return True if any entry was freed, otherwise false
+   */
+  bool reap();
+
+  /**
+   * Take a consumer entry for this process, if we don't have one yet.
+   *
+   * This throws if every entry belongs to a live consumer.
+   *
+   * @return The consumer entry
+   */
+  std::uint32_t join();
+
+  /**
+   * @param slot The slot
+   * @return True if any consumer has the slot pinned, otherwise false
+   */
+  bool is_pinned(const RingSlot& slot) const;
+
+  /**
+   * Try to pin the newest frame.
+   *
+   * @param head The published head
+   * @return The frame, or nothing if it was written over under us
+   */
+  std::optional<Image> pin(std::uint64_t head);
+};
+
+} // namespace sources
+} // namespace faces
+
+#endif // #ifndef SOURCES_SHM_RING_H
@@ -0,0 +1,199 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include <faces/trace.h>
+#include <faces/sources/shm_source.h>
+
+#include "buffer.h"
+#include "shm_ring.h"
+
+namespace faces {
+namespace sources {
+
+namespace py = pybind11;
+
+struct ShmSourceImpl {
+  /** The frame ring. */
+  std::shared_ptr<ShmRing> m_ring;
+
+  /** The sequence number of the last frame read. */
+  std::uint64_t m_last;
+
+  ShmSourceImpl();
+};
+
+ShmSourceImpl::ShmSourceImpl() : m_ring(), m_last(0) {
+}
+
+ShmSource::ShmSource(const std::string& name, std::size_t slots, std::size_t slot_size, double timeout) : impl() {
+  impl = std::make_unique<ShmSourceImpl>();
+  impl->m_ring = ShmRing::open(name, slots, slot_size, timeout);
+}
+
+ShmSource::~ShmSource() = default;
+
+void ShmSource::update(const py::object&) {
+  throw std::runtime_error("shared memory source takes frames from its producer");
+}
+
+std::optional<Image> ShmSource::wait(unsigned long millis) {
+  // Pin the newest frame, waiting for one if need be
+  // Frames the producer wrote while we were busy are skipped, so we never fall behind
+  return impl->m_ring->acquire(impl->m_last, millis);
+}
+
+std::string ShmSource::get_name() const {
+  return impl->m_ring->get_name();
+}
+
+std::uint64_t ShmSource::get_dropped() const {
+  return impl->m_ring->get_dropped();
+}
+
+struct ShmProducerImpl {
+  /** The frame ring. */
+  std::shared_ptr<ShmRing> m_ring;
+
+  /** The slot handed out to Python, if any. */
+  py::object m_slot;
+
+  /** The memoryview of the slot handed out to Python, if any. */
+  py::object m_view;
+
+  ShmProducerImpl();
+};
+
+ShmProducerImpl::ShmProducerImpl() : m_ring(), m_slot(), m_view() {
+}
+
+ShmProducer::ShmProducer(const std::string& name, std::size_t slots, std::size_t slot_size, double timeout)
+    : impl() {
+  impl = std::make_unique<ShmProducerImpl>();
+  impl->m_ring = ShmRing::open(name, slots, slot_size, timeout);
+
+  // Take over from any producer that died mid-frame
+  impl->m_ring->recover();
+}
+
+ShmProducer::~ShmProducer() = default;
+
+std::size_t ShmProducer::get_slot_size() const {
+  return impl->m_ring->get_slot_size();
+}
+
+std::uint64_t ShmProducer::get_dropped() const {
+  return impl->m_ring->get_dropped();
+}
+
+char* ShmProducer::claim() {
+  return impl->m_ring->claim();
+}
+
+void ShmProducer::publish(int width, int height, PixelFormat format, int stride) {
+  // Make sure the frame fits in the slot before anybody reads it
+  Image image;
+  image.width = width;
+  image.height = height;
+  image.stride = stride;
+  image.format = format;
+  image.borrowed_size = impl->m_ring->get_slot_size();
+  if (!image.fits()) {
+    impl->m_ring->abandon();
+    throw std::runtime_error("frame does not fit in a ring slot");
+  }
+
+  impl->m_ring->publish(width, height, stride, format);
+}
+
+void ShmProducer::abandon() {
+  impl->m_ring->abandon();
+}
+
+bool ShmProducer::push(const Image& image) {
+  trace::Span span_push("shm_push");
+
+  auto row = static_cast<std::size_t>(image.width) * bytes_per_pixel(image.format);
+  if (!image.fits() || row * image.height > impl->m_ring->get_slot_size()) {
+    throw std::runtime_error("frame does not fit in a ring slot");
+  }
+
+  auto slot = impl->m_ring->claim();
+  if (!slot) {
+    return false;
+  }
+
+  // Copy the frame in, packing its rows
+  auto src = image.pixels();
+  if (image.step() == static_cast<int>(row)) {
+    std::memcpy(slot, src, row * image.height);
+  } else {
+    for (int y = 0; y < image.height; ++y) {
+      std::memcpy(slot + row * y, src + static_cast<std::size_t>(image.step()) * y, row);
+    }
+  }
+
+  impl->m_ring->publish(image.width, image.height, 0, image.format);
+  return true;
+}
+
+bool ShmProducer::push_buffer(const py::buffer& buf, PixelFormat format) {
+  // Describe the memory behind the buffer
+  // The buffer view keeps it in place while we copy, so Python is free to run meanwhile
+  auto info = buf.request();
+  auto image = borrow_buffer(info, format);
+
+  py::gil_scoped_release release;
+  return push(image);
+}
+
+py::object ShmProducer::claim_view() {
+  auto data = impl->m_ring->claim();
+  if (!data) {
+    return py::none();
+  }
+
+  // The view exports the slot through an owner that keeps the ring mapped
+  // That way, the view stays safe to touch even after the producer is gone
+  try {
+    impl->m_slot = py::cast(ShmSlot {impl->m_ring, data, impl->m_ring->get_slot_size(), true});
+    impl->m_view = py::memoryview(impl->m_slot);
+  } catch (...) {
+    impl->m_slot = py::object();
+    impl->m_ring->abandon();
+    throw;
+  }
+
+  return impl->m_view;
+}
+
+void ShmProducer::release_view() {
+  if (!impl->m_slot) {
+    return;
+  }
+
+  // Release our view, which fails if anything was taken from it
+  // The view itself raises from now on if used
+  if (impl->m_view) {
+    impl->m_view.attr("release")();
+    impl->m_view = py::object();
+  }
+
+  // Slices of the view hold the slot's export on their own, and thereby the slot
+  if (impl->m_slot.ref_count() > 1) {
+    throw py::buffer_error("ring slot memory is still in use by views taken from it");
+  }
+
+  impl->m_slot.cast<ShmSlot&>().claimed = false;
+  impl->m_slot = py::object();
+}
+
+} // namespace sources
+} // namespace faces
@@ -0,0 +1,305 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <faces/trace.h>
+
+namespace faces {
+namespace trace {
+
+namespace {
+
+/** The number of spans each thread can hold before overwriting old ones. */
+constexpr std::uint64_t RING_CAPACITY = 1u << 16u;
+
+/** A recorded span. */
+struct Event {
+  /** The span name. */
+  const char* name;
+
+  /** The span begin time in nanoseconds. */
+  std::uint64_t begin;
+
+  /** The span end time in nanoseconds. */
+  std::uint64_t end;
+
+  /** The span argument. */
+  std::int64_t arg;
+};
+
+/** A per-thread span ring buffer. Only the owning thread writes to it. */
+struct Ring {
+  /** The span storage. */
+  std::unique_ptr<std::array<Event, RING_CAPACITY>> events;
+
+  /** The total number of spans ever written. */
+  std::atomic<std::uint64_t> head;
+
+  /** The head position at the last clear. Older spans are not dumped. */
+  std::atomic<std::uint64_t> floor;
+
+  /** Whether the owning thread has exited. */
+  std::atomic<bool> exited;
+
+  /** The trace thread ID. */
+  int tid;
+
+  /** The thread name (protected by the registry mutex). */
+  std::string name;
+
+  Ring(int p_tid, const std::string& p_name)
+      : events(std::make_unique<std::array<Event, RING_CAPACITY>>())
+      , head(0)
+      , floor(0)
+      , exited(false)
+      , tid(p_tid)
+      , name(p_name) {
+  }
+};
+
+/** The registry of all thread rings. */
+struct Registry {
+  /** Guards ring registration and thread names. Never taken to record. */
+  std::mutex mutex;
+
+  /** The rings of live threads, and of exited threads not yet dumped or cleared. */
+  std::vector<std::shared_ptr<Ring>> rings;
+
+  /** The next trace thread ID. */
+  int next_tid {1};
+
+  /** The recording switch. */
+  std::atomic<bool> enabled {false};
+
+  /** The trace clock origin. */
+  std::chrono::steady_clock::time_point origin {std::chrono::steady_clock::now()};
+};
+
+Registry& registry() {
+  // Constructed on first use and intentionally leaked
+  // Threads may still record while static destructors run
+  static auto reg = new Registry();
+  return *reg;
+}
+
+/**
+ * What the trace knows about a thread. Naming a thread costs only this, so
+ * threads that never record while tracing is on never get a ring.
+ */
+struct ThreadRecord {
+  /** The thread name. */
+  std::string name;
+
+  /** The span ring, once the thread has recorded a span. */
+  std::shared_ptr<Ring> ring;
+
+  ~ThreadRecord() {
+    // Let the ring go once whatever it holds has been dumped or cleared
+    if (ring) {
+      ring->exited.store(true, std::memory_order_release);
+    }
+  }
+};
+
+ThreadRecord& thread_record() {
+  thread_local ThreadRecord record;
+  return record;
+}
+
+/**
+ * Forget some rings. The registry mutex must be held.
+ *
+ * @param reg The registry
+ * @param gone The rings to forget
+ */
+void drop_rings(Registry& reg, const std::vector<const Ring*>& gone) {
+  reg.rings.erase(std::remove_if(reg.rings.begin(), reg.rings.end(), [&](auto& ring) {
+    return std::find(gone.begin(), gone.end(), ring.get()) != gone.end();
+  }), reg.rings.end());
+}
+
+/** Escape a string for inclusion in JSON. */
+void write_json_string(std::ostream& out, const std::string& str) {
+  out << '"';
+  for (auto c : str) {
+    switch (c) {
+      case '"':
+        out << "\\\"";
+        break;
+      case '\\':
+        out << "\\\\";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buf[8];
+          std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out << buf;
+        } else {
+          out << c;
+        }
+    }
+  }
+  out << '"';
+}
+
+/** Write a nanosecond reading as fractional microseconds. */
+void write_micros(std::ostream& out, std::uint64_t nanos) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%llu.%03llu",
+      static_cast<unsigned long long>(nanos / 1000), static_cast<unsigned long long>(nanos % 1000));
+  out << buf;
+}
+
+} // namespace
+
+void set_enabled(bool enabled) {
+  registry().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool is_enabled() {
+  return registry().enabled.load(std::memory_order_relaxed);
+}
+
+void clear() {
+  auto& reg = registry();
+  std::lock_guard lock(reg.mutex);
+
+  // Raise the floor of every ring to its current head
+  // The owning threads keep writing undisturbed
+  // Threads that were gone before the floor went up have nothing left to dump, so forget them
+  std::vector<const Ring*> gone;
+  for (auto& ring : reg.rings) {
+    if (ring->exited.load(std::memory_order_acquire)) {
+      gone.push_back(ring.get());
+    }
+    ring->floor.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+  }
+  drop_rings(reg, gone);
+}
+
+void set_thread_name(const std::string& name) {
+  auto& thread = thread_record();
+  thread.name = name;
+
+  // A ring already out there takes the new name, too
+  if (thread.ring) {
+    std::lock_guard lock(registry().mutex);
+    thread.ring->name = name;
+  }
+}
+
+std::uint64_t now() {
+  auto elapsed = std::chrono::steady_clock::now() - registry().origin;
+
+  // Add one so that a valid reading is never zero
+  return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) + 1;
+}
+
+void record(const char* name, std::uint64_t begin, std::uint64_t end, std::int64_t arg) {
+  auto& thread = thread_record();
+
+  // Register a ring for this thread on its first span while tracing
+  if (!thread.ring) {
+    if (!is_enabled()) {
+      return;
+    }
+
+    auto& reg = registry();
+    std::lock_guard lock(reg.mutex);
+
+    thread.ring = std::make_shared<Ring>(reg.next_tid++, thread.name);
+    reg.rings.push_back(thread.ring);
+  }
+
+  auto& ring = *thread.ring;
+
+  // Write the span into the next slot and then publish it
+  auto head = ring.head.load(std::memory_order_relaxed);
+  (*ring.events)[head % RING_CAPACITY] = Event {name, begin, end, arg};
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+std::string dump() {
+  auto& reg = registry();
+  std::lock_guard lock(reg.mutex);
+
+  std::ostringstream out;
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+  // Name the process
+  out << R"({"name":"process_name","ph":"M","pid":1,"tid":0,"args":{"name":"faces"}})";
+
+  std::vector<const Ring*> gone;
+  for (auto& ring : reg.rings) {
+    // Threads that were gone before the snapshot have given up all they had, so forget them after this
+    if (ring->exited.load(std::memory_order_acquire)) {
+      gone.push_back(ring.get());
+    }
+
+    // Name the thread
+    out << R"(,{"name":"thread_name","ph":"M","pid":1,"tid":)" << ring->tid << R"(,"args":{"name":)";
+    write_json_string(out, ring->name.empty() ? "thread " + std::to_string(ring->tid) : ring->name);
+    out << "}}";
+
+    // Snapshot the readable window of the ring
+    auto head = ring->head.load(std::memory_order_acquire);
+    auto first = std::max(ring->floor.load(std::memory_order_relaxed),
+        head > RING_CAPACITY ? head - RING_CAPACITY : 0);
+
+    // Copy the window out before the owner can lap it
+    std::vector<Event> events;
+    events.reserve(head - first);
+    for (auto i = first; i < head; ++i) {
+      events.push_back((*ring->events)[i % RING_CAPACITY]);
+    }
+
+    // Drop whatever the owner overwrote while we were copying
+    // That includes the slot it may be writing now (at head_after), which is one past the last one it finished
+    auto head_after = ring->head.load(std::memory_order_acquire);
+    auto safe = head_after + 1 > RING_CAPACITY ? head_after + 1 - RING_CAPACITY : 0;
+    auto skip = safe > first ? std::min<std::uint64_t>(safe - first, events.size()) : 0;
+
+    for (auto it = events.begin() + skip; it != events.end(); ++it) {
+      out << R"(,{"name":")" << it->name << R"(","cat":"faces","ph":"X","pid":1,"tid":)" << ring->tid << ",\"ts\":";
+      write_micros(out, it->begin);
+      out << ",\"dur\":";
+      write_micros(out, it->end > it->begin ? it->end - it->begin : 0);
+      out << ",\"args\":{\"arg\":" << it->arg << "}}";
+    }
+  }
+
+  out << "]}";
+
+  drop_rings(reg, gone);
+
+  return out.str();
+}
+
+void dump_file(const std::string& path) {
+  std::ofstream file(path);
+
+  // If the file could not be opened
+  if (!file) {
+    throw std::runtime_error("unable to open trace file");
+  }
+
+  file << dump();
+}
+
+} // namespace trace
+} // namespace faces
@@ -0,0 +1,128 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <chrono>
+#include <thread>
+
+#include <faces/recognizer.h>
+#include <faces/caches/basic_cache.h>
+
+#include "test.h"
+
+using namespace faces;
+using namespace faces::test;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/** A synthetic recognizer hooked up to a cache and a source, counting its events. */
+struct Rig {
+  caches::BasicCache cache;
+  TestSource source;
+  Recognizer rec;
+  int appear = 0;
+  int disappear = 0;
+
+  Rig() : cache(1024), source(), rec(Recognizer::Backend::SYNTHETIC) {
+    rec.configure_synthetic(1, 0, 0);
+    rec.set_cache(&cache);
+    rec.set_source(&source);
+    rec.register_face_appear([this](Recognizer&, int, std::tuple<int, int, int, int>, Encoding&) {
+      ++appear;
+    });
+    rec.register_face_disappear([this](Recognizer&, int) {
+      ++disappear;
+    });
+  }
+
+  /**
+   * Feed a frame and wait for the recognizer to be done with it.
+   *
+   * @param tag The frame tag
+   */
+  void feed(std::uint32_t tag) {
+    auto frames = rec.get_stats().frames;
+    source.push(tag);
+
+    auto deadline = Clock::now() + std::chrono::seconds(2);
+    while (rec.get_stats().frames == frames) {
+      CHECK(Clock::now() < deadline);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+};
+
+/** An unknown face that stays in view is not forgotten by the cache, even past its time to live. */
+void tracked_unknown_outlives_ttl() {
+  Rig rig;
+  rig.cache.set_unknown_ttl(0.1);
+  rig.rec.start();
+
+  // Keep the face in view for several times its time to live
+  // Expiring as we go gives the cache every chance to forget it
+  auto end = Clock::now() + std::chrono::milliseconds(500);
+  for (std::uint32_t tag = 0; Clock::now() < end; ++tag) {
+    rig.feed(tag % 2);
+    rig.cache.expire();
+    rig.rec.poll();
+  }
+
+  rig.rec.stop();
+  rig.rec.poll();
+
+  CHECK(rig.appear == 1);
+  CHECK(rig.disappear == 0);
+  CHECK(rig.cache.get_stats().evicted_expired == 0);
+  CHECK(rig.cache.get_stats().unknown == 1);
+}
+
+/** One stray detection does not wake an idle recognizer that wants faces in several probe frames in a row. */
+void stray_detection_does_not_wake() {
+  Rig rig;
+  rig.rec.configure_synthetic(0, 0, 0);
+
+  // Go idle on the first empty frame, and probe quickly, so the test does not wait on the idle rate
+  Recognizer::Sampling sampling;
+  sampling.adaptive = true;
+  sampling.idle_rate = 1000;
+  sampling.idle_after = 0;
+  sampling.wake_frames = 3;
+  rig.rec.set_sampling(sampling);
+  rig.rec.start();
+
+  rig.feed(0);
+  CHECK(rig.rec.get_stats().idle_entries == 1);
+
+  // A face shows up in one probe frame and is gone in the next
+  // Its track lingers for a while after, but nobody is in view
+  rig.rec.configure_synthetic(1, 0, 0);
+  rig.feed(0);
+  rig.rec.configure_synthetic(0, 0, 0);
+  for (std::uint32_t i = 0; i < 4; ++i) {
+    rig.feed(0);
+  }
+  CHECK(rig.rec.get_stats().idle_exits == 0);
+
+  // A face that stays in view does wake it
+  rig.rec.configure_synthetic(1, 0, 0);
+  for (std::uint32_t i = 0; i < 3; ++i) {
+    rig.feed(0);
+  }
+  CHECK(rig.rec.get_stats().idle_exits == 1);
+
+  rig.rec.stop();
+}
+
+} // namespace
+
+int main() {
+  return run({
+      {"tracked_unknown_outlives_ttl", tracked_unknown_outlives_ttl},
+      {"stray_detection_does_not_wake", stray_detection_does_not_wake},
+  });
+}
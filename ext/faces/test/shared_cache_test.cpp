@@ -0,0 +1,171 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <faces/encoding.h>
+#include <faces/caches/shared_cache.h>
+
+#include "test.h"
+
+using namespace faces;
+using namespace faces::test;
+
+namespace {
+
+/** The segment header, as laid out by the shared cache. */
+struct Header {
+  std::atomic<std::uint64_t> magic;
+  std::uint32_t version;
+  std::uint32_t capacity;
+  std::uint32_t journal_size;
+  std::uint32_t max_prototypes;
+  pthread_mutex_t mutex;
+  std::atomic<std::uint64_t> seq;
+  std::atomic<std::uint64_t> epoch;
+  std::uint32_t count;
+  std::int32_t unknown_id;
+};
+
+/** A face slot, as laid out by the shared cache. */
+struct Slot {
+  std::int32_t id;
+  std::uint32_t prototypes;
+  double radius;
+  Encoding::vector_type centroid;
+};
+
+/**
+ * Map a shared cache segment raw.
+ *
+ * @param name The segment name
+ * @param size The size to map
+ * @return The start of the segment
+ */
+char* map_segment(const std::string& name, std::size_t size) {
+  auto fd = shm_open(name.c_str(), O_RDWR, 0600);
+  return static_cast<char*>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+}
+
+/**
+ * @param slot The slot
+ * @return A face encoding distinct from those of all other slots
+ */
+Encoding make_face(int slot) {
+  Encoding::vector_type vec {};
+  vec[slot % vec.size()] = 1;
+
+  Encoding enc;
+  enc.set_vector(vec);
+  return enc;
+}
+
+/** A query does not hang on a change left half done by a process that died. */
+void query_survives_dead_writer() {
+  auto name = "/cozmonaut-faces-test-" + std::to_string(getpid());
+  shm_unlink(name.c_str());
+
+  caches::SharedCache cache(name, 16, 1024, 8, 1.0);
+  cache.insert(1, make_face(1));
+
+  // Start a change in another process and kill it before it finishes
+  auto pid = fork();
+  CHECK(pid != -1);
+  if (pid == 0) {
+    auto header = reinterpret_cast<Header*>(map_segment(name, sizeof(Header)));
+    pthread_mutex_lock(&header->mutex);
+    header->seq.fetch_add(1);
+    raise(SIGKILL);
+  }
+
+  int status = 0;
+  waitpid(pid, &status, 0);
+  CHECK(WIFSIGNALED(status));
+
+  // If the query hangs, the alarm fails the test
+  alarm(10);
+  auto matched = cache.query(make_face(1), 0.1);
+  alarm(0);
+  CHECK(matched == 1);
+
+  // The cache takes changes again
+  cache.insert(2, make_face(2));
+  CHECK(cache.query(make_face(2), 0.1) == 2);
+
+  shm_unlink(name.c_str());
+}
+
+/** A change left half done by a process that died is repaired before anybody goes on. */
+void dead_writer_damage_is_repaired() {
+  auto name = "/cozmonaut-faces-test-" + std::to_string(getpid());
+  shm_unlink(name.c_str());
+
+  caches::SharedCache cache(name, 16, 4, 8, 1.0);
+  cache.insert(1, make_face(1));
+  cache.insert(2, make_face(2));
+  cache.insert(3, make_face(3));
+  auto epoch = cache.get_epoch();
+
+  // Die while removing face 1, right after moving face 3 over it, and with a torn prototype count on face 2
+  auto pid = fork();
+  CHECK(pid != -1);
+  if (pid == 0) {
+    auto journal = (sizeof(Header) + alignof(Cache::Change) - 1) / alignof(Cache::Change) * alignof(Cache::Change);
+    auto offset = journal + 4 * sizeof(Cache::Change);
+    offset = (offset + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot);
+
+    auto base = map_segment(name, offset + 16 * sizeof(Slot));
+    auto header = reinterpret_cast<Header*>(base);
+    auto slots = reinterpret_cast<Slot*>(base + offset);
+    pthread_mutex_lock(&header->mutex);
+    header->seq.fetch_add(1);
+    slots[0] = slots[2];
+    slots[1].prototypes = 1000;
+    raise(SIGKILL);
+  }
+
+  int status = 0;
+  waitpid(pid, &status, 0);
+  CHECK(WIFSIGNALED(status));
+
+  // Face 3 is there once, face 2 still matches, and face 1 is gone
+  alarm(10);
+  CHECK(cache.query(make_face(3), 0.1) == 3);
+  alarm(0);
+  CHECK(cache.get_size() == 2);
+  CHECK(cache.query(make_face(2), 0.1) == 2);
+  CHECK(cache.query(make_face(1), 0.1) == 0);
+
+  // The journal no longer covers what happened, so followers start over
+  std::vector<Cache::Change> changes;
+  CHECK(!cache.get_changes(epoch, changes));
+
+  // Face 3 can be removed for good
+  cache.remove(3);
+  CHECK(cache.query(make_face(3), 0.1) == 0);
+
+  shm_unlink(name.c_str());
+}
+
+} // namespace
+
+int main() {
+  return run({
+      {"query_survives_dead_writer", query_survives_dead_writer},
+      {"dead_writer_damage_is_repaired", dead_writer_damage_is_repaired},
+  });
+}
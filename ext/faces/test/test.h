@@ -0,0 +1,131 @@
+/*
+ * Cozmonaut
+ * Copyright (c) 2019 The Cozmonaut Contributors
+ *
+ * InsertLicenseText
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <faces/source.h>
+
+namespace faces {
+namespace test {
+
+/** A test case. */
+struct Case {
+  /** The test name. */
+  const char* name;
+
+  /** The test body. It fails by throwing. */
+  std::function<void()> body;
+};
+
+/**
+ * Fail the running test unless a condition holds.
+ *
+ * @param cond The condition
+ * @param what The condition as written
+ * @param file The source file
+ * @param line The source line
+ */
+inline void check(bool cond, const char* what, const char* file, int line) {
+  if (!cond) {
+    throw std::runtime_error(std::string(file) + ":" + std::to_string(line) + ": check failed: " + what);
+  }
+}
+
+/**
+ * Run some tests and report on each.
+ *
+ * @param cases The tests
+ * @return The process exit status
+ */
+inline int run(const std::vector<Case>& cases) {
+  int failed = 0;
+
+  for (auto& c : cases) {
+    try {
+      c.body();
+      std::cout << "PASS " << c.name << "\n";
+    } catch (const std::exception& e) {
+      std::cout << "FAIL " << c.name << ": " << e.what() << "\n";
+      ++failed;
+    }
+  }
+
+  return failed ? 1 : 0;
+}
+
+/** A latest-frame-wins source fed from C++, like PILSource without Python. */
+class TestSource : public Source {
+  /** The pending frame. */
+  Image m_image;
+
+  /** The pending condition variable. */
+  std::condition_variable m_cond;
+
+  /** The pending mutex. */
+  std::mutex m_mutex;
+
+  /** The presence indicator. */
+  bool m_present;
+
+public:
+  TestSource() : m_image(), m_cond(), m_mutex(), m_present(false) {
+  }
+
+  void update(const pybind11::object&) final {
+    throw std::runtime_error("test source takes frames from push()");
+  }
+
+  /**
+   * Submit a frame. The synthetic detector reports faces at x = tag.
+   *
+   * @param tag The frame tag
+   */
+  void push(std::uint32_t tag) {
+    Image image;
+    image.width = 320;
+    image.height = 240;
+    image.data.resize(320 * 240 * 3);
+    std::memcpy(image.data.data(), &tag, sizeof(tag));
+
+    std::lock_guard lock(m_mutex);
+    m_image = std::move(image);
+    m_present = true;
+    m_cond.notify_all();
+  }
+
+  std::optional<Image> wait(unsigned long millis) final {
+    std::unique_lock lock(m_mutex);
+
+    if (!m_cond.wait_for(lock, std::chrono::milliseconds(millis), [&]() { return m_present; })) {
+      return std::nullopt;
+    }
+
+    m_present = false;
+    return m_image;
+  }
+};
+
+} // namespace test
+} // namespace faces
+
+/** Fail the running test unless a condition holds. */
+#define CHECK(cond) ::faces::test::check((cond), #cond, __FILE__, __LINE__)
+
+#endif // #ifndef TEST_H
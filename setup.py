@@ -32,6 +32,16 @@ class CMakeExtension(Extension):
 class build_ext_cmake(build_ext):
     """A setuptools command to build CMakeExtension objects."""
 
+    user_options = build_ext.user_options + [
+        ('pgo', None, 'build with link-time and profile-guided optimization (GCC only)'),
+    ]
+
+    boolean_options = build_ext.boolean_options + ['pgo']
+
+    def initialize_options(self):
+        build_ext.initialize_options(self)
+        self.pgo = False
+
     def build_extensions(self):
         # Assert that we can actually call CMake
         try:
@@ -57,9 +67,24 @@ class build_ext_cmake(build_ext):
             # noinspection PyProtectedMember
             ext_file = ext._file_name
 
+            # CMake configure arguments
+            # Without a build type, CMake builds without optimization
+            cmake_args = [ext.cmake_lists_dir, '-DCMAKE_BUILD_TYPE=Release']
+
+            if self.pgo:
+                # Build instrumented and train on the bundled benchmarks
+                # The profiles stay in the temp build directory for the optimized build below
+                subprocess.check_call(['cmake'] + cmake_args + ['-DFACES_LTO=ON', '-DFACES_PGO=GENERATE',
+                                                                '-DFACES_BUILD_BENCH=ON'], cwd=self.build_temp)
+                subprocess.check_call(['cmake', '--build', '.', '--target', 'faces_pgo_train'], cwd=self.build_temp)
+
+                cmake_args += ['-DFACES_LTO=ON', '-DFACES_PGO=USE']
+            else:
+                cmake_args += ['-DFACES_LTO=OFF', '-DFACES_PGO=OFF']
+
             # CMake configure and build
             # The library DLL will be put in the temp build directory
-            subprocess.check_call(['cmake', ext.cmake_lists_dir], cwd=self.build_temp)
+            subprocess.check_call(['cmake'] + cmake_args, cwd=self.build_temp)
             subprocess.check_call(['cmake', '--build', '.'], cwd=self.build_temp)
 
             # The name of the DLL file